@@ -63,13 +63,24 @@ struct _EphyAboutHandler {
   GObject parent_instance;
 
   EphySMaps *smaps;
+
+  /* The start page is served from sections rendered once and kept until
+   * what they show changes. Only the most visited section is rendered for
+   * every request.
+   */
+  char *start_page_header;
+  char *privacy_report_html;
+  char *bookmarks_html;
+  gboolean privacy_report_stale;
+  gboolean privacy_report_updating;
+  gboolean history_signals_connected;
+  gboolean bookmarks_signals_connected;
+  GList *pending_start_pages;
 };
 
 G_DEFINE_FINAL_TYPE (EphyAboutHandler, ephy_about_handler, G_TYPE_OBJECT)
 
 
-#define EPHY_ABOUT_OVERVIEW_MAX_ITEMS 9
-
 #define EPHY_PAGE_TEMPLATE_ABOUT_CSS        "ephy-resource:///org/gnome/epiphany/page-templates/about.css"
 
 static void
@@ -78,6 +89,9 @@ ephy_about_handler_finalize (GObject *object)
   EphyAboutHandler *handler = EPHY_ABOUT_HANDLER (object);
 
   g_clear_object (&handler->smaps);
+  g_free (handler->start_page_header);
+  g_free (handler->privacy_report_html);
+  g_free (handler->bookmarks_html);
 
   G_OBJECT_CLASS (ephy_about_handler_parent_class)->finalize (object);
 }
@@ -426,124 +440,51 @@ ephy_about_handler_handle_applications (EphyAboutHandler       *handler,
 }
 
 typedef struct {
+  EphyAboutHandler *handler;
   WebKitURISchemeRequest *request;
   GList *urls;
   gboolean success;
-  guint itp_count;
-  GHashTable *tracker_table;
-  GHashTable *website_table;
-} OverviewData;
-
-static void
-itp_summary_ready (GObject      *source_object,
-                   GAsyncResult *res,
-                   gpointer      user_data);
+} StartPageRequest;
 
-static void
-history_service_query_urls_cb (EphyHistoryService     *history,
-                               gboolean                success,
-                               GList                  *urls,
-                               WebKitURISchemeRequest *request)
+static StartPageRequest *
+start_page_request_new (EphyAboutHandler       *handler,
+                        WebKitURISchemeRequest *request,
+                        GList                  *urls,
+                        gboolean                success)
 {
-  OverviewData *data;
-  WebKitWebsiteDataManager *data_manager;
-  WebKitNetworkSession *network_session;
-  EphyEmbedShell *shell;
+  StartPageRequest *data;
 
-  data = g_new0 (OverviewData, 1);
+  data = g_new0 (StartPageRequest, 1);
+  data->handler = g_object_ref (handler);
   data->request = g_object_ref (request);
   data->urls = urls ? ephy_history_url_list_copy (urls) : NULL;
   data->success = success;
-  data->itp_count = 0;
-  data->tracker_table = NULL;
-  data->website_table = NULL;
 
-  shell = ephy_embed_shell_get_default ();
-  network_session = ephy_embed_shell_get_network_session (shell);
-  data_manager = webkit_network_session_get_website_data_manager (network_session);
-
-  webkit_website_data_manager_get_itp_summary (data_manager, NULL, itp_summary_ready, data);
+  return data;
 }
 
 static void
-itp_summary_ready (GObject      *source_object,
-                   GAsyncResult *res,
-                   gpointer      user_data)
+start_page_request_free (StartPageRequest *data)
 {
-  OverviewData *data = (OverviewData *)user_data;
-  WebKitWebsiteDataManager *manager = WEBKIT_WEBSITE_DATA_MANAGER (source_object);
-  g_autolist (WebKitITPThirdParty) summary = NULL;
-  g_autoptr (GError) error = NULL;
-  WebKitWebView *view;
-  EphySnapshotService *snapshot_service;
-  EphyEmbedShell *shell;
-  GString *data_str;
-  gsize data_length;
-  char *lang;
-  GList *l;
-  guint list_length;
-  g_autofree char *privacy_description = NULL;
-
-  summary = webkit_website_data_manager_get_itp_summary_finish (manager, res, &error);
-  if (error) {
-    g_warning ("Could not fetch ITP summary: %s", error->message);
-    data->itp_count = 0;
-    data->tracker_table = NULL;
-    data->website_table = NULL;
-  } else {
-    GHashTable *tracker_table;
-    GHashTable *website_table;
-    GList *tp_list;
-    
-    data->itp_count = g_list_length (summary);
-    
-    /* Create website and tracker tables similar to privacy report */
-    tracker_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
-    website_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
-    
-    for (tp_list = summary; tp_list && tp_list->data; tp_list = tp_list->next) {
-      WebKitITPThirdParty *tp = (WebKitITPThirdParty *)(tp_list->data);
-      GList *fp_list;
-      
-      for (fp_list = webkit_itp_third_party_get_first_parties (tp); fp_list && fp_list->data; fp_list = fp_list->next) {
-        WebKitITPFirstParty *fp = (WebKitITPFirstParty *)(fp_list->data);
-        
-        if (!webkit_itp_first_party_get_website_data_access_allowed (fp)) {
-          const char *fp_domain = webkit_itp_first_party_get_domain (fp);
-          const char *tp_domain = webkit_itp_third_party_get_domain (tp);
-          GPtrArray *websites = NULL;
-          GPtrArray *trackers = NULL;
-          
-          /* Websites */
-          if (g_hash_table_lookup_extended (website_table, fp_domain, NULL, (gpointer *)&websites)) {
-            g_ptr_array_add (websites, g_strdup (tp_domain));
-          } else {
-            websites = g_ptr_array_new_with_free_func (g_free);
-            g_ptr_array_add (websites, g_strdup (tp_domain));
-            g_hash_table_insert (website_table, g_strdup (fp_domain), websites);
-          }
-          
-          /* Tracker */
-          if (g_hash_table_lookup_extended (tracker_table, tp_domain, NULL, (gpointer *)&trackers)) {
-            g_ptr_array_add (trackers, g_strdup (fp_domain));
-          } else {
-            trackers = g_ptr_array_new_with_free_func (g_free);
-            g_ptr_array_add (trackers, g_strdup (fp_domain));
-            g_hash_table_insert (tracker_table, g_strdup (tp_domain), trackers);
-          }
-        }
-      }
-    }
-    
-    data->tracker_table = tracker_table;
-    data->website_table = website_table;
-  }
-
-  view = webkit_uri_scheme_request_get_web_view (data->request);
-  ephy_web_view_register_message_handler (EPHY_WEB_VIEW (view), EPHY_WEB_VIEW_PRIVACY_REPORT_MESSAGE_HANDLER, EPHY_WEB_VIEW_REGISTER_MESSAGE_HANDLER_FOR_CURRENT_PAGE);
+  g_object_unref (data->handler);
+  g_object_unref (data->request);
+  ephy_history_url_list_free (data->urls);
+  g_free (data);
+}
 
-  snapshot_service = ephy_snapshot_service_get_default ();
-  shell = ephy_embed_shell_get_default ();
+static char *
+render_start_page_header (void)
+{
+  GString *data_str;
+  GString *favorites_str;
+  g_autofree char *lang = NULL;
+  g_autofree char *favorites_title = NULL;
+  const char *favorites_data[][2] = {
+    { "https://pearos.xyz", "pearOS" },
+    { "https://google.com", "Google" },
+    { "https://youtube.com", "Youtube" },
+    { "https://mail.google.com", "Gmail" }
+  };
 
   data_str = g_string_new (NULL);
 
@@ -579,297 +520,343 @@ itp_summary_ready (GObject      *source_object,
                           lang, lang,
                           ((gtk_widget_get_default_direction () == GTK_TEXT_DIR_RTL) ? "rtl" : "ltr"),
                           _(NEW_TAB_PAGE_TITLE));
-  g_free (lang);
 
-  list_length = g_list_length (data->urls);
+  favorites_str = g_string_new (NULL);
+  for (guint i = 0; i < G_N_ELEMENTS (favorites_data); i++) {
+    g_autofree char *encoded_url = NULL;
+    g_autofree char *encoded_title = NULL;
+    g_autofree char *escaped_title = NULL;
+
+    encoded_url = ephy_encode_for_html_attribute (favorites_data[i][0]);
+    encoded_title = ephy_encode_for_html_attribute (favorites_data[i][1]);
+    escaped_title = ephy_encode_for_html_entity (favorites_data[i][1]);
+
+    g_string_append_printf (favorites_str,
+                            "<a class=\"overview-item\" title=\"%s\" href=\"%s\">"
+                            "  <iframe class=\"overview-thumbnail\" src=\"%s\" loading=\"lazy\" sandbox=\"allow-same-origin allow-scripts\"></iframe>"
+                            "  <span class=\"overview-title\">%s</span>"
+                            "</a>",
+                            encoded_title, encoded_url, encoded_url, escaped_title);
+  }
+
+  favorites_title = g_markup_escape_text (_("Favorites"), -1);
+  g_string_append_printf (data_str,
+                          "<div id=\"overview\" class=\"start-page\">\n"
+                          "  <div class=\"start-page-section\">\n"
+                          "    <h2 class=\"start-page-title\">%s</h2>\n"
+                          "    <div id=\"favorites-grid\" class=\"bookmarks-grid\">\n"
+                          "%s"
+                          "    </div>\n"
+                          "  </div>\n",
+                          favorites_title, favorites_str->str);
+  g_string_free (favorites_str, TRUE);
+
+  return g_string_free (data_str, FALSE);
+}
+
+/* Returns the first five domains of @table, and how many more there are. */
+static char *
+render_privacy_report_domains (GHashTable *table)
+{
+  GString *str;
+  GHashTableIter iter;
+  gpointer key;
+  guint count;
+  guint i = 0;
+
+  str = g_string_new (NULL);
+  count = g_hash_table_size (table);
+
+  g_hash_table_iter_init (&iter, table);
+  while (g_hash_table_iter_next (&iter, &key, NULL) && i < 5) {
+    g_autofree char *escaped = g_markup_escape_text ((const char *)key, -1);
+    if (i > 0)
+      g_string_append (str, ", ");
+    g_string_append (str, escaped);
+    i++;
+  }
+  if (count > 5) {
+    g_autofree char *more = g_strdup_printf (_(" and %u more"), count - 5);
+    g_string_append (str, more);
+  }
+
+  return g_string_free (str, FALSE);
+}
+
+static char *
+render_privacy_report_detail (const char *label,
+                              const char *domains_html)
+{
+  g_autofree char *escaped_label = NULL;
+
+  if (!domains_html || !domains_html[0])
+    return g_strdup ("");
+
+  escaped_label = g_markup_escape_text (label, -1);
+  return g_strdup_printf ("<p class=\"privacy-report-detail\"><strong>%s:</strong> %s</p>", escaped_label, domains_html);
+}
+
+/* @summary is %NULL if it could not be fetched. */
+static char *
+render_privacy_report (GList *summary)
+{
+  g_autoptr (GHashTable) tracker_table = NULL;
+  g_autoptr (GHashTable) website_table = NULL;
+  g_autofree char *privacy_description = NULL;
+  g_autofree char *trackers_detail_html = NULL;
+  g_autofree char *websites_detail_html = NULL;
+  g_autofree char *privacy_report_title = NULL;
+  g_autofree char *privacy_description_escaped = NULL;
+  g_autofree char *show_more_text = NULL;
+  guint itp_count;
+
+  itp_count = g_list_length (summary);
 
-  /* Generate privacy description and details */
-  {
-    guint tracker_count = 0;
-    guint website_count = 0;
+  if (itp_count > 0) {
     g_autofree char *trackers_html = NULL;
     g_autofree char *websites_html = NULL;
-    GString *trackers_str = NULL;
-    GString *websites_str = NULL;
-    GHashTableIter iter;
-    gpointer key, value;
-    guint i;
-    
-    if (data->itp_count > 0 && data->tracker_table && data->website_table) {
-      tracker_count = g_hash_table_size (data->tracker_table);
-      website_count = g_hash_table_size (data->website_table);
-      
-      privacy_description = g_strdup_printf (ngettext ("Pafari prevented %u tracker from profiling you", "Pafari prevented %u trackers from profiling you", data->itp_count), data->itp_count);
-      
-      /* Generate trackers list (max 5) */
-      trackers_str = g_string_new (NULL);
-      i = 0;
-      g_hash_table_iter_init (&iter, data->tracker_table);
-      while (g_hash_table_iter_next (&iter, &key, &value) && i < 5) {
-        const char *tracker_domain = (const char *)key;
-        g_autofree char *escaped = g_markup_escape_text (tracker_domain, -1);
-        if (i > 0)
-          g_string_append (trackers_str, ", ");
-        g_string_append (trackers_str, escaped);
-        i++;
-      }
-      if (tracker_count > 5) {
-        g_autofree char *more = g_strdup_printf (_(" and %u more"), tracker_count - 5);
-        g_string_append (trackers_str, more);
-      }
-      trackers_html = g_string_free (trackers_str, FALSE);
-      
-      /* Generate websites list (max 5) */
-      websites_str = g_string_new (NULL);
-      i = 0;
-      g_hash_table_iter_init (&iter, data->website_table);
-      while (g_hash_table_iter_next (&iter, &key, &value) && i < 5) {
-        const char *website_domain = (const char *)key;
-        g_autofree char *escaped = g_markup_escape_text (website_domain, -1);
-        if (i > 0)
-          g_string_append (websites_str, ", ");
-        g_string_append (websites_str, escaped);
-        i++;
-      }
-      if (website_count > 5) {
-        g_autofree char *more = g_strdup_printf (_(" and %u more"), website_count - 5);
-        g_string_append (websites_str, more);
-      }
-      websites_html = g_string_free (websites_str, FALSE);
-    } else {
-      privacy_description = g_strdup (_("No trackers blocked yet"));
-      trackers_html = g_strdup ("");
-      websites_html = g_strdup ("");
-    }
-    
-    /* Generate detail HTML for trackers and websites */
-    {
-      g_autofree char *trackers_detail_html = NULL;
-      g_autofree char *websites_detail_html = NULL;
-    
-    if (trackers_html && trackers_html[0]) {
-      g_autofree char *trackers_label = g_markup_escape_text (_("Trackers"), -1);
-      trackers_detail_html = g_strdup_printf ("<p class=\"privacy-report-detail\"><strong>%s:</strong> %s</p>", trackers_label, trackers_html);
-    } else {
-      trackers_detail_html = g_strdup ("");
-    }
-    
-    if (websites_html && websites_html[0]) {
-      g_autofree char *websites_label = g_markup_escape_text (_("Websites"), -1);
-      websites_detail_html = g_strdup_printf ("<p class=\"privacy-report-detail\"><strong>%s:</strong> %s</p>", websites_label, websites_html);
-    } else {
-      websites_detail_html = g_strdup ("");
-    }
 
-  /* Generate new start page with Favorites, Privacy Report, and Bookmarks */
-  {
-    g_autofree char *favorites_title = NULL;
-    g_autofree char *privacy_report_title = NULL;
-    g_autofree char *privacy_description_escaped = NULL;
-    g_autofree char *show_more_text = NULL;
-    g_autofree char *bookmarks_title = NULL;
-    g_autofree char *most_visited_title = NULL;
-    char *bookmarks_html = NULL;
-    char *favorites_html = NULL;
-
-    favorites_title = g_markup_escape_text (_("Favorites"), -1);
-    privacy_report_title = g_markup_escape_text (_("Privacy Report"), -1);
-    privacy_description_escaped = g_markup_escape_text (privacy_description, -1);
-    show_more_text = g_markup_escape_text (_("Show more"), -1);
-    bookmarks_title = g_markup_escape_text (_("Bookmarks"), -1);
-    most_visited_title = g_markup_escape_text (_("Most Visited"), -1);
-    
-    /* Generate favorites HTML */
-    {
-      GString *favorites_str = NULL;
-      const char *favorites_data[][2] = {
-        { "https://pearos.xyz", "pearOS" },
-        { "https://google.com", "Google" },
-        { "https://youtube.com", "Youtube" },
-        { "https://mail.google.com", "Gmail" }
-      };
-      int i;
-      
-      favorites_str = g_string_new (NULL);
-      
-      for (i = 0; i < 4; i++) {
-        g_autofree char *encoded_url = NULL;
-        g_autofree char *encoded_title = NULL;
-        g_autofree char *escaped_title = NULL;
-        
-        encoded_url = ephy_encode_for_html_attribute (favorites_data[i][0]);
-        encoded_title = ephy_encode_for_html_attribute (favorites_data[i][1]);
-        escaped_title = ephy_encode_for_html_entity (favorites_data[i][1]);
-        
-        g_string_append_printf (favorites_str,
-                                "<a class=\"overview-item\" title=\"%s\" href=\"%s\">"
-                                "  <iframe class=\"overview-thumbnail\" src=\"%s\" loading=\"lazy\" sandbox=\"allow-same-origin allow-scripts\"></iframe>"
-                                "  <span class=\"overview-title\">%s</span>"
-                                "</a>",
-                                encoded_title, encoded_url, encoded_url, escaped_title);
-      }
-      
-      favorites_html = g_string_free (favorites_str, FALSE);
-    }
-    
-    /* Generate bookmarks HTML */
-    {
-      GString *bookmarks_str = NULL;
-      EphyEmbedShell *embed_shell;
-      EphyShell *shell;
-      EphyBookmarksManager *bookmarks_manager;
-      GSequence *bookmarks;
-      GSequenceIter *iter;
-      void *handle;
-      EphyShellGetBookmarksManagerFunc get_bookmarks_manager;
-      EphyBookmarksManagerGetBookmarksWithTagFunc get_bookmarks_with_tag;
-      EphyBookmarkGetUrlFunc bookmark_get_url;
-      EphyBookmarkGetTitleFunc bookmark_get_title;
-      GSequenceGetBeginIterFunc sequence_get_begin_iter;
-      GSequenceIterIsEndFunc sequence_iter_is_end;
-      GSequenceIterNextFunc sequence_iter_next;
-      GSequenceGetFunc sequence_get;
-      GSequenceFreeFunc sequence_free;
-      
-      bookmarks_str = g_string_new (NULL);
-      embed_shell = ephy_embed_shell_get_default ();
-      
-      /* Try to cast to EphyShell - it's a subclass of EphyEmbedShell */
-      shell = (EphyShell *)embed_shell;
-      
-      /* Load function pointers using dlsym */
-      handle = dlopen (NULL, RTLD_LAZY);
-      if (handle) {
-        get_bookmarks_manager = (EphyShellGetBookmarksManagerFunc) dlsym (handle, "ephy_shell_get_bookmarks_manager");
-        get_bookmarks_with_tag = (EphyBookmarksManagerGetBookmarksWithTagFunc) dlsym (handle, "ephy_bookmarks_manager_get_bookmarks_with_tag");
-        bookmark_get_url = (EphyBookmarkGetUrlFunc) dlsym (handle, "ephy_bookmark_get_url");
-        bookmark_get_title = (EphyBookmarkGetTitleFunc) dlsym (handle, "ephy_bookmark_get_title");
-        sequence_get_begin_iter = (GSequenceGetBeginIterFunc) dlsym (handle, "g_sequence_get_begin_iter");
-        sequence_iter_is_end = (GSequenceIterIsEndFunc) dlsym (handle, "g_sequence_iter_is_end");
-        sequence_iter_next = (GSequenceIterNextFunc) dlsym (handle, "g_sequence_iter_next");
-        sequence_get = (GSequenceGetFunc) dlsym (handle, "g_sequence_get");
-        sequence_free = (GSequenceFreeFunc) dlsym (handle, "g_sequence_free");
-        
-        if (get_bookmarks_manager && get_bookmarks_with_tag && bookmark_get_url && bookmark_get_title &&
-            sequence_get_begin_iter && sequence_iter_is_end && sequence_iter_next && sequence_get && sequence_free) {
-          bookmarks_manager = get_bookmarks_manager (shell);
-          if (bookmarks_manager) {
-            bookmarks = get_bookmarks_with_tag (bookmarks_manager, NULL);
-            
-            for (iter = sequence_get_begin_iter (bookmarks);
-                 !sequence_iter_is_end (iter);
-                 iter = sequence_iter_next (iter)) {
-              EphyBookmark *bookmark = (EphyBookmark *)sequence_get (iter);
-              const char *url = bookmark_get_url (bookmark);
-              const char *title = bookmark_get_title (bookmark);
-              g_autofree char *encoded_url = NULL;
-              g_autofree char *encoded_title = NULL;
-              g_autofree char *escaped_title = NULL;
-              
-              if (!url || !title)
-                continue;
-              
-              encoded_url = ephy_encode_for_html_attribute (url);
-              encoded_title = ephy_encode_for_html_attribute (title);
-              escaped_title = ephy_encode_for_html_entity (title);
-              
-              g_string_append_printf (bookmarks_str,
-                                      "<a class=\"overview-item\" title=\"%s\" href=\"%s\">"
-                                      "  <span class=\"overview-thumbnail\"></span>"
-                                      "  <span class=\"overview-title\">%s</span>"
-                                      "</a>",
-                                      encoded_title, encoded_url, escaped_title);
-            }
-            
-            sequence_free (bookmarks);
+    /* Create website and tracker tables similar to privacy report */
+    tracker_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+    website_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+
+    for (GList *tp_list = summary; tp_list && tp_list->data; tp_list = tp_list->next) {
+      WebKitITPThirdParty *tp = (WebKitITPThirdParty *)(tp_list->data);
+
+      for (GList *fp_list = webkit_itp_third_party_get_first_parties (tp); fp_list && fp_list->data; fp_list = fp_list->next) {
+        WebKitITPFirstParty *fp = (WebKitITPFirstParty *)(fp_list->data);
+
+        if (!webkit_itp_first_party_get_website_data_access_allowed (fp)) {
+          const char *fp_domain = webkit_itp_first_party_get_domain (fp);
+          const char *tp_domain = webkit_itp_third_party_get_domain (tp);
+          GPtrArray *websites = NULL;
+          GPtrArray *trackers = NULL;
+
+          /* Websites */
+          if (g_hash_table_lookup_extended (website_table, fp_domain, NULL, (gpointer *)&websites)) {
+            g_ptr_array_add (websites, g_strdup (tp_domain));
+          } else {
+            websites = g_ptr_array_new_with_free_func (g_free);
+            g_ptr_array_add (websites, g_strdup (tp_domain));
+            g_hash_table_insert (website_table, g_strdup (fp_domain), websites);
+          }
+
+          /* Tracker */
+          if (g_hash_table_lookup_extended (tracker_table, tp_domain, NULL, (gpointer *)&trackers)) {
+            g_ptr_array_add (trackers, g_strdup (fp_domain));
+          } else {
+            trackers = g_ptr_array_new_with_free_func (g_free);
+            g_ptr_array_add (trackers, g_strdup (fp_domain));
+            g_hash_table_insert (tracker_table, g_strdup (tp_domain), trackers);
           }
         }
-        
-        dlclose (handle);
       }
-      
-      bookmarks_html = g_string_free (bookmarks_str, FALSE);
     }
 
-    g_string_append_printf (data_str,
-                            "<div id=\"overview\" class=\"start-page\">\n"
-                            "  <div class=\"start-page-section\">\n"
-                            "    <h2 class=\"start-page-title\">%s</h2>\n"
-                            "    <div id=\"favorites-grid\" class=\"bookmarks-grid\">\n"
-                            "%s"
-                            "    </div>\n"
-                            "  </div>\n"
-                            "  <div class=\"start-page-section\">\n"
-                            "    <h2 class=\"start-page-title\">%s</h2>\n"
-                            "    <div class=\"privacy-report-card\">\n"
-                            "      <div class=\"privacy-report-header\">\n"
-                            "        <svg class=\"privacy-report-shield\" width=\"64\" height=\"64\" viewBox=\"0 0 16 16\" xmlns=\"http://www.w3.org/2000/svg\"><g fill=\"currentColor\"><path d=\"m 0 2.316406 v 5.507813 c 0 2.214843 1.183594 4.257812 3.109375 5.355469 l 4.890625 2.796874 l 4.890625 -2.796874 c 1.925781 -1.097657 3.109375 -3.140626 3.109375 -5.355469 v -5.507813 l -8 -2.285156 z m 14.726562 1.71875 l -0.726562 -0.964844 v 4.753907 c 0 1.492187 -0.804688 2.878906 -2.101562 3.617187 l -4.394532 2.511719 h 0.992188 l -4.394532 -2.511719 c -1.296874 -0.738281 -2.101562 -2.125 -2.101562 -3.617187 v -4.753907 l -0.726562 0.964844 l 7 -2 h -0.546876 z m 0 0\"/><path d=\"m 5.46875 7.78125 l 2 2 c 0.292969 0.292969 0.769531 0.292969 1.0625 0 l 3 -3 c 0.292969 -0.292969 0.292969 -0.769531 0 -1.0625 s -0.769531 -0.292969 -1.0625 0 l -3 3 h 1.0625 l -2 -2 c -0.292969 -0.292969 -0.769531 -0.292969 -1.0625 0 s -0.292969 0.769531 0 1.0625 z m 0 0\"/></g></svg>\n"
-                            "        <div class=\"privacy-report-stats\">\n"
-                            "          <p class=\"privacy-report-main-text\">%s</p>\n"
-                            "%s%s"
-                            "        </div>\n"
-                            "      </div>\n"
-                            "      <a href=\"#\" onclick=\"window.webkit.messageHandlers.privacyReport.postMessage({}); return false;\" class=\"privacy-report-show-more\">%s</a>\n"
-                            "    </div>\n"
-                            "    <div class=\"privacy-promotions-grid\">\n"
-                            "      <a class=\"overview-item\" title=\"Get NordVPN\" href=\"https://go.nordvpn.net/aff_c?offer_id=15&aff_id=136731&url_id=902\">\n"
-                            "        <div class=\"overview-thumbnail\" style=\"background: white; display: flex; align-items: center; justify-content: center; padding: 12px;\">\n"
-                            "          <img src=\"https://ic.nordcdn.com/v1/https://sb.nordcdn.com/m/1431cb1f1a5ca2c9/original/nordvpn-default.svg\" alt=\"NordVPN\" style=\"max-width: 100%%; max-height: 100%%; object-fit: contain;\">\n"
-                            "        </div>\n"
-                            "        <span class=\"overview-title\">Get NordVPN</span>\n"
-                            "      </a>\n"
-                            "      <a class=\"overview-item\" title=\"Get NordPass\" href=\"https://go.nordpass.io/aff_c?offer_id=488&aff_id=136731&url_id=9356\">\n"
-                            "        <div class=\"overview-thumbnail\" style=\"background: white; display: flex; align-items: center; justify-content: center; padding: 12px;\">\n"
-                            "          <img src=\"https://sb.nordcdn.com/transform/06a0b074-f89f-41d6-90e9-e70fc533c948/nordpass-vertical-logo?format=webp&quality=80&io=transform%%3Afill%%2Cwidth%%3A360\" alt=\"NordPass\" style=\"max-width: 100%%; max-height: 100%%; object-fit: contain;\">\n"
-                            "        </div>\n"
-                            "        <span class=\"overview-title\">Get NordPass</span>\n"
-                            "      </a>\n"
-                            "    </div>\n"
-                            "  </div>\n"
-                            "  <div class=\"start-page-section\">\n"
-                            "    <h2 class=\"start-page-title\">%s</h2>\n"
-                            "    <div id=\"bookmarks-grid\" class=\"bookmarks-grid\">\n"
-                            "%s"
-                            "    </div>\n"
-                            "  </div>\n",
-                            favorites_title, favorites_html ? favorites_html : "",
-                            privacy_report_title, privacy_description_escaped, 
-                            trackers_detail_html ? trackers_detail_html : "",
-                            websites_detail_html ? websites_detail_html : "",
-                            show_more_text, bookmarks_title,
-                            bookmarks_html ? bookmarks_html : "");
-
-      /* Free HTML strings - they are now copied into data_str */
-      g_free (bookmarks_html);
-      g_free (favorites_html);
-      bookmarks_html = NULL;
-      favorites_html = NULL;
-
-      if (list_length > 0 && data->success) {
-        /* Also show most visited if available */
-        g_string_append_printf (data_str,
-                                "  <div class=\"start-page-section\">\n"
-                                "    <h2 class=\"start-page-title\">%s</h2>\n"
-                                "    <div id=\"most-visited-grid\" class=\"bookmarks-grid\">\n",
-                                most_visited_title);
-      } else {
-        g_string_append (data_str, "</div>\n</body></html>\n");
-        data_length = data_str->len;
-        ephy_about_handler_finish_request (data->request, g_string_free (data_str, FALSE), data_length);
-        g_object_unref (data->request);
-        ephy_history_url_list_free (data->urls);
-        if (data->tracker_table)
-          g_hash_table_unref (data->tracker_table);
-        if (data->website_table)
-          g_hash_table_unref (data->website_table);
-        g_free (data);
-        return;
+    privacy_description = g_strdup_printf (ngettext ("Pafari prevented %u tracker from profiling you", "Pafari prevented %u trackers from profiling you", itp_count), itp_count);
+
+    trackers_html = render_privacy_report_domains (tracker_table);
+    websites_html = render_privacy_report_domains (website_table);
+    trackers_detail_html = render_privacy_report_detail (_("Trackers"), trackers_html);
+    websites_detail_html = render_privacy_report_detail (_("Websites"), websites_html);
+  } else {
+    privacy_description = g_strdup (_("No trackers blocked yet"));
+    trackers_detail_html = g_strdup ("");
+    websites_detail_html = g_strdup ("");
+  }
+
+  privacy_report_title = g_markup_escape_text (_("Privacy Report"), -1);
+  privacy_description_escaped = g_markup_escape_text (privacy_description, -1);
+  show_more_text = g_markup_escape_text (_("Show more"), -1);
+
+  return g_strdup_printf ("  <div class=\"start-page-section\">\n"
+                          "    <h2 class=\"start-page-title\">%s</h2>\n"
+                          "    <div class=\"privacy-report-card\">\n"
+                          "      <div class=\"privacy-report-header\">\n"
+                          "        <svg class=\"privacy-report-shield\" width=\"64\" height=\"64\" viewBox=\"0 0 16 16\" xmlns=\"http://www.w3.org/2000/svg\"><g fill=\"currentColor\"><path d=\"m 0 2.316406 v 5.507813 c 0 2.214843 1.183594 4.257812 3.109375 5.355469 l 4.890625 2.796874 l 4.890625 -2.796874 c 1.925781 -1.097657 3.109375 -3.140626 3.109375 -5.355469 v -5.507813 l -8 -2.285156 z m 14.726562 1.71875 l -0.726562 -0.964844 v 4.753907 c 0 1.492187 -0.804688 2.878906 -2.101562 3.617187 l -4.394532 2.511719 h 0.992188 l -4.394532 -2.511719 c -1.296874 -0.738281 -2.101562 -2.125 -2.101562 -3.617187 v -4.753907 l -0.726562 0.964844 l 7 -2 h -0.546876 z m 0 0\"/><path d=\"m 5.46875 7.78125 l 2 2 c 0.292969 0.292969 0.769531 0.292969 1.0625 0 l 3 -3 c 0.292969 -0.292969 0.292969 -0.769531 0 -1.0625 s -0.769531 -0.292969 -1.0625 0 l -3 3 h 1.0625 l -2 -2 c -0.292969 -0.292969 -0.769531 -0.292969 -1.0625 0 s -0.292969 0.769531 0 1.0625 z m 0 0\"/></g></svg>\n"
+                          "        <div class=\"privacy-report-stats\">\n"
+                          "          <p class=\"privacy-report-main-text\">%s</p>\n"
+                          "%s%s"
+                          "        </div>\n"
+                          "      </div>\n"
+                          "      <a href=\"#\" onclick=\"window.webkit.messageHandlers.privacyReport.postMessage({}); return false;\" class=\"privacy-report-show-more\">%s</a>\n"
+                          "    </div>\n"
+                          "    <div class=\"privacy-promotions-grid\">\n"
+                          "      <a class=\"overview-item\" title=\"Get NordVPN\" href=\"https://go.nordvpn.net/aff_c?offer_id=15&aff_id=136731&url_id=902\">\n"
+                          "        <div class=\"overview-thumbnail\" style=\"background: white; display: flex; align-items: center; justify-content: center; padding: 12px;\">\n"
+                          "          <img src=\"https://ic.nordcdn.com/v1/https://sb.nordcdn.com/m/1431cb1f1a5ca2c9/original/nordvpn-default.svg\" alt=\"NordVPN\" style=\"max-width: 100%%; max-height: 100%%; object-fit: contain;\">\n"
+                          "        </div>\n"
+                          "        <span class=\"overview-title\">Get NordVPN</span>\n"
+                          "      </a>\n"
+                          "      <a class=\"overview-item\" title=\"Get NordPass\" href=\"https://go.nordpass.io/aff_c?offer_id=488&aff_id=136731&url_id=9356\">\n"
+                          "        <div class=\"overview-thumbnail\" style=\"background: white; display: flex; align-items: center; justify-content: center; padding: 12px;\">\n"
+                          "          <img src=\"https://sb.nordcdn.com/transform/06a0b074-f89f-41d6-90e9-e70fc533c948/nordpass-vertical-logo?format=webp&quality=80&io=transform%%3Afill%%2Cwidth%%3A360\" alt=\"NordPass\" style=\"max-width: 100%%; max-height: 100%%; object-fit: contain;\">\n"
+                          "        </div>\n"
+                          "        <span class=\"overview-title\">Get NordPass</span>\n"
+                          "      </a>\n"
+                          "    </div>\n"
+                          "  </div>\n",
+                          privacy_report_title, privacy_description_escaped,
+                          trackers_detail_html, websites_detail_html,
+                          show_more_text);
+}
+
+static void
+bookmarks_changed_cb (EphyAboutHandler *handler)
+{
+  g_clear_pointer (&handler->bookmarks_html, g_free);
+}
+
+static char *
+render_bookmarks (EphyAboutHandler *handler)
+{
+  GString *bookmarks_str = NULL;
+  g_autofree char *bookmarks_title = NULL;
+  char *html;
+  EphyEmbedShell *embed_shell;
+  EphyShell *shell;
+  EphyBookmarksManager *bookmarks_manager;
+  GSequence *bookmarks;
+  GSequenceIter *iter;
+  void *handle;
+  EphyShellGetBookmarksManagerFunc get_bookmarks_manager;
+  EphyBookmarksManagerGetBookmarksWithTagFunc get_bookmarks_with_tag;
+  EphyBookmarkGetUrlFunc bookmark_get_url;
+  EphyBookmarkGetTitleFunc bookmark_get_title;
+  GSequenceGetBeginIterFunc sequence_get_begin_iter;
+  GSequenceIterIsEndFunc sequence_iter_is_end;
+  GSequenceIterNextFunc sequence_iter_next;
+  GSequenceGetFunc sequence_get;
+  GSequenceFreeFunc sequence_free;
+
+  bookmarks_str = g_string_new (NULL);
+  embed_shell = ephy_embed_shell_get_default ();
+
+  /* Try to cast to EphyShell - it's a subclass of EphyEmbedShell */
+  shell = (EphyShell *)embed_shell;
+
+  /* Load function pointers using dlsym */
+  handle = dlopen (NULL, RTLD_LAZY);
+  if (handle) {
+    get_bookmarks_manager = (EphyShellGetBookmarksManagerFunc) dlsym (handle, "ephy_shell_get_bookmarks_manager");
+    get_bookmarks_with_tag = (EphyBookmarksManagerGetBookmarksWithTagFunc) dlsym (handle, "ephy_bookmarks_manager_get_bookmarks_with_tag");
+    bookmark_get_url = (EphyBookmarkGetUrlFunc) dlsym (handle, "ephy_bookmark_get_url");
+    bookmark_get_title = (EphyBookmarkGetTitleFunc) dlsym (handle, "ephy_bookmark_get_title");
+    sequence_get_begin_iter = (GSequenceGetBeginIterFunc) dlsym (handle, "g_sequence_get_begin_iter");
+    sequence_iter_is_end = (GSequenceIterIsEndFunc) dlsym (handle, "g_sequence_iter_is_end");
+    sequence_iter_next = (GSequenceIterNextFunc) dlsym (handle, "g_sequence_iter_next");
+    sequence_get = (GSequenceGetFunc) dlsym (handle, "g_sequence_get");
+    sequence_free = (GSequenceFreeFunc) dlsym (handle, "g_sequence_free");
+
+    if (get_bookmarks_manager && get_bookmarks_with_tag && bookmark_get_url && bookmark_get_title &&
+        sequence_get_begin_iter && sequence_iter_is_end && sequence_iter_next && sequence_get && sequence_free) {
+      bookmarks_manager = get_bookmarks_manager (shell);
+      if (bookmarks_manager) {
+        /* The signals are looked up by name, so no need for the type here. */
+        if (!handler->bookmarks_signals_connected) {
+          const char *signals[] = { "bookmark-added", "bookmark-removed", "bookmark-title-changed", "bookmark-url-changed",
+                                    "bookmark-tag-added", "bookmark-tag-removed", "tag-deleted" };
+
+          for (guint i = 0; i < G_N_ELEMENTS (signals); i++)
+            g_signal_connect_object (bookmarks_manager, signals[i],
+                                     G_CALLBACK (bookmarks_changed_cb),
+                                     handler, G_CONNECT_SWAPPED);
+          handler->bookmarks_signals_connected = TRUE;
+        }
+
+        bookmarks = get_bookmarks_with_tag (bookmarks_manager, NULL);
+
+        for (iter = sequence_get_begin_iter (bookmarks);
+             !sequence_iter_is_end (iter);
+             iter = sequence_iter_next (iter)) {
+          EphyBookmark *bookmark = (EphyBookmark *)sequence_get (iter);
+          const char *url = bookmark_get_url (bookmark);
+          const char *title = bookmark_get_title (bookmark);
+          g_autofree char *encoded_url = NULL;
+          g_autofree char *encoded_title = NULL;
+          g_autofree char *escaped_title = NULL;
+
+          if (!url || !title)
+            continue;
+
+          encoded_url = ephy_encode_for_html_attribute (url);
+          encoded_title = ephy_encode_for_html_attribute (title);
+          escaped_title = ephy_encode_for_html_entity (title);
+
+          g_string_append_printf (bookmarks_str,
+                                  "<a class=\"overview-item\" title=\"%s\" href=\"%s\">"
+                                  "  <span class=\"overview-thumbnail\"></span>"
+                                  "  <span class=\"overview-title\">%s</span>"
+                                  "</a>",
+                                  encoded_title, encoded_url, escaped_title);
+        }
+
+        sequence_free (bookmarks);
       }
     }
-    }
+
+    dlclose (handle);
+  }
+
+  bookmarks_title = g_markup_escape_text (_("Bookmarks"), -1);
+  html = g_strdup_printf ("  <div class=\"start-page-section\">\n"
+                          "    <h2 class=\"start-page-title\">%s</h2>\n"
+                          "    <div id=\"bookmarks-grid\" class=\"bookmarks-grid\">\n"
+                          "%s"
+                          "    </div>\n"
+                          "  </div>\n",
+                          bookmarks_title, bookmarks_str->str);
+  g_string_free (bookmarks_str, TRUE);
+
+  return html;
+}
+
+static void
+finish_start_page_request (StartPageRequest *data)
+{
+  EphyAboutHandler *handler = data->handler;
+  WebKitWebView *view;
+  EphySnapshotService *snapshot_service;
+  EphyEmbedShell *shell;
+  GString *data_str;
+  gsize data_length;
+  g_autofree char *most_visited_title = NULL;
+
+  view = webkit_uri_scheme_request_get_web_view (data->request);
+  ephy_web_view_register_message_handler (EPHY_WEB_VIEW (view), EPHY_WEB_VIEW_PRIVACY_REPORT_MESSAGE_HANDLER, EPHY_WEB_VIEW_REGISTER_MESSAGE_HANDLER_FOR_CURRENT_PAGE);
+
+  if (!handler->start_page_header)
+    handler->start_page_header = render_start_page_header ();
+  if (!handler->bookmarks_html)
+    handler->bookmarks_html = render_bookmarks (handler);
+
+  data_str = g_string_sized_new (strlen (handler->start_page_header) +
+                                 strlen (handler->privacy_report_html) +
+                                 strlen (handler->bookmarks_html) + 4096);
+  g_string_append (data_str, handler->start_page_header);
+  g_string_append (data_str, handler->privacy_report_html);
+  g_string_append (data_str, handler->bookmarks_html);
+
+  if (!data->urls || !data->success) {
+    g_string_append (data_str, "</div>\n</body></html>\n");
+    data_length = data_str->len;
+    ephy_about_handler_finish_request (data->request, g_string_free (data_str, FALSE), data_length);
+    start_page_request_free (data);
+    return;
   }
 
-  for (l = data->urls; l; l = g_list_next (l)) {
+  /* Also show most visited if available */
+  most_visited_title = g_markup_escape_text (_("Most Visited"), -1);
+  g_string_append_printf (data_str,
+                          "  <div class=\"start-page-section\">\n"
+                          "    <h2 class=\"start-page-title\">%s</h2>\n"
+                          "    <div id=\"most-visited-grid\" class=\"bookmarks-grid\">\n",
+                          most_visited_title);
+
+  snapshot_service = ephy_snapshot_service_get_default ();
+  shell = ephy_embed_shell_get_default ();
+
+  for (GList *l = data->urls; l; l = g_list_next (l)) {
     EphyHistoryURL *url = (EphyHistoryURL *)l->data;
     const char *snapshot;
     g_autofree char *thumbnail_style = NULL;
@@ -906,13 +893,104 @@ itp_summary_ready (GObject      *source_object,
 
   data_length = data_str->len;
   ephy_about_handler_finish_request (data->request, g_string_free (data_str, FALSE), data_length);
-  g_object_unref (data->request);
-  ephy_history_url_list_free (data->urls);
-  if (data->tracker_table)
-    g_hash_table_unref (data->tracker_table);
-  if (data->website_table)
-    g_hash_table_unref (data->website_table);
-  g_free (data);
+  start_page_request_free (data);
+}
+
+static void
+itp_summary_ready (GObject      *source_object,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  EphyAboutHandler *handler = EPHY_ABOUT_HANDLER (user_data);
+  WebKitWebsiteDataManager *manager = WEBKIT_WEBSITE_DATA_MANAGER (source_object);
+  g_autolist (WebKitITPThirdParty) summary = NULL;
+  g_autoptr (GError) error = NULL;
+  GList *pending;
+
+  summary = webkit_website_data_manager_get_itp_summary_finish (manager, res, &error);
+  if (error)
+    g_warning ("Could not fetch ITP summary: %s", error->message);
+
+  g_free (handler->privacy_report_html);
+  handler->privacy_report_html = render_privacy_report (summary);
+  handler->privacy_report_updating = FALSE;
+
+  pending = g_steal_pointer (&handler->pending_start_pages);
+  for (GList *l = pending; l; l = l->next)
+    finish_start_page_request (l->data);
+  g_list_free (pending);
+
+  g_object_unref (handler);
+}
+
+static void
+privacy_report_changed_cb (EphyAboutHandler *handler)
+{
+  handler->privacy_report_stale = TRUE;
+}
+
+static void
+update_privacy_report (EphyAboutHandler *handler)
+{
+  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
+  WebKitWebsiteDataManager *data_manager;
+
+  if (handler->privacy_report_updating)
+    return;
+
+  /* New pages are what blocks new trackers, and clearing the history usually
+   * goes with clearing the website data.
+   */
+  if (!handler->history_signals_connected) {
+    EphyHistoryService *history = ephy_embed_shell_get_global_history_service (shell);
+
+    g_signal_connect_object (history, "urls-visited",
+                             G_CALLBACK (privacy_report_changed_cb),
+                             handler, G_CONNECT_SWAPPED);
+    g_signal_connect_object (history, "cleared",
+                             G_CALLBACK (privacy_report_changed_cb),
+                             handler, G_CONNECT_SWAPPED);
+    handler->history_signals_connected = TRUE;
+  }
+
+  handler->privacy_report_updating = TRUE;
+  handler->privacy_report_stale = FALSE;
+
+  data_manager = webkit_network_session_get_website_data_manager (ephy_embed_shell_get_network_session (shell));
+  webkit_website_data_manager_get_itp_summary (data_manager, NULL, itp_summary_ready, g_object_ref (handler));
+}
+
+static void
+handle_start_page_request (EphyAboutHandler       *handler,
+                           WebKitURISchemeRequest *request,
+                           GList                  *urls,
+                           gboolean                success)
+{
+  StartPageRequest *data = start_page_request_new (handler, request, urls, success);
+
+  /* Only the very first start page waits for the ITP summary. Later ones show
+   * the last report right away, and a stale one is refreshed for next time.
+   */
+  if (!handler->privacy_report_html) {
+    handler->pending_start_pages = g_list_append (handler->pending_start_pages, data);
+    update_privacy_report (handler);
+    return;
+  }
+
+  finish_start_page_request (data);
+
+  if (handler->privacy_report_stale)
+    update_privacy_report (handler);
+}
+
+static void
+history_service_query_urls_cb (EphyHistoryService *history,
+                               gboolean            success,
+                               GList              *urls,
+                               StartPageRequest   *data)
+{
+  handle_start_page_request (data->handler, data->request, urls, success);
+  start_page_request_free (data);
 }
 
 static gboolean
@@ -950,14 +1028,22 @@ static gboolean
 ephy_about_handler_handle_html_overview (EphyAboutHandler       *handler,
                                          WebKitURISchemeRequest *request)
 {
+  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
   EphyHistoryService *history;
   EphyHistoryQuery *query;
+  GList *urls;
+
+  /* The shell keeps the overview list up to date for the open overviews. */
+  if (ephy_embed_shell_get_overview_urls (shell, &urls)) {
+    handle_start_page_request (handler, request, urls, TRUE);
+    return TRUE;
+  }
 
-  history = ephy_embed_shell_get_global_history_service (ephy_embed_shell_get_default ());
+  history = ephy_embed_shell_get_global_history_service (shell);
   query = ephy_history_query_new_for_overview ();
   ephy_history_service_query_urls (history, query, NULL,
                                    (EphyHistoryJobCallback)history_service_query_urls_cb,
-                                   g_object_ref (request));
+                                   start_page_request_new (handler, request, NULL, FALSE));
   ephy_history_query_free (query);
 
   return TRUE;
@@ -1020,6 +1106,17 @@ ephy_about_handler_new (void)
   return EPHY_ABOUT_HANDLER (g_object_new (EPHY_TYPE_ABOUT_HANDLER, NULL));
 }
 
+void
+ephy_about_handler_website_data_cleared (EphyAboutHandler *handler)
+{
+  /* Do not show the trackers that were just forgotten on the next start page,
+   * it waits for a new report instead.
+   */
+  if (!handler->privacy_report_updating)
+    g_clear_pointer (&handler->privacy_report_html, g_free);
+  handler->privacy_report_stale = TRUE;
+}
+
 void
 ephy_about_handler_handle_request (EphyAboutHandler       *handler,
                                    WebKitURISchemeRequest *request)
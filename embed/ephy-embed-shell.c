@@ -52,10 +52,18 @@
 #define PAGE_SETUP_FILENAME "page-setup-gtk.ini"
 #define PRINT_SETTINGS_FILENAME "print-settings.ini"
 
+#define OVERVIEW_UPDATE_DELAY 500
+
+/* Snapshots are saved for a couple more pages than are present in the
+ * overview, so new snapshots are immediately available when the user
+ * deletes a couple pages from the overview. */
+#define TOP_SITES_EXTRA_SNAPSHOTS 5
+
 typedef struct {
   WebKitWebContext *web_context;
   WebKitNetworkSession *network_session;
   EphyHistoryService *global_history_service;
+  EphyHostTrie *host_trie;
   EphyEncodings *encodings;
   GtkPageSetup *page_setup;
   GtkPrintSettings *print_settings;
@@ -71,6 +79,9 @@ typedef struct {
   GVariant *web_extension_initialization_data;
   EphySearchEngineManager *search_engine_manager;
   GCancellable *cancellable;
+  GList *overview_urls;
+  gboolean overview_urls_loaded;
+  guint overview_update_source_id;
 } EphyEmbedShellPrivate;
 
 enum {
@@ -190,6 +201,7 @@ ephy_embed_shell_dispose (GObject *object)
   g_clear_object (&priv->encodings);
   g_clear_object (&priv->page_setup);
   g_clear_object (&priv->print_settings);
+  g_clear_object (&priv->host_trie);
   g_clear_object (&priv->global_history_service);
   g_clear_object (&priv->about_handler);
   g_clear_object (&priv->reader_handler);
@@ -203,6 +215,8 @@ ephy_embed_shell_dispose (GObject *object)
   g_clear_object (&priv->filters_manager);
   g_clear_object (&priv->search_engine_manager);
   g_clear_pointer (&priv->web_extension_initialization_data, g_variant_unref);
+  g_clear_handle_id (&priv->overview_update_source_id, g_source_remove);
+  g_clear_pointer (&priv->overview_urls, ephy_history_url_list_free);
 
   G_OBJECT_CLASS (ephy_embed_shell_parent_class)->dispose (object);
 }
@@ -225,60 +239,232 @@ web_process_extension_password_form_focused_message_received_cb (WebKitUserConte
                  page_id, insecure_form_action);
 }
 
+/* Overview updates only go to the pages showing it. Other processes get the
+ * whole list when they load the overview, see ephy_embed_shell_send_overview_urls().
+ */
 static void
-history_service_query_urls_cb (EphyHistoryService *service,
-                               gboolean            success,
-                               GList              *urls,
-                               EphyEmbedShell     *shell)
+ephy_embed_shell_send_overview_message (EphyEmbedShell *shell,
+                                        const char     *name,
+                                        GVariant       *parameters)
 {
-  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  GList *windows = gtk_application_get_windows (GTK_APPLICATION (shell));
+
+  if (parameters)
+    g_variant_ref_sink (parameters);
+
+  for (GList *l = windows; l && l->data; l = l->next) {
+    g_autoptr (GList) tabs = NULL;
+
+    if (!EPHY_IS_EMBED_CONTAINER (l->data))
+      continue;
+
+    tabs = ephy_embed_container_get_children (l->data);
+    for (GList *t = tabs; t && t->data; t = t->next) {
+      EphyWebView *view = ephy_embed_get_web_view (t->data);
+
+      if (!ephy_web_view_is_overview (view))
+        continue;
+
+      webkit_web_view_send_message_to_page (WEBKIT_WEB_VIEW (view),
+                                            webkit_user_message_new (name, parameters),
+                                            NULL, NULL, NULL);
+    }
+  }
+
+  if (parameters)
+    g_variant_unref (parameters);
+}
+
+/* Returns the changes turning @old_urls into @new_urls, as expected by
+ * ephy_web_overview_model_update_urls(): the URLs that are gone, and the
+ * position of every URL that is new, moved or retitled. URLs that kept their
+ * relative order are left out. Returns %NULL when nothing changed. URLs that
+ * were not in @old_urls at all are added to @added_urls.
+ *
+ * Only exposed for the tests.
+ */
+GVariant *
+_ephy_embed_shell_overview_urls_diff (GList     *old_urls,
+                                      GList     *new_urls,
+                                      GPtrArray *added_urls)
+{
+  g_autoptr (GHashTable) new_positions = NULL;
+  g_autoptr (GHashTable) old_items = NULL;
+  g_autoptr (GHashTable) kept = NULL;
+  GVariantBuilder removed;
+  GVariantBuilder placed;
+  gboolean changed = FALSE;
+  guint last_position = 0;
+  guint position;
   GList *l;
-  GVariantBuilder builder;
 
-  if (!success)
-    return;
+  new_positions = g_hash_table_new (g_str_hash, g_str_equal);
+  for (l = new_urls, position = 1; l; l = g_list_next (l), position++)
+    g_hash_table_insert (new_positions, ((EphyHistoryURL *)l->data)->url, GUINT_TO_POINTER (position));
 
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
-  for (l = urls; l; l = g_list_next (l)) {
+  old_items = g_hash_table_new (g_str_hash, g_str_equal);
+  kept = g_hash_table_new (g_str_hash, g_str_equal);
+  g_variant_builder_init (&removed, G_VARIANT_TYPE ("as"));
+  for (l = old_urls; l; l = g_list_next (l)) {
     EphyHistoryURL *url = (EphyHistoryURL *)l->data;
 
-    g_variant_builder_add (&builder, "(ss)", url->url, url->title);
-    ephy_embed_shell_schedule_thumbnail_update (shell, (EphyHistoryURL *)l->data);
+    position = GPOINTER_TO_UINT (g_hash_table_lookup (new_positions, url->url));
+    g_hash_table_insert (old_items, url->url, url);
+
+    if (position == 0) {
+      g_variant_builder_add (&removed, "s", url->url);
+      changed = TRUE;
+    } else if (position > last_position) {
+      /* Still in order with the URLs kept so far. */
+      g_hash_table_insert (kept, url->url, url);
+      last_position = position;
+    }
   }
 
-  webkit_web_context_send_message_to_all_extensions (priv->web_context,
-                                                     webkit_user_message_new ("History.SetURLs",
-                                                                              g_variant_builder_end (&builder)));
+  g_variant_builder_init (&placed, G_VARIANT_TYPE ("a(uss)"));
+  for (l = new_urls, position = 0; l; l = g_list_next (l), position++) {
+    EphyHistoryURL *url = (EphyHistoryURL *)l->data;
+    EphyHistoryURL *old_url = g_hash_table_lookup (kept, url->url);
+
+    if (old_url && g_strcmp0 (old_url->title, url->title) == 0)
+      continue;
+
+    if (!g_hash_table_contains (old_items, url->url))
+      g_ptr_array_add (added_urls, url);
+
+    g_variant_builder_add (&placed, "(uss)", position, url->url, url->title);
+    changed = TRUE;
+  }
+
+  if (!changed) {
+    g_variant_builder_clear (&removed);
+    g_variant_builder_clear (&placed);
+    return NULL;
+  }
+
+  return g_variant_new ("(asa(uss))", &removed, &placed);
 }
 
 static void
-ephy_embed_shell_update_overview_urls (EphyEmbedShell *shell)
+update_overview_urls_timeout_cb (gpointer user_data)
 {
+  EphyEmbedShell *shell = EPHY_EMBED_SHELL (user_data);
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
-  g_autoptr (EphyHistoryQuery) query = NULL;
+  g_autoptr (GPtrArray) added_urls = NULL;
+  GList *urls;
+  GVariant *changes;
+
+  priv->overview_update_source_id = 0;
+
+  /* The history service keeps the most visited URLs, the overview shows the
+   * first of them. Until they are loaded, ::top-sites-changed is pending. */
+  if (!ephy_history_service_get_top_sites (ephy_embed_shell_get_global_history_service (shell),
+                                           EPHY_ABOUT_OVERVIEW_MAX_ITEMS, &urls))
+    return;
 
-  query = ephy_history_query_new_for_overview ();
-  ephy_history_service_query_urls (priv->global_history_service, query, NULL,
-                                   (EphyHistoryJobCallback)history_service_query_urls_cb,
-                                   shell);
+  added_urls = g_ptr_array_new ();
+  changes = _ephy_embed_shell_overview_urls_diff (priv->overview_urls, urls, added_urls);
+  if (changes)
+    ephy_embed_shell_send_overview_message (shell, "History.UpdateURLs", changes);
+
+  /* Only new URLs need a thumbnail, the others already got one. */
+  for (guint i = 0; i < added_urls->len; i++)
+    ephy_embed_shell_schedule_thumbnail_update (shell, g_ptr_array_index (added_urls, i));
+
+  ephy_history_url_list_free (priv->overview_urls);
+  priv->overview_urls = urls;
+  priv->overview_urls_loaded = TRUE;
 }
 
+/* Coalesces the updates, e.g. the visits of all the tabs being restored. */
 static void
-history_service_urls_visited_cb (EphyHistoryService *history,
-                                 EphyEmbedShell     *shell)
+ephy_embed_shell_update_overview_urls (EphyEmbedShell *shell)
 {
-  ephy_embed_shell_update_overview_urls (shell);
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  if (priv->overview_update_source_id)
+    return;
+
+  priv->overview_update_source_id = g_timeout_add_once (OVERVIEW_UPDATE_DELAY, update_overview_urls_timeout_cb, shell);
+  g_source_set_name_by_id (priv->overview_update_source_id, "[epiphany] update_overview_urls_timeout_cb");
 }
 
-static void
-history_set_url_hidden_cb (EphyHistoryService *service,
-                           gboolean            success,
-                           gpointer            result_data,
-                           EphyEmbedShell     *shell)
+/**
+ * ephy_embed_shell_get_overview_urls:
+ * @shell: the #EphyEmbedShell
+ * @urls: (out) (transfer none) (element-type EphyHistoryURL): return location
+ *   for the overview URLs
+ *
+ * Gets the most visited URLs shown in the overview, kept up to date while
+ * the history changes.
+ *
+ * Returns: %FALSE if the overview URLs were not queried yet
+ **/
+gboolean
+ephy_embed_shell_get_overview_urls (EphyEmbedShell  *shell,
+                                    GList          **urls)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  *urls = priv->overview_urls;
+
+  return priv->overview_urls_loaded;
+}
+
+/**
+ * ephy_embed_shell_website_data_cleared:
+ * @shell: the #EphyEmbedShell
+ *
+ * Tells the shell that website data was cleared, so that pages showing it,
+ * like the privacy report of the start page, are refreshed.
+ **/
+void
+ephy_embed_shell_website_data_cleared (EphyEmbedShell *shell)
 {
-  if (!success)
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  ephy_about_handler_website_data_cleared (priv->about_handler);
+}
+
+/**
+ * ephy_embed_shell_send_overview_urls:
+ * @shell: the #EphyEmbedShell
+ * @web_view: a #WebKitWebView that just loaded the overview
+ *
+ * Sends the whole list of overview URLs to the web process of @web_view. It
+ * only receives changes to the list while it shows the overview, so its copy
+ * may be outdated.
+ **/
+void
+ephy_embed_shell_send_overview_urls (EphyEmbedShell *shell,
+                                     WebKitWebView  *web_view)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  GVariantBuilder builder;
+
+  /* The first results will reach it as changes from an empty list. */
+  if (!priv->overview_urls_loaded) {
+    ephy_embed_shell_update_overview_urls (shell);
     return;
+  }
 
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
+  for (GList *l = priv->overview_urls; l; l = g_list_next (l)) {
+    EphyHistoryURL *url = (EphyHistoryURL *)l->data;
+
+    g_variant_builder_add (&builder, "(ss)", url->url, url->title);
+  }
+
+  webkit_web_view_send_message_to_page (web_view,
+                                        webkit_user_message_new ("History.SetURLs",
+                                                                 g_variant_builder_end (&builder)),
+                                        NULL, NULL, NULL);
+}
+
+static void
+history_service_top_sites_changed_cb (EphyHistoryService *history,
+                                      EphyEmbedShell     *shell)
+{
   ephy_embed_shell_update_overview_urls (shell);
 }
 
@@ -293,9 +479,7 @@ web_process_extension_overview_message_received_cb (WebKitUserContentManager *ma
   url_to_remove = jsc_value_to_string (message);
 
   ephy_history_service_set_url_hidden (priv->global_history_service,
-                                       url_to_remove, TRUE, NULL,
-                                       (EphyHistoryJobCallback)history_set_url_hidden_cb,
-                                       shell);
+                                       url_to_remove, TRUE, NULL, NULL, NULL);
 }
 
 static char *
@@ -434,9 +618,17 @@ history_service_url_title_changed_cb (EphyHistoryService *service,
 {
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
 
-  webkit_web_context_send_message_to_all_extensions (priv->web_context,
-                                                     webkit_user_message_new ("History.SetURLTitle",
-                                                                              g_variant_new ("(ss)", url, title)));
+  for (GList *l = priv->overview_urls; l; l = g_list_next (l)) {
+    EphyHistoryURL *overview_url = (EphyHistoryURL *)l->data;
+
+    if (g_strcmp0 (overview_url->url, url) == 0) {
+      g_free (overview_url->title);
+      overview_url->title = g_strdup (title);
+    }
+  }
+
+  ephy_embed_shell_send_overview_message (shell, "History.SetURLTitle",
+                                          g_variant_new ("(ss)", url, title));
 }
 
 static void
@@ -445,10 +637,22 @@ history_service_url_deleted_cb (EphyHistoryService *service,
                                 EphyEmbedShell     *shell)
 {
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+  GList *l = priv->overview_urls;
 
-  webkit_web_context_send_message_to_all_extensions (priv->web_context,
-                                                     webkit_user_message_new ("History.DeleteURL",
-                                                                              g_variant_new ("s", url->url)));
+  while (l) {
+    EphyHistoryURL *overview_url = (EphyHistoryURL *)l->data;
+    GList *next = l->next;
+
+    if (g_strcmp0 (overview_url->url, url->url) == 0) {
+      ephy_history_url_free (overview_url);
+      priv->overview_urls = g_list_delete_link (priv->overview_urls, l);
+    }
+
+    l = next;
+  }
+
+  ephy_embed_shell_send_overview_message (shell, "History.DeleteURL",
+                                          g_variant_new ("s", url->url));
 }
 
 static void
@@ -458,11 +662,28 @@ history_service_host_deleted_cb (EphyHistoryService *service,
 {
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
   g_autoptr (GUri) deleted_uri = NULL;
+  const char *host;
+  GList *l = priv->overview_urls;
 
   deleted_uri = g_uri_parse (deleted_url, G_URI_FLAGS_PARSE_RELAXED, NULL);
-  webkit_web_context_send_message_to_all_extensions (priv->web_context,
-                                                     webkit_user_message_new ("History.DeleteHost",
-                                                                              g_variant_new ("s", g_uri_get_host (deleted_uri))));
+  host = g_uri_get_host (deleted_uri);
+
+  while (l) {
+    EphyHistoryURL *overview_url = (EphyHistoryURL *)l->data;
+    g_autoptr (GUri) uri = NULL;
+    GList *next = l->next;
+
+    uri = g_uri_parse (overview_url->url, G_URI_FLAGS_PARSE_RELAXED, NULL);
+    if (g_strcmp0 (g_uri_get_host (uri), host) == 0) {
+      ephy_history_url_free (overview_url);
+      priv->overview_urls = g_list_delete_link (priv->overview_urls, l);
+    }
+
+    l = next;
+  }
+
+  ephy_embed_shell_send_overview_message (shell, "History.DeleteHost",
+                                          g_variant_new ("s", host));
 }
 
 static void
@@ -471,9 +692,9 @@ history_service_cleared_cb (EphyHistoryService *service,
 {
   EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
 
-  webkit_web_context_send_message_to_all_extensions (priv->web_context,
-                                                     webkit_user_message_new ("History.Clear",
-                                                                              NULL));
+  g_clear_pointer (&priv->overview_urls, ephy_history_url_list_free);
+
+  ephy_embed_shell_send_overview_message (shell, "History.Clear", NULL);
 }
 
 void
@@ -481,11 +702,8 @@ ephy_embed_shell_set_thumbnail_path (EphyEmbedShell *shell,
                                      const char     *url,
                                      const char     *path)
 {
-  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
-
-  webkit_web_context_send_message_to_all_extensions (priv->web_context,
-                                                     webkit_user_message_new ("History.SetURLThumbnail",
-                                                                              g_variant_new ("(ss)", url, path)));
+  ephy_embed_shell_send_overview_message (shell, "History.SetURLThumbnail",
+                                          g_variant_new ("(ss)", url, path));
 }
 
 static void
@@ -555,9 +773,11 @@ ephy_embed_shell_get_global_history_service (EphyEmbedShell *shell)
 
     filename = g_build_filename (ephy_profile_dir (), EPHY_HISTORY_FILE, NULL);
     priv->global_history_service = ephy_history_service_new (filename, mode);
+    ephy_history_service_set_top_sites_size (priv->global_history_service,
+                                             EPHY_ABOUT_OVERVIEW_MAX_ITEMS + TOP_SITES_EXTRA_SNAPSHOTS);
 
-    g_signal_connect_object (priv->global_history_service, "urls-visited",
-                             G_CALLBACK (history_service_urls_visited_cb),
+    g_signal_connect_object (priv->global_history_service, "top-sites-changed",
+                             G_CALLBACK (history_service_top_sites_changed_cb),
                              shell, 0);
     g_signal_connect_object (priv->global_history_service, "url-title-changed",
                              G_CALLBACK (history_service_url_title_changed_cb),
@@ -576,6 +796,26 @@ ephy_embed_shell_get_global_history_service (EphyEmbedShell *shell)
   return priv->global_history_service;
 }
 
+/**
+ * ephy_embed_shell_get_host_trie:
+ * @shell: the #EphyEmbedShell
+ *
+ * Return value: (transfer none): the #EphyHostTrie of the global history,
+ * used to complete host names as they are typed
+ **/
+EphyHostTrie *
+ephy_embed_shell_get_host_trie (EphyEmbedShell *shell)
+{
+  EphyEmbedShellPrivate *priv = ephy_embed_shell_get_instance_private (shell);
+
+  g_assert (EPHY_IS_EMBED_SHELL (shell));
+
+  if (!priv->host_trie)
+    priv->host_trie = ephy_host_trie_new (ephy_embed_shell_get_global_history_service (shell));
+
+  return priv->host_trie;
+}
+
 /**
  * ephy_embed_shell_get_encodings:
  * @shell: the #EphyEmbedShell
@@ -829,6 +1069,8 @@ ephy_embed_shell_startup (GApplication *application)
   WebKitCookieManager *cookie_manager;
   g_autofree char *filename = NULL;
 
+  START_PROFILER ("Embed shell startup")
+
   G_APPLICATION_CLASS (ephy_embed_shell_parent_class)->startup (application);
 
   add_path_to_sandbox_or_die (ephy_profile_dir (), priv->web_context);
@@ -900,6 +1142,8 @@ ephy_embed_shell_startup (GApplication *application)
     g_signal_connect_object (EPHY_SETTINGS_WEB, "changed::remember-passwords",
                              G_CALLBACK (remember_passwords_setting_changed_cb), shell, 0);
   }
+
+  STOP_PROFILER ("Embed shell startup")
 }
 
 static void
@@ -909,6 +1153,7 @@ ephy_embed_shell_shutdown (GApplication *application)
 
   g_object_unref (ephy_embed_prefs_get_settings ());
   ephy_embed_utils_shutdown ();
+  ephy_snapshot_service_shutdown ();
 }
 
 static void
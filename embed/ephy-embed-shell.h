@@ -27,6 +27,7 @@
 #include "ephy-downloads-manager.h"
 #include "ephy-encodings.h"
 #include "ephy-history-service.h"
+#include "ephy-host-trie.h"
 #include "ephy-password-manager.h"
 #include "ephy-permissions-manager.h"
 #include "ephy-search-engine-manager.h"
@@ -63,6 +64,7 @@ WebKitWebContext  *ephy_embed_shell_get_web_context            (EphyEmbedShell
 WebKitNetworkSession *ephy_embed_shell_get_network_session     (EphyEmbedShell   *shell);
 EphyHistoryService
                   *ephy_embed_shell_get_global_history_service (EphyEmbedShell   *shell);
+EphyHostTrie      *ephy_embed_shell_get_host_trie              (EphyEmbedShell   *shell);
 EphyEncodings     *ephy_embed_shell_get_encodings              (EphyEmbedShell   *shell);
 void               ephy_embed_shell_restored_window            (EphyEmbedShell   *shell);
 void               ephy_embed_shell_set_page_setup             (EphyEmbedShell   *shell,
@@ -77,6 +79,14 @@ void               ephy_embed_shell_set_thumbnail_path         (EphyEmbedShell
                                                                 const char       *path);
 void               ephy_embed_shell_schedule_thumbnail_update  (EphyEmbedShell   *shell,
                                                                 EphyHistoryURL   *url);
+void               ephy_embed_shell_send_overview_urls         (EphyEmbedShell   *shell,
+                                                                WebKitWebView    *web_view);
+gboolean           ephy_embed_shell_get_overview_urls          (EphyEmbedShell   *shell,
+                                                                GList           **urls);
+void               ephy_embed_shell_website_data_cleared       (EphyEmbedShell   *shell);
+GVariant          *_ephy_embed_shell_overview_urls_diff        (GList            *old_urls,
+                                                                GList            *new_urls,
+                                                                GPtrArray        *added_urls);
 EphyFiltersManager       *ephy_embed_shell_get_filters_manager      (EphyEmbedShell *shell);
 EphyDownloadsManager     *ephy_embed_shell_get_downloads_manager    (EphyEmbedShell *shell);
 EphyPermissionsManager   *ephy_embed_shell_get_permissions_manager  (EphyEmbedShell *shell);
@@ -69,6 +69,7 @@ struct _EphyEmbed {
   WebKitURIRequest *delayed_request;
   WebKitWebViewSessionState *delayed_state;
   guint delayed_request_source_id;
+  gint64 unmapped_time;
   char *typed_input;
 
   GSList *messages; /* owned EphyEmbedStatusbarMsgs */
@@ -91,6 +92,7 @@ struct _EphyEmbed {
   gboolean first_load_finished;
   gboolean animate_reader_mode;
   gboolean animate_search_engine;
+  gboolean discarded;
 };
 
 G_DEFINE_FINAL_TYPE (EphyEmbed, ephy_embed, GTK_TYPE_BOX)
@@ -100,6 +102,7 @@ enum {
   PROP_WEB_VIEW,
   PROP_TITLE,
   PROP_PROGRESS_BAR_ENABLED,
+  PROP_DISCARDED,
   LAST_PROP
 };
 
@@ -489,6 +492,9 @@ ephy_embed_get_property (GObject    *object,
     case PROP_PROGRESS_BAR_ENABLED:
       g_value_set_boolean (value, embed->progress_bar_enabled);
       break;
+    case PROP_DISCARDED:
+      g_value_set_boolean (value, embed->discarded);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -535,6 +541,19 @@ ephy_embed_class_init (EphyEmbedClass *klass)
                           TRUE,
                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
 
+  /**
+   * EphyEmbed:discarded:
+   *
+   * Whether the web process of this embed was torn down to save memory. A
+   * discarded embed reloads its page from the saved session state when it
+   * is mapped again.
+   */
+  obj_properties[PROP_DISCARDED] =
+    g_param_spec_boolean ("discarded",
+                          NULL, NULL,
+                          FALSE,
+                          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, LAST_PROP, obj_properties);
 }
 
@@ -660,6 +679,17 @@ progress_update (EphyWebView *view,
                                  (loading || progress == 1.0) ? progress : 0.0);
 }
 
+static void
+ephy_embed_set_discarded (EphyEmbed *embed,
+                          gboolean   discarded)
+{
+  if (embed->discarded == discarded)
+    return;
+
+  embed->discarded = discarded;
+  g_object_notify_by_pspec (G_OBJECT (embed), obj_properties[PROP_DISCARDED]);
+}
+
 static void
 load_delayed_request_if_mapped (gpointer user_data)
 {
@@ -685,6 +715,8 @@ load_delayed_request_if_mapped (gpointer user_data)
   g_clear_object (&embed->delayed_request);
   g_clear_pointer (&embed->delayed_state, webkit_web_view_session_state_unref);
 
+  ephy_embed_set_discarded (embed, FALSE);
+
   /* We have a binding to `is-loading` in `ephy_tab_view_add_tab ()` that depends on
    * whether the page is a placeholder (to avoid showing the spinner on tabs while restoring the session),
    * so after removing the placeholder we need to notify it again. */
@@ -724,6 +756,13 @@ ephy_embed_mapped_cb (GtkWidget *widget,
   ephy_embed_maybe_load_delayed_request ((EphyEmbed *)widget);
 }
 
+static void
+ephy_embed_unmapped_cb (GtkWidget *widget,
+                        gpointer   data)
+{
+  ((EphyEmbed *)widget)->unmapped_time = g_get_monotonic_time ();
+}
+
 static void
 floating_bar_motion_cb (GtkEventControllerMotion *self,
                         double                    x,
@@ -768,6 +807,9 @@ ephy_embed_constructed (GObject *object)
 
   g_signal_connect (embed, "map",
                     G_CALLBACK (ephy_embed_mapped_cb), NULL);
+  g_signal_connect (embed, "unmap",
+                    G_CALLBACK (ephy_embed_unmapped_cb), NULL);
+  embed->unmapped_time = g_get_monotonic_time ();
 
   /* Skeleton */
   embed->overlay = gtk_overlay_new ();
@@ -996,6 +1038,120 @@ ephy_embed_has_load_pending (EphyEmbed *embed)
   return !!embed->delayed_request;
 }
 
+/**
+ * ephy_embed_discard:
+ * @embed: a #EphyEmbed
+ *
+ * Frees the memory used by the page shown in @embed while it is not visible.
+ * The back/forward history is kept as a delayed load request, the web process
+ * is terminated and a placeholder is shown until the embed is mapped again,
+ * exactly as for tabs that were not loaded yet on session restore. Pages that
+ * play audio, capture media or share their web process with other views are
+ * kept.
+ *
+ * Returns: %TRUE if the page was discarded
+ */
+gboolean
+ephy_embed_discard (EphyEmbed *embed)
+{
+  WebKitWebView *web_view;
+  WebKitURIRequest *request;
+  WebKitWebViewSessionState *state;
+  g_autofree char *uri = NULL;
+
+  g_assert (EPHY_IS_EMBED (embed));
+
+  if (embed->discarded || embed->delayed_request)
+    return FALSE;
+
+  if (gtk_widget_get_mapped (GTK_WIDGET (embed)))
+    return FALSE;
+
+  /* Terminating a web process shared with related views would take their
+   * pages down too, some of which may be visible.
+   */
+  if (!ephy_web_view_owns_web_process (EPHY_WEB_VIEW (embed->web_view)))
+    return FALSE;
+
+  web_view = WEBKIT_WEB_VIEW (embed->web_view);
+  if (webkit_web_view_is_playing_audio (web_view) ||
+      webkit_web_view_get_camera_capture_state (web_view) != WEBKIT_MEDIA_CAPTURE_STATE_NONE ||
+      webkit_web_view_get_microphone_capture_state (web_view) != WEBKIT_MEDIA_CAPTURE_STATE_NONE ||
+      webkit_web_view_get_display_capture_state (web_view) != WEBKIT_MEDIA_CAPTURE_STATE_NONE)
+    return FALSE;
+
+  uri = g_strdup (webkit_web_view_get_uri (embed->web_view));
+  if (!uri)
+    return FALSE;
+
+  LOG ("Discarding tab %s", uri);
+
+  state = webkit_web_view_get_session_state (embed->web_view);
+  request = webkit_uri_request_new (uri);
+  ephy_embed_set_delayed_load_request (embed, request, state);
+  webkit_web_view_session_state_unref (state);
+  g_object_unref (request);
+
+  /* Set before terminating: the pending load request and the flag keep
+   * process_terminated_cb () from showing the crash page.
+   */
+  ephy_embed_set_discarded (embed, TRUE);
+  webkit_web_view_terminate_web_process (embed->web_view);
+  ephy_web_view_set_placeholder (EPHY_WEB_VIEW (embed->web_view), uri, embed->title ? embed->title : "");
+
+  return TRUE;
+}
+
+/**
+ * ephy_embed_mark_discarded:
+ * @embed: a #EphyEmbed
+ *
+ * Marks @embed, whose page is held as a delayed load request, as discarded.
+ * This is used for tabs that were discarded when the session was saved and
+ * are restored unloaded.
+ */
+void
+ephy_embed_mark_discarded (EphyEmbed *embed)
+{
+  g_assert (EPHY_IS_EMBED (embed));
+  g_assert (embed->delayed_request);
+
+  ephy_embed_set_discarded (embed, TRUE);
+}
+
+/**
+ * ephy_embed_is_discarded:
+ * @embed: a #EphyEmbed
+ *
+ * Checks whether the page of this #EphyEmbed was discarded to save memory.
+ *
+ * Returns: %TRUE or %FALSE
+ */
+gboolean
+ephy_embed_is_discarded (EphyEmbed *embed)
+{
+  g_assert (EPHY_IS_EMBED (embed));
+
+  return embed->discarded;
+}
+
+/**
+ * ephy_embed_get_unmapped_time:
+ * @embed: a #EphyEmbed
+ *
+ * Gets the monotonic time at which @embed was last hidden, or created if it
+ * was never shown.
+ *
+ * Returns: the time in microseconds
+ */
+gint64
+ephy_embed_get_unmapped_time (EphyEmbed *embed)
+{
+  g_assert (EPHY_IS_EMBED (embed));
+
+  return embed->unmapped_time;
+}
+
 const char *
 ephy_embed_get_title (EphyEmbed *embed)
 {
@@ -50,6 +50,10 @@ void             ephy_embed_set_delayed_load_request      (EphyEmbed *embed,
                                                            WebKitURIRequest          *request,
                                                            WebKitWebViewSessionState *state);
 gboolean         ephy_embed_has_load_pending              (EphyEmbed *embed);
+gboolean         ephy_embed_discard                       (EphyEmbed *embed);
+void             ephy_embed_mark_discarded                (EphyEmbed *embed);
+gboolean         ephy_embed_is_discarded                  (EphyEmbed *embed);
+gint64           ephy_embed_get_unmapped_time             (EphyEmbed *embed);
 gboolean         ephy_embed_inspector_is_loaded           (EphyEmbed *embed);
 const char      *ephy_embed_get_title                     (EphyEmbed *embed);
 const char      *ephy_embed_get_typed_input               (EphyEmbed *embed);
@@ -22,21 +22,28 @@
 #include "ephy-filters-manager.h"
 
 #include "ephy-debug.h"
-#include "ephy-download.h"
 #include "ephy-file-helpers.h"
 #include "ephy-langs.h"
 #include "ephy-prefs.h"
 #include "ephy-settings.h"
 #include "ephy-string.h"
+#include "ephy-user-agent.h"
 #include "ephy-embed-shell.h"
 
 #include <gio/gio.h>
+#include <libsoup/soup.h>
 
 #include <inttypes.h>
 
 #define ADBLOCK_FILTER_UPDATE_FREQUENCY 24 * 60 * 60 /* In seconds */
 #define ADBLOCK_FILTER_UPDATE_FREQUENCY_METERED 28 * 24 * 60 * 60 /* In seconds */
+#define ADBLOCK_FILTER_UPDATE_STAGGER 60 /* In seconds, between refreshes of different filters */
+#define ADBLOCK_FILTER_UPDATE_JITTER 10 * 60 /* In seconds */
 #define ADBLOCK_FILTER_SIDECAR_FILE_SUFFIX ".filterinfo"
+#define ADBLOCK_FILTER_SET_FILE "filters.set"
+#define COOKIE_BANNER_FILTER_RESOURCE "/org/gnome/epiphany/hush.json"
+
+typedef struct _FilterInfo FilterInfo;
 
 struct _EphyFiltersManager {
   GObject parent_instance;
@@ -49,7 +56,14 @@ struct _EphyFiltersManager {
   GCancellable *cancellable;
   WebKitUserContentFilter *wk_filter;
   WebKitUserContentFilterStore *store;
+  SoupSession *session;
   gboolean metered;
+  guint n_staggered_fetches;
+
+  GHashTable *filter_set;  /* (identifier, FilterSetEntry) of the last completed setup */
+  char *filter_set_key;
+  FilterInfo *cookie_banner_filter;
+  gint64 setup_start_time;
 };
 
 G_DEFINE_FINAL_TYPE (EphyFiltersManager, ephy_filters_manager, G_TYPE_OBJECT)
@@ -72,17 +86,24 @@ enum {
 
 static GParamSpec *object_properties[N_PROPERTIES] = { NULL, };
 
-typedef struct {
+struct _FilterInfo {
   EphyFiltersManager *manager;
   char *identifier;      /* Lazily derived from source_uri. */
   char *source_uri;      /* Saved. */
   char *checksum;        /* Saved. */
   gint64 last_update;    /* Saved, seconds since the Epoch. */
+  char *etag;            /* Saved, from the fetch of the rules in use. */
+  char *last_modified;   /* Saved, from the fetch of the rules in use. */
+  char *fetched_etag;    /* From a fetch whose rules are not in use yet. */
+  char *fetched_last_modified;
+  guint fetch_source_id;
+  gint64 setup_time;     /* Monotonic time the last load or compilation started. */
 
   gboolean found : 1;    /* WebKitUserContentFilter found during lookup. */
   gboolean local : 1;    /* The source_uri is a local file URI. */
   gboolean done  : 1;    /* Filter setup done (successfully or errored). */
-} FilterInfo;
+  gboolean fetched : 1;  /* The fetched_* validators are pending. */
+};
 
 /* The "saved" fields from the struct above are stored as versioned sidecar
  * metadata files, using GVariant for serialization. An integer indicating
@@ -90,18 +111,64 @@ typedef struct {
  * be increased by 1 in the source code whenever the GVariant format below
  * changes.
  */
-#define FILTER_INFO_VARIANT_VERSION ((uint32_t)2)
-#define FILTER_INFO_VARIANT_FORMAT  "(usmsx)"
+#define FILTER_INFO_VARIANT_VERSION ((uint32_t)3)
+#define FILTER_INFO_VARIANT_FORMAT  "(usmsxmsms)"
+
+/* Once all the filters have been set up, the identifiers and checksums of
+ * the whole set are saved in a single file, keyed by a hash of the sorted
+ * "identifier:checksum" pairs. If the key computed at startup for the
+ * configured filters matches it, the compiled filters are loaded straight
+ * from the store without reading the sidecar files.
+ */
+#define FILTER_SET_VARIANT_VERSION ((uint32_t)2)
+#define FILTER_SET_VARIANT_FORMAT  "(usa(ssxmsms))"
+
+typedef struct {
+  char *checksum;
+  gint64 last_update;
+  char *etag;
+  char *last_modified;
+} FilterSetEntry;
 
 static void filter_info_setup_done (FilterInfo *self);
+static void filter_info_fetch_done (FilterInfo *self);
+
+static void
+filter_set_entry_free (FilterSetEntry *entry)
+{
+  g_free (entry->checksum);
+  g_free (entry->etag);
+  g_free (entry->last_modified);
+  g_free (entry);
+}
+
+static FilterSetEntry *
+filter_set_entry_new (const char *checksum,
+                      gint64      last_update,
+                      const char *etag,
+                      const char *last_modified)
+{
+  FilterSetEntry *entry = g_new (FilterSetEntry, 1);
+
+  entry->checksum = g_strdup (checksum);
+  entry->last_update = last_update;
+  entry->etag = g_strdup (etag);
+  entry->last_modified = g_strdup (last_modified);
+  return entry;
+}
 
 static void
 filter_info_free (FilterInfo *self)
 {
+  g_clear_handle_id (&self->fetch_source_id, g_source_remove);
   g_clear_weak_pointer (&self->manager);
   g_clear_pointer (&self->identifier, g_free);
   g_clear_pointer (&self->source_uri, g_free);
   g_clear_pointer (&self->checksum, g_free);
+  g_clear_pointer (&self->etag, g_free);
+  g_clear_pointer (&self->last_modified, g_free);
+  g_clear_pointer (&self->fetched_etag, g_free);
+  g_clear_pointer (&self->fetched_last_modified, g_free);
   g_free (self);
 }
 
@@ -132,6 +199,8 @@ filter_info_load_from_bytes (FilterInfo  *self,
   g_autofree char *source_uri = NULL;
   g_autofree char *checksum = NULL;
   guint64 last_update = 0;
+  g_autofree char *etag = NULL;
+  g_autofree char *last_modified = NULL;
 
   g_autoptr (GVariantType) value_type = g_variant_type_new (FILTER_INFO_VARIANT_FORMAT);
   g_autoptr (GVariant) value = g_variant_ref_sink (g_variant_new_from_bytes (value_type, data, TRUE));
@@ -161,7 +230,9 @@ filter_info_load_from_bytes (FilterInfo  *self,
                  NULL,  /* Ignore the version, it has been checked already. */
                  &source_uri,
                  &checksum,
-                 &last_update);
+                 &last_update,
+                 &etag,
+                 &last_modified);
 
   if (strcmp (source_uri, self->source_uri) != 0) {
     g_set_error (error,
@@ -182,12 +253,18 @@ filter_info_load_from_bytes (FilterInfo  *self,
   g_clear_pointer (&self->checksum, g_free);
   self->checksum = g_steal_pointer (&checksum);
   self->last_update = last_update;
+  g_clear_pointer (&self->etag, g_free);
+  self->etag = g_steal_pointer (&etag);
+  g_clear_pointer (&self->last_modified, g_free);
+  self->last_modified = g_steal_pointer (&last_modified);
 
-  LOG ("Loaded metadata: uri=<%s>, identifier=%s, checksum=%s, last_update=%" PRIu64,
+  LOG ("Loaded metadata: uri=<%s>, identifier=%s, checksum=%s, last_update=%" PRIu64 ", etag=%s, last_modified=%s",
        self->source_uri,
        self->identifier,
        self->checksum,
-       self->last_update);
+       self->last_update,
+       self->etag,
+       self->last_modified);
 
   return TRUE;
 }
@@ -302,7 +379,9 @@ filter_info_get_data_as_bytes (FilterInfo *self)
                                                                   FILTER_INFO_VARIANT_VERSION,
                                                                   self->source_uri,
                                                                   self->checksum,
-                                                                  self->last_update));
+                                                                  self->last_update,
+                                                                  self->etag,
+                                                                  self->last_modified));
   return g_variant_get_data_as_bytes (value);
 }
 
@@ -337,11 +416,13 @@ filter_info_save_sidecar (FilterInfo          *self,
   GTask *task = g_task_new (NULL, cancellable, callback, user_data);
   g_task_set_name (task, task_name);
 
-  LOG ("Saving metadata: uri=<%s>, identifier=%s, checksum=%s, last_update=%" PRIu64,
+  LOG ("Saving metadata: uri=<%s>, identifier=%s, checksum=%s, last_update=%" PRIu64 ", etag=%s, last_modified=%s",
        self->source_uri,
        self->identifier,
        self->checksum,
-       self->last_update);
+       self->last_update,
+       self->etag,
+       self->last_modified);
 
   /* Using G_FILE_CREATE_REPLACE_DESTINATION is needed to ensure that
    * different processes trying to write the same file replace its
@@ -394,6 +475,32 @@ filter_info_setup_enable_compiled_filter (FilterInfo              *self,
   g_signal_emit (self->manager, s_signals[FILTER_READY], 0, wk_filter);
 }
 
+static void
+filter_info_drop_fetched_validators (FilterInfo *self)
+{
+  g_clear_pointer (&self->fetched_etag, g_free);
+  g_clear_pointer (&self->fetched_last_modified, g_free);
+  self->fetched = FALSE;
+}
+
+/* The validators of a fetch only describe the rules in use once these have
+ * been compiled and saved. Committing them earlier would let a failed update
+ * save them next to the old rules, and every later conditional request would
+ * then get a "Not Modified" response.
+ */
+static void
+filter_info_commit_fetched_validators (FilterInfo *self)
+{
+  if (!self->fetched)
+    return;
+
+  g_free (self->etag);
+  self->etag = g_steal_pointer (&self->fetched_etag);
+  g_free (self->last_modified);
+  self->last_modified = g_steal_pointer (&self->fetched_last_modified);
+  self->fetched = FALSE;
+}
+
 static gboolean
 filter_info_needs_updating_from_source (const FilterInfo *self)
 {
@@ -445,6 +552,221 @@ filter_info_needs_updating_from_source (const FilterInfo *self)
   return ret;
 }
 
+static double
+filter_info_get_setup_elapsed_ms (FilterInfo *self)
+{
+  return (g_get_monotonic_time () - self->setup_time) / 1000.0;
+}
+
+static int
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return strcmp (*(const char **)a, *(const char **)b);
+}
+
+static char *
+filter_set_compute_key (GPtrArray *items)
+{
+  g_autoptr (GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+  g_ptr_array_sort (items, compare_strings);
+  for (guint i = 0; i < items->len; i++) {
+    const char *item = g_ptr_array_index (items, i);
+
+    g_checksum_update (checksum, (const guchar *)item, -1);
+    g_checksum_update (checksum, (const guchar *)"\n", 1);
+  }
+
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+static void
+filters_manager_load_filter_set (EphyFiltersManager *manager)
+{
+  g_autofree char *path = g_build_filename (manager->filters_dir, ADBLOCK_FILTER_SET_FILE, NULL);
+  g_autoptr (GMappedFile) file_map = NULL;
+  g_autoptr (GBytes) data = NULL;
+  g_autoptr (GVariant) value = NULL;
+  g_autoptr (GVariantIter) iter = NULL;
+  g_autoptr (GError) error = NULL;
+  uint32_t saved_version = 0;
+  const char *key;
+  const char *identifier;
+  const char *checksum;
+  gint64 last_update;
+  const char *etag;
+  const char *last_modified;
+
+  file_map = g_mapped_file_new (path, FALSE, &error);
+  if (!file_map) {
+    if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      g_warning ("Cannot map filter set file %s: %s", path, error->message);
+    return;
+  }
+
+  data = g_mapped_file_get_bytes (file_map);
+  value = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (FILTER_SET_VARIANT_FORMAT), data, FALSE));
+  if (!g_variant_is_normal_form (value)) {
+    g_warning ("Ignoring malformed filter set file %s", path);
+    return;
+  }
+
+  g_variant_get_child (value, 0, "u", &saved_version);
+  if (saved_version != FILTER_SET_VARIANT_VERSION) {
+    LOG ("Ignoring filter set file with format version %" PRIu32 " (expected %" PRIu32 ")",
+         saved_version, FILTER_SET_VARIANT_VERSION);
+    return;
+  }
+
+  g_variant_get (value, "(u&sa(ssxmsms))", NULL, &key, &iter);
+
+  g_clear_pointer (&manager->filter_set, g_hash_table_unref);
+  manager->filter_set = g_hash_table_new_full (g_str_hash,
+                                               g_str_equal,
+                                               g_free,
+                                               (GDestroyNotify)filter_set_entry_free);
+  while (g_variant_iter_next (iter, "(&s&sxm&sm&s)", &identifier, &checksum, &last_update, &etag, &last_modified)) {
+    g_hash_table_replace (manager->filter_set,
+                          g_strdup (identifier),
+                          filter_set_entry_new (checksum, last_update, etag, last_modified));
+  }
+
+  g_free (manager->filter_set_key);
+  manager->filter_set_key = g_strdup (key);
+
+  LOG ("Loaded filter set %s with %u filters.", key, g_hash_table_size (manager->filter_set));
+}
+
+static gboolean
+filters_manager_filter_set_matches (EphyFiltersManager  *manager,
+                                    char               **uris,
+                                    FilterInfo          *cookie_banner_filter)
+{
+  g_autoptr (GPtrArray) items = NULL;
+  g_autofree char *key = NULL;
+
+  if (!manager->filter_set_key)
+    return FALSE;
+
+  items = g_ptr_array_new_with_free_func (g_free);
+  for (guint i = 0; uris[i]; i++) {
+    g_autofree char *identifier = filter_info_identifier_for_source_uri (uris[i]);
+    FilterSetEntry *entry = g_hash_table_lookup (manager->filter_set, identifier);
+
+    if (!entry)
+      return FALSE;
+
+    g_ptr_array_add (items, g_strconcat (identifier, ":", entry->checksum, NULL));
+  }
+
+  if (cookie_banner_filter) {
+    g_ptr_array_add (items, g_strconcat (filter_info_get_identifier (cookie_banner_filter), ":",
+                                         cookie_banner_filter->checksum, NULL));
+  }
+
+  key = filter_set_compute_key (items);
+  return strcmp (key, manager->filter_set_key) == 0;
+}
+
+static void
+filter_set_saved_cb (GFile        *file,
+                     GAsyncResult *result,
+                     void         *user_data)
+{
+  g_autoptr (GError) error = NULL;
+
+  if (g_file_replace_contents_finish (file, result, NULL, &error))
+    LOG ("Filter set saved.");
+  else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    g_warning ("Cannot save filter set: %s", error->message);
+}
+
+static void
+filters_manager_save_filter_set (EphyFiltersManager *manager)
+{
+  g_autoptr (GHashTable) filter_set = NULL;
+  g_autoptr (GPtrArray) filters = g_ptr_array_new ();
+  g_autoptr (GPtrArray) items = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr (GVariant) value = NULL;
+  g_autoptr (GBytes) data = NULL;
+  g_autoptr (GFile) file = NULL;
+  g_autofree char *key = NULL;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  FilterInfo *filter;
+  gboolean changed = FALSE;
+
+  g_hash_table_iter_init (&iter, manager->filters);
+  while (g_hash_table_iter_next (&iter, NULL, (void **)&filter))
+    g_ptr_array_add (filters, filter);
+  if (manager->cookie_banner_filter)
+    g_ptr_array_add (filters, manager->cookie_banner_filter);
+
+  filter_set = g_hash_table_new_full (g_str_hash,
+                                      g_str_equal,
+                                      g_free,
+                                      (GDestroyNotify)filter_set_entry_free);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssxmsms)"));
+
+  for (guint i = 0; i < filters->len; i++) {
+    const char *identifier;
+    FilterSetEntry *entry;
+
+    filter = g_ptr_array_index (filters, i);
+
+    /* Without a checksum the filter has never been compiled. Leaving it out
+     * makes the next startup go through the sidecar files again.
+     */
+    if (!filter->checksum)
+      continue;
+
+    identifier = filter_info_get_identifier (filter);
+    entry = manager->filter_set ? g_hash_table_lookup (manager->filter_set, identifier) : NULL;
+    changed = changed || !entry || entry->last_update != filter->last_update ||
+              g_strcmp0 (entry->etag, filter->etag) != 0 ||
+              g_strcmp0 (entry->last_modified, filter->last_modified) != 0;
+
+    g_ptr_array_add (items, g_strconcat (identifier, ":", filter->checksum, NULL));
+    g_variant_builder_add (&builder, "(ssxmsms)",
+                           identifier, filter->checksum, filter->last_update,
+                           filter->etag, filter->last_modified);
+    g_hash_table_replace (filter_set,
+                          g_strdup (identifier),
+                          filter_set_entry_new (filter->checksum, filter->last_update,
+                                                filter->etag, filter->last_modified));
+  }
+
+  key = filter_set_compute_key (items);
+  if (!changed && g_strcmp0 (key, manager->filter_set_key) == 0) {
+    g_variant_builder_clear (&builder);
+    LOG ("Filter set %s unchanged, not saving.", key);
+    return;
+  }
+
+  LOG ("Saving filter set %s with %u filters.", key, g_hash_table_size (filter_set));
+
+  value = g_variant_ref_sink (g_variant_new (FILTER_SET_VARIANT_FORMAT,
+                                             FILTER_SET_VARIANT_VERSION,
+                                             key,
+                                             &builder));
+  data = g_variant_get_data_as_bytes (value);
+  file = g_file_new_build_filename (manager->filters_dir, ADBLOCK_FILTER_SET_FILE, NULL);
+  g_file_replace_contents_bytes_async (file,
+                                       data,
+                                       NULL,   /* etag */
+                                       FALSE,  /* make_backup */
+                                       G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION,
+                                       manager->cancellable,
+                                       (GAsyncReadyCallback)filter_set_saved_cb,
+                                       NULL);
+
+  g_clear_pointer (&manager->filter_set, g_hash_table_unref);
+  manager->filter_set = g_steal_pointer (&filter_set);
+  g_free (manager->filter_set_key);
+  manager->filter_set_key = g_steal_pointer (&key);
+}
+
 static void
 file_removed_cb (GFile        *file,
                  GAsyncResult *result,
@@ -499,20 +821,44 @@ filter_saved_cb (WebKitUserContentFilterStore *store,
                                                                            result,
                                                                            &error);
   if (self->manager->wk_filter) {
-    LOG ("Filter %s compiled successfully.", filter_info_get_identifier (self));
+    LOG ("Filter %s compiled successfully in %.1f ms.",
+         filter_info_get_identifier (self),
+         filter_info_get_setup_elapsed_ms (self));
+    self->found = TRUE;
     filter_info_setup_enable_compiled_filter (self, self->manager->wk_filter);
+    filter_info_commit_fetched_validators (self);
     filter_info_save_sidecar (self,
                               self->manager->cancellable,
                               (GAsyncReadyCallback)sidecar_saved_cb,
                               self);
-  } else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
-    g_warning ("Filter %s <%s> cannot be compiled: %s.",
-               filter_info_get_identifier (self), self->source_uri,
-               error->message);
+  } else {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_warning ("Filter %s <%s> cannot be compiled: %s.",
+                 filter_info_get_identifier (self), self->source_uri,
+                 error->message);
+    }
+    filter_info_drop_fetched_validators (self);
   }
 
   /* In either case, setting up this filter is done. */
-  filter_info_setup_done (self);
+  filter_info_fetch_done (self);
+}
+
+static void
+filter_info_setup_compile (FilterInfo *self,
+                           GBytes     *json_data)
+{
+  LOG ("Compiling filter %s (%" G_GSIZE_FORMAT " bytes).",
+       filter_info_get_identifier (self),
+       g_bytes_get_size (json_data));
+
+  self->setup_time = g_get_monotonic_time ();
+  webkit_user_content_filter_store_save (self->manager->store,
+                                         filter_info_get_identifier (self),
+                                         json_data,
+                                         self->manager->cancellable,
+                                         (GAsyncReadyCallback)filter_saved_cb,
+                                         self);
 }
 
 static void
@@ -553,7 +899,8 @@ filter_info_setup_load_file (FilterInfo *self,
     g_warning ("Cannot map filter %s source file %s: %s",
                filter_info_get_identifier (self),
                json_file_path, error->message);
-    filter_info_setup_done (self);
+    filter_info_drop_fetched_validators (self);
+    filter_info_fetch_done (self);
     return;
   }
 
@@ -564,21 +911,19 @@ filter_info_setup_load_file (FilterInfo *self,
 
   if (!filter_info_needs_updating_from_source (self) && self->found &&
       old_checksum && strcmp (self->checksum, old_checksum) == 0) {
-    /* Even if an update is not needed, the sidecar needs to be updated. */
+    /* The fetched rules are the ones in use. Even if an update is not
+     * needed, the sidecar needs to be updated.
+     */
+    filter_info_commit_fetched_validators (self);
     filter_info_save_sidecar (self,
                               self->manager->cancellable,
                               (GAsyncReadyCallback)sidecar_saved_cb,
                               self);
     LOG ("Filter %s not stale, source checksum unchanged (%s), recompilation skipped.",
          filter_info_get_identifier (self), self->checksum);
-    filter_info_setup_done (self);
+    filter_info_fetch_done (self);
   } else {
-    webkit_user_content_filter_store_save (self->manager->store,
-                                           filter_info_get_identifier (self),
-                                           json_data,
-                                           self->manager->cancellable,
-                                           (GAsyncReadyCallback)filter_saved_cb,
-                                           self);
+    filter_info_setup_compile (self, json_data);
   }
 }
 
@@ -593,9 +938,22 @@ json_file_deleted (GObject      *source,
 }
 
 typedef struct {
-  EphyDownload *download;
   FilterInfo *self;
-} FilterJsonInfoAsyncData;
+  GFile *json_file;
+  GInputStream *stream;
+  char *etag;
+  char *last_modified;
+} FilterFetchData;
+
+static void
+filter_fetch_data_free (FilterFetchData *data)
+{
+  g_clear_object (&data->json_file);
+  g_clear_object (&data->stream);
+  g_free (data->etag);
+  g_free (data->last_modified);
+  g_free (data);
+}
 
 static void
 json_file_info_callback (GObject      *source_object,
@@ -603,7 +961,7 @@ json_file_info_callback (GObject      *source_object,
                          gpointer      user_data)
 {
   g_autoptr (GError) error = NULL;
-  FilterJsonInfoAsyncData *data = user_data;
+  FilterFetchData *data = user_data;
   GFile *json_file = G_FILE (source_object);
   g_autoptr (GFileInfo) info = g_file_query_info_finish (json_file, res, &error);
   const char *content_type = NULL;
@@ -611,44 +969,52 @@ json_file_info_callback (GObject      *source_object,
   if (info)
     content_type = g_file_info_get_content_type (info);
   else
-    g_warning ("Couldn't query filter file %s: %s", ephy_download_get_destination (data->download), error->message);
+    g_warning ("Couldn't query filter file %s: %s", g_file_peek_path (json_file), error->message);
 
   if (content_type && g_strcmp0 ("application/json", content_type) == 0) {
+    /* Pending until the rules are in use, see filter_saved_cb(). */
+    filter_info_drop_fetched_validators (data->self);
+    data->self->fetched_etag = g_steal_pointer (&data->etag);
+    data->self->fetched_last_modified = g_steal_pointer (&data->last_modified);
+    data->self->fetched = TRUE;
+
     filter_info_setup_load_file (data->self, json_file);
   } else {
     g_warning ("Filter source %s has invalid MIME type: %s",
-               ephy_download_get_destination (data->download),
+               g_file_peek_path (json_file),
                content_type);
 
     g_file_delete_async (json_file, G_PRIORITY_DEFAULT, NULL, json_file_deleted, NULL);
 
-    filter_info_setup_done (data->self);
+    filter_info_fetch_done (data->self);
   }
 
-  g_object_unref (data->download);
-  g_free (data);
+  filter_fetch_data_free (data);
 }
 
 static void
-download_completed_cb (EphyDownload *download,
-                       FilterInfo   *self)
+json_file_spliced_cb (GOutputStream   *stream,
+                      GAsyncResult    *result,
+                      FilterFetchData *data)
 {
-  g_autoptr (GFile) json_file = NULL;
-  FilterJsonInfoAsyncData *data = NULL;
-
-  g_assert (download);
-  g_assert (self);
+  g_autoptr (GError) error = NULL;
+  FilterInfo *self = data->self;
 
-  g_signal_handlers_disconnect_by_data (download, self);
+  if (g_output_stream_splice_finish (stream, result, &error) < 0) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_warning ("Cannot fetch source for filter %s from <%s>: %s",
+                 filter_info_get_identifier (self), self->source_uri,
+                 error->message);
+      g_file_delete_async (data->json_file, G_PRIORITY_DEFAULT, NULL, json_file_deleted, NULL);
+      filter_info_fetch_done (self);
+    }
+    filter_fetch_data_free (data);
+    return;
+  }
 
   LOG ("Filter source %s fetched from <%s>", filter_info_get_identifier (self), self->source_uri);
 
-  data = g_new0 (FilterJsonInfoAsyncData, 1);
-  data->download = download;
-  data->self = self;
-
-  json_file = g_file_new_for_path (ephy_download_get_destination (download));
-  g_file_query_info_async (json_file,
+  g_file_query_info_async (data->json_file,
                            G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
                            G_FILE_QUERY_INFO_NONE,
                            G_PRIORITY_DEFAULT,
@@ -658,28 +1024,172 @@ download_completed_cb (EphyDownload *download,
 }
 
 static void
-download_errored_cb (EphyDownload *download,
-                     GError       *error,
-                     FilterInfo   *self)
+json_file_replaced_cb (GFile           *json_file,
+                       GAsyncResult    *result,
+                       FilterFetchData *data)
 {
-  g_assert (download);
-  g_assert (error);
-  g_assert (self);
+  g_autoptr (GFileOutputStream) output = NULL;
+  g_autoptr (GError) error = NULL;
+  FilterInfo *self = data->self;
+
+  output = g_file_replace_finish (json_file, result, &error);
+  if (!output) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_warning ("Cannot write source for filter %s to %s: %s",
+                 filter_info_get_identifier (self), g_file_peek_path (json_file),
+                 error->message);
+      filter_info_fetch_done (self);
+    }
+    filter_fetch_data_free (data);
+    return;
+  }
+
+  g_output_stream_splice_async (G_OUTPUT_STREAM (output),
+                                data->stream,
+                                G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                G_PRIORITY_LOW,
+                                self->manager->cancellable,
+                                (GAsyncReadyCallback)json_file_spliced_cb,
+                                data);
+}
+
+static void
+filter_fetch_sent_cb (SoupSession  *session,
+                      GAsyncResult *result,
+                      FilterInfo   *self)
+{
+  g_autoptr (GInputStream) stream = NULL;
+  g_autoptr (GError) error = NULL;
+  SoupMessageHeaders *headers;
+  SoupMessage *msg;
+  FilterFetchData *data;
+  guint status;
+
+  stream = soup_session_send_finish (session, result, &error);
+  if (!stream) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_warning ("Cannot fetch source for filter %s from <%s>: %s",
+                 filter_info_get_identifier (self), self->source_uri,
+                 error->message);
 
-  g_signal_handlers_disconnect_by_data (download, self);
+      /* There is not much else we can do if the fetch failed. Note that it
+       * is still possible that if a precompiled version of the filter was
+       * found that may get used instead.
+       */
+      filter_info_fetch_done (self);
+    }
+    return;
+  }
+
+  if (!self->manager)
+    return;
+
+  msg = soup_session_get_async_result_message (session, result);
+  status = soup_message_get_status (msg);
 
-  if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-    g_warning ("Cannot fetch source for filter %s from <%s>: %s",
+  if (status == SOUP_STATUS_NOT_MODIFIED) {
+    LOG ("Filter %s not modified at <%s>, fetch and recompilation skipped.",
+         filter_info_get_identifier (self), self->source_uri);
+    self->last_update = self->manager->update_time;
+    filter_info_save_sidecar (self,
+                              self->manager->cancellable,
+                              (GAsyncReadyCallback)sidecar_saved_cb,
+                              self);
+    filter_info_fetch_done (self);
+    return;
+  }
+
+  if (!SOUP_STATUS_IS_SUCCESSFUL (status)) {
+    g_warning ("Cannot fetch source for filter %s from <%s>: %u %s",
                filter_info_get_identifier (self), self->source_uri,
-               error ? error->message : "Unknown error");
+               status, soup_message_get_reason_phrase (msg));
+    filter_info_fetch_done (self);
+    return;
+  }
+
+  headers = soup_message_get_response_headers (msg);
+
+  data = g_new0 (FilterFetchData, 1);
+  data->self = self;
+  data->json_file = filter_info_get_source_file (self);
+  data->stream = g_steal_pointer (&stream);
+  data->etag = g_strdup (soup_message_headers_get_one (headers, "ETag"));
+  data->last_modified = g_strdup (soup_message_headers_get_one (headers, "Last-Modified"));
+
+  g_file_replace_async (data->json_file,
+                        NULL,   /* etag */
+                        FALSE,  /* make_backup */
+                        G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION,
+                        G_PRIORITY_LOW,
+                        self->manager->cancellable,
+                        (GAsyncReadyCallback)json_file_replaced_cb,
+                        data);
+}
+
+static gboolean
+accept_certificate_cb (SoupMessage          *msg,
+                       GTlsCertificate      *certificate,
+                       GTlsCertificateFlags  errors,
+                       gpointer              user_data)
+{
+  return TRUE;
+}
+
+static void
+filter_info_fetch (FilterInfo *self)
+{
+  g_autoptr (SoupMessage) msg = NULL;
+  WebKitNetworkSession *network_session;
+
+  g_assert (self);
 
-  /* There is not much else we can do if the download failed. Note that it
-   * is still possible that if a precompiled version of the filter was found
-   * that may get used instead.
+  if (!self->manager)
+    return;
+
+  msg = soup_message_new (SOUP_METHOD_GET, self->source_uri);
+  if (!msg) {
+    g_warning ("Cannot fetch source for filter %s: invalid URI <%s>",
+               filter_info_get_identifier (self), self->source_uri);
+    filter_info_fetch_done (self);
+    return;
+  }
+
+  /* Apply the TLS policy of the web views, e.g. ignoring errors under
+   * automation.
+   */
+  network_session = ephy_embed_shell_get_network_session (ephy_embed_shell_get_default ());
+  if (webkit_network_session_get_tls_errors_policy (network_session) == WEBKIT_TLS_ERRORS_POLICY_IGNORE)
+    g_signal_connect (msg, "accept-certificate", G_CALLBACK (accept_certificate_cb), NULL);
+
+  /* Only a filter which is already compiled can make do with a
+   * "Not Modified" response.
    */
-  filter_info_setup_done (self);
+  if (self->found) {
+    SoupMessageHeaders *headers = soup_message_get_request_headers (msg);
 
-  g_object_unref (download);
+    if (self->etag)
+      soup_message_headers_replace (headers, "If-None-Match", self->etag);
+    if (self->last_modified)
+      soup_message_headers_replace (headers, "If-Modified-Since", self->last_modified);
+  }
+
+  LOG ("Fetching filter %s from <%s>%s", filter_info_get_identifier (self), self->source_uri,
+       self->found && (self->etag || self->last_modified) ? " (conditional)" : "");
+
+  soup_session_send_async (self->manager->session,
+                           msg,
+                           G_PRIORITY_LOW,
+                           self->manager->cancellable,
+                           (GAsyncReadyCallback)filter_fetch_sent_cb,
+                           self);
+}
+
+static gboolean
+filter_fetch_timeout_cb (FilterInfo *self)
+{
+  self->fetch_source_id = 0;
+  filter_info_fetch (self);
+  return G_SOURCE_REMOVE;
 }
 
 static void
@@ -689,8 +1199,7 @@ filter_load_cb (WebKitUserContentFilterStore *store,
 {
   g_autoptr (GError) error = NULL;
   g_autoptr (GFile) source_file = NULL;
-  g_autoptr (GFile) json_file = NULL;
-  EphyDownload *download;
+  guint delay;
 
   if (!self->manager)
     return;
@@ -707,7 +1216,9 @@ filter_load_cb (WebKitUserContentFilterStore *store,
   self->found = !!self->manager->wk_filter;
 
   if (self->manager->wk_filter) {
-    LOG ("Found compiled filter %s.", filter_info_get_identifier (self));
+    LOG ("Found compiled filter %s, loaded in %.1f ms.",
+         filter_info_get_identifier (self),
+         filter_info_get_setup_elapsed_ms (self));
     filter_info_setup_enable_compiled_filter (self, self->manager->wk_filter);
     LOG ("Update %sneeded for filter %s (last %" PRIu64 "s ago, interval %us)",
          filter_info_needs_updating_from_source (self) ? "" : "not ",
@@ -728,7 +1239,10 @@ filter_load_cb (WebKitUserContentFilterStore *store,
                error->message);
   }
 
-  if (!filter_info_needs_updating_from_source (self)) {
+  /* A filter missing from the store needs fetching regardless of how
+   * recent its saved metadata is.
+   */
+  if (self->found && !filter_info_needs_updating_from_source (self)) {
     filter_info_setup_done (self);
     return;
   }
@@ -747,18 +1261,24 @@ filter_load_cb (WebKitUserContentFilterStore *store,
     return;
   }
 
-  /* Download non-local URIs. */
-  download = ephy_download_new_for_uri_internal (self->source_uri);
-
-  json_file = filter_info_get_source_file (self);
-  ephy_download_set_destination (download, g_file_peek_path (json_file));
-  ephy_download_disable_desktop_notification (download);
-  webkit_download_set_allow_overwrite (ephy_download_get_webkit_download (download), TRUE);
+  /* The compiled filter is in use already, so there is no hurry to refresh
+   * it. Spread the fetches over time so that they do not all compete for
+   * the network and get recompiled at once, and add some jitter so that
+   * many instances do not hit the servers at the same moment.
+   */
+  if (self->found) {
+    delay = self->manager->n_staggered_fetches++ * ADBLOCK_FILTER_UPDATE_STAGGER +
+            g_random_int_range (0, ADBLOCK_FILTER_UPDATE_JITTER);
+    LOG ("Fetch of filter %s scheduled in %us.", filter_info_get_identifier (self), delay);
+    self->fetch_source_id = g_timeout_add_seconds (delay,
+                                                   (GSourceFunc)filter_fetch_timeout_cb,
+                                                   self);
+    g_source_set_name_by_id (self->fetch_source_id, "[epiphany] filter_fetch_timeout_cb");
+    filter_info_setup_done (self);
+    return;
+  }
 
-  g_signal_connect (download, "completed",
-                    G_CALLBACK (download_completed_cb), self);
-  g_signal_connect (download, "error",
-                    G_CALLBACK (download_errored_cb), self);
+  filter_info_fetch (self);
 }
 
 static void
@@ -771,7 +1291,10 @@ filter_info_setup_start (FilterInfo *self)
 
   LOG ("Setup started for <%s> id=%s", self->source_uri, filter_info_get_identifier (self));
 
+  g_clear_handle_id (&self->fetch_source_id, g_source_remove);
+  filter_info_drop_fetched_validators (self);
   self->done = FALSE;
+  self->setup_time = g_get_monotonic_time ();
   webkit_user_content_filter_store_load (self->manager->store,
                                          filter_info_get_identifier (self),
                                          self->manager->cancellable,
@@ -816,12 +1339,36 @@ filter_info_setup_done (FilterInfo *self)
        filter_info_get_identifier (self), self->source_uri);
 
   if (done) {
-    LOG ("Setup completed for %u filters.",
-         g_hash_table_size (self->manager->filters));
+    LOG ("Setup completed for %u filters in %.1f ms.",
+         g_hash_table_size (self->manager->filters),
+         (g_get_monotonic_time () - self->manager->setup_start_time) / 1000.0);
+    STOP_PROFILER ("Content filters setup")
+    filters_manager_save_filter_set (self->manager);
     filters_manager_ensure_initialized (self->manager);
   }
 }
 
+/* Ends a fetch for @self. When the refresh of a filter already in use was
+ * staggered, its setup was completed as the fetch was scheduled, and only the
+ * filter set is left to save for the refreshed rules.
+ */
+static void
+filter_info_fetch_done (FilterInfo *self)
+{
+  gboolean done = TRUE;
+
+  if (!self->done) {
+    filter_info_setup_done (self);
+    return;
+  }
+
+  g_hash_table_foreach (self->manager->filters,
+                        (GHFunc)accumulate_filter_done,
+                        &done);
+  if (done)
+    filters_manager_save_filter_set (self->manager);
+}
+
 static void
 filter_removed_cb (WebKitUserContentFilterStore *store,
                    GAsyncResult                 *result,
@@ -890,12 +1437,71 @@ sidecar_loaded_cb (GObject      *source_object,
   filter_info_setup_start (self);
 }
 
+static void
+cookie_banner_filter_loaded_cb (WebKitUserContentFilterStore *store,
+                                GAsyncResult                 *result,
+                                FilterInfo                   *self)
+{
+  g_autoptr (GBytes) data = NULL;
+  g_autoptr (GError) error = NULL;
+
+  if (!self->manager)
+    return;
+
+  g_clear_pointer (&self->manager->wk_filter, webkit_user_content_filter_unref);
+  self->manager->wk_filter = webkit_user_content_filter_store_load_finish (store,
+                                                                           result,
+                                                                           &error);
+  if (self->manager->wk_filter) {
+    LOG ("Found compiled filter %s, loaded in %.1f ms.",
+         filter_info_get_identifier (self),
+         filter_info_get_setup_elapsed_ms (self));
+    self->found = TRUE;
+    filter_info_setup_enable_compiled_filter (self, self->manager->wk_filter);
+    return;
+  }
+
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  LOG ("Compiled filter %s unavailable (%s), compiling.",
+       filter_info_get_identifier (self), error->message);
+  data = g_resources_lookup_data (COOKIE_BANNER_FILTER_RESOURCE, 0, NULL);
+  filter_info_setup_compile (self, data);
+}
+
+static FilterInfo *
+filters_manager_update_cookie_banner_filter (EphyFiltersManager *manager)
+{
+  g_autoptr (GBytes) data = g_resources_lookup_data (COOKIE_BANNER_FILTER_RESOURCE, 0, NULL);
+  g_autofree char *checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, data);
+  FilterInfo *filter_info = manager->cookie_banner_filter;
+
+  if (!filter_info) {
+    filter_info = filter_info_new (COOKIE_BANNER_FILTER_RESOURCE, manager);
+    /* The identifier is derived from the path without its leading slash. */
+    filter_info->identifier = filter_info_identifier_for_source_uri (COOKIE_BANNER_FILTER_RESOURCE + 1);
+    manager->cookie_banner_filter = filter_info;
+  } else if (filter_info->found && g_strcmp0 (filter_info->checksum, checksum) == 0) {
+    LOG ("Filter %s unchanged and already enabled.", filter_info_get_identifier (filter_info));
+    return filter_info;
+  }
+
+  g_free (filter_info->checksum);
+  filter_info->checksum = g_steal_pointer (&checksum);
+  filter_info->found = FALSE;
+
+  return filter_info;
+}
+
 static void
 update_filters (EphyFiltersManager  *manager,
                 char               **uris)
 {
   const gint64 update_time = g_get_real_time () / G_USEC_PER_SEC;
   g_autoptr (GHashTable) old_filters = NULL;
+  FilterInfo *cookie_banner_filter = NULL;
+  gboolean filter_set_matches;
 
   if ((!g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_ENABLE_ADBLOCK)) ||
       (ephy_embed_shell_get_mode (ephy_embed_shell_get_default ()) == EPHY_EMBED_SHELL_MODE_AUTOMATION)) {
@@ -911,6 +1517,16 @@ update_filters (EphyFiltersManager  *manager,
   g_object_unref (manager->cancellable);
   manager->cancellable = g_cancellable_new ();
   manager->update_time = update_time;
+  manager->setup_start_time = g_get_monotonic_time ();
+  manager->n_staggered_fetches = 0;
+  START_PROFILER ("Content filters setup")
+
+  if (!g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_ENABLE_COOKIE_BANNER))
+    cookie_banner_filter = filters_manager_update_cookie_banner_filter (manager);
+
+  filter_set_matches = filters_manager_filter_set_matches (manager, uris, cookie_banner_filter);
+  LOG ("Filter set %s the one of the last completed setup.",
+       filter_set_matches ? "matches" : "differs from");
 
   old_filters = g_steal_pointer (&manager->filters);
   manager->filters = g_hash_table_new_full (g_str_hash,
@@ -939,6 +1555,20 @@ update_filters (EphyFiltersManager  *manager,
 
       LOG ("Filter %s in old set, stolen and starting setup.", filter_id);
       filter_info_setup_start (filter_info);
+    } else if (filter_set_matches) {
+      /* The saved filter set has the same metadata the sidecar files would
+       * provide, so go straight to loading the compiled filter.
+       */
+      FilterSetEntry *entry = g_hash_table_lookup (manager->filter_set, filter_id);
+
+      LOG ("Filter %s not in old set, creating from saved filter set.", filter_id);
+      filter_info = filter_info_new (uris[i], manager);
+      filter_info->identifier = g_steal_pointer (&filter_id);
+      filter_info->checksum = g_strdup (entry->checksum);
+      filter_info->last_update = entry->last_update;
+      filter_info->etag = g_strdup (entry->etag);
+      filter_info->last_modified = g_strdup (entry->last_modified);
+      filter_info_setup_start (filter_info);
     } else {
       /* Filter was not present in the old hash table: create a FilterInfo
        * for the URI and start by loading its sidecar file.
@@ -957,20 +1587,24 @@ update_filters (EphyFiltersManager  *manager,
                           filter_info);
   }
 
-  if (!g_settings_get_boolean (EPHY_SETTINGS_WEB, EPHY_PREFS_WEB_ENABLE_COOKIE_BANNER)) {
-    g_autoptr (GBytes) data = g_resources_lookup_data ("/org/gnome/epiphany/hush.json", 0, NULL);
-    g_autofree char *filter_id = filter_info_identifier_for_source_uri ("org/gnome/epiphany/hush.json");
-    FilterInfo *filter_info = NULL;
-
-    filter_info = filter_info_new ("/org/gnome/epiphany/hush.json", manager);
-    filter_info->identifier = g_steal_pointer (&filter_id);
-
-    webkit_user_content_filter_store_save (manager->store,
-                                           filter_info_get_identifier (filter_info),
-                                           data,
-                                           manager->cancellable,
-                                           (GAsyncReadyCallback)filter_saved_cb,
-                                           filter_info);
+  /* The cookie banner rules only change with the application, so they are
+   * compiled again only when their checksum differs from the saved one.
+   */
+  if (cookie_banner_filter && !cookie_banner_filter->found) {
+    FilterSetEntry *entry = manager->filter_set ? g_hash_table_lookup (manager->filter_set,
+                                                                       filter_info_get_identifier (cookie_banner_filter)) : NULL;
+
+    if (entry && strcmp (entry->checksum, cookie_banner_filter->checksum) == 0) {
+      cookie_banner_filter->setup_time = g_get_monotonic_time ();
+      webkit_user_content_filter_store_load (manager->store,
+                                             filter_info_get_identifier (cookie_banner_filter),
+                                             manager->cancellable,
+                                             (GAsyncReadyCallback)cookie_banner_filter_loaded_cb,
+                                             cookie_banner_filter);
+    } else {
+      g_autoptr (GBytes) data = g_resources_lookup_data (COOKIE_BANNER_FILTER_RESOURCE, 0, NULL);
+      filter_info_setup_compile (cookie_banner_filter, data);
+    }
   }
 
   /* Remove the filters which are no longer in the configured set. */
@@ -1005,6 +1639,7 @@ ephy_filters_manager_dispose (GObject *object)
   }
   g_clear_pointer (&manager->wk_filter, webkit_user_content_filter_unref);
   g_clear_object (&manager->store);
+  g_clear_object (&manager->session);
 
   G_OBJECT_CLASS (ephy_filters_manager_parent_class)->dispose (object);
 }
@@ -1015,6 +1650,9 @@ ephy_filters_manager_finalize (GObject *object)
   EphyFiltersManager *manager = EPHY_FILTERS_MANAGER (object);
 
   g_clear_pointer (&manager->filters, g_hash_table_unref);
+  g_clear_pointer (&manager->filter_set, g_hash_table_unref);
+  g_clear_pointer (&manager->cookie_banner_filter, filter_info_free);
+  g_free (manager->filter_set_key);
   g_free (manager->filters_dir);
 
   G_OBJECT_CLASS (ephy_filters_manager_parent_class)->finalize (object);
@@ -1112,6 +1750,17 @@ ephy_filters_manager_constructed (GObject *object)
   g_mkdir_with_parents (saved_filters_dir, 0700);
   manager->store = webkit_user_content_filter_store_new (saved_filters_dir);
 
+  /* WebKit cannot send conditional requests for downloads, so the filters
+   * are fetched with libsoup. The network session of the web views leaves
+   * its proxy settings to the system default, which is what the default
+   * proxy resolver follows too. Its TLS policy is applied per fetch.
+   */
+  manager->session = soup_session_new_with_options ("user-agent", ephy_user_agent_get (),
+                                                    "proxy-resolver", g_proxy_resolver_get_default (),
+                                                    NULL);
+
+  filters_manager_load_filter_set (manager);
+
   /* Note: up here because we must connect *before* reading the settings. */
   g_signal_connect_object (EPHY_SETTINGS_MAIN, "changed::" EPHY_PREFS_CONTENT_FILTERS,
                            G_CALLBACK (update_adblock_filter_files_cb), manager, 0);
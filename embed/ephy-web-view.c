@@ -144,6 +144,12 @@ struct _EphyWebView {
 
   EphyClientCertificateManager *client_certificate_manager;
 
+  /* Number of live views sharing the web process of this one, shared by
+   * all of them. Related views, e.g. popups, run in the process of their
+   * opener.
+   */
+  guint *web_process_views;
+
   /* Autofill */
   gboolean autofill_popup_enabled;
 };
@@ -483,42 +489,11 @@ take_snapshot (EphyWebView *view)
                                                  g_strdup (view->pending_snapshot_uri));
 }
 
-static void
-history_service_query_urls_cb (EphyHistoryService *service,
-                               gboolean            success,
-                               GList              *urls,
-                               EphyWebView        *view)
-{
-  const char *url = webkit_web_view_get_uri (WEBKIT_WEB_VIEW (view));
-
-  if (!success)
-    goto out;
-
-  /* Have we already started a new load? */
-  if (g_strcmp0 (url, view->pending_snapshot_uri) != 0)
-    goto out;
-
-  for (GList *l = urls; l; l = g_list_next (l)) {
-    EphyHistoryURL *history_url = l->data;
-
-    /* Take snapshot if this URL is one of the top history results. */
-    if (strcmp (history_url->url, view->pending_snapshot_uri) == 0) {
-      take_snapshot (view);
-      break;
-    }
-  }
-
-out:
-  g_clear_pointer (&view->pending_snapshot_uri, g_free);
-  g_object_unref (view);
-}
-
 static gboolean
 maybe_take_snapshot (EphyWebView *view)
 {
   EphyEmbedShell *shell;
   EphyHistoryService *service;
-  EphyHistoryQuery *query;
 
   view->snapshot_timeout_id = 0;
 
@@ -528,16 +503,12 @@ maybe_take_snapshot (EphyWebView *view)
   shell = ephy_embed_shell_get_default ();
   service = ephy_embed_shell_get_global_history_service (shell);
 
-  /* We want to save snapshots for just a couple more pages than are present
-   * in the overview, so new snapshots are immediately available when the user
-   * deletes a couple pages from the overview. Let's say five more.
-   */
-  query = ephy_history_query_new_for_overview ();
-  query->limit += 5;
-  ephy_history_service_query_urls (service, query, NULL,
-                                   (EphyHistoryJobCallback)history_service_query_urls_cb,
-                                   g_object_ref (view));
-  ephy_history_query_free (query);
+  /* Take snapshot if this URL is one of the top history results. The top
+   * sites include a couple more pages than are present in the overview. */
+  if (ephy_history_service_is_top_site (service, view->pending_snapshot_uri))
+    take_snapshot (view);
+
+  g_clear_pointer (&view->pending_snapshot_uri, g_free);
 
   return FALSE;
 }
@@ -806,6 +777,17 @@ process_terminated_cb (EphyWebView                       *web_view,
   EphyWebViewErrorPage error_page = EPHY_WEB_VIEW_ERROR_PROCESS_CRASH;
   GtkWidget *widget;
 
+  /* We're getting the embed manually here because the web view might already be
+   * unparented by this point.
+   */
+  widget = gtk_widget_get_parent (GTK_WIDGET (web_view));
+  while (widget && !EPHY_IS_EMBED (widget))
+    widget = gtk_widget_get_parent (widget);
+
+  /* Discarded tabs terminate their own web process on purpose. */
+  if (widget && ephy_embed_is_discarded (EPHY_EMBED (widget)))
+    return;
+
   switch (reason) {
     case WEBKIT_WEB_PROCESS_CRASHED:
       g_warning (_("Web process crashed"));
@@ -819,13 +801,6 @@ process_terminated_cb (EphyWebView                       *web_view,
       break;
   }
 
-  /* We're getting the embed manually here because the web view might already be
-   * unparented by this point.
-   */
-  widget = gtk_widget_get_parent (GTK_WIDGET (web_view));
-  while (widget && !EPHY_IS_EMBED (widget))
-    widget = gtk_widget_get_parent (widget);
-
   if (widget && !ephy_embed_has_load_pending (EPHY_EMBED (widget))) {
     ephy_web_view_load_error_page (web_view, ephy_web_view_get_address (web_view),
                                    error_page, NULL, NULL);
@@ -1740,6 +1715,10 @@ load_changed_cb (WebKitWebView   *web_view,
 
       /* Zoom level. */
       restore_zoom_level (view, uri);
+
+      /* The web process may have missed overview updates meanwhile. */
+      if (ephy_web_view_is_overview (view))
+        ephy_embed_shell_send_overview_urls (ephy_embed_shell_get_default (), web_view);
       break;
     }
     case WEBKIT_LOAD_FINISHED:
@@ -4001,6 +3980,11 @@ ephy_web_view_dispose (GObject *object)
 
   g_clear_pointer (&view->client_certificate_manager, ephy_client_certificate_manager_free);
 
+  if (view->web_process_views) {
+    (*view->web_process_views)--;
+    g_clear_pointer (&view->web_process_views, g_rc_box_release);
+  }
+
   G_OBJECT_CLASS (ephy_web_view_parent_class)->dispose (object);
 }
 
@@ -4061,6 +4045,9 @@ ephy_web_view_init (EphyWebView *web_view)
 
   web_view->uid = web_view_uid++;
 
+  web_view->web_process_views = g_rc_box_new (guint);
+  *web_view->web_process_views = 1;
+
   web_view->opensearch_engines = g_list_store_new (EPHY_TYPE_OPENSEARCH_AUTODISCOVERY_LINK);
 
   web_view->is_blank = TRUE;
@@ -4421,12 +4408,40 @@ GtkWidget *
 ephy_web_view_new_with_related_view (WebKitWebView *related_view)
 {
   g_autoptr (WebKitUserContentManager) ucm = webkit_user_content_manager_new ();
+  EphyWebView *web_view;
 
-  return g_object_new (EPHY_TYPE_WEB_VIEW,
-                       "related-view", related_view,
-                       "user-content-manager", ucm,
-                       "settings", ephy_embed_prefs_get_settings (),
-                       NULL);
+  web_view = g_object_new (EPHY_TYPE_WEB_VIEW,
+                           "related-view", related_view,
+                           "user-content-manager", ucm,
+                           "settings", ephy_embed_prefs_get_settings (),
+                           NULL);
+
+  if (EPHY_IS_WEB_VIEW (related_view)) {
+    EphyWebView *related = EPHY_WEB_VIEW (related_view);
+
+    g_rc_box_release (web_view->web_process_views);
+    web_view->web_process_views = g_rc_box_acquire (related->web_process_views);
+    (*web_view->web_process_views)++;
+  }
+
+  return GTK_WIDGET (web_view);
+}
+
+/**
+ * ephy_web_view_owns_web_process:
+ * @view: an #EphyWebView
+ *
+ * Checks whether @view is the only view running in its web process, i.e. it
+ * was not opened by another view and no view it opened is still around.
+ *
+ * Returns: %TRUE if terminating the web process only affects @view
+ **/
+gboolean
+ephy_web_view_owns_web_process (EphyWebView *view)
+{
+  g_assert (EPHY_IS_WEB_VIEW (view));
+
+  return *view->web_process_views == 1;
 }
 
 guint64
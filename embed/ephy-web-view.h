@@ -90,6 +90,7 @@ typedef enum {
 
 GtkWidget *                ephy_web_view_new                      (void);
 GtkWidget                 *ephy_web_view_new_with_related_view    (WebKitWebView             *related_view);
+gboolean                   ephy_web_view_owns_web_process         (EphyWebView               *view);
 void                       ephy_web_view_load_request             (EphyWebView               *view,
                                                                    WebKitURIRequest          *request);
 void                       ephy_web_view_load_url                 (EphyWebView               *view,
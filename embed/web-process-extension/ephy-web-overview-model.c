@@ -197,6 +197,68 @@ ephy_web_overview_model_set_urls (EphyWebOverviewModel *model,
   ephy_web_overview_model_notify_urls_changed (model);
 }
 
+static gboolean
+ephy_web_overview_model_remove_url (EphyWebOverviewModel *model,
+                                    const char           *url)
+{
+  GList *l;
+  gboolean changed = FALSE;
+
+  l = model->items;
+  while (l) {
+    EphyWebOverviewModelItem *item = (EphyWebOverviewModelItem *)l->data;
+    GList *next = l->next;
+
+    if (g_strcmp0 (item->url, url) == 0) {
+      changed = TRUE;
+
+      ephy_web_overview_model_item_free (item);
+      model->items = g_list_delete_link (model->items, l);
+    }
+
+    l = next;
+  }
+
+  return changed;
+}
+
+/**
+ * ephy_web_overview_model_update_urls:
+ * @model: an #EphyWebOverviewModel
+ * @removed_urls: the URLs no longer in the overview
+ * @items: (transfer full): the new, moved or retitled items, sorted by position
+ *
+ * Applies the difference between two overview lists computed by the UI
+ * process. Items not mentioned keep their relative order. Applying the same
+ * changes twice gives the same result, so processes with several overview
+ * pages can receive them once per page.
+ **/
+void
+ephy_web_overview_model_update_urls (EphyWebOverviewModel *model,
+                                     const char * const   *removed_urls,
+                                     GList                *items)
+{
+  gboolean changed = FALSE;
+
+  g_assert (EPHY_IS_WEB_OVERVIEW_MODEL (model));
+
+  for (guint i = 0; removed_urls && removed_urls[i]; i++)
+    changed |= ephy_web_overview_model_remove_url (model, removed_urls[i]);
+
+  for (GList *l = items; l; l = g_list_next (l)) {
+    EphyWebOverviewModelItem *item = (EphyWebOverviewModelItem *)l->data;
+
+    ephy_web_overview_model_remove_url (model, item->url);
+    model->items = g_list_insert (model->items, item, item->position);
+    changed = TRUE;
+  }
+
+  g_list_free (items);
+
+  if (changed)
+    ephy_web_overview_model_notify_urls_changed (model);
+}
+
 void
 ephy_web_overview_model_set_url_thumbnail (EphyWebOverviewModel *model,
                                            const char           *url,
@@ -248,27 +310,9 @@ void
 ephy_web_overview_model_delete_url (EphyWebOverviewModel *model,
                                     const char           *url)
 {
-  GList *l;
-  gboolean changed = FALSE;
-
   g_assert (EPHY_IS_WEB_OVERVIEW_MODEL (model));
 
-  l = model->items;
-  while (l) {
-    EphyWebOverviewModelItem *item = (EphyWebOverviewModelItem *)l->data;
-    GList *next = l->next;
-
-    if (g_strcmp0 (item->url, url) == 0) {
-      changed = TRUE;
-
-      ephy_web_overview_model_item_free (item);
-      model->items = g_list_delete_link (model->items, l);
-    }
-
-    l = next;
-  }
-
-  if (changed)
+  if (ephy_web_overview_model_remove_url (model, url))
     ephy_web_overview_model_notify_urls_changed (model);
 }
 
@@ -32,6 +32,9 @@ G_DECLARE_FINAL_TYPE (EphyWebOverviewModel, ephy_web_overview_model, EPHY, WEB_O
 EphyWebOverviewModel *ephy_web_overview_model_new               (void);
 void                  ephy_web_overview_model_set_urls          (EphyWebOverviewModel *model,
                                                                  GList                *urls);
+void                  ephy_web_overview_model_update_urls       (EphyWebOverviewModel *model,
+                                                                 const char * const   *removed_urls,
+                                                                 GList                *items);
 void                  ephy_web_overview_model_set_url_thumbnail (EphyWebOverviewModel *model,
                                                                  const char           *url,
                                                                  const char           *path,
@@ -51,6 +54,7 @@ struct _EphyWebOverviewModelItem
 {
   char *url;
   char *title;
+  guint position; /* Only used by ephy_web_overview_model_update_urls() */
 };
 
 EphyWebOverviewModelItem *ephy_web_overview_model_item_new  (const char               *url,
@@ -207,8 +207,9 @@ web_page_context_menu (WebKitWebPage          *web_page,
   return TRUE;
 }
 
+/* The UI process only sends these to pages showing the overview. */
 static void
-ephy_web_process_extension_user_message_received_cb (EphyWebProcessExtension *extension,
+ephy_web_process_extension_history_message_received (EphyWebProcessExtension *extension,
                                                      WebKitUserMessage       *message)
 {
   const char *name = webkit_user_message_get_name (message);
@@ -234,6 +235,35 @@ ephy_web_process_extension_user_message_received_cb (EphyWebProcessExtension *ex
 
       ephy_web_overview_model_set_urls (extension->overview_model, g_list_reverse (items));
     }
+  } else if (g_strcmp0 (name, "History.UpdateURLs") == 0) {
+    if (extension->overview_model) {
+      GVariant *parameters;
+      GVariantIter iter;
+      guint position;
+      const char *url;
+      const char *title;
+      GList *items = NULL;
+      g_autofree const char **removed_urls = NULL;
+      g_autoptr (GVariant) removed = NULL;
+      g_autoptr (GVariant) placed = NULL;
+
+      parameters = webkit_user_message_get_parameters (message);
+      if (!parameters)
+        return;
+
+      g_variant_get (parameters, "(@as@a(uss))", &removed, &placed);
+      removed_urls = g_variant_get_strv (removed, NULL);
+
+      g_variant_iter_init (&iter, placed);
+      while (g_variant_iter_loop (&iter, "(u&s&s)", &position, &url, &title)) {
+        EphyWebOverviewModelItem *item = ephy_web_overview_model_item_new (url, title);
+
+        item->position = position;
+        items = g_list_prepend (items, item);
+      }
+
+      ephy_web_overview_model_update_urls (extension->overview_model, removed_urls, g_list_reverse (items));
+    }
   } else if (g_strcmp0 (name, "History.SetURLThumbnail") == 0) {
     if (extension->overview_model) {
       GVariant *parameters;
@@ -287,7 +317,16 @@ ephy_web_process_extension_user_message_received_cb (EphyWebProcessExtension *ex
   } else if (g_strcmp0 (name, "History.Clear") == 0) {
     if (extension->overview_model)
       ephy_web_overview_model_clear (extension->overview_model);
-  } else if (g_strcmp0 (name, "PasswordManager.SetShouldRememberPasswords") == 0) {
+  }
+}
+
+static void
+ephy_web_process_extension_user_message_received_cb (EphyWebProcessExtension *extension,
+                                                     WebKitUserMessage       *message)
+{
+  const char *name = webkit_user_message_get_name (message);
+
+  if (g_strcmp0 (name, "PasswordManager.SetShouldRememberPasswords") == 0) {
     GVariant *parameters;
 
     parameters = webkit_user_message_get_parameters (message);
@@ -464,6 +503,8 @@ web_page_received_message (WebKitWebPage     *web_page,
 
     /* WebExtensionData vreated using create_web_extension_data is transferred to hash table */
     g_hash_table_replace (extension->web_extensions, guid, create_web_extension_data (guid, dict));
+  } else if (g_str_has_prefix (name, "History.")) {
+    ephy_web_process_extension_history_message_received (extension, message);
   } else {
     g_warning ("Unhandled page message: %s", name);
     return FALSE;
@@ -4,25 +4,53 @@ window.browser = {};
 
 class EphyEventListener {
     #listeners = [];
+    #name = null;
+
+    // Extension views name their events, see webextensions.js, and tell the
+    // UI process which ones have listeners so it only emits those.
+    _setName (name) {
+        // Aliases like contextMenus keep the first name.
+        if (this.#name !== null)
+            return;
+
+        this.#name = name;
+        if (this.#listeners.length > 0)
+            this.#setListening (true);
+    }
+
+    #setListening (listening) {
+        if (this.#name === null)
+            return;
+
+        ephy_message ('runtime._setListening', [this.#name, listening]).catch(error_message => {
+            console.error(error_message);
+        });
+    }
 
     addListener (cb) {
         this.#listeners.push({callback: cb});
+        if (this.#listeners.length === 1)
+            this.#setListening (true);
     }
 
     removeListener (cb) {
+        const had_listeners = this.#listeners.length > 0;
+
         this.#listeners = this.#listeners.filter(l => l.callback !== cb);
+        if (had_listeners && this.#listeners.length === 0)
+            this.#setListening (false);
     }
 
     hasListener (cb) {
         return !!this.#listeners.find(l => l.callback === cb);
     }
 
-    #emit (...data) {
+    _emit (...data) {
         for (const listener of this.#listeners)
             listener.callback (...data);
     }
 
-    #emit_with_reply (message, sender, message_guid) {
+    _emit_with_reply (message, sender, message_guid) {
         let handled = false;
         const reply_callback = function (reply_message) {
             ephy_message ('runtime._sendMessageReply', [message_guid, reply_message]).catch(error_message => {
@@ -171,3 +171,14 @@ window.browser.menus = {
 
 // Chrome compat.
 window.browser.contextMenus = window.browser.menus;
+
+// The UI process emits events by these names, see EphyEventListener._setName().
+for (const [namespace, api] of Object.entries(window.browser)) {
+    if (typeof api !== 'object' || api === null)
+        continue;
+
+    for (const [member, value] of Object.entries(api)) {
+        if (value instanceof EphyEventListener)
+            value._setName (`${namespace}.${member}`);
+    }
+}
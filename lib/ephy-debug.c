@@ -23,9 +23,11 @@
 #include "ephy-debug.h"
 
 #include <string.h>
+#include <unistd.h>
 #ifdef HAVE_EXECINFO_H
 #include <execinfo.h>
 #endif
+#include <errno.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -44,6 +46,11 @@ static GHashTable *ephy_profilers_hash = NULL;
 static char **ephy_profile_modules;
 static gboolean ephy_profile_all_modules;
 
+/* Profilers can be started and stopped from any thread when writing a trace. */
+static GMutex ephy_profilers_mutex;
+static FILE *ephy_profile_trace;
+static gboolean ephy_profile_trace_empty = TRUE;
+
 static char **
 build_modules (const char *name,
                gboolean   *is_all)
@@ -150,6 +157,7 @@ ephy_profiler_new (const char *name,
   profiler->timer = g_timer_new ();
   profiler->name = g_strdup (name);
   profiler->module = g_strdup (module);
+  profiler->start_time = g_get_monotonic_time ();
 
   g_timer_start (profiler->timer);
 
@@ -193,6 +201,89 @@ ephy_profiler_dump (EphyProfiler *profiler)
            seconds);
 }
 
+static void
+append_json_string (GString    *json,
+                    const char *str)
+{
+  g_string_append_c (json, '"');
+  for (const char *p = str; *p; p++) {
+    if (*p == '"' || *p == '\\')
+      g_string_append_printf (json, "\\%c", *p);
+    else if ((guchar)*p < 0x20)
+      g_string_append_printf (json, "\\u%04x", *p);
+    else
+      g_string_append_c (json, *p);
+  }
+  g_string_append_c (json, '"');
+}
+
+static guint
+get_trace_thread_id (void)
+{
+  static GPrivate thread_id_key;
+  static int next_thread_id = 1;
+  guint thread_id = GPOINTER_TO_UINT (g_private_get (&thread_id_key));
+
+  if (!thread_id) {
+    thread_id = g_atomic_int_add (&next_thread_id, 1);
+    g_private_set (&thread_id_key, GUINT_TO_POINTER (thread_id));
+  }
+
+  return thread_id;
+}
+
+/* Events are appended as soon as they complete, so the trace is usable even
+ * if the process never exits cleanly: the closing bracket of the array is
+ * optional in the Trace Event Format.
+ */
+static void
+write_trace_event (const char *json)
+{
+  fprintf (ephy_profile_trace, "%s%s", ephy_profile_trace_empty ? "" : ",\n", json);
+  fflush (ephy_profile_trace);
+  ephy_profile_trace_empty = FALSE;
+}
+
+static void
+ephy_profiler_write_trace_event (EphyProfiler *profiler)
+{
+  g_autoptr (GString) json = g_string_new ("{\"ph\":\"X\",\"name\":");
+  g_autofree char *category = g_path_get_basename (profiler->module);
+
+  append_json_string (json, profiler->name);
+  g_string_append (json, ",\"cat\":");
+  append_json_string (json, category);
+  g_string_append_printf (json,
+                          ",\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%u}",
+                          profiler->start_time,
+                          g_get_monotonic_time () - profiler->start_time,
+                          getpid (),
+                          get_trace_thread_id ());
+  write_trace_event (json->str);
+}
+
+static void
+ephy_profile_trace_open (const char *path_template)
+{
+  g_autoptr (GString) json = NULL;
+  g_auto (GStrv) parts = g_strsplit (path_template, "%p", -1);
+  g_autofree char *pid = g_strdup_printf ("%d", getpid ());
+  g_autofree char *path = g_strjoinv (pid, parts);
+
+  ephy_profile_trace = fopen (path, "w");
+  if (!ephy_profile_trace) {
+    g_warning ("Cannot open profile trace file %s: %s", path, g_strerror (errno));
+    return;
+  }
+
+  fputs ("[\n", ephy_profile_trace);
+
+  json = g_string_new ("{\"ph\":\"M\",\"name\":\"process_name\",\"args\":{\"name\":");
+  append_json_string (json, g_get_prgname () ? g_get_prgname () : "epiphany");
+  g_string_append_printf (json, "},\"pid\":%d,\"tid\":%u}", getpid (), get_trace_thread_id ());
+  write_trace_event (json->str);
+}
+
 static void
 ephy_profiler_free (EphyProfiler *profiler)
 {
@@ -229,19 +320,23 @@ ephy_profiler_start (const char *name,
 {
   EphyProfiler *profiler;
 
+  if (!ephy_profile_trace && !ephy_profile_all_modules &&
+      (!ephy_profile_modules || !ephy_should_profile (module)))
+    return;
+
+  profiler = ephy_profiler_new (name, module);
+
+  g_mutex_lock (&ephy_profilers_mutex);
+
   if (!ephy_profilers_hash) {
     ephy_profilers_hash =
       g_hash_table_new_full (g_str_hash, g_str_equal,
-                             g_free, NULL);
+                             g_free, (GDestroyNotify)ephy_profiler_free);
   }
 
-  if (!ephy_profile_all_modules &&
-      (!ephy_profile_modules || !ephy_should_profile (module)))
-    return;
-
-  profiler = ephy_profiler_new (name, module);
+  g_hash_table_replace (ephy_profilers_hash, g_strdup (name), profiler);
 
-  g_hash_table_insert (ephy_profilers_hash, g_strdup (name), profiler);
+  g_mutex_unlock (&ephy_profilers_mutex);
 }
 
 /**
@@ -253,33 +348,94 @@ ephy_profiler_start (const char *name,
 void
 ephy_profiler_stop (const char *name)
 {
-  EphyProfiler *profiler;
+  EphyProfiler *profiler = NULL;
+
+  g_mutex_lock (&ephy_profilers_mutex);
+
+  if (ephy_profilers_hash)
+    g_hash_table_steal_extended (ephy_profilers_hash, name, NULL, (gpointer *)&profiler);
+
+  if (profiler) {
+    if (ephy_profile_trace)
+      ephy_profiler_write_trace_event (profiler);
+  }
+
+  g_mutex_unlock (&ephy_profilers_mutex);
 
-  profiler = g_hash_table_lookup (ephy_profilers_hash, name);
   if (!profiler)
     return;
 
-  g_hash_table_remove (ephy_profilers_hash, name);
+  if (ephy_profile_all_modules ||
+      (ephy_profile_modules && ephy_should_profile (profiler->module)))
+    ephy_profiler_dump (profiler);
 
-  ephy_profiler_dump (profiler);
   ephy_profiler_free (profiler);
 }
 
+/**
+ * ephy_profiler_counter:
+ * @name: name of the counter
+ * @module: Pafari module the counter belongs to
+ * @value: current value of the counter
+ *
+ * Records the value of the counter named @name, as a counter event in the
+ * trace and on the console if @module is profiled.
+ **/
+void
+ephy_profiler_counter (const char *name,
+                       const char *module,
+                       double      value)
+{
+  if (ephy_profile_trace) {
+    g_autoptr (GString) json = g_string_new ("{\"ph\":\"C\",\"name\":");
+    g_autofree char *category = g_path_get_basename (module);
+    char number[G_ASCII_DTOSTR_BUF_SIZE];
+
+    append_json_string (json, name);
+    g_string_append (json, ",\"cat\":");
+    append_json_string (json, category);
+    /* JSON numbers do not depend on the locale. */
+    g_string_append_printf (json,
+                            ",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%u,\"args\":{\"value\":%s}}",
+                            g_get_monotonic_time (),
+                            getpid (),
+                            get_trace_thread_id (),
+                            g_ascii_dtostr (number, sizeof (number), value));
+
+    g_mutex_lock (&ephy_profilers_mutex);
+    write_trace_event (json->str);
+    g_mutex_unlock (&ephy_profilers_mutex);
+  }
+
+  if (ephy_profile_all_modules ||
+      (ephy_profile_modules && ephy_should_profile (module)))
+    g_print ("[ %s ] %s %g\n", module, name, value);
+}
+
 /**
  * ephy_debug_init:
  *
  * Starts the debugging facility. See Pafari's HACKING file for
  * more information. It also starts module logging and profiling if the
  * appropriate variables are set: EPHY_LOG_MODULES and EPHY_PROFILE_MODULES.
+ * When EPHY_PROFILE_TRACE names a file, all the profilers are recorded to
+ * it in the Trace Event Format understood by Perfetto and chrome://tracing.
+ * A "%p" in the file name is replaced by the process id.
  **/
 void
 ephy_debug_init (void)
 {
+  const char *trace_path;
+
   ephy_log_modules = build_modules ("EPHY_LOG_MODULES", &ephy_log_all_modules);
   g_log_set_handler (G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG, log_module, NULL);
 
   ephy_profile_modules = build_modules ("EPHY_PROFILE_MODULES", &ephy_profile_all_modules);
 
+  trace_path = g_getenv ("EPHY_PROFILE_TRACE");
+  if (trace_path && *trace_path && !ephy_profile_trace)
+    ephy_profile_trace_open (trace_path);
+
   ephy_debug_break = g_getenv ("EPHY_DEBUG_BREAK");
   g_log_set_default_handler (trap_handler, NULL);
 }
@@ -30,12 +30,14 @@ G_BEGIN_DECLS
 
 #define START_PROFILER(name)	ephy_profiler_start (name, __FILE__);
 #define STOP_PROFILER(name)   ephy_profiler_stop (name);
+#define PROFILER_COUNTER(name, value) ephy_profiler_counter (name, __FILE__, value);
 
 typedef struct
 {
 	GTimer *timer;
 	char *name;
 	char *module;
+	gint64 start_time;
 } EphyProfiler;
 
 void		ephy_debug_init		(void);
@@ -45,6 +47,10 @@ void		ephy_profiler_start	(const char *name,
 
 void		ephy_profiler_stop	(const char *name);
 
+void		ephy_profiler_counter	(const char *name,
+					 const char *module,
+					 double      value);
+
 void		ephy_debug_set_fatal_criticals ();
 
 G_END_DECLS
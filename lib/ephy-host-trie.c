@@ -0,0 +1,409 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-host-trie.h"
+
+#include "ephy-debug.h"
+#include "ephy-uri-helpers.h"
+
+#include <string.h>
+
+/* Trie of the host names and base domains of the history, weighted by the
+ * number of visits to each host. Every node knows the highest weight below
+ * it, so the completion of a prefix is a walk down the prefix and then down
+ * the heaviest branch.
+ */
+typedef struct _TrieNode TrieNode;
+
+struct _TrieNode {
+  TrieNode *children;
+  TrieNode *next;
+  int weight;       /* Visits of the name ending at this node. */
+  int max_weight;   /* Highest weight of this node and the ones below. */
+  char c;
+};
+
+struct _EphyHostTrie {
+  GObject parent_instance;
+
+  EphyHistoryService *history_service;
+  GCancellable *cancellable;
+  TrieNode *root;
+  gboolean loading;
+  gboolean dirty;
+};
+
+G_DEFINE_FINAL_TYPE (EphyHostTrie, ephy_host_trie, G_TYPE_OBJECT)
+
+enum {
+  PROP_0,
+  PROP_HISTORY_SERVICE,
+  LAST_PROP
+};
+
+static GParamSpec *obj_properties[LAST_PROP];
+
+static void
+trie_node_free (TrieNode *node)
+{
+  TrieNode *child = node->children;
+
+  while (child) {
+    TrieNode *next = child->next;
+
+    trie_node_free (child);
+    child = next;
+  }
+
+  g_free (node);
+}
+
+static TrieNode *
+trie_node_get_child (TrieNode *node,
+                     char      c)
+{
+  TrieNode *child;
+
+  for (child = node->children; child; child = child->next) {
+    if (child->c == c)
+      break;
+  }
+
+  return child;
+}
+
+static void
+trie_insert (TrieNode   *root,
+             const char *name,
+             int         weight)
+{
+  TrieNode *node = root;
+
+  for (const char *p = name; *p; p++) {
+    TrieNode *child = trie_node_get_child (node, *p);
+
+    if (!child) {
+      child = g_new0 (TrieNode, 1);
+      child->c = *p;
+      child->next = node->children;
+      node->children = child;
+    }
+
+    node = child;
+  }
+
+  node->weight += weight;
+  weight = node->weight;
+
+  node = root;
+  for (const char *p = name;; p++) {
+    node->max_weight = MAX (node->max_weight, weight);
+    if (!*p)
+      break;
+
+    node = trie_node_get_child (node, *p);
+  }
+}
+
+/* Adds @weight to the host name of @url and to its base domain. Returns the
+ * number of names this inserted into the trie. */
+static guint
+trie_add_url (TrieNode   *root,
+              const char *url,
+              int         weight)
+{
+  g_autoptr (GUri) uri = NULL;
+  g_autofree char *hostname = NULL;
+  g_autofree char *base_domain = NULL;
+
+  /* Skips the pseudo hosts of local files and other schemes too. */
+  if (weight <= 0 || !url || !g_str_has_prefix (url, "http"))
+    return 0;
+
+  uri = g_uri_parse (url, G_URI_FLAGS_PARSE_RELAXED, NULL);
+  if (!uri || !g_uri_get_host (uri))
+    return 0;
+
+  hostname = g_ascii_strdown (g_uri_get_host (uri), -1);
+  trie_insert (root, hostname, weight);
+
+  base_domain = ephy_uri_get_base_domain (hostname);
+  if (!base_domain || strcmp (base_domain, hostname) == 0)
+    return 1;
+
+  trie_insert (root, base_domain, weight);
+  return 2;
+}
+
+static void ephy_host_trie_load (EphyHostTrie *self);
+
+static void
+hosts_loaded_cb (EphyHistoryService *service,
+                 gboolean            success,
+                 gpointer            result_data,
+                 gpointer            user_data)
+{
+  EphyHostTrie *self = EPHY_HOST_TRIE (user_data);
+  GList *hosts = result_data;
+
+  self->loading = FALSE;
+
+  if (success) {
+    TrieNode *root = g_new0 (TrieNode, 1);
+    guint n_names = 0;
+
+    for (GList *l = hosts; l; l = l->next) {
+      EphyHistoryHost *host = l->data;
+
+      n_names += trie_add_url (root, host->url, host->visit_count);
+    }
+
+    g_clear_pointer (&self->root, trie_node_free);
+    self->root = root;
+
+    LOG ("Host trie loaded with %u names", n_names);
+  }
+
+  if (self->dirty)
+    ephy_host_trie_load (self);
+}
+
+static void
+ephy_host_trie_load (EphyHostTrie *self)
+{
+  if (self->loading) {
+    self->dirty = TRUE;
+    return;
+  }
+
+  self->loading = TRUE;
+  self->dirty = FALSE;
+
+  ephy_history_service_get_hosts (self->history_service,
+                                  self->cancellable,
+                                  (EphyHistoryJobCallback)hosts_loaded_cb,
+                                  self);
+}
+
+static void
+history_urls_visited_cb (EphyHostTrie  *self,
+                         char         **urls)
+{
+  /* The load in progress may or may not include these visits. */
+  if (self->loading) {
+    self->dirty = TRUE;
+    return;
+  }
+
+  for (guint i = 0; urls[i]; i++)
+    ephy_host_trie_add_visits (self, urls[i], 1);
+}
+
+static void
+history_cleared_cb (EphyHostTrie *self)
+{
+  g_clear_pointer (&self->root, trie_node_free);
+
+  /* A load in progress may still return the old hosts. */
+  if (self->loading)
+    self->dirty = TRUE;
+}
+
+static void
+ephy_host_trie_set_property (GObject      *object,
+                             guint         prop_id,
+                             const GValue *value,
+                             GParamSpec   *pspec)
+{
+  EphyHostTrie *self = EPHY_HOST_TRIE (object);
+
+  switch (prop_id) {
+    case PROP_HISTORY_SERVICE:
+      self->history_service = g_value_dup_object (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+ephy_host_trie_constructed (GObject *object)
+{
+  EphyHostTrie *self = EPHY_HOST_TRIE (object);
+
+  G_OBJECT_CLASS (ephy_host_trie_parent_class)->constructed (object);
+
+  if (!self->history_service)
+    return;
+
+  /* Visits add to the weights, deletions need the trie to be rebuilt. */
+  g_signal_connect_object (self->history_service, "urls-visited",
+                           G_CALLBACK (history_urls_visited_cb), self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->history_service, "url-deleted",
+                           G_CALLBACK (ephy_host_trie_load), self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->history_service, "host-deleted",
+                           G_CALLBACK (ephy_host_trie_load), self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->history_service, "cleared",
+                           G_CALLBACK (history_cleared_cb), self, G_CONNECT_SWAPPED);
+
+  ephy_host_trie_load (self);
+}
+
+static void
+ephy_host_trie_dispose (GObject *object)
+{
+  EphyHostTrie *self = EPHY_HOST_TRIE (object);
+
+  g_cancellable_cancel (self->cancellable);
+  g_clear_object (&self->cancellable);
+  g_clear_object (&self->history_service);
+
+  G_OBJECT_CLASS (ephy_host_trie_parent_class)->dispose (object);
+}
+
+static void
+ephy_host_trie_finalize (GObject *object)
+{
+  EphyHostTrie *self = EPHY_HOST_TRIE (object);
+
+  g_clear_pointer (&self->root, trie_node_free);
+
+  G_OBJECT_CLASS (ephy_host_trie_parent_class)->finalize (object);
+}
+
+static void
+ephy_host_trie_class_init (EphyHostTrieClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->set_property = ephy_host_trie_set_property;
+  object_class->constructed = ephy_host_trie_constructed;
+  object_class->dispose = ephy_host_trie_dispose;
+  object_class->finalize = ephy_host_trie_finalize;
+
+  obj_properties[PROP_HISTORY_SERVICE] =
+    g_param_spec_object ("history-service",
+                         NULL, NULL,
+                         EPHY_TYPE_HISTORY_SERVICE,
+                         G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, LAST_PROP, obj_properties);
+}
+
+static void
+ephy_host_trie_init (EphyHostTrie *self)
+{
+  self->cancellable = g_cancellable_new ();
+}
+
+/**
+ * ephy_host_trie_new:
+ * @history_service: (nullable): the history to load the trie from
+ *
+ * Creates a trie of the hosts of @history_service, kept up to date with
+ * its changes. Without @history_service, the trie starts empty and is only
+ * filled by ephy_host_trie_add_visits().
+ *
+ * Returns: (transfer full): a new #EphyHostTrie
+ **/
+EphyHostTrie *
+ephy_host_trie_new (EphyHistoryService *history_service)
+{
+  return g_object_new (EPHY_TYPE_HOST_TRIE,
+                       "history-service", history_service,
+                       NULL);
+}
+
+/**
+ * ephy_host_trie_add_visits:
+ * @self: an #EphyHostTrie
+ * @url: a visited URL
+ * @n_visits: the number of visits to @url
+ *
+ * Adds @n_visits to the weight of the host name of @url and of its base
+ * domain. URLs with a scheme other than http or https are ignored.
+ **/
+void
+ephy_host_trie_add_visits (EphyHostTrie *self,
+                           const char   *url,
+                           int           n_visits)
+{
+  g_assert (EPHY_IS_HOST_TRIE (self));
+
+  if (!self->root)
+    self->root = g_new0 (TrieNode, 1);
+
+  trie_add_url (self->root, url, n_visits);
+}
+
+/**
+ * ephy_host_trie_complete:
+ * @self: an #EphyHostTrie
+ * @prefix: the text typed so far, optionally starting with an http or https
+ *   scheme
+ *
+ * Finds the most visited host name or base domain starting with @prefix.
+ *
+ * Returns: (transfer full) (nullable): @prefix followed by the rest of the
+ *   name, or %NULL if no name longer than @prefix matches
+ **/
+char *
+ephy_host_trie_complete (EphyHostTrie *self,
+                         const char   *prefix)
+{
+  TrieNode *node = self->root;
+  const char *name = prefix;
+  GString *completion;
+
+  g_assert (EPHY_IS_HOST_TRIE (self));
+
+  if (!node)
+    return NULL;
+
+  if (g_str_has_prefix (name, "http://"))
+    name += strlen ("http://");
+  else if (g_str_has_prefix (name, "https://"))
+    name += strlen ("https://");
+
+  if (!*name)
+    return NULL;
+
+  for (const char *p = name; *p && node; p++)
+    node = trie_node_get_child (node, g_ascii_tolower (*p));
+
+  if (!node || node->weight == node->max_weight)
+    return NULL;
+
+  completion = g_string_new (prefix);
+
+  while (node->weight < node->max_weight) {
+    TrieNode *best = node->children;
+
+    for (TrieNode *child = node->children; child; child = child->next) {
+      if (child->max_weight > best->max_weight)
+        best = child;
+    }
+
+    g_string_append_c (completion, best->c);
+    node = best;
+  }
+
+  return g_string_free (completion, FALSE);
+}
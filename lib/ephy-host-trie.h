@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-history-service.h"
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_HOST_TRIE (ephy_host_trie_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphyHostTrie, ephy_host_trie, EPHY, HOST_TRIE, GObject)
+
+EphyHostTrie *ephy_host_trie_new        (EphyHistoryService *history_service);
+
+void          ephy_host_trie_add_visits (EphyHostTrie       *self,
+                                         const char         *url,
+                                         int                 n_visits);
+
+char         *ephy_host_trie_complete   (EphyHostTrie       *self,
+                                         const char         *prefix);
+
+G_END_DECLS
@@ -165,6 +165,7 @@ static const char * const ephy_prefs_web_schema[] = {
 #define EPHY_PREFS_ACTIVE_CLEAR_DATA_ITEMS            "active-clear-data-items"
 #define EPHY_PREFS_INCOGNITO_SEARCH_ENGINE            "incognito-search-engine"
 #define EPHY_PREFS_USE_SEARCH_SUGGESTIONS             "use-search-suggestions"
+#define EPHY_PREFS_TAB_DISCARD_TIMEOUT                "tab-discard-timeout"
 
 #define EPHY_PREFS_LOCKDOWN_SCHEMA            "org.gnome.Pafari.lockdown"
 #define EPHY_PREFS_LOCKDOWN_FULLSCREEN        "disable-fullscreen"
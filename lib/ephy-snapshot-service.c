@@ -21,6 +21,7 @@
 #include "config.h"
 #include "ephy-snapshot-service.h"
 
+#include "ephy-debug.h"
 #include "ephy-file-helpers.h"
 #include "ephy-pixbuf-utils.h"
 
@@ -32,12 +33,37 @@
 #include <unistd.h>
 #include <webkit/webkit.h>
 
+#define THUMBNAIL_INDEX_FILE "index"
+#define THUMBNAIL_INDEX_VARIANT_TYPE "a(sxu)"
+#define THUMBNAIL_INDEX_SAVE_DELAY 1000
+
 struct _EphySnapshotService {
   GObject parent_instance;
 
   GHashTable *cache;
+
+  /* Thumbnails on disk by URL hash, so that checking whether a URL has a
+   * thumbnail is a lookup instead of a thread decoding the file. Loaded from
+   * a memory-mapped index file at startup, or built by scanning the thumbnail
+   * directory when there is no index yet. The index is only a hint: a URL
+   * missing from it is still checked on disk.
+   */
+  GHashTable *index;
+  GCancellable *index_cancellable;
+  guint index_save_source_id;
+  gboolean index_saving;
+  gboolean index_save_pending;
+
+  /* Bumped by every change of the index, and the last one written to disk,
+   * so that a save never overwrites a newer index or a deleted one.
+   */
+  guint64 index_generation;
+  guint64 index_written;
+  GMutex index_write_mutex;
 };
 
+static EphySnapshotService *default_service;
+
 G_DEFINE_FINAL_TYPE (EphySnapshotService, ephy_snapshot_service, G_TYPE_OBJECT)
 
 typedef enum {
@@ -50,6 +76,11 @@ typedef struct {
   EphySnapshotFreshness freshness;
 } SnapshotPathCachedData;
 
+typedef struct {
+  gint64 mtime;
+  guint32 size;
+} ThumbnailIndexEntry;
+
 static void
 snapshot_path_cached_data_free (SnapshotPathCachedData *data)
 {
@@ -57,9 +88,55 @@ snapshot_path_cached_data_free (SnapshotPathCachedData *data)
   g_free (data);
 }
 
+static ThumbnailIndexEntry *
+thumbnail_index_entry_new (gint64  mtime,
+                           guint32 size)
+{
+  ThumbnailIndexEntry *entry;
+
+  entry = g_new (ThumbnailIndexEntry, 1);
+  entry->mtime = mtime;
+  entry->size = size;
+
+  return entry;
+}
+
+static void load_thumbnail_index (EphySnapshotService *self);
+static void flush_thumbnail_index (EphySnapshotService *self);
+
+static void
+ephy_snapshot_service_dispose (GObject *object)
+{
+  EphySnapshotService *self = EPHY_SNAPSHOT_SERVICE (object);
+
+  if (self->index_cancellable) {
+    flush_thumbnail_index (self);
+    g_cancellable_cancel (self->index_cancellable);
+    g_clear_object (&self->index_cancellable);
+  }
+
+  G_OBJECT_CLASS (ephy_snapshot_service_parent_class)->dispose (object);
+}
+
+static void
+ephy_snapshot_service_finalize (GObject *object)
+{
+  EphySnapshotService *self = EPHY_SNAPSHOT_SERVICE (object);
+
+  g_hash_table_unref (self->cache);
+  g_hash_table_unref (self->index);
+  g_mutex_clear (&self->index_write_mutex);
+
+  G_OBJECT_CLASS (ephy_snapshot_service_parent_class)->finalize (object);
+}
+
 static void
 ephy_snapshot_service_class_init (EphySnapshotServiceClass *klass)
 {
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_snapshot_service_dispose;
+  object_class->finalize = ephy_snapshot_service_finalize;
 }
 
 static void
@@ -68,27 +145,25 @@ ephy_snapshot_service_init (EphySnapshotService *self)
   self->cache = g_hash_table_new_full (g_str_hash, g_str_equal,
                                        (GDestroyNotify)g_free,
                                        (GDestroyNotify)snapshot_path_cached_data_free);
+  self->index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->index_cancellable = g_cancellable_new ();
+  g_mutex_init (&self->index_write_mutex);
+
+  load_thumbnail_index (self);
 }
 
 static char *
-thumbnail_filename (const char *uri)
+thumbnail_hash (const char *uri)
 {
-  GChecksum *checksum;
-  guint8 digest[16];
-  gsize digest_len = sizeof (digest);
-  char *file;
-
-  checksum = g_checksum_new (G_CHECKSUM_MD5);
-  g_checksum_update (checksum, (const guchar *)uri, strlen (uri));
-
-  g_checksum_get_digest (checksum, digest, &digest_len);
-  g_assert (digest_len == 16);
-
-  file = g_strconcat (g_checksum_get_string (checksum), ".jpg", NULL);
+  return g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
+}
 
-  g_checksum_free (checksum);
+static char *
+thumbnail_filename (const char *uri)
+{
+  g_autofree char *hash = thumbnail_hash (uri);
 
-  return file;
+  return g_strconcat (hash, ".jpg", NULL);
 }
 
 static char *
@@ -114,6 +189,306 @@ thumbnail_path (const char *uri)
   return path;
 }
 
+static char *
+thumbnail_index_path (void)
+{
+  g_autofree char *dir = thumbnail_directory ();
+
+  return g_build_filename (dir, THUMBNAIL_INDEX_FILE, NULL);
+}
+
+static GVariant *
+thumbnail_index_to_variant (EphySnapshotService *self)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  const char *hash;
+  ThumbnailIndexEntry *entry;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE (THUMBNAIL_INDEX_VARIANT_TYPE));
+
+  g_hash_table_iter_init (&iter, self->index);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&hash, (gpointer *)&entry))
+    g_variant_builder_add (&builder, "(sxu)", hash, entry->mtime, entry->size);
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+typedef struct {
+  GVariant *variant;
+  guint64 generation;
+} ThumbnailIndexSaveData;
+
+static void
+thumbnail_index_save_data_free (ThumbnailIndexSaveData *data)
+{
+  g_variant_unref (data->variant);
+  g_free (data);
+}
+
+/* Can be called from any thread. */
+static gboolean
+write_thumbnail_index (EphySnapshotService  *self,
+                       GVariant             *variant,
+                       guint64               generation,
+                       GError              **error)
+{
+  g_autofree char *path = thumbnail_index_path ();
+  gboolean ret = TRUE;
+
+  g_mutex_lock (&self->index_write_mutex);
+  if (generation > self->index_written) {
+    ret = g_file_set_contents (path,
+                               g_variant_get_data (variant),
+                               g_variant_get_size (variant),
+                               error);
+    if (ret)
+      self->index_written = generation;
+  }
+  g_mutex_unlock (&self->index_write_mutex);
+
+  return ret;
+}
+
+static void
+save_thumbnail_index_thread (GTask                  *task,
+                             EphySnapshotService    *self,
+                             ThumbnailIndexSaveData *data,
+                             GCancellable           *cancellable)
+{
+  GError *error = NULL;
+
+  if (!write_thumbnail_index (self, data->variant, data->generation, &error)) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void schedule_thumbnail_index_save (EphySnapshotService *self);
+
+static void
+save_thumbnail_index_cb (EphySnapshotService *self,
+                         GAsyncResult        *result,
+                         gpointer             user_data)
+{
+  g_autoptr (GError) error = NULL;
+
+  /* The thumbnail directory is only created with the first thumbnail. */
+  if (!g_task_propagate_boolean (G_TASK (result), &error) &&
+      !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+    g_warning ("Failed to save thumbnail index: %s", error->message);
+
+  self->index_saving = FALSE;
+  if (self->index_save_pending) {
+    self->index_save_pending = FALSE;
+    schedule_thumbnail_index_save (self);
+  }
+}
+
+static void
+save_thumbnail_index_timeout_cb (gpointer user_data)
+{
+  EphySnapshotService *self = EPHY_SNAPSHOT_SERVICE (user_data);
+  ThumbnailIndexSaveData *data;
+  GTask *task;
+
+  self->index_save_source_id = 0;
+
+  /* Writes must land in order, so wait for the one in flight. */
+  if (self->index_saving) {
+    self->index_save_pending = TRUE;
+    return;
+  }
+
+  self->index_saving = TRUE;
+
+  data = g_new (ThumbnailIndexSaveData, 1);
+  data->variant = thumbnail_index_to_variant (self);
+  data->generation = self->index_generation;
+
+  task = g_task_new (self, NULL, (GAsyncReadyCallback)save_thumbnail_index_cb, NULL);
+  g_task_set_priority (task, G_PRIORITY_LOW);
+  g_task_set_task_data (task, data, (GDestroyNotify)thumbnail_index_save_data_free);
+  g_task_run_in_thread (task, (GTaskThreadFunc)save_thumbnail_index_thread);
+  g_object_unref (task);
+}
+
+static void
+schedule_thumbnail_index_save (EphySnapshotService *self)
+{
+  if (self->index_save_source_id)
+    return;
+
+  self->index_save_source_id = g_timeout_add_once (THUMBNAIL_INDEX_SAVE_DELAY, save_thumbnail_index_timeout_cb, self);
+  g_source_set_name_by_id (self->index_save_source_id, "[epiphany] save_thumbnail_index_timeout_cb");
+}
+
+static void
+thumbnail_index_changed (EphySnapshotService *self)
+{
+  self->index_generation++;
+  schedule_thumbnail_index_save (self);
+}
+
+/* Writes the index right away if it has unsaved changes, e.g. on shutdown. */
+static void
+flush_thumbnail_index (EphySnapshotService *self)
+{
+  g_autoptr (GVariant) variant = NULL;
+  g_autoptr (GError) error = NULL;
+  gboolean written;
+
+  g_clear_handle_id (&self->index_save_source_id, g_source_remove);
+  self->index_save_pending = FALSE;
+
+  g_mutex_lock (&self->index_write_mutex);
+  written = self->index_written >= self->index_generation;
+  g_mutex_unlock (&self->index_write_mutex);
+  if (written)
+    return;
+
+  variant = thumbnail_index_to_variant (self);
+  if (!write_thumbnail_index (self, variant, self->index_generation, &error) &&
+      !g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+    g_warning ("Failed to save thumbnail index: %s", error->message);
+}
+
+static void
+thumbnail_index_add (EphySnapshotService *self,
+                     const char          *url,
+                     gint64               mtime,
+                     guint32              size)
+{
+  g_hash_table_replace (self->index, thumbnail_hash (url), thumbnail_index_entry_new (mtime, size));
+  thumbnail_index_changed (self);
+}
+
+static void
+thumbnail_index_remove (EphySnapshotService *self,
+                        const char          *url)
+{
+  g_autofree char *hash = thumbnail_hash (url);
+
+  if (g_hash_table_remove (self->index, hash))
+    thumbnail_index_changed (self);
+}
+
+static gboolean
+thumbnail_index_contains (EphySnapshotService *self,
+                          const char          *url)
+{
+  g_autofree char *hash = thumbnail_hash (url);
+
+  return g_hash_table_contains (self->index, hash);
+}
+
+static void
+scan_thumbnail_directory_thread (GTask        *task,
+                                 gpointer      source_object,
+                                 gpointer      task_data,
+                                 GCancellable *cancellable)
+{
+  g_autofree char *dirname = thumbnail_directory ();
+  g_autoptr (GDir) dir = NULL;
+  GHashTable *index;
+  const char *name;
+
+  index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  dir = g_dir_open (dirname, 0, NULL);
+  while (dir && (name = g_dir_read_name (dir))) {
+    g_autofree char *path = NULL;
+    struct stat st;
+
+    if (g_task_return_error_if_cancelled (task)) {
+      g_hash_table_unref (index);
+      return;
+    }
+
+    /* 32 hex digits of MD5 followed by ".jpg" */
+    if (strlen (name) != 36 || !g_str_has_suffix (name, ".jpg"))
+      continue;
+
+    path = g_build_filename (dirname, name, NULL);
+    if (stat (path, &st) != 0 || st.st_size == 0)
+      continue;
+
+    g_hash_table_insert (index,
+                         g_strndup (name, 32),
+                         thumbnail_index_entry_new (st.st_mtime, st.st_size));
+  }
+
+  g_task_return_pointer (task, index, (GDestroyNotify)g_hash_table_unref);
+}
+
+static void
+scan_thumbnail_directory_cb (EphySnapshotService *self,
+                             GAsyncResult        *result,
+                             gpointer             user_data)
+{
+  g_autoptr (GHashTable) index = NULL;
+  GHashTableIter iter;
+  char *hash;
+  ThumbnailIndexEntry *entry;
+
+  index = g_task_propagate_pointer (G_TASK (result), NULL);
+  if (!index)
+    return;
+
+  /* Thumbnails saved during the scan are already in the index. */
+  g_hash_table_iter_init (&iter, index);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&hash, (gpointer *)&entry)) {
+    if (!g_hash_table_contains (self->index, hash)) {
+      g_hash_table_insert (self->index, hash, entry);
+      g_hash_table_iter_steal (&iter);
+    }
+  }
+
+  LOG ("Indexed %u thumbnails", g_hash_table_size (self->index));
+
+  thumbnail_index_changed (self);
+}
+
+static void
+load_thumbnail_index (EphySnapshotService *self)
+{
+  g_autofree char *path = thumbnail_index_path ();
+  g_autoptr (GMappedFile) file = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GVariant) variant = NULL;
+  g_autoptr (GError) error = NULL;
+  GVariantIter iter;
+  const char *hash;
+  gint64 mtime;
+  guint32 size;
+  GTask *task;
+
+  file = g_mapped_file_new (path, FALSE, &error);
+  if (file) {
+    bytes = g_mapped_file_get_bytes (file);
+    variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (THUMBNAIL_INDEX_VARIANT_TYPE),
+                                                            bytes, FALSE));
+    if (g_variant_is_normal_form (variant)) {
+      g_variant_iter_init (&iter, variant);
+      while (g_variant_iter_next (&iter, "(&sxu)", &hash, &mtime, &size))
+        g_hash_table_replace (self->index, g_strdup (hash), thumbnail_index_entry_new (mtime, size));
+
+      return;
+    }
+
+    g_warning ("Thumbnail index %s is corrupted, rebuilding it", path);
+  } else if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+    g_warning ("Failed to load thumbnail index: %s", error->message);
+  }
+
+  task = g_task_new (self, self->index_cancellable, (GAsyncReadyCallback)scan_thumbnail_directory_cb, NULL);
+  g_task_set_priority (task, G_PRIORITY_LOW);
+  g_task_run_in_thread (task, scan_thumbnail_directory_thread);
+  g_object_unref (task);
+}
+
 static gboolean
 save_thumbnail (GdkPixbuf  *pixbuf,
                 const char *uri)
@@ -261,20 +636,28 @@ snapshot_async_data_free (SnapshotAsyncData *data)
 }
 
 typedef struct {
-  GHashTable *cache;
+  EphySnapshotService *service;
   char *url;
   SnapshotPathCachedData *data;
+  struct stat st;
 } CacheData;
 
 static void
 idle_cache_snapshot_path (gpointer user_data)
 {
   CacheData *data = (CacheData *)user_data;
-  g_hash_table_insert (data->cache, data->url, data->data);
-  g_hash_table_unref (data->cache);
+
+  if (data->st.st_size > 0)
+    thumbnail_index_add (data->service, data->url, data->st.st_mtime, data->st.st_size);
+
+  g_hash_table_insert (data->service->cache, data->url, data->data);
+  g_object_unref (data->service);
   g_free (data);
 }
 
+/* Must be called from the thread that wrote or checked the thumbnail: it is
+ * stat()ed here so that the index knows about it without touching the disk.
+ */
 static void
 cache_snapshot_data_in_idle (EphySnapshotService   *service,
                              const char            *url,
@@ -282,12 +665,14 @@ cache_snapshot_data_in_idle (EphySnapshotService   *service,
                              EphySnapshotFreshness  freshness)
 {
   CacheData *data;
-  data = g_new (CacheData, 1);
-  data->cache = g_hash_table_ref (service->cache);
+  data = g_new0 (CacheData, 1);
+  data->service = g_object_ref (service);
   data->url = g_strdup (url);
   data->data = g_new (SnapshotPathCachedData, 1);
   data->data->path = g_strdup (path);
   data->data->freshness = freshness;
+  if (stat (path, &data->st) != 0)
+    data->st.st_size = 0;
   g_idle_add_once (idle_cache_snapshot_path, data);
 }
 
@@ -515,12 +900,27 @@ ephy_snapshot_service_error_quark (void)
 EphySnapshotService *
 ephy_snapshot_service_get_default (void)
 {
-  static EphySnapshotService *service = NULL;
+  if (!default_service)
+    default_service = g_object_new (EPHY_TYPE_SNAPSHOT_SERVICE, NULL);
+
+  return default_service;
+}
 
-  if (!service)
-    service = g_object_new (EPHY_TYPE_SNAPSHOT_SERVICE, NULL);
+/**
+ * ephy_snapshot_service_shutdown:
+ *
+ * Saves the pending changes of the thumbnail index, which are otherwise
+ * written after a delay, and releases the default #EphySnapshotService.
+ **/
+void
+ephy_snapshot_service_shutdown (void)
+{
+  if (!default_service)
+    return;
 
-  return service;
+  /* Tasks still running hold references, do not rely on dispose. */
+  flush_thumbnail_index (default_service);
+  g_clear_object (&default_service);
 }
 
 const char *
@@ -532,6 +932,13 @@ ephy_snapshot_service_lookup_cached_snapshot_path (EphySnapshotService *service,
   g_assert (EPHY_IS_SNAPSHOT_SERVICE (service));
 
   data = g_hash_table_lookup (service->cache, url);
+  if (!data && thumbnail_index_contains (service, url)) {
+    /* Thumbnails from a previous session are stale. */
+    data = g_new (SnapshotPathCachedData, 1);
+    data->path = thumbnail_path (url);
+    data->freshness = SNAPSHOT_STALE;
+    g_hash_table_insert (service->cache, g_strdup (url), data);
+  }
 
   return !data ? NULL : data->path;
 }
@@ -553,19 +960,16 @@ get_snapshot_path_for_url_thread (GTask               *task,
                                   SnapshotAsyncData   *data,
                                   GCancellable        *cancellable)
 {
-  g_autoptr (GdkPixbuf) pixbuf = NULL;
-  g_autoptr (GError) error = NULL;
   char *path;
 
   path = thumbnail_path (data->url);
 
-  pixbuf = gdk_pixbuf_new_from_file (path, &error);
-  if (!pixbuf) {
+  if (!g_file_test (path, G_FILE_TEST_IS_REGULAR)) {
     g_task_return_new_error (task,
                              EPHY_SNAPSHOT_SERVICE_ERROR,
                              EPHY_SNAPSHOT_SERVICE_ERROR_NOT_FOUND,
-                             "Snapshot for url \"%s\" not found in disk cache: %s",
-                             data->url, error->message);
+                             "Snapshot for url \"%s\" not found in disk cache",
+                             data->url);
     g_free (path);
     return;
   }
@@ -597,6 +1001,9 @@ ephy_snapshot_service_get_snapshot_path_for_url_async (EphySnapshotService *serv
     return;
   }
 
+  /* Not in the index: the thumbnail may still have been saved by another
+   * instance, or after the index was last written. Checking the disk adds it.
+   */
   g_task_set_priority (task, G_PRIORITY_LOW);
   g_task_set_task_data (task,
                         snapshot_async_data_new (service, NULL, NULL, url),
@@ -699,30 +1106,20 @@ ephy_snapshot_service_get_snapshot_path_finish (EphySnapshotService  *service,
   return g_task_propagate_pointer (G_TASK (result), error);
 }
 
-static void
-got_snapshot_path_to_delete_cb (EphySnapshotService *service,
-                                GAsyncResult        *result,
-                                gpointer             user_data)
-{
-  char *path;
-
-  path = ephy_snapshot_service_get_snapshot_path_for_url_finish (service, result, NULL);
-  if (path)
-    unlink (path);
-  g_free (path);
-
-  g_object_unref (service);
-}
-
 void
 ephy_snapshot_service_delete_snapshot_for_url (EphySnapshotService *service,
                                                const char          *url)
 {
-  ephy_snapshot_service_get_snapshot_path_for_url_async (g_object_ref (service),
-                                                         url,
-                                                         NULL,
-                                                         (GAsyncReadyCallback)got_snapshot_path_to_delete_cb,
-                                                         NULL);
+  g_autofree char *path = NULL;
+
+  g_assert (EPHY_IS_SNAPSHOT_SERVICE (service));
+
+  /* The path only depends on the URL, so there is nothing to look up. */
+  path = thumbnail_path (url);
+  unlink (path);
+
+  g_hash_table_remove (service->cache, url);
+  thumbnail_index_remove (service, url);
 }
 
 void
@@ -731,6 +1128,23 @@ ephy_snapshot_service_delete_all_snapshots (EphySnapshotService *service)
   GError *error = NULL;
   char *dir;
 
+  g_assert (EPHY_IS_SNAPSHOT_SERVICE (service));
+
+  /* The index file goes away with the directory. Pending saves, including
+   * one already running, must not write it back.
+   */
+  g_cancellable_cancel (service->index_cancellable);
+  g_clear_object (&service->index_cancellable);
+  service->index_cancellable = g_cancellable_new ();
+  g_clear_handle_id (&service->index_save_source_id, g_source_remove);
+  service->index_save_pending = FALSE;
+  g_hash_table_remove_all (service->index);
+  g_hash_table_remove_all (service->cache);
+
+  g_mutex_lock (&service->index_write_mutex);
+  service->index_written = ++service->index_generation;
+  g_mutex_unlock (&service->index_write_mutex);
+
   dir = thumbnail_directory ();
 
   ephy_file_delete_dir_recursively (dir, &error);
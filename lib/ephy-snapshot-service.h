@@ -46,6 +46,8 @@ GQuark               ephy_snapshot_service_error_quark                      (voi
 
 EphySnapshotService *ephy_snapshot_service_get_default                      (void);
 
+void                 ephy_snapshot_service_shutdown                         (void);
+
 const char          *ephy_snapshot_service_lookup_cached_snapshot_path      (EphySnapshotService *service,
                                                                              const char *url);
 
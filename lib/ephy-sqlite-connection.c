@@ -21,6 +21,7 @@
 #include "config.h"
 #include "ephy-sqlite-connection.h"
 
+#include "ephy-debug.h"
 #include "ephy-lib-type-builtins.h"
 
 #include <errno.h>
@@ -35,8 +36,23 @@ struct _EphySQLiteConnection {
   EphySQLiteConnectionMode mode;
 
   EphySQLiteStatement *connection_table_exists_statement;
+
+  /* Maps SQL strings to links in statement_cache_lru, most recently used first. */
+  GHashTable *statement_cache;
+  GQueue statement_cache_lru;
+  guint statement_cache_hits;
+  guint statement_cache_misses;
 };
 
+/* Dynamically built queries only come in a handful of shapes, so a small
+ * cache is enough to skip parsing and planning most of them. */
+#define STATEMENT_CACHE_SIZE 32
+
+typedef struct {
+  char *sql;
+  EphySQLiteStatement *statement;
+} CachedStatement;
+
 G_DEFINE_FINAL_TYPE (EphySQLiteConnection, ephy_sqlite_connection, G_TYPE_OBJECT);
 
 enum {
@@ -53,8 +69,9 @@ ephy_sqlite_connection_finalize (GObject *object)
 {
   EphySQLiteConnection *self = EPHY_SQLITE_CONNECTION (object);
   g_clear_object (&self->connection_table_exists_statement);
-  g_free (EPHY_SQLITE_CONNECTION (self)->database_path);
   ephy_sqlite_connection_close (EPHY_SQLITE_CONNECTION (self));
+  g_free (EPHY_SQLITE_CONNECTION (self)->database_path);
+  g_hash_table_unref (self->statement_cache);
   G_OBJECT_CLASS (ephy_sqlite_connection_parent_class)->finalize (object);
 }
 
@@ -107,6 +124,34 @@ static void
 ephy_sqlite_connection_init (EphySQLiteConnection *self)
 {
   self->database = NULL;
+  self->statement_cache = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&self->statement_cache_lru);
+}
+
+static void
+cached_statement_free (CachedStatement *cached)
+{
+  g_free (cached->sql);
+  g_object_unref (cached->statement);
+  g_free (cached);
+}
+
+static void
+ephy_sqlite_connection_clear_statement_cache (EphySQLiteConnection *self)
+{
+  guint total = self->statement_cache_hits + self->statement_cache_misses;
+
+  if (total > 0) {
+    g_autofree char *basename = g_path_get_basename (self->database_path);
+    g_autofree char *name = g_strdup_printf ("Statement cache hit rate for %s", basename);
+
+    LOG ("Statement cache for %s: %u hits, %u misses",
+         self->database_path, self->statement_cache_hits, self->statement_cache_misses);
+    PROFILER_COUNTER (name, 100.0 * self->statement_cache_hits / total)
+  }
+
+  g_hash_table_remove_all (self->statement_cache);
+  g_queue_clear_full (&self->statement_cache_lru, (GDestroyNotify)cached_statement_free);
 }
 
 GQuark
@@ -137,16 +182,27 @@ gboolean
 ephy_sqlite_connection_open (EphySQLiteConnection  *self,
                              GError               **error)
 {
+  int flags;
+
   if (self->database) {
     set_error_from_string ("Connection already open.", error);
     return FALSE;
   }
 
-  if (sqlite3_open_v2 (self->database_path,
-                       &self->database,
-                       self->mode == EPHY_SQLITE_CONNECTION_MODE_MEMORY ? SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_MEMORY
-                                                                        : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
-                       NULL) != SQLITE_OK) {
+  switch (self->mode) {
+    case EPHY_SQLITE_CONNECTION_MODE_MEMORY:
+      flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_MEMORY;
+      break;
+    case EPHY_SQLITE_CONNECTION_MODE_READ_ONLY:
+      flags = SQLITE_OPEN_READONLY;
+      break;
+    case EPHY_SQLITE_CONNECTION_MODE_READWRITE:
+    default:
+      flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+      break;
+  }
+
+  if (sqlite3_open_v2 (self->database_path, &self->database, flags, NULL) != SQLITE_OK) {
     ephy_sqlite_connection_get_error (self, error);
     ephy_sqlite_connection_close (self);
     return FALSE;
@@ -171,6 +227,10 @@ ephy_sqlite_connection_open (EphySQLiteConnection  *self,
     }
 
     sqlite3_close (init_db);
+  } else if (self->mode == EPHY_SQLITE_CONNECTION_MODE_READ_ONLY) {
+    /* The journal mode is persistent, so this relies on a read/write
+     * connection having switched the database to WAL already. */
+    ephy_sqlite_connection_execute (self, "PRAGMA main.cache_size=10000", error);
   } else {
     ephy_sqlite_connection_execute (self, "PRAGMA main.journal_mode=WAL", error);
     ephy_sqlite_connection_execute (self, "PRAGMA main.synchronous=NORMAL", error);
@@ -183,6 +243,10 @@ ephy_sqlite_connection_open (EphySQLiteConnection  *self,
 void
 ephy_sqlite_connection_close (EphySQLiteConnection *self)
 {
+  /* Cached statements keep the connection alive, and must be finalized
+   * before the database can be closed. */
+  ephy_sqlite_connection_clear_statement_cache (self);
+
   if (self->database) {
     sqlite3_close (self->database);
     self->database = NULL;
@@ -257,6 +321,57 @@ ephy_sqlite_connection_create_statement (EphySQLiteConnection  *self,
                                               NULL));
 }
 
+/**
+ * ephy_sqlite_connection_get_cached_statement:
+ *
+ * Like ephy_sqlite_connection_create_statement(), but keeps the most
+ * recently used statements around, reset and ready to be bound again.
+ * Intended for queries built at runtime that are often repeated with
+ * different values. The returned statement must not be kept once the
+ * results have been read.
+ *
+ * Returns: (transfer full): the statement, or %NULL on error
+ */
+EphySQLiteStatement *
+ephy_sqlite_connection_get_cached_statement (EphySQLiteConnection  *self,
+                                             const char            *sql,
+                                             GError               **error)
+{
+  EphySQLiteStatement *statement;
+  CachedStatement *cached;
+  GList *link;
+
+  link = g_hash_table_lookup (self->statement_cache, sql);
+  if (link) {
+    self->statement_cache_hits++;
+    g_queue_unlink (&self->statement_cache_lru, link);
+    g_queue_push_head_link (&self->statement_cache_lru, link);
+
+    cached = link->data;
+    ephy_sqlite_statement_reset (cached->statement);
+    return g_object_ref (cached->statement);
+  }
+
+  self->statement_cache_misses++;
+  statement = ephy_sqlite_connection_create_statement (self, sql, error);
+  if (!statement)
+    return NULL;
+
+  if (self->statement_cache_lru.length >= STATEMENT_CACHE_SIZE) {
+    cached = g_queue_pop_tail (&self->statement_cache_lru);
+    g_hash_table_remove (self->statement_cache, cached->sql);
+    cached_statement_free (cached);
+  }
+
+  cached = g_new (CachedStatement, 1);
+  cached->sql = g_strdup (sql);
+  cached->statement = g_object_ref (statement);
+  g_queue_push_head (&self->statement_cache_lru, cached);
+  g_hash_table_insert (self->statement_cache, cached->sql, self->statement_cache_lru.head);
+
+  return statement;
+}
+
 gint64
 ephy_sqlite_connection_get_last_insert_id (EphySQLiteConnection *self)
 {
@@ -33,7 +33,8 @@ G_DECLARE_FINAL_TYPE (EphySQLiteConnection, ephy_sqlite_connection, EPHY, SQLITE
 
 typedef enum {
   EPHY_SQLITE_CONNECTION_MODE_MEMORY,
-  EPHY_SQLITE_CONNECTION_MODE_READWRITE
+  EPHY_SQLITE_CONNECTION_MODE_READWRITE,
+  EPHY_SQLITE_CONNECTION_MODE_READ_ONLY
 } EphySQLiteConnectionMode;
 
 EphySQLiteConnection *  ephy_sqlite_connection_new                     (EphySQLiteConnectionMode  mode, const char *database_path);
@@ -46,6 +47,7 @@ void                    ephy_sqlite_connection_get_error               (EphySQLi
 
 gboolean                ephy_sqlite_connection_execute                 (EphySQLiteConnection *self, const char *sql, GError **error);
 EphySQLiteStatement *   ephy_sqlite_connection_create_statement        (EphySQLiteConnection *self, const char *sql, GError **error);
+EphySQLiteStatement *   ephy_sqlite_connection_get_cached_statement    (EphySQLiteConnection *self, const char *sql, GError **error);
 gint64                  ephy_sqlite_connection_get_last_insert_id      (EphySQLiteConnection *self);
 void                    ephy_sqlite_connection_enable_foreign_keys     (EphySQLiteConnection *self);
 
@@ -23,6 +23,7 @@
 
 #include "ephy-sqlite-connection.h"
 #include <sqlite3.h>
+#include <string.h>
 
 enum {
   PROP_0,
@@ -298,14 +299,45 @@ ephy_sqlite_statement_get_column_as_blob (EphySQLiteStatement *self,
   return sqlite3_column_blob (self->prepared_statement, column);
 }
 
+/* Copies at most max_bytes bytes of a UTF-8 string, without splitting
+ * its last character. */
+static char *
+utf8_strndup (const char *string,
+              gsize       max_bytes)
+{
+  const char *end;
+
+  if (strlen (string) <= max_bytes)
+    return g_strdup (string);
+
+  end = g_utf8_find_prev_char (string, string + max_bytes + 1);
+  return g_strndup (string, end ? end - string : 0);
+}
+
 char *
 ephy_sqlite_create_match_pattern (const char *match_string)
 {
   char *string, *pattern;
 
-  string = g_strndup (match_string, EPHY_SQLITE_LIMIT_LIKE_PATTERN_LENGTH - 2);
+  string = utf8_strndup (match_string, EPHY_SQLITE_LIMIT_LIKE_PATTERN_LENGTH - 2);
   pattern = g_strdup_printf ("%%:%%%s%%", string);
   g_free (string);
 
   return pattern;
 }
+
+char *
+ephy_sqlite_create_fts_match_pattern (const char *match_string)
+{
+  g_autofree char *string = NULL;
+  g_auto (GStrv) parts = NULL;
+  g_autofree char *escaped = NULL;
+
+  /* Quote the string as a single FTS5 phrase, so that none of its
+   * characters are interpreted as query syntax. */
+  string = utf8_strndup (match_string, EPHY_SQLITE_LIMIT_LIKE_PATTERN_LENGTH - 2);
+  parts = g_strsplit (string, "\"", -1);
+  escaped = g_strjoinv ("\"\"", parts);
+
+  return g_strdup_printf ("\"%s\"", escaped);
+}
@@ -36,6 +36,9 @@ const SecretSchema *ephy_sync_utils_get_secret_schema (void) G_GNUC_CONST;
 
 #define EPHY_SYNC_BATCH_SIZE    80
 #define EPHY_SYNC_MAX_BATCHES   80
+#define EPHY_SYNC_PAGE_SIZE     1000
+
+#define EPHY_SYNC_MAX_COLLECTION_RESTARTS 3
 
 char     *ephy_sync_utils_encode_hex                    (const guint8 *data,
                                                          gsize         data_len);
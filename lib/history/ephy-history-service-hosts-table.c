@@ -231,8 +231,9 @@ ephy_history_service_get_all_hosts (EphyHistoryService *self)
 }
 
 GList *
-ephy_history_service_find_host_rows (EphyHistoryService *self,
-                                     EphyHistoryQuery   *query)
+ephy_history_service_find_host_rows (EphyHistoryService   *self,
+                                     EphySQLiteConnection *connection,
+                                     EphyHistoryQuery     *query)
 {
   EphySQLiteStatement *statement = NULL;
   GList *substring;
@@ -251,8 +252,7 @@ ephy_history_service_find_host_rows (EphyHistoryService *self,
 
   int i = 0;
 
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database);
+  g_assert (connection);
 
   statement_str = g_string_new (base_statement);
 
@@ -277,8 +277,8 @@ ephy_history_service_find_host_rows (EphyHistoryService *self,
 
   statement_str = g_string_append (statement_str, "1 ");
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
-                                                       statement_str->str, &error);
+  statement = ephy_sqlite_connection_get_cached_statement (connection,
+                                                           statement_str->str, &error);
   g_string_free (statement_str, TRUE);
 
   if (error) {
@@ -423,6 +423,8 @@ ephy_history_service_delete_host_row (EphyHistoryService *self,
 
   g_assert (host->id != -1 || host->url);
 
+  ephy_history_service_delete_url_fts_rows_for_host (self, host);
+
   if (host->id != -1) {
     statement = ephy_history_service_get_cached_statement (self, EPHY_HISTORY_STATEMENT_DELETE_HOST_ROW_FOR_ID, &error);
   } else {
@@ -44,7 +44,14 @@ typedef enum {
 
   /* visits table */
   EPHY_HISTORY_STATEMENT_ADD_VISIT_ROW,
-  
+
+  /* urls_fts table */
+  EPHY_HISTORY_STATEMENT_ADD_URL_FTS_ROW,
+  EPHY_HISTORY_STATEMENT_UPDATE_URL_FTS_ROW,
+  EPHY_HISTORY_STATEMENT_DELETE_URL_FTS_FOR_ID,
+  EPHY_HISTORY_STATEMENT_DELETE_URL_FTS_FOR_URL,
+  EPHY_HISTORY_STATEMENT_DELETE_URL_FTS_FOR_HOST,
+
   EPHY_HISTORY_STATEMENT_LEN,
 } EphyHistoryServiceStatement;
 
@@ -59,8 +66,28 @@ struct _EphyHistoryService {
   GAsyncQueue *queue;
   gboolean scheduled_to_quit;
   gboolean in_memory;
+  gboolean urls_fts_enabled;
   int queue_urls_visited_id;
+  GPtrArray *visited_urls;
   EphySQLiteStatement **statements;
+  GThreadPool *reader_pool;
+  GAsyncQueue *readers;
+  int readers_quitting;
+  int database_generation;
+  GMutex writes_mutex;
+  GCond writes_cond;
+  guint64 writes_queued;
+  guint64 writes_done;
+  gboolean commit_requested;
+  GHashTable *pending_writes;
+  GMutex pending_writes_mutex;
+  GPtrArray *batch;
+  gint64 batch_start_time;
+  GMutex top_sites_mutex;
+  GPtrArray *top_sites;
+  guint top_sites_size;
+  gboolean top_sites_loaded;
+  int top_sites_changed_queued;
 };
 
 EphySQLiteStatement *    ephy_history_service_get_cached_statement    (EphyHistoryService *self, EphyHistoryServiceStatement stmt, GError **error);
@@ -68,19 +95,27 @@ gboolean                 ephy_history_service_initialize_urls_table   (EphyHisto
 EphyHistoryURL *         ephy_history_service_get_url_row             (EphyHistoryService *self, const char *url_string, EphyHistoryURL *url);
 void                     ephy_history_service_add_url_row             (EphyHistoryService *self, EphyHistoryURL *url);
 void                     ephy_history_service_update_url_row          (EphyHistoryService *self, EphyHistoryURL *url);
-GList*                   ephy_history_service_find_url_rows           (EphyHistoryService *self, EphyHistoryQuery *query);
+GList*                   ephy_history_service_find_url_rows           (EphyHistoryService *self, EphySQLiteConnection *connection, EphyHistoryQuery *query);
 void                     ephy_history_service_delete_url              (EphyHistoryService *self, EphyHistoryURL *url);
 
+gboolean                 ephy_history_service_initialize_urls_fts_table (EphyHistoryService *self);
+gboolean                 ephy_history_service_can_use_urls_fts        (EphyHistoryService *self, const char *substring);
+gboolean                 ephy_history_service_url_is_remote           (const char *url);
+int                      ephy_history_service_compare_most_visited    (const EphyHistoryURL *a, const EphyHistoryURL *b);
+void                     ephy_history_service_append_substring_clauses (EphyHistoryService *self, GString *statement_str, GList *substring_list);
+gboolean                 ephy_history_service_bind_substrings         (EphyHistoryService *self, EphySQLiteStatement *statement, GList *substring_list, int *column, GError **error);
+void                     ephy_history_service_delete_url_fts_rows_for_host (EphyHistoryService *self, EphyHistoryHost *host);
+
 gboolean                 ephy_history_service_initialize_visits_table (EphyHistoryService *self);
 void                     ephy_history_service_add_visit_row           (EphyHistoryService *self, EphyHistoryPageVisit *visit);
-GList *                  ephy_history_service_find_visit_rows         (EphyHistoryService *self, EphyHistoryQuery *query);
+GList *                  ephy_history_service_find_visit_rows         (EphyHistoryService *self, EphySQLiteConnection *connection, EphyHistoryQuery *query);
 
 gboolean                 ephy_history_service_initialize_hosts_table  (EphyHistoryService *self);
 void                     ephy_history_service_add_host_row            (EphyHistoryService *self, EphyHistoryHost *host);
 void                     ephy_history_service_update_host_row         (EphyHistoryService *self, EphyHistoryHost *host);
 EphyHistoryHost *        ephy_history_service_get_host_row            (EphyHistoryService *self, const gchar *url_string, EphyHistoryHost *host);
 GList *                  ephy_history_service_get_all_hosts           (EphyHistoryService *self);
-GList *                  ephy_history_service_find_host_rows          (EphyHistoryService *self, EphyHistoryQuery *query);
+GList *                  ephy_history_service_find_host_rows          (EphyHistoryService *self, EphySQLiteConnection *connection, EphyHistoryQuery *query);
 EphyHistoryHost *        ephy_history_service_get_host_row_from_url   (EphyHistoryService *self, const gchar *url);
 void                     ephy_history_service_delete_host_row         (EphyHistoryService *self, EphyHistoryHost *host);
 void                     ephy_history_service_delete_orphan_hosts     (EphyHistoryService *self);
@@ -22,6 +22,7 @@
 
 #include "ephy-history-service.h"
 #include "ephy-history-service-private.h"
+#include "ephy-debug.h"
 
 gboolean
 ephy_history_service_initialize_urls_table (EphyHistoryService *self)
@@ -52,6 +53,264 @@ ephy_history_service_initialize_urls_table (EphyHistoryService *self)
   return TRUE;
 }
 
+gboolean
+ephy_history_service_initialize_urls_fts_table (EphyHistoryService *self)
+{
+  GError *error = NULL;
+
+  self->urls_fts_enabled = ephy_sqlite_connection_table_exists (self->history_database, "urls_fts");
+  if (self->urls_fts_enabled)
+    return TRUE;
+
+  /* Never build the index for a throwaway in-memory copy of the history,
+   * the LIKE fallback is good enough for it. */
+  if (self->in_memory)
+    return FALSE;
+
+  /* The trigram tokenizer indexes every three-character sequence, which lets
+   * MATCH answer the same substring queries we otherwise run with LIKE. The
+   * table is filled from the existing urls table in the same transaction, so
+   * databases created by older versions get migrated here. */
+  ephy_sqlite_connection_begin_transaction (self->history_database, &error);
+  if (error) {
+    g_warning ("Could not create urls_fts table: %s", error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+
+  if (!ephy_sqlite_connection_execute (self->history_database,
+                                       "CREATE VIRTUAL TABLE urls_fts USING fts5 ("
+                                       "url, title, tokenize='trigram')", &error) ||
+      !ephy_sqlite_connection_execute (self->history_database,
+                                       "INSERT INTO urls_fts (rowid, url, title) "
+                                       "SELECT id, url, title FROM urls", &error)) {
+    /* SQLite might be built without FTS5, or be older than 3.34 and not
+     * have the trigram tokenizer. Keep using LIKE in that case. */
+    LOG ("Could not create urls_fts table, falling back to LIKE queries: %s", error->message);
+    g_error_free (error);
+    ephy_sqlite_connection_execute (self->history_database, "ROLLBACK", NULL);
+    return FALSE;
+  }
+
+  ephy_sqlite_connection_commit_transaction (self->history_database, &error);
+  if (error) {
+    g_warning ("Could not create urls_fts table: %s", error->message);
+    g_error_free (error);
+    ephy_sqlite_connection_execute (self->history_database, "ROLLBACK", NULL);
+    return FALSE;
+  }
+
+  self->urls_fts_enabled = TRUE;
+  return TRUE;
+}
+
+gboolean
+ephy_history_service_can_use_urls_fts (EphyHistoryService *self,
+                                       const char         *substring)
+{
+  /* Trigram MATCH queries shorter than three characters match nothing. */
+  return self->urls_fts_enabled && g_utf8_strlen (substring, -1) >= 3;
+}
+
+/* Whether a URL is kept by queries that ignore local URLs. This is the
+ * "urls.url LIKE 'http%'" clause, and LIKE ignores the case of ASCII
+ * characters. */
+gboolean
+ephy_history_service_url_is_remote (const char *url)
+{
+  return url && g_ascii_strncasecmp (url, "http", 4) == 0;
+}
+
+/* Orders URLs like EPHY_HISTORY_SORT_MOST_VISITED queries do: most visited
+ * first, then oldest first. */
+int
+ephy_history_service_compare_most_visited (const EphyHistoryURL *a,
+                                           const EphyHistoryURL *b)
+{
+  if (a->visit_count != b->visit_count)
+    return a->visit_count > b->visit_count ? -1 : 1;
+
+  return (a->id > b->id) - (a->id < b->id);
+}
+
+/* Appends one clause per substring to a WHERE clause over the urls table,
+ * with the parameters bound by ephy_history_service_bind_substrings(). */
+void
+ephy_history_service_append_substring_clauses (EphyHistoryService *self,
+                                               GString            *statement_str,
+                                               GList              *substring_list)
+{
+  for (GList *substring = substring_list; substring; substring = substring->next) {
+    /* The index only narrows down the candidate rows, the LIKE clauses
+     * still decide which of them actually match. */
+    if (ephy_history_service_can_use_urls_fts (self, substring->data))
+      g_string_append (statement_str, "urls.id IN (SELECT rowid FROM urls_fts WHERE urls_fts MATCH ?) AND ");
+    g_string_append (statement_str, "(urls.url LIKE ? OR urls.title LIKE ?) AND ");
+  }
+}
+
+gboolean
+ephy_history_service_bind_substrings (EphyHistoryService   *self,
+                                      EphySQLiteStatement  *statement,
+                                      GList                *substring_list,
+                                      int                  *column,
+                                      GError              **error)
+{
+  for (GList *substring = substring_list; substring; substring = substring->next) {
+    g_autofree char *pattern = NULL;
+
+    if (ephy_history_service_can_use_urls_fts (self, substring->data)) {
+      g_autofree char *fts_pattern = ephy_sqlite_create_fts_match_pattern (substring->data);
+
+      if (!ephy_sqlite_statement_bind_string (statement, (*column)++, fts_pattern, error))
+        return FALSE;
+    }
+
+    pattern = ephy_sqlite_create_match_pattern (substring->data);
+    if (!ephy_sqlite_statement_bind_string (statement, (*column)++, pattern, error) ||
+        !ephy_sqlite_statement_bind_string (statement, (*column)++, pattern + 2, error))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+ephy_history_service_add_url_fts_row (EphyHistoryService *self,
+                                      EphyHistoryURL     *url)
+{
+  EphySQLiteStatement *statement;
+  GError *error = NULL;
+
+  if (!self->urls_fts_enabled)
+    return;
+
+  statement = ephy_history_service_get_cached_statement (self, EPHY_HISTORY_STATEMENT_ADD_URL_FTS_ROW, &error);
+  if (error) {
+    g_warning ("Could not build urls_fts table addition statement: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  if (!ephy_sqlite_statement_bind_int (statement, 0, url->id, &error) ||
+      !ephy_sqlite_statement_bind_string (statement, 1, url->url, &error) ||
+      !ephy_sqlite_statement_bind_string (statement, 2, url->title, &error)) {
+    g_warning ("Could not insert URL into urls_fts table: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  ephy_sqlite_statement_step (statement, &error);
+  if (error) {
+    g_warning ("Could not insert URL into urls_fts table: %s", error->message);
+    g_error_free (error);
+  }
+}
+
+static void
+ephy_history_service_update_url_fts_row (EphyHistoryService *self,
+                                         EphyHistoryURL     *url)
+{
+  EphySQLiteStatement *statement;
+  GError *error = NULL;
+
+  if (!self->urls_fts_enabled)
+    return;
+
+  statement = ephy_history_service_get_cached_statement (self, EPHY_HISTORY_STATEMENT_UPDATE_URL_FTS_ROW, &error);
+  if (error) {
+    g_warning ("Could not build urls_fts table modification statement: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  if (!ephy_sqlite_statement_bind_string (statement, 0, url->title, &error) ||
+      !ephy_sqlite_statement_bind_int (statement, 1, url->id, &error)) {
+    g_warning ("Could not modify URL in urls_fts table: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  ephy_sqlite_statement_step (statement, &error);
+  if (error) {
+    g_warning ("Could not modify URL in urls_fts table: %s", error->message);
+    g_error_free (error);
+  }
+}
+
+static void
+ephy_history_service_delete_url_fts_row (EphyHistoryService *self,
+                                         EphyHistoryURL     *url)
+{
+  EphySQLiteStatement *statement;
+  GError *error = NULL;
+
+  if (!self->urls_fts_enabled)
+    return;
+
+  if (url->id != -1)
+    statement = ephy_history_service_get_cached_statement (self, EPHY_HISTORY_STATEMENT_DELETE_URL_FTS_FOR_ID, &error);
+  else
+    statement = ephy_history_service_get_cached_statement (self, EPHY_HISTORY_STATEMENT_DELETE_URL_FTS_FOR_URL, &error);
+
+  if (error) {
+    g_warning ("Could not build urls_fts table deletion statement: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  if (url->id != -1)
+    ephy_sqlite_statement_bind_int (statement, 0, url->id, &error);
+  else
+    ephy_sqlite_statement_bind_string (statement, 0, url->url, &error);
+
+  if (error) {
+    g_warning ("Could not build urls_fts table deletion statement: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  ephy_sqlite_statement_step (statement, &error);
+  if (error) {
+    g_warning ("Could not delete URL from urls_fts table: %s", error->message);
+    g_error_free (error);
+  }
+}
+
+void
+ephy_history_service_delete_url_fts_rows_for_host (EphyHistoryService *self,
+                                                   EphyHistoryHost    *host)
+{
+  EphySQLiteStatement *statement;
+  GError *error = NULL;
+
+  g_assert (self->history_thread == g_thread_self ());
+  g_assert (self->history_database);
+
+  if (!self->urls_fts_enabled)
+    return;
+
+  statement = ephy_history_service_get_cached_statement (self, EPHY_HISTORY_STATEMENT_DELETE_URL_FTS_FOR_HOST, &error);
+  if (error) {
+    g_warning ("Could not build urls_fts table deletion statement: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  if (!ephy_sqlite_statement_bind_int (statement, 0, host->id, &error) ||
+      !ephy_sqlite_statement_bind_string (statement, 1, host->url, &error)) {
+    g_warning ("Could not build urls_fts table deletion statement: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  ephy_sqlite_statement_step (statement, &error);
+  if (error) {
+    g_warning ("Could not delete host URLs from urls_fts table: %s", error->message);
+    g_error_free (error);
+  }
+}
+
 EphyHistoryURL *
 ephy_history_service_get_url_row (EphyHistoryService *self,
                                   const char         *url_string,
@@ -155,6 +414,7 @@ ephy_history_service_add_url_row (EphyHistoryService *self,
     g_error_free (error);
   } else {
     url->id = ephy_sqlite_connection_get_last_insert_id (self->history_database);
+    ephy_history_service_add_url_fts_row (self, url);
   }
 }
 
@@ -195,6 +455,8 @@ ephy_history_service_update_url_row (EphyHistoryService *self,
   if (error) {
     g_warning ("Could not modify URL in urls table: %s", error->message);
     g_error_free (error);
+  } else {
+    ephy_history_service_update_url_fts_row (self, url);
   }
 }
 
@@ -217,11 +479,11 @@ create_url_from_statement (EphySQLiteStatement *statement)
 }
 
 GList *
-ephy_history_service_find_url_rows (EphyHistoryService *self,
-                                    EphyHistoryQuery   *query)
+ephy_history_service_find_url_rows (EphyHistoryService   *self,
+                                    EphySQLiteConnection *connection,
+                                    EphyHistoryQuery     *query)
 {
   EphySQLiteStatement *statement = NULL;
-  GList *substring;
   GString *statement_str;
   GList *urls = NULL;
   GError *error = NULL;
@@ -241,8 +503,7 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
 
   int i = 0;
 
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database);
+  g_assert (connection);
 
   statement_str = g_string_new (base_statement);
 
@@ -259,20 +520,21 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
   if (query->ignore_hidden)
     statement_str = g_string_append (statement_str, "urls.hidden_from_overview = 0 AND ");
 
+  /* Keep in sync with ephy_history_service_url_is_remote(). */
   if (query->ignore_local)
     statement_str = g_string_append (statement_str, "urls.url LIKE 'http%' AND ");
 
   if (query->host > 0)
     statement_str = g_string_append (statement_str, "urls.host = ? AND ");
 
-  for (substring = query->substring_list; substring; substring = substring->next)
-    statement_str = g_string_append (statement_str, "(urls.url LIKE ? OR urls.title LIKE ?) AND ");
+  ephy_history_service_append_substring_clauses (self, statement_str, query->substring_list);
 
   statement_str = g_string_append (statement_str, "1 ");
 
   switch (query->sort_type) {
     case EPHY_HISTORY_SORT_MOST_VISITED:
-      statement_str = g_string_append (statement_str, "ORDER BY urls.visit_count DESC ");
+      /* Keep in sync with ephy_history_service_compare_most_visited(). */
+      statement_str = g_string_append (statement_str, "ORDER BY urls.visit_count DESC, urls.id ");
       break;
     case EPHY_HISTORY_SORT_LEAST_VISITED:
       statement_str = g_string_append (statement_str, "ORDER BY urls.visit_count ");
@@ -295,6 +557,17 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
     case EPHY_HISTORY_SORT_URL_DESCENDING:
       statement_str = g_string_append (statement_str, "ORDER BY LOWER(urls.url) DESC ");
       break;
+    case EPHY_HISTORY_SORT_FRECENCY:
+      /* Visits weighted by the age of the last one, in the same buckets as
+       * the location bar's frecency. Times are in microseconds. */
+      statement_str = g_string_append (statement_str,
+                                       "ORDER BY (urls.visit_count + urls.typed_count) * CASE "
+                                       "WHEN urls.last_visit_time > (strftime('%s', 'now') - 4 * 86400) * 1000000 THEN 100 "
+                                       "WHEN urls.last_visit_time > (strftime('%s', 'now') - 14 * 86400) * 1000000 THEN 70 "
+                                       "WHEN urls.last_visit_time > (strftime('%s', 'now') - 31 * 86400) * 1000000 THEN 50 "
+                                       "WHEN urls.last_visit_time > (strftime('%s', 'now') - 90 * 86400) * 1000000 THEN 30 "
+                                       "ELSE 10 END DESC ");
+      break;
     case EPHY_HISTORY_SORT_NONE:
     default:
       g_warning ("We don't support this sorting method yet.");
@@ -304,8 +577,8 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
     statement_str = g_string_append (statement_str, "LIMIT ? ");
   }
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
-                                                       statement_str->str, &error);
+  statement = ephy_sqlite_connection_get_cached_statement (connection,
+                                                           statement_str->str, &error);
   g_string_free (statement_str, TRUE);
 
   if (error) {
@@ -338,23 +611,11 @@ ephy_history_service_find_url_rows (EphyHistoryService *self,
       return NULL;
     }
   }
-  for (substring = query->substring_list; substring; substring = substring->next) {
-    char *string = ephy_sqlite_create_match_pattern (substring->data);
-    if (!ephy_sqlite_statement_bind_string (statement, i++, string, &error)) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      g_free (string);
-      return NULL;
-    }
-    if (!ephy_sqlite_statement_bind_string (statement, i++, string + 2, &error)) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      g_free (string);
-      return NULL;
-    }
-    g_free (string);
+  if (!ephy_history_service_bind_substrings (self, statement, query->substring_list, &i, &error)) {
+    g_warning ("Could not build urls table query statement: %s", error->message);
+    g_error_free (error);
+    g_object_unref (statement);
+    return NULL;
   }
 
   if (query->limit)
@@ -394,6 +655,8 @@ ephy_history_service_delete_url (EphyHistoryService *self,
 
   g_assert (url->id != -1 || url->url);
 
+  ephy_history_service_delete_url_fts_row (self, url);
+
   if (url->id != -1)
     statement = ephy_history_service_get_cached_statement (self, EPHY_HISTORY_STATEMENT_DELETE_URL_FOR_ID, &error);
   else
@@ -89,47 +89,56 @@ ephy_history_service_add_visit_row (EphyHistoryService   *self,
 static EphyHistoryPageVisit *
 create_page_visit_from_statement (EphySQLiteStatement *statement)
 {
+  EphyHistoryURL *url =
+    ephy_history_url_new (ephy_sqlite_statement_get_column_as_string (statement, 3),
+                          ephy_sqlite_statement_get_column_as_string (statement, 4),
+                          ephy_sqlite_statement_get_column_as_int (statement, 5),
+                          ephy_sqlite_statement_get_column_as_int (statement, 6),
+                          ephy_sqlite_statement_get_column_as_int64 (statement, 7));
   EphyHistoryPageVisit *visit =
-    ephy_history_page_visit_new (NULL,
-                                 ephy_sqlite_statement_get_column_as_int64 (statement, 1),
-                                 ephy_sqlite_statement_get_column_as_int (statement, 2));
-  visit->url->id = ephy_sqlite_statement_get_column_as_int (statement, 0);
+    ephy_history_page_visit_new_with_url (url,
+                                          ephy_sqlite_statement_get_column_as_int64 (statement, 1),
+                                          ephy_sqlite_statement_get_column_as_int (statement, 2));
+
+  url->id = ephy_sqlite_statement_get_column_as_int (statement, 0);
+  url->hidden = ephy_sqlite_statement_get_column_as_int (statement, 8);
+  url->sync_id = g_strdup (ephy_sqlite_statement_get_column_as_string (statement, 9));
+
   return visit;
 }
 
 GList *
-ephy_history_service_find_visit_rows (EphyHistoryService *self,
-                                      EphyHistoryQuery   *query)
+ephy_history_service_find_visit_rows (EphyHistoryService   *self,
+                                      EphySQLiteConnection *connection,
+                                      EphyHistoryQuery     *query)
 {
   EphySQLiteStatement *statement = NULL;
-  GList *substring;
   GString *statement_str;
   GList *visits = NULL;
   GError *error = NULL;
+  /* The urls columns are fetched along with the visits, so callers don't
+   * need a second lookup per visit. */
   const char *base_statement = ""
                                "SELECT "
                                "visits.url, "
                                "visits.visit_time, "
-                               "visits.visit_type ";
-  const char *from_join_statement = ""
-                                    "FROM "
-                                    "visits JOIN urls ON visits.url = urls.id ";
-  const char *from_visits_statement = ""
-                                      "FROM "
-                                      "visits ";
+                               "visits.visit_type, "
+                               "urls.url, "
+                               "urls.title, "
+                               "urls.visit_count, "
+                               "urls.typed_count, "
+                               "urls.last_visit_time, "
+                               "urls.hidden_from_overview, "
+                               "urls.sync_id "
+                               "FROM "
+                               "visits JOIN urls ON visits.url = urls.id ";
 
   int i = 0;
 
-  g_assert (self->history_thread == g_thread_self ());
-  g_assert (self->history_database);
+  g_assert (connection);
 
   statement_str = g_string_new (base_statement);
 
-  if (query->substring_list)
-    statement_str = g_string_append (statement_str, from_join_statement);
-  else
-    statement_str = g_string_append (statement_str, from_visits_statement);
-
   statement_str = g_string_append (statement_str, "WHERE ");
 
   if (query->from >= 0)
@@ -140,14 +149,12 @@ ephy_history_service_find_visit_rows (EphyHistoryService *self,
   if (query->host > 0)
     statement_str = g_string_append (statement_str, "urls.host = ? AND ");
 
-  for (substring = query->substring_list; substring; substring = substring->next) {
-    statement_str = g_string_append (statement_str, "(urls.url LIKE ? OR urls.title LIKE ?) AND ");
-  }
+  ephy_history_service_append_substring_clauses (self, statement_str, query->substring_list);
 
   statement_str = g_string_append (statement_str, "1");
 
-  statement = ephy_sqlite_connection_create_statement (self->history_database,
-                                                       statement_str->str, &error);
+  statement = ephy_sqlite_connection_get_cached_statement (connection,
+                                                           statement_str->str, &error);
   g_string_free (statement_str, TRUE);
 
   if (error) {
@@ -180,23 +187,11 @@ ephy_history_service_find_visit_rows (EphyHistoryService *self,
       return NULL;
     }
   }
-  for (substring = query->substring_list; substring; substring = substring->next) {
-    char *string = ephy_sqlite_create_match_pattern (substring->data);
-    if (!ephy_sqlite_statement_bind_string (statement, i++, string, &error)) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      g_free (string);
-      return NULL;
-    }
-    if (!ephy_sqlite_statement_bind_string (statement, i++, string + 2, &error)) {
-      g_warning ("Could not build urls table query statement: %s", error->message);
-      g_error_free (error);
-      g_object_unref (statement);
-      g_free (string);
-      return NULL;
-    }
-    g_free (string);
+  if (!ephy_history_service_bind_substrings (self, statement, query->substring_list, &i, &error)) {
+    g_warning ("Could not build visits table query statement: %s", error->message);
+    g_error_free (error);
+    g_object_unref (statement);
+    return NULL;
   }
 
   while (ephy_sqlite_statement_step (statement, &error))
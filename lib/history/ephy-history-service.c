@@ -21,6 +21,7 @@
 #include "config.h"
 #include "ephy-history-service.h"
 
+#include "ephy-debug.h"
 #include "ephy-history-service-private.h"
 #include "ephy-history-types.h"
 #include "ephy-lib-type-builtins.h"
@@ -32,11 +33,21 @@
 #include <errno.h>
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <string.h>
 
 typedef gboolean (*EphyHistoryServiceMethod)      (EphyHistoryService *self,
                                                    gpointer            data,
                                                    gpointer           *result);
 
+/* Number of threads, and thus of read-only connections, serving queries. */
+#define READER_THREADS 2
+
+/* Writes are committed in batches: a transaction is kept open until the
+ * queue runs dry and the window has passed, or it holds this many writes.
+ * A query waiting for one of these writes has the batch committed at once. */
+#define BATCH_WINDOW (250 * G_TIME_SPAN_MILLISECOND)
+#define BATCH_MAX_WRITES 100
+
 typedef enum {
   /* WRITE */
   SET_URL_TITLE,
@@ -47,6 +58,8 @@ typedef enum {
   DELETE_URLS,
   DELETE_HOST,
   CLEAR,
+  /* COMMIT */
+  COMMIT,
   /* QUIT */
   QUIT,
   /* READ */
@@ -55,7 +68,8 @@ typedef enum {
   QUERY_URLS,
   QUERY_VISITS,
   GET_HOSTS,
-  QUERY_HOSTS
+  QUERY_HOSTS,
+  LOAD_TOP_SITES
 } EphyHistoryServiceMessageType;
 
 enum {
@@ -65,6 +79,7 @@ enum {
   URL_TITLE_CHANGED,
   URL_DELETED,
   HOST_DELETED,
+  TOP_SITES_CHANGED,
   LAST_SIGNAL
 };
 
@@ -81,8 +96,15 @@ typedef struct _EphyHistoryServiceMessage {
   GDestroyNotify method_argument_cleanup;
   GDestroyNotify result_cleanup;
   EphyHistoryJobCallback callback;
+  guint64 writes_before;
+  char *coalesce_key;
 } EphyHistoryServiceMessage;
 
+typedef struct {
+  EphySQLiteConnection *connection;
+  int generation;
+} EphyHistoryServiceReader;
+
 static gpointer run_history_service_thread (EphyHistoryService *self);
 static void ephy_history_service_process_message (EphyHistoryService        *self,
                                                   EphyHistoryServiceMessage *message);
@@ -92,6 +114,10 @@ static gboolean ephy_history_service_execute_quit (EphyHistoryService *self,
 static void ephy_history_service_quit (EphyHistoryService    *self,
                                        EphyHistoryJobCallback callback,
                                        gpointer               user_data);
+static void ephy_history_service_reader_thread_func (EphyHistoryServiceMessage *message,
+                                                     EphyHistoryService        *self);
+static void ephy_history_service_reader_free (EphyHistoryServiceReader *reader);
+static void ephy_history_service_commit_batch (EphyHistoryService *self);
 
 enum {
   PROP_0,
@@ -148,6 +174,16 @@ ephy_history_service_finalize (GObject *object)
 {
   EphyHistoryService *self = EPHY_HISTORY_SERVICE (object);
 
+  /* Queries still running might hand themselves back to the writer thread,
+   * so the pool has to be gone before the writer is told to quit. Their
+   * callbacks would run after the service is freed, so the queries are
+   * dropped, like the ones queued after QUIT on the history thread. */
+  if (self->reader_pool) {
+    g_atomic_int_set (&self->readers_quitting, TRUE);
+    g_thread_pool_free (self->reader_pool, FALSE, TRUE);
+  }
+  g_clear_pointer (&self->readers, g_async_queue_unref);
+
   ephy_history_service_quit (self, NULL, NULL);
 
   if (self->history_thread)
@@ -160,6 +196,11 @@ ephy_history_service_finalize (GObject *object)
       g_object_unref (self->statements[i]);
   g_free (self->statements);
 
+  g_hash_table_unref (self->pending_writes);
+  g_ptr_array_unref (self->batch);
+  g_ptr_array_unref (self->top_sites);
+  g_ptr_array_unref (self->visited_urls);
+
   G_OBJECT_CLASS (ephy_history_service_parent_class)->finalize (object);
 }
 
@@ -182,6 +223,10 @@ ephy_history_service_constructed (GObject *object)
 
   self->statements = g_malloc0_n (EPHY_HISTORY_STATEMENT_LEN, sizeof (EphySQLiteStatement *));
   self->queue = g_async_queue_new ();
+  self->pending_writes = g_hash_table_new (g_str_hash, g_str_equal);
+  self->batch = g_ptr_array_new ();
+  self->top_sites = g_ptr_array_new_with_free_func ((GDestroyNotify)ephy_history_url_free);
+  self->visited_urls = g_ptr_array_new_with_free_func (g_free);
 
   /* This value is checked in several functions to verify that they are only
    * ever run on the history thread. Accordingly, we'd better be sure it's set
@@ -201,21 +246,38 @@ ephy_history_service_constructed (GObject *object)
   while (!self->history_thread_initialized)
     g_cond_wait (&self->history_thread_initialized_condition, &self->history_thread_mutex);
 
+  /* Queries are served from read-only connections on their own threads, so
+   * they neither wait for nor delay the writes done on the history thread.
+   * WAL mode makes that safe. An in-memory database is private to the
+   * history thread's connection, so it cannot be shared this way. */
+  if (!self->in_memory && self->history_database) {
+    self->readers = g_async_queue_new_full ((GDestroyNotify)ephy_history_service_reader_free);
+    self->reader_pool = g_thread_pool_new ((GFunc)ephy_history_service_reader_thread_func,
+                                           self, READER_THREADS, FALSE, NULL);
+  }
+
   g_mutex_unlock (&self->history_thread_mutex);
 }
 
 static gboolean
 emit_urls_visited (EphyHistoryService *self)
 {
-  g_signal_emit (self, signals[URLS_VISITED], 0);
+  g_autoptr (GPtrArray) urls = g_steal_pointer (&self->visited_urls);
+
   self->queue_urls_visited_id = 0;
+  self->visited_urls = g_ptr_array_new_with_free_func (g_free);
+  g_ptr_array_add (urls, NULL);
+  g_signal_emit (self, signals[URLS_VISITED], 0, urls->pdata);
 
   return FALSE;
 }
 
 static void
-ephy_history_service_queue_urls_visited (EphyHistoryService *self)
+ephy_history_service_queue_urls_visited (EphyHistoryService *self,
+                                         const char         *url)
 {
+  g_ptr_array_add (self->visited_urls, g_strdup (url));
+
   if (self->queue_urls_visited_id)
     return;
 
@@ -247,11 +309,13 @@ ephy_history_service_class_init (EphyHistoryServiceClass *klass)
  * EphyHistoryService::urls-visited:
  * @service: the #EphyHistoryService that received the signal
  *
+ * @urls: the URLs visited since the last emission
+ *
  * The ::urls-visited signal is emitted after one or more visits to
- * URLS have taken place. This signal is intended for use-cases when
- * precise information of the actual URLS visited is not important and
- * there is only interest in the fact that there have been changes in
- * the history. For more precise information, you can use ::visit-url
+ * URLS have taken place. Visits close to each other are reported
+ * together, @urls holds the URL of each of them, so a URL visited
+ * several times is listed as many times. Queries sent from a handler
+ * see these visits.
  **/
   signals[URLS_VISITED] =
     g_signal_new ("urls-visited",
@@ -259,7 +323,8 @@ ephy_history_service_class_init (EphyHistoryServiceClass *klass)
                   G_SIGNAL_RUN_LAST,
                   0, NULL, NULL, NULL,
                   G_TYPE_NONE,
-                  0);
+                  1,
+                  G_TYPE_STRV | G_SIGNAL_TYPE_STATIC_SCOPE);
 
   signals[CLEARED] =
     g_signal_new ("cleared",
@@ -297,6 +362,21 @@ ephy_history_service_class_init (EphyHistoryServiceClass *klass)
                   1,
                   G_TYPE_STRING | G_SIGNAL_TYPE_STATIC_SCOPE);
 
+/**
+ * EphyHistoryService::top-sites-changed:
+ * @service: the #EphyHistoryService that received the signal
+ *
+ * The ::top-sites-changed signal is emitted when the most visited URLs,
+ * as returned by ephy_history_service_get_top_sites(), changed or moved.
+ **/
+  signals[TOP_SITES_CHANGED] =
+    g_signal_new ("top-sites-changed",
+                  G_OBJECT_CLASS_TYPE (gobject_class),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE,
+                  0);
+
   obj_properties[PROP_HISTORY_FILENAME] =
     g_param_spec_string ("history-filename",
                          NULL, NULL,
@@ -371,14 +451,72 @@ ephy_history_service_message_free (EphyHistoryServiceMessage *message)
   if (message->cancellable)
     g_object_unref (message->cancellable);
 
+  g_free (message->coalesce_key);
   g_free (message);
 }
 
+static gboolean
+ephy_history_service_message_is_write (EphyHistoryServiceMessage *message)
+{
+  return message->type < COMMIT;
+}
+
+static gboolean
+ephy_history_service_message_is_read_query (EphyHistoryServiceMessage *message)
+{
+  return message->type == QUERY_URLS ||
+         message->type == QUERY_VISITS ||
+         message->type == QUERY_HOSTS;
+}
+
+/* Setting the title, zoom level or hidden flag of a URL replaces whatever
+ * was set before, so a message still waiting in the queue for the same URL
+ * can simply take over the new argument. Only messages nobody waits on are
+ * merged this way. Returns %TRUE if @message was merged and freed. */
+static gboolean
+ephy_history_service_coalesce_message (EphyHistoryService        *self,
+                                       EphyHistoryServiceMessage *message,
+                                       const char                *url)
+{
+  EphyHistoryServiceMessage *pending;
+
+  if (message->callback || message->cancellable)
+    return FALSE;
+
+  message->coalesce_key = g_strdup_printf ("%d %s", message->type, url);
+
+  g_mutex_lock (&self->pending_writes_mutex);
+  pending = g_hash_table_lookup (self->pending_writes, message->coalesce_key);
+  if (pending) {
+    gpointer old_argument = pending->method_argument;
+
+    pending->method_argument = message->method_argument;
+    message->method_argument = old_argument;
+  } else {
+    g_hash_table_insert (self->pending_writes, message->coalesce_key, message);
+  }
+  g_mutex_unlock (&self->pending_writes_mutex);
+
+  if (pending)
+    ephy_history_service_message_free (message);
+
+  return !!pending;
+}
+
 static void
 ephy_history_service_send_message (EphyHistoryService        *self,
                                    EphyHistoryServiceMessage *message)
 {
-  g_async_queue_push_sorted (self->queue, message, (GCompareDataFunc)sort_messages, NULL);
+  g_mutex_lock (&self->writes_mutex);
+  if (ephy_history_service_message_is_write (message))
+    self->writes_queued++;
+  message->writes_before = self->writes_queued;
+  g_mutex_unlock (&self->writes_mutex);
+
+  if (self->reader_pool && ephy_history_service_message_is_read_query (message))
+    g_thread_pool_push (self->reader_pool, message, NULL);
+  else
+    g_async_queue_push_sorted (self->queue, message, (GCompareDataFunc)sort_messages, NULL);
 }
 
 static void
@@ -441,9 +579,16 @@ ephy_history_service_open_database_connections (EphyHistoryService *self)
     ephy_sqlite_connection_enable_foreign_keys (self->history_database);
   }
 
-  return (ephy_history_service_initialize_hosts_table (self) &&
-          ephy_history_service_initialize_urls_table (self) &&
-          ephy_history_service_initialize_visits_table (self));
+  if (!ephy_history_service_initialize_hosts_table (self) ||
+      !ephy_history_service_initialize_urls_table (self) ||
+      !ephy_history_service_initialize_visits_table (self))
+    return FALSE;
+
+  /* The full-text index is an optimization only, so failing to set it up
+   * must not prevent the history from being used. */
+  ephy_history_service_initialize_urls_fts_table (self);
+
+  return TRUE;
 }
 
 static void
@@ -484,7 +629,9 @@ run_history_service_thread (EphyHistoryService *self)
   g_mutex_lock (&self->history_thread_mutex);
   g_assert (self->history_thread == g_thread_self ());
 
+  START_PROFILER ("History database open")
   success = ephy_history_service_open_database_connections (self);
+  STOP_PROFILER ("History database open")
 
   self->history_thread_initialized = TRUE;
   g_cond_signal (&self->history_thread_initialized_condition);
@@ -495,6 +642,16 @@ run_history_service_thread (EphyHistoryService *self)
 
   do {
     message = g_async_queue_try_pop (self->queue);
+    if (!message && self->batch_start_time) {
+      /* Give the open batch until the end of its window to collect more
+       * writes, then commit it. */
+      gint64 remaining = self->batch_start_time + BATCH_WINDOW - g_get_monotonic_time ();
+
+      if (remaining > 0)
+        message = g_async_queue_timeout_pop (self->queue, remaining);
+      if (!message)
+        ephy_history_service_commit_batch (self);
+    }
     if (!message) {
       /* Block the thread until there's data in the queue. */
       message = g_async_queue_pop (self->queue);
@@ -504,6 +661,8 @@ run_history_service_thread (EphyHistoryService *self)
     ephy_history_service_process_message (self, message);
   } while (!self->scheduled_to_quit);
 
+  /* Flush whatever is still pending before closing the database. */
+  ephy_history_service_commit_batch (self);
   ephy_history_service_close_database_connections (self);
 
   return NULL;
@@ -561,6 +720,160 @@ signal_emission_context_new (EphyHistoryService *service,
   return ctx;
 }
 
+static gboolean
+top_sites_changed_signal_emit (SignalEmissionContext *ctx)
+{
+  g_atomic_int_set (&ctx->service->top_sites_changed_queued, FALSE);
+  g_signal_emit (ctx->service, signals[TOP_SITES_CHANGED], 0);
+
+  return FALSE;
+}
+
+static void
+ephy_history_service_queue_top_sites_changed (EphyHistoryService *self)
+{
+  SignalEmissionContext *ctx;
+
+  if (!g_atomic_int_compare_and_exchange (&self->top_sites_changed_queued, FALSE, TRUE))
+    return;
+
+  ctx = signal_emission_context_new (self, NULL, NULL);
+  g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+                   (GSourceFunc)top_sites_changed_signal_emit,
+                   ctx, (GDestroyNotify)signal_emission_context_free);
+}
+
+/* The top sites are the most visited URLs that the overview may show, most
+ * visited first. They are loaded once and then kept up to date as visits
+ * are added, so that nobody needs to query them again. Changes that can
+ * bring back a URL that is not in the list, like deletions, load them again.
+ * The list is written on the history thread and read from the main thread,
+ * so it is only accessed under top_sites_mutex.
+ */
+static gboolean
+top_sites_find (GPtrArray  *top_sites,
+                const char *url,
+                guint      *index)
+{
+  for (guint i = 0; i < top_sites->len; i++) {
+    EphyHistoryURL *top_site = top_sites->pdata[i];
+
+    if (strcmp (top_site->url, url) == 0) {
+      if (index)
+        *index = i;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/* Visit counts only grow, so a top site can only move up. */
+static guint
+top_sites_move_up (GPtrArray *top_sites,
+                   guint      index)
+{
+  EphyHistoryURL *top_site = top_sites->pdata[index];
+
+  while (index > 0 && ephy_history_service_compare_most_visited (top_sites->pdata[index - 1], top_site) > 0) {
+    top_sites->pdata[index] = top_sites->pdata[index - 1];
+    index--;
+  }
+  top_sites->pdata[index] = top_site;
+
+  return index;
+}
+
+static void
+ephy_history_service_load_top_sites (EphyHistoryService *self)
+{
+  g_autoptr (EphyHistoryQuery) query = NULL;
+  GList *urls;
+  guint size;
+
+  g_assert (self->history_thread == g_thread_self ());
+
+  g_mutex_lock (&self->top_sites_mutex);
+  size = self->top_sites_size;
+  g_mutex_unlock (&self->top_sites_mutex);
+
+  if (size == 0 || !self->history_database)
+    return;
+
+  /* The same URLs as ephy_history_query_new_for_overview(). */
+  query = ephy_history_query_new ();
+  query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
+  query->limit = size;
+  query->ignore_hidden = TRUE;
+  query->ignore_local = TRUE;
+
+  urls = ephy_history_service_find_url_rows (self, self->history_database, query);
+
+  g_mutex_lock (&self->top_sites_mutex);
+  g_ptr_array_set_size (self->top_sites, 0);
+  for (GList *l = urls; l; l = l->next)
+    g_ptr_array_add (self->top_sites, l->data);
+  self->top_sites_loaded = TRUE;
+  g_mutex_unlock (&self->top_sites_mutex);
+
+  LOG ("Loaded %u top sites", g_list_length (urls));
+  g_list_free (urls);
+
+  ephy_history_service_queue_top_sites_changed (self);
+}
+
+static void
+ephy_history_service_update_top_site (EphyHistoryService *self,
+                                      EphyHistoryURL     *url)
+{
+  GPtrArray *top_sites = self->top_sites;
+  gboolean changed = FALSE;
+  guint index;
+
+  g_assert (self->history_thread == g_thread_self ());
+
+  /* The same URLs as the query of ephy_history_service_load_top_sites(). */
+  if (url->hidden || !ephy_history_service_url_is_remote (url->url))
+    return;
+
+  g_mutex_lock (&self->top_sites_mutex);
+
+  if (!self->top_sites_loaded) {
+    g_mutex_unlock (&self->top_sites_mutex);
+    return;
+  }
+
+  if (top_sites_find (top_sites, url->url, &index)) {
+    EphyHistoryURL *top_site = top_sites->pdata[index];
+
+    top_site->visit_count = url->visit_count;
+    changed = top_sites_move_up (top_sites, index) != index;
+  } else if (top_sites->len < self->top_sites_size ||
+             ephy_history_service_compare_most_visited (url, top_sites->pdata[top_sites->len - 1]) < 0) {
+    if (top_sites->len == self->top_sites_size)
+      g_ptr_array_remove_index (top_sites, top_sites->len - 1);
+
+    g_ptr_array_add (top_sites, ephy_history_url_copy (url));
+    top_sites_move_up (top_sites, top_sites->len - 1);
+    changed = TRUE;
+  }
+
+  g_mutex_unlock (&self->top_sites_mutex);
+
+  if (changed)
+    ephy_history_service_queue_top_sites_changed (self);
+}
+
+static gboolean
+ephy_history_service_execute_load_top_sites (EphyHistoryService *self,
+                                             gpointer            data,
+                                             gpointer           *result)
+{
+  ephy_history_service_load_top_sites (self);
+
+  return TRUE;
+}
+
 static gboolean
 ephy_history_service_execute_add_visit_helper (EphyHistoryService   *self,
                                                EphyHistoryPageVisit *visit)
@@ -608,6 +921,8 @@ ephy_history_service_execute_add_visit_helper (EphyHistoryService   *self,
     ephy_history_service_update_url_row (self, visit->url);
   }
 
+  ephy_history_service_update_top_site (self, visit->url);
+
   if (visit->url->notify_visit)
     g_signal_emit (self, signals[VISIT_URL], 0, visit->url);
 
@@ -636,7 +951,7 @@ ephy_history_service_execute_add_visits (EphyHistoryService *self,
   g_assert (self->history_thread == g_thread_self ());
 
   while (visits) {
-    success = success && ephy_history_service_execute_add_visit_helper (self, (EphyHistoryPageVisit *)visits->data);
+    success = ephy_history_service_execute_add_visit_helper (self, (EphyHistoryPageVisit *)visits->data) && success;
     visits = visits->next;
   }
 
@@ -644,26 +959,13 @@ ephy_history_service_execute_add_visits (EphyHistoryService *self,
 }
 
 static gboolean
-ephy_history_service_execute_find_visits (EphyHistoryService *self,
-                                          EphyHistoryQuery   *query,
-                                          gpointer           *result)
+ephy_history_service_execute_find_visits (EphyHistoryService   *self,
+                                          EphySQLiteConnection *connection,
+                                          EphyHistoryQuery     *query,
+                                          gpointer             *result)
 {
-  GList *visits = ephy_history_service_find_visit_rows (self, query);
-  GList *current = visits;
-
   /* FIXME: We don't have a good way to tell the difference between failures and empty returns */
-  while (current) {
-    EphyHistoryPageVisit *visit = (EphyHistoryPageVisit *)current->data;
-    if (!ephy_history_service_get_url_row (self, NULL, visit->url)) {
-      ephy_history_page_visit_list_free (visits);
-      g_warning ("Tried to process an orphaned page visit");
-      return FALSE;
-    }
-
-    current = current->next;
-  }
-
-  *result = visits;
+  *result = ephy_history_service_find_visit_rows (self, connection, query);
   return TRUE;
 }
 
@@ -681,13 +983,14 @@ ephy_history_service_execute_get_hosts (EphyHistoryService *self,
 }
 
 static gboolean
-ephy_history_service_execute_query_hosts (EphyHistoryService *self,
-                                          EphyHistoryQuery   *query,
-                                          gpointer           *results)
+ephy_history_service_execute_query_hosts (EphyHistoryService   *self,
+                                          EphySQLiteConnection *connection,
+                                          EphyHistoryQuery     *query,
+                                          gpointer             *results)
 {
   GList *hosts;
 
-  hosts = ephy_history_service_find_host_rows (self, query);
+  hosts = ephy_history_service_find_host_rows (self, connection, query);
   *results = hosts;
 
   return TRUE;
@@ -760,6 +1063,28 @@ ephy_history_service_get_cached_statement (EphyHistoryService           *self,
       sql = "INSERT INTO visits (url, visit_time, visit_type) "
             " VALUES (?, ?, ?) ";
       break;
+    case EPHY_HISTORY_STATEMENT_ADD_URL_FTS_ROW:
+      sql = "INSERT INTO urls_fts (rowid, url, title) "
+            "VALUES (?, ?, ?)";
+      break;
+    case EPHY_HISTORY_STATEMENT_UPDATE_URL_FTS_ROW:
+      sql = "UPDATE urls_fts SET title=? "
+            "WHERE rowid=?";
+      break;
+    case EPHY_HISTORY_STATEMENT_DELETE_URL_FTS_FOR_ID:
+      sql = "DELETE FROM urls_fts WHERE rowid=?";
+      break;
+    case EPHY_HISTORY_STATEMENT_DELETE_URL_FTS_FOR_URL:
+      sql = "DELETE FROM urls_fts WHERE rowid IN "
+            "(SELECT id FROM urls WHERE url=?)";
+      break;
+    case EPHY_HISTORY_STATEMENT_DELETE_URL_FTS_FOR_HOST:
+      /* urls rows go away through ON DELETE CASCADE when their host is
+       * deleted, so the index has to be cleaned up before that happens. */
+      sql = "DELETE FROM urls_fts WHERE rowid IN "
+            "(SELECT urls.id FROM urls JOIN hosts ON urls.host = hosts.id "
+            "WHERE hosts.id=? OR hosts.url=?)";
+      break;
     case EPHY_HISTORY_STATEMENT_LEN:
       break;
   }
@@ -853,11 +1178,12 @@ ephy_history_service_query_visits (EphyHistoryService     *self,
 }
 
 static gboolean
-ephy_history_service_execute_query_urls (EphyHistoryService *self,
-                                         EphyHistoryQuery   *query,
-                                         gpointer           *result)
+ephy_history_service_execute_query_urls (EphyHistoryService   *self,
+                                         EphySQLiteConnection *connection,
+                                         EphyHistoryQuery     *query,
+                                         gpointer             *result)
 {
-  GList *urls = ephy_history_service_find_url_rows (self, query);
+  GList *urls = ephy_history_service_find_url_rows (self, connection, query);
 
   *result = urls;
 
@@ -944,10 +1270,21 @@ ephy_history_service_execute_set_url_title (EphyHistoryService *self,
   } else {
     SignalEmissionContext *ctx;
 
+    guint index;
+
     g_free (url->title);
     url->title = title;
     ephy_history_service_update_url_row (self, url);
 
+    g_mutex_lock (&self->top_sites_mutex);
+    if (top_sites_find (self->top_sites, url->url, &index)) {
+      EphyHistoryURL *top_site = self->top_sites->pdata[index];
+
+      g_free (top_site->title);
+      top_site->title = g_strdup (url->title);
+    }
+    g_mutex_unlock (&self->top_sites_mutex);
+
     ctx = signal_emission_context_new (self,
                                        ephy_history_url_copy (url),
                                        (GDestroyNotify)ephy_history_url_free);
@@ -978,7 +1315,8 @@ ephy_history_service_set_url_title (EphyHistoryService     *self,
   message = ephy_history_service_message_new (self, SET_URL_TITLE,
                                               url, (GDestroyNotify)ephy_history_url_free,
                                               NULL, cancellable, callback, user_data);
-  ephy_history_service_send_message (self, message);
+  if (!ephy_history_service_coalesce_message (self, message, orig_url))
+    ephy_history_service_send_message (self, message);
 }
 
 static gboolean
@@ -1026,7 +1364,8 @@ ephy_history_service_set_url_zoom_level (EphyHistoryService     *self,
   message = ephy_history_service_message_new (self, SET_URL_ZOOM_LEVEL,
                                               variant, (GDestroyNotify)g_variant_unref,
                                               NULL, cancellable, callback, user_data);
-  ephy_history_service_send_message (self, message);
+  if (!ephy_history_service_coalesce_message (self, message, url))
+    ephy_history_service_send_message (self, message);
 }
 
 static gboolean
@@ -1044,6 +1383,9 @@ ephy_history_service_execute_set_url_hidden (EphyHistoryService *self,
   } else {
     url->hidden = hidden;
     ephy_history_service_update_url_row (self, url);
+
+    /* Hiding a top site makes room for the next one. */
+    ephy_history_service_load_top_sites (self);
     return TRUE;
   }
 }
@@ -1068,7 +1410,8 @@ ephy_history_service_set_url_hidden (EphyHistoryService     *self,
   message = ephy_history_service_message_new (self, SET_URL_HIDDEN,
                                               url, (GDestroyNotify)ephy_history_url_free,
                                               NULL, cancellable, callback, user_data);
-  ephy_history_service_send_message (self, message);
+  if (!ephy_history_service_coalesce_message (self, message, orig_url))
+    ephy_history_service_send_message (self, message);
 }
 
 static gboolean
@@ -1154,9 +1497,11 @@ ephy_history_service_execute_delete_urls (EphyHistoryService *self,
   GList *l;
   EphyHistoryURL *url;
   SignalEmissionContext *ctx;
+  gboolean top_site_deleted = FALSE;
 
   for (l = urls; l; l = l->next) {
     url = l->data;
+    top_site_deleted |= ephy_history_service_is_top_site (self, url->url);
     ephy_history_service_delete_url (self, url);
 
     if (url->notify_delete) {
@@ -1171,6 +1516,9 @@ ephy_history_service_execute_delete_urls (EphyHistoryService *self,
 
   ephy_history_service_delete_orphan_hosts (self);
 
+  if (top_site_deleted)
+    ephy_history_service_load_top_sites (self);
+
   return TRUE;
 }
 
@@ -1201,6 +1549,8 @@ ephy_history_service_execute_delete_host (EphyHistoryService     *self,
                    ctx,
                    (GDestroyNotify)signal_emission_context_free);
 
+  ephy_history_service_load_top_sites (self);
+
   return TRUE;
 }
 
@@ -1219,6 +1569,14 @@ ephy_history_service_execute_clear (EphyHistoryService *self,
   ephy_history_service_open_database_connections (self);
   ephy_history_service_open_transaction (self);
 
+  /* Readers still have the deleted database open and must reconnect. */
+  g_atomic_int_inc (&self->database_generation);
+
+  g_mutex_lock (&self->top_sites_mutex);
+  g_ptr_array_set_size (self->top_sites, 0);
+  g_mutex_unlock (&self->top_sites_mutex);
+  ephy_history_service_queue_top_sites_changed (self);
+
   return TRUE;
 }
 
@@ -1291,19 +1649,119 @@ static EphyHistoryServiceMethod methods[] = {
   (EphyHistoryServiceMethod)ephy_history_service_execute_delete_urls,
   (EphyHistoryServiceMethod)ephy_history_service_execute_delete_host,
   (EphyHistoryServiceMethod)ephy_history_service_execute_clear,
+  NULL, /* COMMIT, see ephy_history_service_process_message () */
   (EphyHistoryServiceMethod)ephy_history_service_execute_quit,
   (EphyHistoryServiceMethod)ephy_history_service_execute_get_url,
   (EphyHistoryServiceMethod)ephy_history_service_execute_get_host_for_url,
-  (EphyHistoryServiceMethod)ephy_history_service_execute_query_urls,
-  (EphyHistoryServiceMethod)ephy_history_service_execute_find_visits,
+  NULL, /* QUERY_URLS, see ephy_history_service_execute_read_query () */
+  NULL, /* QUERY_VISITS */
   (EphyHistoryServiceMethod)ephy_history_service_execute_get_hosts,
-  (EphyHistoryServiceMethod)ephy_history_service_execute_query_hosts
+  NULL, /* QUERY_HOSTS */
+  (EphyHistoryServiceMethod)ephy_history_service_execute_load_top_sites
 };
 
 static gboolean
-ephy_history_service_message_is_write (EphyHistoryServiceMessage *message)
+ephy_history_service_execute_read_query (EphyHistoryService        *self,
+                                         EphySQLiteConnection      *connection,
+                                         EphyHistoryServiceMessage *message)
 {
-  return message->type < QUIT;
+  switch (message->type) {
+    case QUERY_URLS:
+      return ephy_history_service_execute_query_urls (self, connection, (EphyHistoryQuery *)message->method_argument, &message->result);
+    case QUERY_VISITS:
+      return ephy_history_service_execute_find_visits (self, connection, (EphyHistoryQuery *)message->method_argument, &message->result);
+    case QUERY_HOSTS:
+      return ephy_history_service_execute_query_hosts (self, connection, (EphyHistoryQuery *)message->method_argument, &message->result);
+    default:
+      g_assert_not_reached ();
+  }
+
+  return FALSE;
+}
+
+static void
+ephy_history_service_reader_free (EphyHistoryServiceReader *reader)
+{
+  ephy_sqlite_connection_close (reader->connection);
+  g_object_unref (reader->connection);
+  g_free (reader);
+}
+
+static EphyHistoryServiceReader *
+ephy_history_service_reader_acquire (EphyHistoryService *self)
+{
+  EphyHistoryServiceReader *reader;
+  int generation = g_atomic_int_get (&self->database_generation);
+  GError *error = NULL;
+
+  reader = g_async_queue_try_pop (self->readers);
+  if (reader && reader->generation == generation)
+    return reader;
+
+  g_clear_pointer (&reader, ephy_history_service_reader_free);
+
+  reader = g_new0 (EphyHistoryServiceReader, 1);
+  reader->generation = generation;
+  reader->connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READ_ONLY,
+                                                   self->history_filename);
+  ephy_sqlite_connection_open (reader->connection, &error);
+  if (error) {
+    g_warning ("Could not open read-only history database connection: %s", error->message);
+    g_error_free (error);
+    ephy_history_service_reader_free (reader);
+    return NULL;
+  }
+
+  return reader;
+}
+
+static void
+ephy_history_service_reader_thread_func (EphyHistoryServiceMessage *message,
+                                         EphyHistoryService        *self)
+{
+  EphyHistoryServiceReader *reader;
+
+  if (g_atomic_int_get (&self->readers_quitting)) {
+    ephy_history_service_message_free (message);
+    return;
+  }
+
+  /* Preserve the ordering of the single queue: a query sees the result of
+   * every write that was sent before it. Do not leave these writes in the
+   * open batch until its window ends, have it committed right away. */
+  g_mutex_lock (&self->writes_mutex);
+  if (self->writes_done < message->writes_before && !self->commit_requested) {
+    self->commit_requested = TRUE;
+    g_async_queue_push_sorted (self->queue,
+                               ephy_history_service_message_new (self, COMMIT,
+                                                                 NULL, NULL, NULL, NULL,
+                                                                 NULL, NULL),
+                               (GCompareDataFunc)sort_messages, NULL);
+  }
+  while (self->writes_done < message->writes_before)
+    g_cond_wait (&self->writes_cond, &self->writes_mutex);
+  g_mutex_unlock (&self->writes_mutex);
+
+  if (g_cancellable_is_cancelled (message->cancellable)) {
+    ephy_history_service_message_free (message);
+    return;
+  }
+
+  reader = ephy_history_service_reader_acquire (self);
+  if (!reader) {
+    /* Fall back to the connection of the history thread. */
+    g_async_queue_push_sorted (self->queue, message, (GCompareDataFunc)sort_messages, NULL);
+    return;
+  }
+
+  message->result = NULL;
+  message->success = ephy_history_service_execute_read_query (self, reader->connection, message);
+  g_async_queue_push (self->readers, reader);
+
+  if (message->callback && !g_atomic_int_get (&self->readers_quitting))
+    g_idle_add ((GSourceFunc)ephy_history_service_execute_job_callback, message);
+  else
+    ephy_history_service_message_free (message);
 }
 
 static void
@@ -1320,16 +1778,51 @@ ephy_history_service_process_message (EphyHistoryService        *self,
     return;
   }
 
+  /* Queued behind the writes a query waits for, see
+   * ephy_history_service_reader_thread_func (). */
+  if (message->type == COMMIT) {
+    g_mutex_lock (&self->writes_mutex);
+    self->commit_requested = FALSE;
+    g_mutex_unlock (&self->writes_mutex);
+
+    ephy_history_service_commit_batch (self);
+    ephy_history_service_message_free (message);
+    return;
+  }
+
+  /* From now on, further writes to the same URL need a message of their own. */
+  if (message->coalesce_key) {
+    g_mutex_lock (&self->pending_writes_mutex);
+    if (g_hash_table_lookup (self->pending_writes, message->coalesce_key) == message)
+      g_hash_table_remove (self->pending_writes, message->coalesce_key);
+    g_mutex_unlock (&self->pending_writes_mutex);
+  }
+
   method = methods[message->type];
   message->result = NULL;
   if (message->service->history_database) {
-    ephy_history_service_open_transaction (self);
-    message->success = method (message->service, message->method_argument, &message->result);
-    ephy_history_service_commit_transaction (self);
+    if (!self->batch_start_time) {
+      ephy_history_service_open_transaction (self);
+      self->batch_start_time = g_get_monotonic_time ();
+    }
+
+    if (ephy_history_service_message_is_read_query (message))
+      message->success = ephy_history_service_execute_read_query (self, self->history_database, message);
+    else
+      message->success = method (message->service, message->method_argument, &message->result);
   } else {
     message->success = FALSE;
   }
 
+  /* Writes are only reported once they have been committed. */
+  if (ephy_history_service_message_is_write (message)) {
+    g_ptr_array_add (self->batch, message);
+    if (self->batch->len >= BATCH_MAX_WRITES ||
+        g_get_monotonic_time () - self->batch_start_time >= BATCH_WINDOW)
+      ephy_history_service_commit_batch (self);
+    return;
+  }
+
   if (message->callback || message->type == CLEAR)
     g_idle_add ((GSourceFunc)ephy_history_service_execute_job_callback, message);
   else
@@ -1338,6 +1831,36 @@ ephy_history_service_process_message (EphyHistoryService        *self,
   return;
 }
 
+static void
+ephy_history_service_commit_batch (EphyHistoryService *self)
+{
+  g_assert (self->history_thread == g_thread_self ());
+
+  if (self->batch_start_time) {
+    ephy_history_service_commit_transaction (self);
+    self->batch_start_time = 0;
+  }
+
+  if (self->batch->len == 0)
+    return;
+
+  g_mutex_lock (&self->writes_mutex);
+  self->writes_done += self->batch->len;
+  g_cond_broadcast (&self->writes_cond);
+  g_mutex_unlock (&self->writes_mutex);
+
+  for (guint i = 0; i < self->batch->len; i++) {
+    EphyHistoryServiceMessage *message = self->batch->pdata[i];
+
+    if (message->callback || message->type == CLEAR)
+      g_idle_add ((GSourceFunc)ephy_history_service_execute_job_callback, message);
+    else
+      ephy_history_service_message_free (message);
+  }
+
+  g_ptr_array_set_size (self->batch, 0);
+}
+
 /* Public API. */
 
 void
@@ -1392,7 +1915,23 @@ ephy_history_service_visit_url (EphyHistoryService       *self,
   ephy_history_service_add_visit (self, visit, NULL, NULL, NULL);
   ephy_history_page_visit_free (visit);
 
-  ephy_history_service_queue_urls_visited (self);
+  ephy_history_service_queue_urls_visited (self, url);
+}
+
+/* Like ephy_history_service_visit_url() for a list of #EphyHistoryPageVisit,
+ * stored in a single job. */
+void
+ephy_history_service_visit_urls (EphyHistoryService *self,
+                                 GList              *visits)
+{
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+
+  if (!visits)
+    return;
+
+  ephy_history_service_add_visits (self, visits, NULL, NULL, NULL);
+  for (GList *l = visits; l; l = l->next)
+    ephy_history_service_queue_urls_visited (self, ((EphyHistoryPageVisit *)l->data)->url->url);
 }
 
 void
@@ -1416,3 +1955,87 @@ ephy_history_service_find_hosts (EphyHistoryService     *self,
                                     cancellable, callback, user_data);
   ephy_history_query_free (query);
 }
+
+/**
+ * ephy_history_service_set_top_sites_size:
+ * @self: an #EphyHistoryService
+ * @size: the number of top sites to keep, more than 0
+ *
+ * Starts keeping the @size most visited URLs that are neither hidden nor
+ * local, for ephy_history_service_get_top_sites() and
+ * ephy_history_service_is_top_site(). They are loaded in the background,
+ * #EphyHistoryService::top-sites-changed is emitted once they are ready.
+ **/
+void
+ephy_history_service_set_top_sites_size (EphyHistoryService *self,
+                                         guint               size)
+{
+  EphyHistoryServiceMessage *message;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+  g_assert (size > 0);
+
+  g_mutex_lock (&self->top_sites_mutex);
+  self->top_sites_size = size;
+  g_mutex_unlock (&self->top_sites_mutex);
+
+  message = ephy_history_service_message_new (self, LOAD_TOP_SITES,
+                                              NULL, NULL, NULL,
+                                              NULL, NULL, NULL);
+  ephy_history_service_send_message (self, message);
+}
+
+/**
+ * ephy_history_service_get_top_sites:
+ * @self: an #EphyHistoryService
+ * @limit: the maximum number of URLs to return
+ * @urls: (out) (transfer full) (element-type EphyHistoryURL): return location
+ *   for the most visited URLs, most visited first
+ *
+ * Returns: %FALSE if the top sites were not loaded yet
+ **/
+gboolean
+ephy_history_service_get_top_sites (EphyHistoryService  *self,
+                                    guint                limit,
+                                    GList              **urls)
+{
+  gboolean loaded;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+
+  *urls = NULL;
+
+  g_mutex_lock (&self->top_sites_mutex);
+  for (guint i = MIN (limit, self->top_sites->len); i > 0; i--)
+    *urls = g_list_prepend (*urls, ephy_history_url_copy (self->top_sites->pdata[i - 1]));
+  loaded = self->top_sites_loaded;
+  g_mutex_unlock (&self->top_sites_mutex);
+
+  return loaded;
+}
+
+/**
+ * ephy_history_service_is_top_site:
+ * @self: an #EphyHistoryService
+ * @url: a URL
+ *
+ * Returns: whether @url is one of the top sites, see
+ *   ephy_history_service_set_top_sites_size()
+ **/
+gboolean
+ephy_history_service_is_top_site (EphyHistoryService *self,
+                                  const char         *url)
+{
+  gboolean found;
+
+  g_assert (EPHY_IS_HISTORY_SERVICE (self));
+
+  if (!url)
+    return FALSE;
+
+  g_mutex_lock (&self->top_sites_mutex);
+  found = top_sites_find (self->top_sites, url, NULL);
+  g_mutex_unlock (&self->top_sites_mutex);
+
+  return found;
+}
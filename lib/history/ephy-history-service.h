@@ -52,7 +52,11 @@ void                     ephy_history_service_get_url                 (EphyHisto
 void                     ephy_history_service_delete_urls             (EphyHistoryService *self, GList *urls, GCancellable *cancellable, EphyHistoryJobCallback callback, gpointer user_data);
 void                     ephy_history_service_find_urls               (EphyHistoryService *self, gint64 from, gint64 to, guint limit, gint host, GList *substring_list, EphyHistorySortType sort_type, GCancellable *cancellable, EphyHistoryJobCallback callback, gpointer user_data);
 void                     ephy_history_service_visit_url               (EphyHistoryService *self, const char *url, const char *sync_id, gint64 visit_time, EphyHistoryPageVisitType visit_type, gboolean should_notify);
+void                     ephy_history_service_visit_urls              (EphyHistoryService *self, GList *visits);
 void                     ephy_history_service_clear                   (EphyHistoryService *self, GCancellable *cancellable, EphyHistoryJobCallback callback, gpointer user_data);
 void                     ephy_history_service_find_hosts              (EphyHistoryService *self, gint64 from, gint64 to, GCancellable *cancellable, EphyHistoryJobCallback callback, gpointer user_data);
+void                     ephy_history_service_set_top_sites_size      (EphyHistoryService *self, guint size);
+gboolean                 ephy_history_service_get_top_sites           (EphyHistoryService *self, guint limit, GList **urls);
+gboolean                 ephy_history_service_is_top_site             (EphyHistoryService *self, const char *url);
 
 G_END_DECLS
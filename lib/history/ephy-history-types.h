@@ -47,7 +47,8 @@ typedef enum {
   EPHY_HISTORY_SORT_TITLE_ASCENDING,
   EPHY_HISTORY_SORT_TITLE_DESCENDING,
   EPHY_HISTORY_SORT_URL_ASCENDING,
-  EPHY_HISTORY_SORT_URL_DESCENDING
+  EPHY_HISTORY_SORT_URL_DESCENDING,
+  EPHY_HISTORY_SORT_FRECENCY
 } EphyHistorySortType;
 
 typedef struct
@@ -331,12 +331,40 @@ ephy_history_manager_handle_different_id_same_url (EphyHistoryManager *self,
   ephy_history_record_add_visit_time (remote, local_last_visit_time);
 }
 
+/* The visits of a merge are collected and stored in a single history job
+ * instead of one job, and one URL lookup round trip, per remote record.
+ */
+static GList *
+prepend_visit (GList      *visits,
+               const char *url,
+               const char *sync_id,
+               gint64      visit_time)
+{
+  EphyHistoryPageVisit *visit;
+
+  visit = ephy_history_page_visit_new (url, visit_time, EPHY_PAGE_VISIT_LINK);
+  visit->url->sync_id = g_strdup (sync_id);
+  visit->url->notify_visit = FALSE;
+
+  return g_list_prepend (visits, visit);
+}
+
+static void
+ephy_history_manager_store_visits (EphyHistoryManager *self,
+                                   GList              *visits)
+{
+  visits = g_list_reverse (visits);
+  ephy_history_service_visit_urls (self->service, visits);
+  ephy_history_page_visit_list_free (visits);
+}
+
 static GPtrArray *
 ephy_history_manager_handle_initial_merge (EphyHistoryManager *self,
                                            GHashTable         *records_ht_id,
                                            GHashTable         *records_ht_url,
                                            GList              *remote_records)
 {
+  GList *visits = NULL;
   EphyHistoryRecord *record;
   GHashTableIter iter;
   gpointer key, value;
@@ -368,9 +396,7 @@ ephy_history_manager_handle_initial_merge (EphyHistoryManager *self,
        * the local last visit time to the remote one. */
       local_last_visit_time = ephy_history_record_get_last_visit_time (record);
       if (remote_last_visit_time > local_last_visit_time)
-        ephy_history_service_visit_url (self->service, remote_url,
-                                        remote_id, remote_last_visit_time,
-                                        EPHY_PAGE_VISIT_LINK, FALSE);
+        visits = prepend_visit (visits, remote_url, remote_id, remote_last_visit_time);
 
       if (ephy_history_record_add_visit_time (l->data, local_last_visit_time))
         g_ptr_array_add (to_upload, g_object_ref (l->data));
@@ -388,13 +414,13 @@ ephy_history_manager_handle_initial_merge (EphyHistoryManager *self,
       } else {
         /* Different ID, different URL. This is a new record. */
         if (remote_last_visit_time > 0)
-          ephy_history_service_visit_url (self->service, remote_url,
-                                          remote_id, remote_last_visit_time,
-                                          EPHY_PAGE_VISIT_LINK, FALSE);
+          visits = prepend_visit (visits, remote_url, remote_id, remote_last_visit_time);
       }
     }
   }
 
+  ephy_history_manager_store_visits (self, visits);
+
   /* Set the remaining local records to be uploaded to server. */
   g_hash_table_iter_init (&iter, records_ht_id);
   while (g_hash_table_iter_next (&iter, &key, &value))
@@ -412,6 +438,7 @@ ephy_history_manager_handle_regular_merge (EphyHistoryManager *self,
 {
   EphyHistoryRecord *record;
   GPtrArray *to_upload;
+  GList *visits = NULL;
   const char *remote_id;
   const char *remote_url;
   gint64 remote_last_visit_time;
@@ -456,9 +483,7 @@ ephy_history_manager_handle_regular_merge (EphyHistoryManager *self,
         ephy_synchronizable_manager_remove (EPHY_SYNCHRONIZABLE_MANAGER (self),
                                             EPHY_SYNCHRONIZABLE (record));
       else if (remote_last_visit_time > local_last_visit_time)
-        ephy_history_service_visit_url (self->service, remote_url,
-                                        remote_id, remote_last_visit_time,
-                                        EPHY_PAGE_VISIT_LINK, FALSE);
+        visits = prepend_visit (visits, remote_url, remote_id, remote_last_visit_time);
     } else {
       /* Try find by URL. */
       record = g_hash_table_lookup (records_ht_url, remote_url);
@@ -470,13 +495,13 @@ ephy_history_manager_handle_regular_merge (EphyHistoryManager *self,
       } else {
         /* Different ID, different URL. This is a new record. */
         if (remote_last_visit_time > 0)
-          ephy_history_service_visit_url (self->service, remote_url,
-                                          remote_id, remote_last_visit_time,
-                                          EPHY_PAGE_VISIT_LINK, FALSE);
+          visits = prepend_visit (visits, remote_url, remote_id, remote_last_visit_time);
       }
     }
   }
 
+  ephy_history_manager_store_visits (self, visits);
+
   return to_upload;
 }
 
@@ -21,6 +21,8 @@
 #include "config.h"
 
 #include "ephy-password-import.h"
+
+#include "ephy-debug.h"
 #include "ephy-password-manager.h"
 #include "ephy-sqlite-connection.h"
 #include "ephy-uri-helpers.h"
@@ -105,11 +107,120 @@ decrypt (unsigned char *password,
   return out;
 }
 
-gboolean
-ephy_password_import_from_chrome (EphyPasswordManager  *manager,
-                                  ChromeType            type,
-                                  GError              **error)
+typedef struct {
+  EphyPasswordManager *manager;
+  GPtrArray *records;
+  gboolean *exists;
+} PasswordImportRecordsData;
+
+static void
+password_import_records_data_free (PasswordImportRecordsData *data)
+{
+  g_object_unref (data->manager);
+  g_ptr_array_unref (data->records);
+  g_free (data->exists);
+
+  g_free (data);
+}
+
+/* Only the records the index missed are looked up, and the secret service
+ * is searched from here so the main thread never blocks on it.
+ */
+static void
+ephy_password_import_records_thread_cb (GTask        *task,
+                                        gpointer      source_object,
+                                        gpointer      task_data,
+                                        GCancellable *cancellable)
 {
+  PasswordImportRecordsData *data = task_data;
+
+  for (guint i = 0; i < data->records->len; i++) {
+    EphyPasswordRecord *record = g_ptr_array_index (data->records, i);
+
+    if (data->exists[i])
+      continue;
+
+    data->exists[i] = ephy_password_manager_find (data->manager,
+                                                  ephy_password_record_get_origin (record),
+                                                  ephy_password_record_get_target_origin (record),
+                                                  ephy_password_record_get_username (record),
+                                                  ephy_password_record_get_username_field (record),
+                                                  ephy_password_record_get_password_field (record));
+  }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+ephy_password_import_records_checked_cb (GObject      *source_object,
+                                         GAsyncResult *result,
+                                         gpointer      user_data)
+{
+  g_autoptr (GTask) task = user_data;
+  PasswordImportRecordsData *data = g_task_get_task_data (G_TASK (result));
+
+  for (guint i = 0; i < data->records->len; i++) {
+    EphyPasswordRecord *record = g_ptr_array_index (data->records, i);
+    const char *username = ephy_password_record_get_username (record);
+
+    ephy_password_manager_save (data->manager,
+                                ephy_password_record_get_origin (record),
+                                ephy_password_record_get_target_origin (record),
+                                username,
+                                username,
+                                ephy_password_record_get_password (record),
+                                ephy_password_record_get_username_field (record),
+                                ephy_password_record_get_password_field (record),
+                                !data->exists[i]);
+  }
+
+  LOG ("Imported %u password records", data->records->len);
+  g_task_return_boolean (task, TRUE);
+}
+
+/* Records found in the password manager's index are known to exist. The
+ * others are checked against the secret service in a thread, then all of
+ * them are saved from the main thread, which owns the password manager.
+ */
+static void
+ephy_password_import_records_async (EphyPasswordManager *manager,
+                                    GPtrArray           *records,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+  g_autoptr (GTask) check_task = NULL;
+  PasswordImportRecordsData *data;
+  GTask *task;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+
+  data = g_new0 (PasswordImportRecordsData, 1);
+  data->manager = g_object_ref (manager);
+  data->records = g_ptr_array_ref (records);
+  data->exists = g_new0 (gboolean, records->len);
+
+  for (guint i = 0; i < records->len; i++) {
+    EphyPasswordRecord *record = g_ptr_array_index (records, i);
+
+    data->exists[i] = ephy_password_manager_find_cached (manager,
+                                                         ephy_password_record_get_origin (record),
+                                                         ephy_password_record_get_target_origin (record),
+                                                         ephy_password_record_get_username (record),
+                                                         ephy_password_record_get_username_field (record),
+                                                         ephy_password_record_get_password_field (record));
+  }
+
+  check_task = g_task_new (NULL, NULL, ephy_password_import_records_checked_cb, task);
+  g_task_set_task_data (check_task, data, (GDestroyNotify)password_import_records_data_free);
+  g_task_run_in_thread (check_task, ephy_password_import_records_thread_cb);
+}
+
+/* Runs in a thread: only reads and decrypts the browser's logins. */
+static GPtrArray *
+ephy_password_import_read_chrome (ChromeType   type,
+                                  GError     **error)
+{
+  g_autoptr (GPtrArray) records = NULL;
   g_autoptr (EphySQLiteConnection) connection = NULL;
   g_autoptr (EphySQLiteStatement) statement = NULL;
   g_autoptr (GError) my_error = NULL;
@@ -122,8 +233,9 @@ ephy_password_import_from_chrome (EphyPasswordManager  *manager,
   else if (type == CHROMIUM)
     filename = g_build_filename (g_get_user_config_dir (), "chromium", "Default", "Login Data", NULL);
   else
-    return FALSE;
+    return NULL;
 
+  records = g_ptr_array_new_with_free_func (g_object_unref);
 
   connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_MEMORY, filename);
   if (!connection) {
@@ -131,7 +243,7 @@ ephy_password_import_from_chrome (EphyPasswordManager  *manager,
                  PASSWORDS_IMPORT_ERROR,
                  PASSWORDS_IMPORT_ERROR_PASSWORDS,
                  _("Cannot create SQLite connection. Close browser and try again."));
-    return FALSE;
+    return NULL;
   }
 
   if (!ephy_sqlite_connection_open (connection, &my_error)) {
@@ -140,7 +252,7 @@ ephy_password_import_from_chrome (EphyPasswordManager  *manager,
                  PASSWORDS_IMPORT_ERROR,
                  PASSWORDS_IMPORT_ERROR_PASSWORDS,
                  _("Browser password database could not be opened. Close browser and try again."));
-    return FALSE;
+    return NULL;
   }
 
   statement = ephy_sqlite_connection_create_statement (connection, statement_str, &my_error);
@@ -152,7 +264,7 @@ ephy_password_import_from_chrome (EphyPasswordManager  *manager,
                  _("Browser password database could not be opened. Close browser and try again."));
 
     ephy_sqlite_connection_close (connection);
-    return FALSE;
+    return NULL;
   }
 
   while (ephy_sqlite_statement_step (statement, &my_error)) {
@@ -166,7 +278,6 @@ ephy_password_import_from_chrome (EphyPasswordManager  *manager,
     g_autofree char *decrypted_password = NULL;
     g_autofree char *secure_origin = NULL;
     g_autofree char *secure_target_origin = NULL;
-    gboolean exists;
 
     /* Skip unsupported protocols */
     if (!g_str_has_prefix (origin, "http") && !g_str_has_prefix (origin, "https"))
@@ -196,27 +307,15 @@ ephy_password_import_from_chrome (EphyPasswordManager  *manager,
     if (!secure_target_origin)
       secure_target_origin = g_strdup (secure_origin);
 
-    exists = ephy_password_manager_find (manager,
-                                         secure_origin,
-                                         secure_target_origin,
-                                         username,
-                                         username_field,
-                                         password_field);
-
-    ephy_password_manager_save (manager,
-                                secure_origin,
-                                secure_target_origin,
-                                username,
-                                username,
-                                decrypted_password,
-                                username_field,
-                                password_field,
-                                !exists);
+    g_ptr_array_add (records, ephy_password_record_new (NULL, secure_origin, secure_target_origin,
+                                                        username, decrypted_password,
+                                                        username_field, password_field,
+                                                        0, 0));
   }
 
   ephy_sqlite_connection_close (connection);
 
-  return TRUE;
+  return g_steal_pointer (&records);
 }
 
 typedef struct {
@@ -240,13 +339,49 @@ ephy_password_import_from_chrome_thread_cb (GTask        *task,
 {
   PasswordImportChromeData *data = task_data;
   GError *error = NULL;
-  gboolean retval;
+  GPtrArray *records;
 
-  retval = ephy_password_import_from_chrome (data->manager, data->type, &error);
+  records = ephy_password_import_read_chrome (data->type, &error);
   if (error)
     g_task_return_error (task, error);
   else
-    g_task_return_boolean (task, retval);
+    g_task_return_pointer (task, records, (GDestroyNotify)g_ptr_array_unref);
+}
+
+static void
+ephy_password_import_from_chrome_saved_cb (GObject      *source_object,
+                                           GAsyncResult *result,
+                                           gpointer      user_data)
+{
+  g_autoptr (GTask) task = user_data;
+
+  g_task_return_boolean (task, g_task_propagate_boolean (G_TASK (result), NULL));
+}
+
+static void
+ephy_password_import_from_chrome_read_cb (GObject      *source_object,
+                                          GAsyncResult *result,
+                                          gpointer      user_data)
+{
+  g_autoptr (GTask) task = user_data;
+  PasswordImportChromeData *data = g_task_get_task_data (G_TASK (result));
+  g_autoptr (GPtrArray) records = NULL;
+  GError *error = NULL;
+
+  records = g_task_propagate_pointer (G_TASK (result), &error);
+  if (error) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  if (!records) {
+    g_task_return_boolean (task, FALSE);
+    return;
+  }
+
+  ephy_password_import_records_async (data->manager, records,
+                                      ephy_password_import_from_chrome_saved_cb,
+                                      g_steal_pointer (&task));
 }
 
 void
@@ -256,6 +391,7 @@ ephy_password_import_from_chrome_async (EphyPasswordManager *manager,
                                         gpointer             user_data)
 {
   g_autoptr (GTask) task = NULL;
+  g_autoptr (GTask) read_task = NULL;
   PasswordImportChromeData *data = NULL;
 
   g_assert (manager);
@@ -267,9 +403,13 @@ ephy_password_import_from_chrome_async (EphyPasswordManager *manager,
   data->type = type;
   data->manager = g_object_ref (manager);
 
-  g_task_set_task_data (task, data, (void *)ephy_password_import_from_chrome_data_free);
+  /* The logins are read in a thread, then checked and stored by
+   * ephy_password_import_records_async().
+   */
+  read_task = g_task_new (NULL, NULL, ephy_password_import_from_chrome_read_cb, g_object_ref (task));
+  g_task_set_task_data (read_task, data, (void *)ephy_password_import_from_chrome_data_free);
 
-  g_task_run_in_thread (task, ephy_password_import_from_chrome_thread_cb);
+  g_task_run_in_thread (read_task, ephy_password_import_from_chrome_thread_cb);
 }
 
 gboolean
@@ -352,6 +492,7 @@ ephy_password_import_from_csv (EphyPasswordManager  *manager,
                                GError              **error)
 {
   g_autofree char *file_string = NULL;
+  g_autoptr (GPtrArray) records = NULL;
   char ***rows = NULL;
   char **header_row = NULL;
 
@@ -364,6 +505,7 @@ ephy_password_import_from_csv (EphyPasswordManager  *manager,
 
   rows = parse_csv (file_string);
   header_row = rows[0];
+  records = g_ptr_array_new_with_free_func (g_object_unref);
 
   for (guint i = 0; rows[i]; i++) {
     char **row = NULL;
@@ -377,7 +519,6 @@ ephy_password_import_from_csv (EphyPasswordManager  *manager,
     const gchar *scheme = NULL;
     const gchar *host = NULL;
     gint port;
-    gboolean exists;
     g_autoptr (GError) error = NULL;
 
     row = rows[i];
@@ -431,24 +572,14 @@ ephy_password_import_from_csv (EphyPasswordManager  *manager,
     else
       secure_origin = g_strdup_printf ("%s://%s", scheme, host);
 
-    exists = ephy_password_manager_find (manager,
-                                         secure_origin,
-                                         secure_origin,
-                                         username,
-                                         NULL,
-                                         NULL);
-
-    ephy_password_manager_save (manager,
-                                secure_origin,
-                                secure_origin,
-                                username,
-                                username,
-                                decrypted_password,
-                                NULL,
-                                NULL,
-                                !exists);
+    g_ptr_array_add (records, ephy_password_record_new (NULL, secure_origin, secure_origin,
+                                                        username, decrypted_password,
+                                                        NULL, NULL, 0, 0));
   }
 
+  /* The passwords are stored once the rows are checked in a thread. */
+  ephy_password_import_records_async (manager, records, NULL, NULL);
+
   for (guint k = 0; rows[k]; k++)
     g_strfreev (rows[k]);
 
@@ -23,12 +23,14 @@
 
 #include "ephy-debug.h"
 #include "ephy-settings.h"
+#include "ephy-sync-merge-index.h"
 #include "ephy-sync-utils.h"
 #include "ephy-synchronizable-manager.h"
 
 #include <glib/gi18n.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 
 void
 ephy_password_request_data_free (EphyPasswordRequestData *request_data)
@@ -64,10 +66,28 @@ ephy_password_manager_get_password_schema (void)
   return &schema;
 }
 
+/* Attributes of a stored password, without the secret itself. */
+typedef struct {
+  char *id;
+  char *origin;
+  char *target_origin;
+  char *username;
+  char *username_field;
+  char *password_field;
+} CachedCredential;
+
+static void cached_credential_free (CachedCredential *credential);
+
 struct _EphyPasswordManager {
   GObject parent_instance;
 
+  /* origin -> usernames, as returned by get_usernames_for_origin(). */
   GHashTable *cache;
+  /* origin -> GPtrArray of CachedCredential, answers existence checks of
+   * known passwords without a round trip to the secret service once loaded.
+   */
+  GHashTable *credentials;
+  gboolean credentials_loaded;
 };
 
 enum {
@@ -106,6 +126,8 @@ typedef struct {
   EphyPasswordManager *manager;
   EphyPasswordRecord *record;
   GTask *task;
+  /* Index entry replaced by a store, put back if the store fails. */
+  CachedCredential *previous;
 } ManageRecordAsyncData;
 
 typedef struct {
@@ -226,6 +248,7 @@ manage_record_async_data_free (ManageRecordAsyncData *data)
   g_clear_object (&data->manager);
   g_clear_object (&data->record);
   g_clear_object (&data->task);
+  g_clear_pointer (&data->previous, cached_credential_free);
 
   g_free (data);
 }
@@ -335,19 +358,197 @@ ephy_password_manager_cache_add (EphyPasswordManager *self,
   g_hash_table_replace (self->cache, g_strdup (origin), usernames);
 }
 
+static CachedCredential *
+cached_credential_new (EphyPasswordRecord *record)
+{
+  CachedCredential *credential;
+
+  credential = g_new (CachedCredential, 1);
+  credential->id = g_strdup (ephy_password_record_get_id (record));
+  credential->origin = g_strdup (ephy_password_record_get_origin (record));
+  credential->target_origin = g_strdup (ephy_password_record_get_target_origin (record));
+  credential->username = g_strdup (ephy_password_record_get_username (record));
+  credential->username_field = g_strdup (ephy_password_record_get_username_field (record));
+  credential->password_field = g_strdup (ephy_password_record_get_password_field (record));
+
+  return credential;
+}
+
+static void
+cached_credential_free (CachedCredential *credential)
+{
+  g_free (credential->id);
+  g_free (credential->origin);
+  g_free (credential->target_origin);
+  g_free (credential->username);
+  g_free (credential->username_field);
+  g_free (credential->password_field);
+  g_free (credential);
+}
+
+/* Same semantics as a secret service search: a NULL attribute matches
+ * anything.
+ */
+static gboolean
+cached_credential_matches (CachedCredential *credential,
+                           const char       *target_origin,
+                           const char       *username,
+                           const char       *username_field,
+                           const char       *password_field)
+{
+  return (!target_origin || !g_strcmp0 (credential->target_origin, target_origin)) &&
+         (!username || !g_strcmp0 (credential->username, username)) &&
+         (!username_field || !g_strcmp0 (credential->username_field, username_field)) &&
+         (!password_field || !g_strcmp0 (credential->password_field, password_field));
+}
+
+static gboolean
+credentials_match (GPtrArray  *credentials,
+                   const char *target_origin,
+                   const char *username,
+                   const char *username_field,
+                   const char *password_field)
+{
+  for (guint i = 0; credentials && i < credentials->len; i++) {
+    if (cached_credential_matches (g_ptr_array_index (credentials, i), target_origin,
+                                   username, username_field, password_field))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+ephy_password_manager_credentials_lookup (EphyPasswordManager *self,
+                                          const char          *origin,
+                                          const char          *target_origin,
+                                          const char          *username,
+                                          const char          *username_field,
+                                          const char          *password_field)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_assert (self->credentials_loaded);
+
+  if (origin)
+    return credentials_match (g_hash_table_lookup (self->credentials, origin),
+                              target_origin, username, username_field, password_field);
+
+  g_hash_table_iter_init (&iter, self->credentials);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    if (credentials_match (value, target_origin, username, username_field, password_field))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+credentials_have_username (GPtrArray  *credentials,
+                           const char *username)
+{
+  for (guint i = 0; credentials && i < credentials->len; i++) {
+    CachedCredential *credential = g_ptr_array_index (credentials, i);
+
+    if (!g_strcmp0 (credential->username, username))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Removes the entry of @id on @origin from the index and returns it. */
+static CachedCredential *
+ephy_password_manager_credentials_steal (EphyPasswordManager *self,
+                                         const char          *origin,
+                                         const char          *id)
+{
+  CachedCredential *credential = NULL;
+  GPtrArray *credentials;
+
+  if (!origin)
+    return NULL;
+
+  credentials = g_hash_table_lookup (self->credentials, origin);
+  for (guint i = 0; credentials && i < credentials->len; i++) {
+    if (!g_strcmp0 (((CachedCredential *)g_ptr_array_index (credentials, i))->id, id)) {
+      credential = g_ptr_array_steal_index_fast (credentials, i);
+      break;
+    }
+  }
+
+  if (credentials && credentials->len == 0)
+    g_hash_table_remove (self->credentials, origin);
+
+  /* Another form on the same origin may still use the username. */
+  if (credential &&
+      !credentials_have_username (g_hash_table_lookup (self->credentials, origin), credential->username))
+    ephy_password_manager_cache_remove (self, origin, credential->username);
+
+  return credential;
+}
+
+static void
+ephy_password_manager_credentials_remove (EphyPasswordManager *self,
+                                          EphyPasswordRecord  *record)
+{
+  const char *origin = ephy_password_record_get_origin (record);
+  const char *username = ephy_password_record_get_username (record);
+  CachedCredential *credential;
+
+  credential = ephy_password_manager_credentials_steal (self, origin, ephy_password_record_get_id (record));
+  g_clear_pointer (&credential, cached_credential_free);
+
+  /* The record may not have been indexed yet. */
+  if (origin && !credentials_have_username (g_hash_table_lookup (self->credentials, origin), username))
+    ephy_password_manager_cache_remove (self, origin, username);
+}
+
+/* Takes ownership of @credential, replacing the entry with the same id. */
+static void
+ephy_password_manager_credentials_insert (EphyPasswordManager *self,
+                                          CachedCredential    *credential)
+{
+  CachedCredential *replaced;
+  GPtrArray *credentials;
+
+  if (!credential->origin) {
+    cached_credential_free (credential);
+    return;
+  }
+
+  replaced = ephy_password_manager_credentials_steal (self, credential->origin, credential->id);
+  g_clear_pointer (&replaced, cached_credential_free);
+
+  credentials = g_hash_table_lookup (self->credentials, credential->origin);
+  if (!credentials) {
+    credentials = g_ptr_array_new_with_free_func ((GDestroyNotify)cached_credential_free);
+    g_hash_table_insert (self->credentials, g_strdup (credential->origin), credentials);
+  }
+  g_ptr_array_add (credentials, credential);
+
+  ephy_password_manager_cache_add (self, credential->origin, credential->username);
+}
+
+static void
+ephy_password_manager_credentials_add (EphyPasswordManager *self,
+                                       EphyPasswordRecord  *record)
+{
+  ephy_password_manager_credentials_insert (self, cached_credential_new (record));
+}
+
 static void
 populate_cache_cb (GList    *records,
                    gpointer  user_data)
 {
   EphyPasswordManager *self = EPHY_PASSWORD_MANAGER (user_data);
 
-  for (GList *l = records; l && l->data; l = l->next) {
-    EphyPasswordRecord *record = EPHY_PASSWORD_RECORD (l->data);
-    const char *origin = ephy_password_record_get_origin (record);
-    const char *username = ephy_password_record_get_username (record);
+  for (GList *l = records; l && l->data; l = l->next)
+    ephy_password_manager_credentials_add (self, EPHY_PASSWORD_RECORD (l->data));
 
-    ephy_password_manager_cache_add (self, origin, username);
-  }
+  self->credentials_loaded = TRUE;
+  LOG ("Loaded %u origins into internal cache", g_hash_table_size (self->credentials));
 }
 
 static void
@@ -360,6 +561,8 @@ ephy_password_manager_dispose (GObject *object)
     g_clear_pointer (&self->cache, g_hash_table_unref);
   }
 
+  g_clear_pointer (&self->credentials, g_hash_table_unref);
+
   G_OBJECT_CLASS (ephy_password_manager_parent_class)->dispose (object);
 }
 
@@ -382,6 +585,8 @@ ephy_password_manager_init (EphyPasswordManager *self)
 {
   LOG ("Loading usernames into internal cache...");
   self->cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->credentials = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify)g_ptr_array_unref);
   ephy_password_manager_query (self, NULL, NULL, NULL, NULL, NULL, NULL,
                                populate_cache_cb, self);
 }
@@ -426,8 +631,11 @@ secret_password_store_cb (GObject               *source_object,
                  error->message);
     }
     g_error_free (error);
-  } else {
-    ephy_password_manager_cache_add (data->manager, origin, username);
+    if (data->manager->credentials) {
+      ephy_password_manager_credentials_remove (data->manager, data->record);
+      if (data->previous)
+        ephy_password_manager_credentials_insert (data->manager, g_steal_pointer (&data->previous));
+    }
   }
 
   manage_record_async_data_free (data);
@@ -438,6 +646,7 @@ ephy_password_manager_store_record (EphyPasswordManager *self,
                                     EphyPasswordRecord  *record)
 {
   GHashTable *attributes;
+  ManageRecordAsyncData *data;
   const char *origin;
   const char *target_origin;
   const char *username;
@@ -477,10 +686,17 @@ ephy_password_manager_store_record (EphyPasswordManager *self,
                                      username_field, password_field,
                                      modified);
 
+  /* Indexed right away, so that a record stored twice in a row, e.g. a
+   * duplicate row of an import, is seen as existing the second time.
+   */
+  data = manage_record_async_data_new (self, record, NULL);
+  data->previous = ephy_password_manager_credentials_steal (self, origin, ephy_password_record_get_id (record));
+  ephy_password_manager_credentials_add (self, record);
+
   secret_password_storev (EPHY_FORM_PASSWORD_SCHEMA,
                           attributes, NULL, label, password, NULL,
                           (GAsyncReadyCallback)secret_password_store_cb,
-                          manage_record_async_data_new (self, record, NULL));
+                          data);
 
   g_free (label);
   g_hash_table_unref (attributes);
@@ -726,6 +942,28 @@ ephy_password_manager_query (EphyPasswordManager              *self,
   g_hash_table_unref (attributes);
 }
 
+/* Answers from the index only, on the main thread. The index misses
+ * passwords stored by other applications, or while it was loading, so
+ * FALSE does not mean there is no such password.
+ */
+gboolean
+ephy_password_manager_find_cached (EphyPasswordManager *self,
+                                   const char          *origin,
+                                   const char          *target_origin,
+                                   const char          *username,
+                                   const char          *username_field,
+                                   const char          *password_field)
+{
+  g_assert (EPHY_IS_PASSWORD_MANAGER (self));
+
+  return self->credentials_loaded &&
+         ephy_password_manager_credentials_lookup (self, origin, target_origin, username,
+                                                   username_field, password_field);
+}
+
+/* Blocks on the secret service and does not touch the index, so it can be
+ * called from a thread.
+ */
 gboolean
 ephy_password_manager_find (EphyPasswordManager *self,
                             const char          *origin,
@@ -817,9 +1055,7 @@ ephy_password_manager_forget_record (EphyPasswordManager *self,
                           (GAsyncReadyCallback)secret_password_clear_cb,
                           clear_cb_data);
 
-  ephy_password_manager_cache_remove (self,
-                                      ephy_password_record_get_origin (record),
-                                      ephy_password_record_get_username (record));
+  ephy_password_manager_credentials_remove (self, record);
   g_hash_table_unref (attributes);
 }
 
@@ -885,6 +1121,7 @@ forget_all_cb (GList    *records,
     g_signal_emit (self, signals[SYNCHRONIZABLE_DELETED], 0, l->data);
 
   ephy_password_manager_cache_clear (self);
+  g_hash_table_remove_all (self->credentials);
 
   g_hash_table_unref (attributes);
 }
@@ -994,58 +1231,68 @@ synchronizable_manager_save (EphySynchronizableManager *manager,
   ephy_password_manager_replace_existing (self, record);
 }
 
-static EphyPasswordRecord *
-get_record_by_id (GList      *records,
-                  const char *id)
+/* A NULL field must not match an empty one, and the fields are length
+ * prefixed so that no combination of them can collide with another.
+ */
+static char *
+get_tuple_key (const char *origin,
+               const char *target_origin,
+               const char *username,
+               const char *username_field,
+               const char *password_field)
 {
-  g_assert (id);
-
-  for (GList *l = records; l && l->data; l = l->next) {
-    if (!g_strcmp0 (ephy_password_record_get_id (l->data), id))
-      return l->data;
+  const char *fields[] = { origin, target_origin, username, username_field, password_field };
+  GString *key = g_string_new (NULL);
+
+  for (guint i = 0; i < G_N_ELEMENTS (fields); i++) {
+    if (fields[i])
+      g_string_append_printf (key, "%zu:%s", strlen (fields[i]), fields[i]);
+    else
+      g_string_append_c (key, '-');
   }
 
-  return NULL;
+  return g_string_free (key, FALSE);
 }
 
-static EphyPasswordRecord *
-get_record_by_parameters (GList      *records,
-                          const char *origin,
-                          const char *target_origin,
-                          const char *username,
-                          const char *username_field,
-                          const char *password_field)
-{
-  for (GList *l = records; l && l->data; l = l->next) {
-    if (!g_strcmp0 (ephy_password_record_get_username (l->data), username) &&
-        !g_strcmp0 (ephy_password_record_get_origin (l->data), origin) &&
-        !g_strcmp0 (ephy_password_record_get_target_origin (l->data), target_origin) &&
-        !g_strcmp0 (ephy_password_record_get_username_field (l->data), username_field) &&
-        !g_strcmp0 (ephy_password_record_get_password_field (l->data), password_field))
-      return l->data;
-  }
+static char *
+get_record_tuple_key (EphySynchronizable *synchronizable)
+{
+  EphyPasswordRecord *record = EPHY_PASSWORD_RECORD (synchronizable);
 
-  return NULL;
+  return get_tuple_key (ephy_password_record_get_origin (record),
+                        ephy_password_record_get_target_origin (record),
+                        ephy_password_record_get_username (record),
+                        ephy_password_record_get_username_field (record),
+                        ephy_password_record_get_password_field (record));
 }
 
+static EphyPasswordRecord *
+get_record_by_id (EphySyncMergeIndex *index,
+                  const char         *id)
+{
+  g_assert (id);
 
-static GList *
-delete_record_by_id (GList      *records,
-                     const char *id)
+  return (EphyPasswordRecord *)ephy_sync_merge_index_lookup_id (index, id);
+}
+
+static EphyPasswordRecord *
+get_record_by_parameters (EphySyncMergeIndex *index,
+                          const char         *origin,
+                          const char         *target_origin,
+                          const char         *username,
+                          const char         *username_field,
+                          const char         *password_field)
 {
-  for (GList *l = records; l && l->data; l = l->next) {
-    if (!g_strcmp0 (ephy_password_record_get_id (l->data), id)) {
-      g_object_unref (l->data);
-      return g_list_delete_link (records, l);
-    }
-  }
+  g_autofree char *key = get_tuple_key (origin, target_origin, username,
+                                        username_field, password_field);
 
-  return records;
+  return (EphyPasswordRecord *)ephy_sync_merge_index_lookup_key (index, key);
 }
 
 static GPtrArray *
 ephy_password_manager_handle_initial_merge (EphyPasswordManager *self,
                                             GList               *local_records,
+                                            EphySyncMergeIndex  *local_index,
                                             GList               *remote_records)
 {
   EphyPasswordRecord *record;
@@ -1086,7 +1333,7 @@ ephy_password_manager_handle_initial_merge (EphyPasswordManager *self,
     remote_timestamp = ephy_password_record_get_time_password_changed (l->data);
     remote_server_time_modified = ephy_synchronizable_get_server_time_modified (l->data);
 
-    record = get_record_by_id (local_records, remote_id);
+    record = get_record_by_id (local_index, remote_id);
     if (record) {
       if (!g_strcmp0 (ephy_password_record_get_password (record), remote_password)) {
         /* Same id, same password. Nothing to do. */
@@ -1110,7 +1357,7 @@ ephy_password_manager_handle_initial_merge (EphyPasswordManager *self,
         }
       }
     } else {
-      record = get_record_by_parameters (local_records,
+      record = get_record_by_parameters (local_index,
                                          remote_origin,
                                          remote_target_origin,
                                          remote_username,
@@ -1128,7 +1375,7 @@ ephy_password_manager_handle_initial_merge (EphyPasswordManager *self,
           g_hash_table_add (dont_upload, g_strdup (remote_id));
         }
       } else {
-        record = get_record_by_parameters (local_records,
+        record = get_record_by_parameters (local_index,
                                            remote_origin,
                                            remote_origin,
                                            remote_username,
@@ -1161,10 +1408,10 @@ ephy_password_manager_handle_initial_merge (EphyPasswordManager *self,
 }
 
 static GPtrArray *
-ephy_password_manager_handle_regular_merge (EphyPasswordManager  *self,
-                                            GList               **local_records,
-                                            GList                *deleted_records,
-                                            GList                *updated_records)
+ephy_password_manager_handle_regular_merge (EphyPasswordManager *self,
+                                            EphySyncMergeIndex  *local_index,
+                                            GList               *deleted_records,
+                                            GList               *updated_records)
 {
   EphyPasswordRecord *record;
   GPtrArray *to_upload;
@@ -1183,10 +1430,10 @@ ephy_password_manager_handle_regular_merge (EphyPasswordManager  *self,
 
   for (GList *l = deleted_records; l && l->data; l = l->next) {
     remote_id = ephy_password_record_get_id (l->data);
-    record = get_record_by_id (*local_records, remote_id);
+    record = get_record_by_id (local_index, remote_id);
     if (record) {
       ephy_password_manager_forget_record (self, record, NULL, NULL);
-      *local_records = delete_record_by_id (*local_records, remote_id);
+      ephy_sync_merge_index_remove (local_index, EPHY_SYNCHRONIZABLE (record));
     }
   }
 
@@ -1200,12 +1447,12 @@ ephy_password_manager_handle_regular_merge (EphyPasswordManager  *self,
     remote_password_field = ephy_password_record_get_password_field (l->data);
     remote_timestamp = ephy_password_record_get_time_password_changed (l->data);
 
-    record = get_record_by_id (*local_records, remote_id);
+    record = get_record_by_id (local_index, remote_id);
     if (record) {
       /* Same id. Overwrite local record. */
       ephy_password_manager_forget_record (self, record, l->data, NULL);
     } else {
-      record = get_record_by_parameters (*local_records,
+      record = get_record_by_parameters (local_index,
                                          remote_origin,
                                          remote_target_origin,
                                          remote_username,
@@ -1237,13 +1484,22 @@ merge_cb (GList    *records,
           gpointer  user_data)
 {
   MergePasswordsAsyncData *data = (MergePasswordsAsyncData *)user_data;
+  g_autoptr (EphySyncMergeIndex) local_index = NULL;
   GPtrArray *to_upload;
 
+  /* Index the local records once, the merge then costs a lookup per remote
+   * record instead of a scan of the local records.
+   */
+  local_index = ephy_sync_merge_index_new (get_record_tuple_key);
+  for (GList *l = records; l && l->data; l = l->next)
+    ephy_sync_merge_index_add (local_index, l->data);
+
   if (data->is_initial)
     to_upload = ephy_password_manager_handle_initial_merge (data->manager, records,
+                                                            local_index,
                                                             data->remotes_updated);
   else
-    to_upload = ephy_password_manager_handle_regular_merge (data->manager, &records,
+    to_upload = ephy_password_manager_handle_regular_merge (data->manager, local_index,
                                                             data->remotes_deleted,
                                                             data->remotes_updated);
 
@@ -85,6 +85,12 @@ gboolean             ephy_password_manager_find                     (EphyPasswor
                                                                      const char                       *username,
                                                                      const char                       *username_field,
                                                                      const char                       *password_field);
+gboolean             ephy_password_manager_find_cached              (EphyPasswordManager              *self,
+                                                                     const char                       *origin,
+                                                                     const char                       *target_origin,
+                                                                     const char                       *username,
+                                                                     const char                       *username_field,
+                                                                     const char                       *password_field);
 void                 ephy_password_manager_forget                    (EphyPasswordManager *self,
                                                                       const char          *id,
                                                                       GCancellable        *cancellable,
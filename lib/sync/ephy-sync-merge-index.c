@@ -0,0 +1,201 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-sync-merge-index.h"
+
+/* Local records indexed by sync id and by a secondary key, so that merging
+ * remote records is a single pass of hash lookups instead of a scan of the
+ * local records for every remote one. Each id and key maps to the queue of
+ * records sharing it, in the order they were added: lookups return the first
+ * one, like a linear search would find it, and removing it exposes the next.
+ */
+struct _EphySyncMergeIndex {
+  EphySyncMergeIndexKeyFunc key_func;
+  GHashTable *by_id;
+  GHashTable *by_key;
+};
+
+static void
+records_free (GQueue *records)
+{
+  g_queue_free_full (records, g_object_unref);
+}
+
+static void
+records_add (GHashTable         *table,
+             char               *name,
+             EphySynchronizable *synchronizable)
+{
+  GQueue *records;
+
+  records = g_hash_table_lookup (table, name);
+  if (records) {
+    g_free (name);
+  } else {
+    records = g_queue_new ();
+    g_hash_table_insert (table, name, records);
+  }
+
+  g_queue_push_tail (records, g_object_ref (synchronizable));
+}
+
+static void
+records_remove (GHashTable         *table,
+                const char         *name,
+                EphySynchronizable *synchronizable)
+{
+  GQueue *records;
+
+  records = g_hash_table_lookup (table, name);
+  if (!records || !g_queue_remove (records, synchronizable))
+    return;
+
+  g_object_unref (synchronizable);
+  if (g_queue_is_empty (records))
+    g_hash_table_remove (table, name);
+}
+
+static EphySynchronizable *
+records_lookup (GHashTable *table,
+                const char *name)
+{
+  GQueue *records;
+
+  records = g_hash_table_lookup (table, name);
+
+  return records ? g_queue_peek_head (records) : NULL;
+}
+
+EphySyncMergeIndex *
+ephy_sync_merge_index_new (EphySyncMergeIndexKeyFunc key_func)
+{
+  EphySyncMergeIndex *index;
+
+  g_assert (key_func);
+
+  index = g_new (EphySyncMergeIndex, 1);
+  index->key_func = key_func;
+  index->by_id = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)records_free);
+  index->by_key = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)records_free);
+
+  return index;
+}
+
+void
+ephy_sync_merge_index_free (EphySyncMergeIndex *index)
+{
+  g_assert (index);
+
+  g_hash_table_unref (index->by_id);
+  g_hash_table_unref (index->by_key);
+  g_free (index);
+}
+
+void
+ephy_sync_merge_index_add (EphySyncMergeIndex *index,
+                           EphySynchronizable *synchronizable)
+{
+  const char *id;
+  char *key;
+
+  g_assert (index);
+  g_assert (EPHY_IS_SYNCHRONIZABLE (synchronizable));
+
+  id = ephy_synchronizable_get_id (synchronizable);
+  if (id)
+    records_add (index->by_id, g_strdup (id), synchronizable);
+
+  key = index->key_func (synchronizable);
+  if (key)
+    records_add (index->by_key, key, synchronizable);
+}
+
+void
+ephy_sync_merge_index_remove (EphySyncMergeIndex *index,
+                              EphySynchronizable *synchronizable)
+{
+  const char *id;
+  char *key;
+
+  g_assert (index);
+  g_assert (EPHY_IS_SYNCHRONIZABLE (synchronizable));
+
+  /* The tables may hold the last references, so compute everything first. */
+  g_object_ref (synchronizable);
+
+  key = index->key_func (synchronizable);
+  if (key)
+    records_remove (index->by_key, key, synchronizable);
+
+  id = ephy_synchronizable_get_id (synchronizable);
+  if (id)
+    records_remove (index->by_id, id, synchronizable);
+
+  g_free (key);
+  g_object_unref (synchronizable);
+}
+
+EphySynchronizable *
+ephy_sync_merge_index_lookup_id (EphySyncMergeIndex *index,
+                                 const char         *id)
+{
+  g_assert (index);
+
+  if (!id)
+    return NULL;
+
+  return records_lookup (index->by_id, id);
+}
+
+EphySynchronizable *
+ephy_sync_merge_index_lookup_key (EphySyncMergeIndex *index,
+                                  const char         *key)
+{
+  g_assert (index);
+
+  if (!key)
+    return NULL;
+
+  return records_lookup (index->by_key, key);
+}
+
+/* Returns the records found by id, owned by @index. Free the list only. */
+GList *
+ephy_sync_merge_index_get_values (EphySyncMergeIndex *index)
+{
+  GHashTableIter iter;
+  GQueue *records;
+  GList *values = NULL;
+
+  g_assert (index);
+
+  g_hash_table_iter_init (&iter, index->by_id);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&records))
+    values = g_list_prepend (values, g_queue_peek_head (records));
+
+  return values;
+}
+
+guint
+ephy_sync_merge_index_get_size (EphySyncMergeIndex *index)
+{
+  g_assert (index);
+
+  return g_hash_table_size (index->by_id);
+}
@@ -0,0 +1,49 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-synchronizable.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EphySyncMergeIndex EphySyncMergeIndex;
+
+/* Returns a newly allocated key identifying @synchronizable besides its id,
+ * e.g. its URL, or %NULL if it has none.
+ */
+typedef char * (*EphySyncMergeIndexKeyFunc) (EphySynchronizable *synchronizable);
+
+EphySyncMergeIndex *ephy_sync_merge_index_new         (EphySyncMergeIndexKeyFunc  key_func);
+void                ephy_sync_merge_index_free        (EphySyncMergeIndex        *index);
+void                ephy_sync_merge_index_add         (EphySyncMergeIndex        *index,
+                                                       EphySynchronizable        *synchronizable);
+void                ephy_sync_merge_index_remove      (EphySyncMergeIndex        *index,
+                                                       EphySynchronizable        *synchronizable);
+EphySynchronizable *ephy_sync_merge_index_lookup_id   (EphySyncMergeIndex        *index,
+                                                       const char                *id);
+EphySynchronizable *ephy_sync_merge_index_lookup_key  (EphySyncMergeIndex        *index,
+                                                       const char                *key);
+GList              *ephy_sync_merge_index_get_values  (EphySyncMergeIndex        *index);
+guint               ephy_sync_merge_index_get_size    (EphySyncMergeIndex        *index);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EphySyncMergeIndex, ephy_sync_merge_index_free)
+
+G_END_DECLS
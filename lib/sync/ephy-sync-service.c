@@ -92,6 +92,7 @@ enum {
   LOAD_FINISHED,
   SIGN_IN_ERROR,
   SYNC_FINISHED,
+  SYNC_PROGRESS,
   LAST_SIGNAL
 };
 
@@ -106,7 +107,7 @@ typedef struct {
   char *method;
   char *request_body;
   gint64 modified_since;
-  gint64 unmodified_since;
+  gdouble unmodified_since;
   SoupSessionCallback callback;
   gpointer user_data;
 } StorageRequestAsyncData;
@@ -123,13 +124,35 @@ typedef struct {
   guint8 *resp_xor_key;
 } SignInAsyncData;
 
+/* A collection is downloaded in pages of EPHY_SYNC_PAGE_SIZE records. Pages
+ * are merged as soon as they are decrypted, except for the initial sync which
+ * needs every remote record to know which local records are missing from the
+ * server. What the merges return is uploaded after the last page, so that the
+ * sync time is only advanced once the whole collection has been seen.
+ *
+ * Later pages are requested with the X-Last-Modified of the first one as
+ * X-If-Unmodified-Since, so a collection changed by another client while
+ * paging fails with 412 and the sync of the collection starts over.
+ */
 typedef struct {
   EphySyncService *service;
   EphySynchronizableManager *manager;
   gboolean is_initial;
   gboolean is_last;
+  char *endpoint;
+  guint pending_pages;
+  guint downloaded;
+  guint decrypted;
+  gboolean failed;
+  gboolean modified_while_paging;
+  guint attempt;
+  gdouble last_modified;
+  gboolean is_merging;
   GList *remotes_deleted;
   GList *remotes_updated;
+  GList *merging_deleted;
+  GList *merging_updated;
+  GPtrArray *to_upload;
 } SyncCollectionAsyncData;
 
 typedef struct {
@@ -149,12 +172,48 @@ typedef struct {
   gboolean sync_done;
 } BatchUploadAsyncData;
 
+/* Records are encrypted and decrypted in chunks of EPHY_SYNC_BATCH_SIZE, each
+ * chunk in a GTask worker thread. The results are handed back to the main loop
+ * and only used once every chunk of the collection has been processed.
+ */
+typedef struct {
+  BatchUploadAsyncData *data;
+  SyncCryptoKeyBundle *bundle;
+  char *endpoint;
+  GPtrArray *batches;
+  guint pending;
+  guint done;
+  guint total;
+} EncryptBatchesAsyncData;
+
+typedef struct {
+  EncryptBatchesAsyncData *batches_data;
+  guint index;
+  GPtrArray *records;
+} EncryptBatchData;
+
+typedef struct {
+  SyncCollectionAsyncData *data;
+  SyncCryptoKeyBundle *bundle;
+  JsonNode *node;
+  GType type;
+  guint pending;
+} DecryptCollectionAsyncData;
+
+typedef struct {
+  DecryptCollectionAsyncData *collection_data;
+  guint start;
+  guint end;
+  GList *remotes_deleted;
+  GList *remotes_updated;
+} DecryptChunkData;
+
 static StorageRequestAsyncData *
 storage_request_async_data_new (const char          *endpoint,
                                 const char          *method,
                                 const char          *request_body,
                                 gint64               modified_since,
-                                gint64               unmodified_since,
+                                gdouble              unmodified_since,
                                 SoupSessionCallback  callback,
                                 gpointer             user_data)
 {
@@ -298,7 +357,8 @@ static SyncCollectionAsyncData *
 sync_collection_async_data_new (EphySyncService           *service,
                                 EphySynchronizableManager *manager,
                                 gboolean                   is_initial,
-                                gboolean                   is_last)
+                                gboolean                   is_last,
+                                const char                *endpoint)
 {
   SyncCollectionAsyncData *data;
 
@@ -307,8 +367,20 @@ sync_collection_async_data_new (EphySyncService           *service,
   data->manager = g_object_ref (manager);
   data->is_initial = is_initial;
   data->is_last = is_last;
+  data->endpoint = g_strdup (endpoint);
+  data->pending_pages = 0;
+  data->downloaded = 0;
+  data->decrypted = 0;
+  data->failed = FALSE;
+  data->modified_while_paging = FALSE;
+  data->attempt = 0;
+  data->last_modified = -1;
+  data->is_merging = FALSE;
   data->remotes_deleted = NULL;
   data->remotes_updated = NULL;
+  data->merging_deleted = NULL;
+  data->merging_updated = NULL;
+  data->to_upload = g_ptr_array_new_with_free_func (g_object_unref);
 
   return data;
 }
@@ -320,8 +392,13 @@ sync_collection_async_data_free (SyncCollectionAsyncData *data)
 
   g_object_unref (data->service);
   g_object_unref (data->manager);
+  g_free (data->endpoint);
   g_list_free_full (data->remotes_deleted, g_object_unref);
   g_list_free_full (data->remotes_updated, g_object_unref);
+  g_list_free_full (data->merging_deleted, g_object_unref);
+  g_list_free_full (data->merging_updated, g_object_unref);
+  if (data->to_upload)
+    g_ptr_array_unref (data->to_upload);
   g_free (data);
 }
 
@@ -399,6 +476,83 @@ batch_upload_async_data_free (BatchUploadAsyncData *data)
   g_free (data);
 }
 
+static EncryptBatchesAsyncData *
+encrypt_batches_async_data_new (BatchUploadAsyncData *data,
+                                SyncCryptoKeyBundle  *bundle,
+                                const char           *endpoint)
+{
+  EncryptBatchesAsyncData *batches_data;
+
+  batches_data = g_new (EncryptBatchesAsyncData, 1);
+  batches_data->data = batch_upload_async_data_dup (data);
+  batches_data->bundle = bundle;
+  batches_data->endpoint = g_strdup (endpoint);
+  batches_data->batches = g_ptr_array_new_with_free_func (g_free);
+  batches_data->pending = 0;
+  batches_data->done = 0;
+  batches_data->total = data->end - data->start;
+
+  return batches_data;
+}
+
+static void
+encrypt_batches_async_data_free (EncryptBatchesAsyncData *batches_data)
+{
+  g_assert (batches_data);
+
+  batch_upload_async_data_free (batches_data->data);
+  ephy_sync_crypto_key_bundle_free (batches_data->bundle);
+  g_free (batches_data->endpoint);
+  g_ptr_array_unref (batches_data->batches);
+  g_free (batches_data);
+}
+
+static void
+encrypt_batch_data_free (EncryptBatchData *batch)
+{
+  g_assert (batch);
+
+  g_ptr_array_unref (batch->records);
+  g_free (batch);
+}
+
+static DecryptCollectionAsyncData *
+decrypt_collection_async_data_new (SyncCollectionAsyncData *data,
+                                   SyncCryptoKeyBundle     *bundle,
+                                   JsonNode                *node)
+{
+  DecryptCollectionAsyncData *collection_data;
+
+  collection_data = g_new (DecryptCollectionAsyncData, 1);
+  collection_data->data = data;
+  collection_data->bundle = bundle;
+  collection_data->node = json_node_ref (node);
+  collection_data->type = ephy_synchronizable_manager_get_synchronizable_type (data->manager);
+  collection_data->pending = 0;
+
+  return collection_data;
+}
+
+static void
+decrypt_collection_async_data_free (DecryptCollectionAsyncData *collection_data)
+{
+  g_assert (collection_data);
+
+  ephy_sync_crypto_key_bundle_free (collection_data->bundle);
+  json_node_unref (collection_data->node);
+  g_free (collection_data);
+}
+
+static void
+decrypt_chunk_data_free (DecryptChunkData *chunk)
+{
+  g_assert (chunk);
+
+  g_list_free_full (chunk->remotes_deleted, g_object_unref);
+  g_list_free_full (chunk->remotes_updated, g_object_unref);
+  g_free (chunk);
+}
+
 static void
 ephy_sync_service_set_property (GObject      *object,
                                 guint         prop_id,
@@ -609,7 +763,7 @@ ephy_sync_service_send_storage_request (EphySyncService         *self,
   SoupMessageHeaders *request_headers;
   char *url;
   char *if_modified_since = NULL;
-  char *if_unmodified_since = NULL;
+  char if_unmodified_since[G_ASCII_DTOSTR_BUF_SIZE];
   const char *content_type = "application/json; charset=utf-8";
 
   g_assert (EPHY_IS_SYNC_SERVICE (self));
@@ -638,8 +792,11 @@ ephy_sync_service_send_storage_request (EphySyncService         *self,
     soup_message_headers_append (request_headers, "X-If-Modified-Since", if_modified_since);
   }
 
+  /* Server timestamps have two decimals, truncating them would make the
+   * precondition fail against the very version it was read from.
+   */
   if (data->unmodified_since >= 0) {
-    if_unmodified_since = g_strdup_printf ("%" PRId64, data->unmodified_since);
+    g_ascii_formatd (if_unmodified_since, sizeof (if_unmodified_since), "%.2f", data->unmodified_since);
     soup_message_headers_append (request_headers, "X-If-Unmodified-Since", if_unmodified_since);
   }
 
@@ -655,7 +812,6 @@ ephy_sync_service_send_storage_request (EphySyncService         *self,
 
   g_free (url);
   g_free (if_modified_since);
-  g_free (if_unmodified_since);
   ephy_sync_crypto_hawk_header_free (header);
   if (options)
     ephy_sync_crypto_hawk_options_free (options);
@@ -1221,7 +1377,7 @@ ephy_sync_service_queue_storage_request (EphySyncService     *self,
                                          const char          *method,
                                          const char          *request_body,
                                          gint64               modified_since,
-                                         gint64               unmodified_since,
+                                         gdouble              unmodified_since,
                                          SoupSessionCallback  callback,
                                          gpointer             user_data)
 {
@@ -1508,51 +1664,6 @@ ephy_sync_service_upload_synchronizable (EphySyncService           *self,
   ephy_sync_crypto_key_bundle_free (bundle);
 }
 
-static GPtrArray *
-ephy_sync_service_split_into_batches (EphySyncService           *self,
-                                      EphySynchronizableManager *manager,
-                                      GPtrArray                 *synchronizables,
-                                      guint                      start,
-                                      guint                      end)
-{
-  SyncCryptoKeyBundle *bundle;
-  GPtrArray *batches;
-  const char *collection;
-
-  g_assert (EPHY_IS_SYNC_SERVICE (self));
-  g_assert (EPHY_IS_SYNCHRONIZABLE_MANAGER (manager));
-  g_assert (synchronizables);
-
-  collection = ephy_synchronizable_manager_get_collection_name (manager);
-  bundle = ephy_sync_service_get_key_bundle (self, collection);
-  if (!bundle)
-    return NULL;
-
-  batches = g_ptr_array_new_with_free_func (g_free);
-
-  for (guint i = start; i < end; i += EPHY_SYNC_BATCH_SIZE) {
-    JsonNode *node = json_node_new (JSON_NODE_ARRAY);
-    JsonArray *array = json_array_new ();
-
-    for (guint k = i; k < MIN (i + EPHY_SYNC_BATCH_SIZE, end); k++) {
-      EphySynchronizable *synchronizable = g_ptr_array_index (synchronizables, k);
-      JsonNode *bso = ephy_synchronizable_to_bso (synchronizable, bundle);
-      JsonObject *object = json_object_ref (json_node_get_object (bso));
-
-      json_array_add_object_element (array, object);
-      json_node_unref (bso);
-    }
-
-    json_node_take_array (node, array);
-    g_ptr_array_add (batches, json_to_string (node, FALSE));
-    json_node_unref (node);
-  }
-
-  ephy_sync_crypto_key_bundle_free (bundle);
-
-  return batches;
-}
-
 static void
 commit_batch_cb (SoupSession *session,
                  SoupMessage *msg,
@@ -1623,13 +1734,140 @@ out:
   batch_upload_async_data_free (data);
 }
 
+static void
+ephy_sync_service_report_progress (EphySyncService           *self,
+                                   EphySynchronizableManager *manager,
+                                   gboolean                   is_upload,
+                                   guint                      done,
+                                   guint                      total)
+{
+  const char *collection;
+
+  collection = ephy_synchronizable_manager_get_collection_name (manager);
+  LOG ("%s %u/%u records in %s collection",
+       is_upload ? "Encrypted" : "Decrypted", done, total, collection);
+  g_signal_emit (self, signals[SYNC_PROGRESS], 0, collection, is_upload, done, total);
+}
+
+static void
+encrypt_batch_thread (GTask        *task,
+                      gpointer      source_object,
+                      gpointer      task_data,
+                      GCancellable *cancellable)
+{
+  EncryptBatchData *batch = task_data;
+  SyncCryptoKeyBundle *bundle = batch->batches_data->bundle;
+  JsonNode *node = json_node_new (JSON_NODE_ARRAY);
+  JsonArray *array = json_array_new ();
+
+  /* Records are stored as consecutive (id, cleartext) pairs. */
+  for (guint i = 0; i + 1 < batch->records->len; i += 2) {
+    JsonObject *object = json_object_new ();
+    char *payload;
+
+    payload = ephy_sync_crypto_encrypt_record (g_ptr_array_index (batch->records, i + 1), bundle);
+    json_object_set_string_member (object, "id", g_ptr_array_index (batch->records, i));
+    json_object_set_string_member (object, "payload", payload);
+    json_array_add_object_element (array, object);
+    g_free (payload);
+  }
+
+  json_node_take_array (node, array);
+  g_task_return_pointer (task, json_to_string (node, FALSE), g_free);
+  json_node_unref (node);
+}
+
+static void
+encrypt_batch_cb (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  EphySyncService *self = EPHY_SYNC_SERVICE (source_object);
+  EncryptBatchData *batch = g_task_get_task_data (G_TASK (result));
+  EncryptBatchesAsyncData *batches_data = batch->batches_data;
+  BatchUploadAsyncData *data = batches_data->data;
+
+  g_ptr_array_index (batches_data->batches, batch->index) = g_task_propagate_pointer (G_TASK (result), NULL);
+  batches_data->done += batch->records->len / 2;
+  ephy_sync_service_report_progress (self, data->manager, TRUE,
+                                     batches_data->done, batches_data->total);
+
+  if (--batches_data->pending > 0)
+    return;
+
+  /* Every batch is encrypted, queue them in their original order so that the
+   * last one still triggers the commit.
+   */
+  for (guint i = 0; i < batches_data->batches->len; i++) {
+    BatchUploadAsyncData *data_dup = batch_upload_async_data_dup (data);
+
+    if (i == batches_data->batches->len - 1)
+      data_dup->batch_is_last = TRUE;
+
+    ephy_sync_service_queue_storage_request (self, batches_data->endpoint, SOUP_METHOD_POST,
+                                             g_ptr_array_index (batches_data->batches, i), -1, -1,
+                                             upload_batch_cb, data_dup);
+  }
+
+  encrypt_batches_async_data_free (batches_data);
+}
+
+static void
+ephy_sync_service_encrypt_batches (EphySyncService      *self,
+                                   BatchUploadAsyncData *data,
+                                   const char           *endpoint)
+{
+  EncryptBatchesAsyncData *batches_data;
+  SyncCryptoKeyBundle *bundle;
+  const char *collection;
+
+  g_assert (EPHY_IS_SYNC_SERVICE (self));
+  g_assert (data->start < data->end);
+
+  collection = ephy_synchronizable_manager_get_collection_name (data->manager);
+  bundle = ephy_sync_service_get_key_bundle (self, collection);
+  if (!bundle)
+    return;
+
+  batches_data = encrypt_batches_async_data_new (data, bundle, endpoint);
+
+  for (guint i = data->start; i < data->end; i += EPHY_SYNC_BATCH_SIZE) {
+    EncryptBatchData *batch;
+    GTask *task;
+
+    batch = g_new (EncryptBatchData, 1);
+    batch->batches_data = batches_data;
+    batch->index = batches_data->batches->len;
+    batch->records = g_ptr_array_new_with_free_func (g_free);
+
+    /* The records are live objects owned by their managers, so they are
+     * serialized here on the main thread, the same way
+     * ephy_synchronizable_default_to_bso() does. Only the encryption runs
+     * in the worker.
+     */
+    for (guint k = i; k < MIN (i + EPHY_SYNC_BATCH_SIZE, data->end); k++) {
+      EphySynchronizable *synchronizable = g_ptr_array_index (data->synchronizables, k);
+
+      g_ptr_array_add (batch->records, g_strdup (ephy_synchronizable_get_id (synchronizable)));
+      g_ptr_array_add (batch->records, json_gobject_to_data (G_OBJECT (synchronizable), NULL));
+    }
+
+    g_ptr_array_add (batches_data->batches, NULL);
+    batches_data->pending++;
+
+    task = g_task_new (self, NULL, encrypt_batch_cb, NULL);
+    g_task_set_task_data (task, batch, (GDestroyNotify)encrypt_batch_data_free);
+    g_task_run_in_thread (task, encrypt_batch_thread);
+    g_object_unref (task);
+  }
+}
+
 static void
 start_batch_upload_cb (SoupSession *session,
                        SoupMessage *msg,
                        gpointer     user_data)
 {
   BatchUploadAsyncData *data = user_data;
-  GPtrArray *batches = NULL;
   JsonNode *node = NULL;
   JsonObject *object;
   g_autoptr (GError) error = NULL;
@@ -1660,29 +1898,20 @@ start_batch_upload_cb (SoupSession *session,
   collection = ephy_synchronizable_manager_get_collection_name (data->manager);
   endpoint = g_strdup_printf ("storage/%s?batch=%s", collection, data->batch_id);
 
-  batches = ephy_sync_service_split_into_batches (data->service, data->manager,
-                                                  data->synchronizables,
-                                                  data->start, data->end);
-  for (guint i = 0; i < batches->len; i++) {
-    BatchUploadAsyncData *data_dup = batch_upload_async_data_dup (data);
-
-    if (i == batches->len - 1)
-      data_dup->batch_is_last = TRUE;
-
-    ephy_sync_service_queue_storage_request (data->service, endpoint, SOUP_METHOD_POST,
-                                             g_ptr_array_index (batches, i), -1, -1,
-                                             upload_batch_cb, data_dup);
-  }
+  ephy_sync_service_encrypt_batches (data->service, data, endpoint);
 
 out:
   g_free (endpoint);
   if (node)
     json_node_unref (node);
-  if (batches)
-    g_ptr_array_unref (batches);
   batch_upload_async_data_free (data);
 }
 
+static void sync_collection_start (EphySyncService           *self,
+                                   EphySynchronizableManager *manager,
+                                   gboolean                   is_last,
+                                   guint                      attempt);
+
 static void
 merge_collection_finished_cb (GPtrArray *to_upload,
                               gpointer   user_data)
@@ -1693,9 +1922,20 @@ merge_collection_finished_cb (GPtrArray *to_upload,
   const char *collection;
   char *endpoint = NULL;
 
+  if (data->modified_while_paging && data->attempt < EPHY_SYNC_MAX_COLLECTION_RESTARTS) {
+    LOG ("%s collection was modified while paging, restarting sync...",
+         ephy_synchronizable_manager_get_collection_name (data->manager));
+    if (to_upload)
+      g_ptr_array_unref (to_upload);
+    sync_collection_start (data->service, data->manager, data->is_last, data->attempt + 1);
+    goto out;
+  }
+
   if (!to_upload || to_upload->len == 0) {
     if (data->is_last)
       g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
+    if (to_upload)
+      g_ptr_array_unref (to_upload);
     goto out;
   }
 
@@ -1718,28 +1958,175 @@ out:
   sync_collection_async_data_free (data);
 }
 
+static void
+decrypt_chunk_thread (GTask        *task,
+                      gpointer      source_object,
+                      gpointer      task_data,
+                      GCancellable *cancellable)
+{
+  DecryptChunkData *chunk = task_data;
+  DecryptCollectionAsyncData *collection_data = chunk->collection_data;
+  JsonArray *array = json_node_get_array (collection_data->node);
+  EphySynchronizable *remote;
+  gboolean is_deleted;
+
+  for (guint i = chunk->start; i < chunk->end; i++) {
+    remote = EPHY_SYNCHRONIZABLE (ephy_synchronizable_from_bso (json_array_get_element (array, i),
+                                                                collection_data->type,
+                                                                collection_data->bundle,
+                                                                &is_deleted));
+    if (!remote) {
+      g_warning ("Failed to create synchronizable object from BSO, skipping...");
+      continue;
+    }
+    if (is_deleted)
+      chunk->remotes_deleted = g_list_prepend (chunk->remotes_deleted, remote);
+    else
+      chunk->remotes_updated = g_list_prepend (chunk->remotes_updated, remote);
+  }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void sync_collection_merge_pending (SyncCollectionAsyncData *data);
+
+static void
+merge_page_finished_cb (GPtrArray *to_upload,
+                        gpointer   user_data)
+{
+  SyncCollectionAsyncData *data = user_data;
+
+  if (to_upload) {
+    for (guint i = 0; i < to_upload->len; i++)
+      g_ptr_array_add (data->to_upload, g_object_ref (g_ptr_array_index (to_upload, i)));
+    g_ptr_array_unref (to_upload);
+  }
+
+  g_list_free_full (data->merging_deleted, g_object_unref);
+  g_list_free_full (data->merging_updated, g_object_unref);
+  data->merging_deleted = NULL;
+  data->merging_updated = NULL;
+  data->is_merging = FALSE;
+
+  sync_collection_merge_pending (data);
+}
+
+static void
+sync_collection_merge_pending (SyncCollectionAsyncData *data)
+{
+  /* Only one merge runs at a time; records decrypted in the meantime are
+   * merged together once it returns.
+   */
+  if (data->is_merging)
+    return;
+
+  if (data->is_initial && data->pending_pages > 0)
+    return;
+
+  /* An initial merge of an incomplete collection would upload every local
+   * record as missing from the server.
+   */
+  if (data->failed && data->is_initial) {
+    g_list_free_full (data->remotes_deleted, g_object_unref);
+    g_list_free_full (data->remotes_updated, g_object_unref);
+    data->remotes_deleted = NULL;
+    data->remotes_updated = NULL;
+  }
+
+  if (data->remotes_deleted || data->remotes_updated || (data->is_initial && !data->failed)) {
+    gboolean is_initial = data->is_initial;
+
+    LOG ("Found %u deleted objects and %u new/updated objects in %s collection",
+         g_list_length (data->remotes_deleted),
+         g_list_length (data->remotes_updated),
+         ephy_synchronizable_manager_get_collection_name (data->manager));
+
+    data->merging_deleted = g_steal_pointer (&data->remotes_deleted);
+    data->merging_updated = g_steal_pointer (&data->remotes_updated);
+    data->is_merging = TRUE;
+    /* The initial merge happens only once. */
+    data->is_initial = FALSE;
+
+    /* Some managers merge synchronously and @data may be gone on return. */
+    ephy_synchronizable_manager_set_is_initial_sync (data->manager, FALSE);
+    ephy_synchronizable_manager_merge (data->manager, is_initial,
+                                       data->merging_deleted, data->merging_updated,
+                                       merge_page_finished_cb, data);
+    return;
+  }
+
+  if (data->pending_pages > 0)
+    return;
+
+  /* Uploading after a failed download would commit and advance the sync time
+   * past the records that were never received.
+   */
+  merge_collection_finished_cb (data->failed ? NULL : g_steal_pointer (&data->to_upload), data);
+}
+
+static void
+decrypt_chunk_cb (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  EphySyncService *self = EPHY_SYNC_SERVICE (source_object);
+  DecryptChunkData *chunk = g_task_get_task_data (G_TASK (result));
+  DecryptCollectionAsyncData *collection_data = chunk->collection_data;
+  SyncCollectionAsyncData *data = collection_data->data;
+
+  g_task_propagate_boolean (G_TASK (result), NULL);
+
+  data->remotes_deleted = g_list_concat (chunk->remotes_deleted, data->remotes_deleted);
+  data->remotes_updated = g_list_concat (chunk->remotes_updated, data->remotes_updated);
+  chunk->remotes_deleted = NULL;
+  chunk->remotes_updated = NULL;
+
+  data->decrypted += chunk->end - chunk->start;
+  ephy_sync_service_report_progress (self, data->manager, FALSE,
+                                     data->decrypted, data->downloaded);
+
+  if (--collection_data->pending > 0)
+    return;
+
+  decrypt_collection_async_data_free (collection_data);
+  data->pending_pages--;
+  sync_collection_merge_pending (data);
+}
+
 static void
 sync_collection_cb (SoupSession *session,
                     SoupMessage *msg,
                     gpointer     user_data)
 {
   SyncCollectionAsyncData *data = (SyncCollectionAsyncData *)user_data;
-  EphySynchronizable *remote;
-  SyncCryptoKeyBundle *bundle = NULL;
+  DecryptCollectionAsyncData *collection_data;
+  SyncCryptoKeyBundle *bundle;
   JsonNode *node = NULL;
   JsonArray *array = NULL;
   g_autoptr (GError) error = NULL;
-  GType type;
+  SoupMessageHeaders *response_headers;
   const char *collection;
-  gboolean is_deleted;
+  const char *last_modified;
+  const char *next_offset;
+  guint length;
   guint status_code;
   g_autoptr (GBytes) response_body = NULL;
 
   collection = ephy_synchronizable_manager_get_collection_name (data->manager);
 
   status_code = soup_message_get_status (msg);
+  response_headers = soup_message_get_response_headers (msg);
   response_body = g_bytes_ref (g_object_get_data (G_OBJECT (msg), "ephy-request-body"));
 
+  /* Code 412 means that the collection changed since the first page, the
+   * offsets of the pages left are no longer valid.
+   */
+  if (status_code == 412) {
+    LOG ("%s collection changed since the first page was fetched", collection);
+    data->modified_while_paging = TRUE;
+    goto out_error;
+  }
+
   if (status_code != 200) {
     g_warning ("Failed to get records in collection %s. Status code: %u, response: %s",
                collection, status_code, (const char *)g_bytes_get_data (response_body, NULL));
@@ -1756,50 +2143,75 @@ sync_collection_cb (SoupSession *session,
     goto out_error;
   }
 
-  type = ephy_synchronizable_manager_get_synchronizable_type (data->manager);
+  length = json_array_get_length (array);
+  data->downloaded += length;
+
+  if (data->last_modified < 0) {
+    last_modified = soup_message_headers_get_one (response_headers, "X-Last-Modified");
+    if (last_modified)
+      data->last_modified = g_ascii_strtod (last_modified, NULL);
+  }
+
+  /* Request the next page right away, it downloads while this one is
+   * decrypted and merged.
+   */
+  next_offset = soup_message_headers_get_one (response_headers, "X-Weave-Next-Offset");
+  if (next_offset) {
+    g_autofree char *offset = g_uri_escape_string (next_offset, NULL, TRUE);
+    g_autofree char *endpoint = g_strdup_printf ("%s&offset=%s", data->endpoint, offset);
+
+    LOG ("Fetching next page of %s collection (%u records so far)...", collection, data->downloaded);
+    data->pending_pages++;
+    ephy_sync_service_queue_storage_request (data->service, endpoint, SOUP_METHOD_GET,
+                                             NULL, -1, data->last_modified,
+                                             sync_collection_cb, data);
+  }
+
+  if (length == 0) {
+    data->pending_pages--;
+    sync_collection_merge_pending (data);
+    goto out;
+  }
+
   bundle = ephy_sync_service_get_key_bundle (data->service, collection);
   if (!bundle)
     goto out_error;
 
-  for (guint i = 0; i < json_array_get_length (array); i++) {
-    remote = EPHY_SYNCHRONIZABLE (ephy_synchronizable_from_bso (json_array_get_element (array, i),
-                                                                type, bundle, &is_deleted));
-    if (!remote) {
-      g_warning ("Failed to create synchronizable object from BSO, skipping...");
-      continue;
-    }
-    if (is_deleted)
-      data->remotes_deleted = g_list_prepend (data->remotes_deleted, remote);
-    else
-      data->remotes_updated = g_list_prepend (data->remotes_updated, remote);
+  /* Decrypt and deserialize the records of the page in parallel; the page is
+   * merged once its last chunk is back on the main thread.
+   */
+  collection_data = decrypt_collection_async_data_new (data, bundle, node);
+  for (guint i = 0; i < length; i += EPHY_SYNC_BATCH_SIZE) {
+    DecryptChunkData *chunk;
+    GTask *task;
+
+    chunk = g_new0 (DecryptChunkData, 1);
+    chunk->collection_data = collection_data;
+    chunk->start = i;
+    chunk->end = MIN (i + EPHY_SYNC_BATCH_SIZE, length);
+    collection_data->pending++;
+
+    task = g_task_new (data->service, NULL, decrypt_chunk_cb, NULL);
+    g_task_set_task_data (task, chunk, (GDestroyNotify)decrypt_chunk_data_free);
+    g_task_run_in_thread (task, decrypt_chunk_thread);
+    g_object_unref (task);
   }
-
-  LOG ("Found %u deleted objects and %u new/updated objects in %s collection",
-       g_list_length (data->remotes_deleted),
-       g_list_length (data->remotes_updated),
-       collection);
-
-  ephy_synchronizable_manager_set_is_initial_sync (data->manager, FALSE);
-  ephy_synchronizable_manager_merge (data->manager, data->is_initial,
-                                     data->remotes_deleted, data->remotes_updated,
-                                     merge_collection_finished_cb, data);
-  goto out_no_error;
+  goto out;
 
 out_error:
-  if (data->is_last)
-    g_signal_emit (data->service, signals[SYNC_FINISHED], 0);
-  sync_collection_async_data_free (data);
-out_no_error:
-  if (bundle)
-    ephy_sync_crypto_key_bundle_free (bundle);
+  data->failed = TRUE;
+  data->pending_pages--;
+  sync_collection_merge_pending (data);
+out:
   if (node)
     json_node_unref (node);
 }
 
 static void
-ephy_sync_service_sync_collection (EphySyncService           *self,
-                                   EphySynchronizableManager *manager,
-                                   gboolean                   is_last)
+sync_collection_start (EphySyncService           *self,
+                       EphySynchronizableManager *manager,
+                       gboolean                   is_last,
+                       guint                      attempt)
 {
   SyncCollectionAsyncData *data;
   const char *collection;
@@ -1813,15 +2225,22 @@ ephy_sync_service_sync_collection (EphySyncService           *self,
   collection = ephy_synchronizable_manager_get_collection_name (manager);
   is_initial = ephy_synchronizable_manager_is_initial_sync (manager);
 
+  /* Oldest first, so that records modified while paging move behind the
+   * current offset instead of being skipped.
+   */
   if (is_initial) {
-    endpoint = g_strdup_printf ("storage/%s?full=true", collection);
+    endpoint = g_strdup_printf ("storage/%s?full=true&sort=oldest&limit=%u",
+                                collection, EPHY_SYNC_PAGE_SIZE);
   } else {
-    endpoint = g_strdup_printf ("storage/%s?newer=%" PRId64 "&full=true", collection,
-                                ephy_synchronizable_manager_get_sync_time (manager));
+    endpoint = g_strdup_printf ("storage/%s?newer=%" PRId64 "&full=true&sort=oldest&limit=%u",
+                                collection, ephy_synchronizable_manager_get_sync_time (manager),
+                                EPHY_SYNC_PAGE_SIZE);
   }
 
   LOG ("Syncing %s collection %s...", collection, is_initial ? "initial" : "regular");
-  data = sync_collection_async_data_new (self, manager, is_initial, is_last);
+  data = sync_collection_async_data_new (self, manager, is_initial, is_last, endpoint);
+  data->attempt = attempt;
+  data->pending_pages++;
   ephy_sync_service_queue_storage_request (self, endpoint, SOUP_METHOD_GET,
                                            NULL, -1, -1,
                                            sync_collection_cb, data);
@@ -1853,7 +2272,7 @@ ephy_sync_service_sync_internal (EphySyncService *self)
 
   num_managers = g_slist_length (self->managers);
   for (GSList *l = self->managers; l && l->data; l = l->next)
-    ephy_sync_service_sync_collection (self, l->data, ++index == num_managers);
+    sync_collection_start (self, l->data, ++index == num_managers, 0);
 
   ephy_sync_utils_set_sync_time (g_get_real_time () / 1000000);
 
@@ -2256,6 +2675,20 @@ ephy_sync_service_class_init (EphySyncServiceClass *klass)
                   G_SIGNAL_RUN_LAST,
                   0, NULL, NULL, NULL,
                   G_TYPE_NONE, 0);
+
+  /* Collection name, whether records are being encrypted for upload (as
+   * opposed to decrypted after download), records done and records total.
+   */
+  signals[SYNC_PROGRESS] =
+    g_signal_new ("sync-collection-progress",
+                  EPHY_TYPE_SYNC_SERVICE,
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 4,
+                  G_TYPE_STRING,
+                  G_TYPE_BOOLEAN,
+                  G_TYPE_UINT,
+                  G_TYPE_UINT);
 }
 
 EphySyncService *
@@ -362,6 +362,7 @@ ephy_bookmark_set_id (EphyBookmark *self,
 
   g_free (self->id);
   self->id = g_strdup (id);
+  g_object_notify_by_pspec (G_OBJECT (self), obj_properties[PROP_ID]);
 }
 
 const char *
@@ -209,6 +209,10 @@ ephy_bookmarks_export (EphyBookmarksManager *manager,
 
     root_table = gvdb_hash_table_new (NULL, NULL);
 
+    /* Only journal records written after this file belong on top of it. */
+    gvdb_hash_table_insert_variant (root_table, "journal-generation",
+                                    g_variant_new_int64 (ephy_bookmarks_manager_get_journal_generation (manager)));
+
     if (with_tags_order) {
       table = gvdb_hash_table_new (root_table, "tags-order");
       g_sequence_foreach (ephy_bookmarks_manager_get_tags_order (manager), (GFunc)add_to_tags_order_table, table);
@@ -278,3 +282,49 @@ ephy_bookmarks_export_finish (EphyBookmarksManager  *manager,
 
   return g_task_propagate_boolean (G_TASK (result), error);
 }
+
+static void
+append_journal_record (GByteArray                     *journal,
+                       EphyBookmarksJournalRecordType  type,
+                       const char                     *key,
+                       GVariant                       *value)
+{
+  g_autoptr (GVariant) record = NULL;
+  guint32 size;
+
+  record = g_variant_new (EPHY_BOOKMARKS_JOURNAL_RECORD_TYPE, type, key, value);
+  g_variant_ref_sink (record);
+
+  size = GUINT32_TO_LE (g_variant_get_size (record));
+  g_byte_array_append (journal, (const guint8 *)&size, sizeof (size));
+  g_byte_array_append (journal, g_variant_get_data (record), g_variant_get_size (record));
+}
+
+void
+ephy_bookmarks_export_journal_header (GByteArray *journal,
+                                      gint64      generation)
+{
+  append_journal_record (journal, EPHY_BOOKMARKS_JOURNAL_HEADER, "",
+                         g_variant_new_int64 (generation));
+}
+
+void
+ephy_bookmarks_export_journal_bookmark (GByteArray   *journal,
+                                        const char   *url,
+                                        EphyBookmark *bookmark)
+{
+  if (bookmark)
+    append_journal_record (journal, EPHY_BOOKMARKS_JOURNAL_ADD_BOOKMARK, url, build_variant (bookmark));
+  else
+    append_journal_record (journal, EPHY_BOOKMARKS_JOURNAL_REMOVE_BOOKMARK, url, NULL);
+}
+
+void
+ephy_bookmarks_export_journal_tag (GByteArray *journal,
+                                   const char *tag,
+                                   gboolean    created)
+{
+  append_journal_record (journal,
+                         created ? EPHY_BOOKMARKS_JOURNAL_ADD_TAG : EPHY_BOOKMARKS_JOURNAL_REMOVE_TAG,
+                         tag, NULL);
+}
@@ -24,6 +24,21 @@
 
 G_BEGIN_DECLS
 
+/* Changes saved after the GVDB file was written are appended to a journal
+ * file next to it. Each record is a little endian guint32 size followed by
+ * a GVariant of EPHY_BOOKMARKS_JOURNAL_RECORD_TYPE holding the record type,
+ * a URL or tag, and for headers and added bookmarks a value. */
+#define EPHY_BOOKMARKS_JOURNAL_SUFFIX      ".journal"
+#define EPHY_BOOKMARKS_JOURNAL_RECORD_TYPE "(ysmv)"
+
+typedef enum {
+  EPHY_BOOKMARKS_JOURNAL_HEADER,
+  EPHY_BOOKMARKS_JOURNAL_ADD_BOOKMARK,
+  EPHY_BOOKMARKS_JOURNAL_REMOVE_BOOKMARK,
+  EPHY_BOOKMARKS_JOURNAL_ADD_TAG,
+  EPHY_BOOKMARKS_JOURNAL_REMOVE_TAG
+} EphyBookmarksJournalRecordType;
+
 void            ephy_bookmarks_export        (EphyBookmarksManager  *manager,
                                               const char            *filename,
                                               gboolean               with_bookmarks_order,
@@ -35,4 +50,13 @@ gboolean        ephy_bookmarks_export_finish (EphyBookmarksManager  *manager,
                                               GAsyncResult          *result,
                                               GError               **error);
 
+void            ephy_bookmarks_export_journal_header   (GByteArray   *journal,
+                                                        gint64        generation);
+void            ephy_bookmarks_export_journal_bookmark (GByteArray   *journal,
+                                                        const char   *url,
+                                                        EphyBookmark *bookmark);
+void            ephy_bookmarks_export_journal_tag      (GByteArray   *journal,
+                                                        const char   *tag,
+                                                        gboolean      created);
+
 G_END_DECLS
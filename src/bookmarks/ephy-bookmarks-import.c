@@ -21,6 +21,8 @@
 #include "config.h"
 #include "ephy-bookmarks-import.h"
 
+#include "ephy-bookmarks-export.h"
+#include "ephy-debug.h"
 #include "ephy-shell.h"
 #include "ephy-sqlite-connection.h"
 #include "ephy-sync-utils.h"
@@ -28,6 +30,7 @@
 #include "gvdb-reader.h"
 
 #include <glib/gi18n.h>
+#include <string.h>
 
 GQuark bookmarks_import_error_quark (void);
 G_DEFINE_QUARK (BookmarksImportErrorQuark, bookmarks_import_error)
@@ -38,8 +41,45 @@ typedef enum {
   BOOKMARKS_IMPORT_ERROR_BOOKMARKS = 1002
 } BookmarksImportErrorCode;
 
+static EphyBookmark *
+bookmark_from_variant (const char *url,
+                       GVariant   *value)
+{
+  EphyBookmark *bookmark;
+  GVariantIter *iter;
+  GSequence *tags;
+  char *tag;
+  const char *title;
+  gint64 time_added;
+  const char *id;
+  gint64 server_time_modified;
+  gboolean is_uploaded;
+
+  g_variant_get (value, "(x&s&sxbas)",
+                 &time_added, &title, &id,
+                 &server_time_modified, &is_uploaded, &iter);
+
+  /* Add all stored tags in a GSequence. */
+  tags = g_sequence_new (g_free);
+  while (g_variant_iter_next (iter, "s", &tag)) {
+    g_sequence_insert_sorted (tags, tag,
+                              (GCompareDataFunc)ephy_bookmark_tags_compare,
+                              NULL);
+  }
+  g_variant_iter_free (iter);
+
+  /* Create the new bookmark. */
+  bookmark = ephy_bookmark_new (url, title, tags, id);
+  ephy_bookmark_set_time_added (bookmark, time_added);
+  ephy_synchronizable_set_server_time_modified (EPHY_SYNCHRONIZABLE (bookmark), server_time_modified);
+  ephy_bookmark_set_is_uploaded (bookmark, is_uploaded);
+
+  return bookmark;
+}
+
 static GSequence *
-get_bookmarks_from_table (GvdbTable *table)
+get_bookmarks_from_table (GvdbTable  *table,
+                          GHashTable *journal_bookmarks)
 {
   GSequence *bookmarks = NULL;
   char **list = NULL;
@@ -51,46 +91,103 @@ get_bookmarks_from_table (GvdbTable *table)
   /* Iterate over all keys (url's) in the table. */
   list = gvdb_table_get_names (table, &length);
   for (i = 0; i < length; i++) {
-    EphyBookmark *bookmark;
     GVariant *value;
-    GVariantIter *iter;
-    GSequence *tags;
-    char *tag;
-    const char *title;
-    gint64 time_added;
-    char *id;
-    gint64 server_time_modified;
-    gboolean is_uploaded;
+
+    /* The journal has the latest version of this bookmark. */
+    if (g_hash_table_contains (journal_bookmarks, list[i]))
+      continue;
 
     /* Obtain the corresponding GVariant. */
     value = gvdb_table_get_value (table, list[i]);
+    g_sequence_prepend (bookmarks, bookmark_from_variant (list[i], value));
+    g_variant_unref (value);
+  }
 
-    g_variant_get (value, "(x&s&sxbas)",
-                   &time_added, &title, &id,
-                   &server_time_modified, &is_uploaded, &iter);
+  g_strfreev (list);
 
-    /* Add all stored tags in a GSequence. */
-    tags = g_sequence_new (g_free);
-    while (g_variant_iter_next (iter, "s", &tag)) {
-      g_sequence_insert_sorted (tags, tag,
-                                (GCompareDataFunc)ephy_bookmark_tags_compare,
-                                NULL);
+  return bookmarks;
+}
+
+/* Reads the changes recorded in the journal since the GVDB file with the
+ * given generation was written. For each bookmark URL and tag only the last
+ * change is kept: a maybe variant holding the bookmark, or Nothing when it
+ * was removed, and whether the tag was created or deleted.
+ *
+ * Returns the size of the journal, or -1 when new records can not simply be
+ * appended to it: it ends with a partial record, or with records written on
+ * top of another GVDB file. */
+static gssize
+read_journal (const char *filename,
+              gint64      generation,
+              GHashTable *journal_bookmarks,
+              GHashTable *journal_tags)
+{
+  g_autofree char *journal_filename = g_strconcat (filename, EPHY_BOOKMARKS_JOURNAL_SUFFIX, NULL);
+  g_autofree char *contents = NULL;
+  gboolean current = FALSE;
+  gsize length;
+  gsize offset = 0;
+
+  if (!g_file_get_contents (journal_filename, &contents, &length, NULL))
+    return 0;
+
+  while (length - offset >= sizeof (guint32)) {
+    g_autoptr (GBytes) bytes = NULL;
+    g_autoptr (GVariant) record = NULL;
+    g_autoptr (GVariant) value = NULL;
+    const char *key;
+    guint32 size;
+    guint8 type;
+
+    memcpy (&size, contents + offset, sizeof (size));
+    size = GUINT32_FROM_LE (size);
+    offset += sizeof (size);
+
+    if (size > length - offset) {
+      LOG ("Ignoring incomplete record at the end of %s", journal_filename);
+      return -1;
     }
-    g_variant_iter_free (iter);
 
-    /* Create the new bookmark. */
-    bookmark = ephy_bookmark_new (list[i], title, tags, id);
-    ephy_bookmark_set_time_added (bookmark, time_added);
-    ephy_synchronizable_set_server_time_modified (EPHY_SYNCHRONIZABLE (bookmark), server_time_modified);
-    ephy_bookmark_set_is_uploaded (bookmark, is_uploaded);
-    g_sequence_prepend (bookmarks, bookmark);
+    bytes = g_bytes_new (contents + offset, size);
+    offset += size;
 
-    g_variant_unref (value);
+    record = g_variant_new_from_bytes (G_VARIANT_TYPE (EPHY_BOOKMARKS_JOURNAL_RECORD_TYPE), bytes, FALSE);
+    g_variant_get (record, "(y&s@mv)", &type, &key, &value);
+
+    /* Records written on top of an older GVDB file are already part of the
+     * current one. */
+    if (type == EPHY_BOOKMARKS_JOURNAL_HEADER) {
+      g_autoptr (GVariant) child = g_variant_get_maybe (value);
+      g_autoptr (GVariant) header = child ? g_variant_get_variant (child) : NULL;
+
+      current = header &&
+                g_variant_is_of_type (header, G_VARIANT_TYPE_INT64) &&
+                g_variant_get_int64 (header) == generation;
+      continue;
+    }
+
+    if (!current)
+      continue;
+
+    switch (type) {
+      case EPHY_BOOKMARKS_JOURNAL_ADD_BOOKMARK:
+      case EPHY_BOOKMARKS_JOURNAL_REMOVE_BOOKMARK:
+        g_hash_table_replace (journal_bookmarks, g_strdup (key), g_steal_pointer (&value));
+        break;
+      case EPHY_BOOKMARKS_JOURNAL_ADD_TAG:
+      case EPHY_BOOKMARKS_JOURNAL_REMOVE_TAG:
+        g_hash_table_replace (journal_tags, g_strdup (key),
+                              GINT_TO_POINTER (type == EPHY_BOOKMARKS_JOURNAL_ADD_TAG));
+        break;
+      default:
+        LOG ("Ignoring unknown record type %u in %s", type, journal_filename);
+    }
   }
 
-  g_strfreev (list);
+  if (offset != length || (length > 0 && !current))
+    return -1;
 
-  return bookmarks;
+  return length;
 }
 
 gboolean
@@ -101,6 +198,13 @@ ephy_bookmarks_import (EphyBookmarksManager  *manager,
   GvdbTable *root_table = NULL;
   GvdbTable *table = NULL;
   GSequence *bookmarks = NULL;
+  g_autoptr (GHashTable) journal_bookmarks = NULL;
+  g_autoptr (GHashTable) journal_tags = NULL;
+  g_autoptr (GVariant) generation = NULL;
+  gint64 journal_generation = 0;
+  gssize journal_size = 0;
+  GHashTableIter iter;
+  gpointer key, value;
   char **list = NULL;
   gboolean res = TRUE;
   gsize length;
@@ -118,6 +222,14 @@ ephy_bookmarks_import (EphyBookmarksManager  *manager,
     goto out;
   }
 
+  journal_bookmarks = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
+  journal_tags = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  generation = gvdb_table_get_value (root_table, "journal-generation");
+  if (generation && g_variant_is_of_type (generation, G_VARIANT_TYPE_INT64)) {
+    journal_generation = g_variant_get_int64 (generation);
+    journal_size = read_journal (filename, journal_generation, journal_bookmarks, journal_tags);
+  }
+
   /* Add tags to the bookmark manager's sequence. */
   table = gvdb_table_get_table (root_table, "tags");
   if (!table) {
@@ -131,11 +243,19 @@ ephy_bookmarks_import (EphyBookmarksManager  *manager,
 
   /* Iterate over all keys (url's) in the table. */
   list = gvdb_table_get_names (table, &length);
-  for (i = 0; i < length; i++)
-    ephy_bookmarks_manager_create_tag (manager, list[i]);
+  for (i = 0; i < length; i++) {
+    if (!g_hash_table_contains (journal_tags, list[i]))
+      ephy_bookmarks_manager_create_tag (manager, list[i]);
+  }
   g_strfreev (list);
   gvdb_table_free (table);
 
+  g_hash_table_iter_init (&iter, journal_tags);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    if (GPOINTER_TO_INT (value))
+      ephy_bookmarks_manager_create_tag (manager, key);
+  }
+
   /* Get tags order table */
   /* Add tags to the bookmark manager's sequence. */
   table = gvdb_table_get_table (root_table, "tags-order");
@@ -163,7 +283,20 @@ ephy_bookmarks_import (EphyBookmarksManager  *manager,
     goto out;
   }
 
-  bookmarks = get_bookmarks_from_table (table);
+  bookmarks = get_bookmarks_from_table (table, journal_bookmarks);
+
+  g_hash_table_iter_init (&iter, journal_bookmarks);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    g_autoptr (GVariant) child = g_variant_get_maybe (value);
+
+    if (child) {
+      g_autoptr (GVariant) bookmark_value = g_variant_get_variant (child);
+
+      if (g_variant_is_of_type (bookmark_value, G_VARIANT_TYPE ("(xssxbas)")))
+        g_sequence_prepend (bookmarks, bookmark_from_variant (key, bookmark_value));
+    }
+  }
+
   ephy_bookmarks_manager_add_bookmarks (manager, bookmarks);
   gvdb_table_free (table);
 
@@ -183,6 +316,12 @@ ephy_bookmarks_import (EphyBookmarksManager  *manager,
     g_strfreev (list);
   }
 
+  /* Further saves append to the journal that was just replayed. */
+  if (journal_size >= 0)
+    ephy_bookmarks_manager_journal_loaded (manager, journal_generation, journal_size);
+  else
+    ephy_bookmarks_manager_journal_loaded (manager, 0, 0);
+
 out:
   if (table)
     gvdb_table_free (table);
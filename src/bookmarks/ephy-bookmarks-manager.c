@@ -29,10 +29,23 @@
 #include "ephy-sync-utils.h"
 #include "ephy-synchronizable-manager.h"
 
+#include "dzl-fuzzy-mutable-index.h"
 #include <string.h>
 
 #define EPHY_BOOKMARKS_FILE "bookmarks.gvdb"
 
+/* Removed keys stay in the fuzzy index as tombstones until it is rebuilt. */
+#define MIN_FUZZY_INDEX_TOMBSTONES 64
+
+/* Once the journal grows past this size it is folded into a new GVDB file. */
+#define JOURNAL_COMPACTION_SIZE (256 * 1024)
+
+typedef struct {
+  char *id;
+  char *url;
+  char *key; /* The bookmark id, a newline, then the casefolded text to search. */
+} BookmarkIndexEntry;
+
 struct _EphyBookmarksManager {
   GObject parent_instance;
 
@@ -43,7 +56,27 @@ struct _EphyBookmarksManager {
   GSequence *bookmarks_order;
   GSequence *tags_order;
 
+  /* Lookup indexes over the bookmarks sequence. bookmarks_by_id borrows its
+   * keys from the BookmarkIndexEntry of each bookmark. bookmarks_by_url maps
+   * each URL to the bookmarks using it, in the order they were indexed. */
+  GHashTable *index_entries;
+  GHashTable *bookmarks_by_id;
+  GHashTable *bookmarks_by_url;
+  DzlFuzzyMutableIndex *fuzzy_index;
+  guint fuzzy_index_tombstones;
+
   gchar *gvdb_filename;
+
+  /* Changes not yet written to the journal, see ephy_bookmarks_manager_save(). */
+  char *journal_filename;
+  gint64 journal_generation;
+  gsize journal_size;
+  GHashTable *journal_bookmarks;
+  GHashTable *journal_removed_urls;
+  GHashTable *journal_tags;
+  gboolean compaction_needed;
+  GPtrArray *save_tasks;
+  GPtrArray *running_save_tasks;
 };
 
 static void list_model_iface_init (GListModelInterface *iface);
@@ -72,6 +105,204 @@ enum {
 
 static guint signals[LAST_SIGNAL];
 
+static void
+bookmark_index_entry_free (BookmarkIndexEntry *entry)
+{
+  g_free (entry->id);
+  g_free (entry->url);
+  g_free (entry->key);
+  g_free (entry);
+}
+
+static char *
+build_fuzzy_index_key (EphyBookmark *bookmark)
+{
+  GSequence *tags = ephy_bookmark_get_tags (bookmark);
+  g_autoptr (GString) text = g_string_new (NULL);
+  g_autofree char *text_casefold = NULL;
+
+  g_string_append (text, ephy_bookmark_get_title (bookmark));
+  g_string_append_c (text, '\n');
+  g_string_append (text, ephy_bookmark_get_url (bookmark));
+  g_string_append_c (text, '\n');
+
+  for (GSequenceIter *iter = g_sequence_get_begin_iter (tags);
+       !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter)) {
+    g_string_append (text, g_sequence_get (iter));
+    g_string_append_c (text, ' ');
+  }
+
+  text_casefold = g_utf8_casefold (text->str, -1);
+
+  return g_strconcat (ephy_bookmark_get_id (bookmark), "\n", text_casefold, NULL);
+}
+
+static void
+ephy_bookmarks_manager_rebuild_fuzzy_index (EphyBookmarksManager *self)
+{
+  GHashTableIter iter;
+  gpointer bookmark;
+  gpointer entry;
+
+  g_clear_pointer (&self->fuzzy_index, dzl_fuzzy_mutable_index_unref);
+  self->fuzzy_index = dzl_fuzzy_mutable_index_new (FALSE);
+  self->fuzzy_index_tombstones = 0;
+
+  dzl_fuzzy_mutable_index_begin_bulk_insert (self->fuzzy_index);
+  g_hash_table_iter_init (&iter, self->index_entries);
+  while (g_hash_table_iter_next (&iter, &bookmark, &entry))
+    dzl_fuzzy_mutable_index_insert (self->fuzzy_index, ((BookmarkIndexEntry *)entry)->key, bookmark);
+  dzl_fuzzy_mutable_index_end_bulk_insert (self->fuzzy_index);
+}
+
+static void
+ephy_bookmarks_manager_add_url (EphyBookmarksManager *self,
+                                const char           *url,
+                                EphyBookmark         *bookmark)
+{
+  GPtrArray *bookmarks = g_hash_table_lookup (self->bookmarks_by_url, url);
+
+  if (!bookmarks) {
+    bookmarks = g_ptr_array_new ();
+    g_hash_table_insert (self->bookmarks_by_url, g_strdup (url), bookmarks);
+  }
+  g_ptr_array_add (bookmarks, bookmark);
+}
+
+static void
+ephy_bookmarks_manager_remove_url (EphyBookmarksManager *self,
+                                   const char           *url,
+                                   EphyBookmark         *bookmark)
+{
+  GPtrArray *bookmarks = g_hash_table_lookup (self->bookmarks_by_url, url);
+
+  if (!bookmarks)
+    return;
+
+  g_ptr_array_remove (bookmarks, bookmark);
+  if (bookmarks->len == 0)
+    g_hash_table_remove (self->bookmarks_by_url, url);
+}
+
+static void
+ephy_bookmarks_manager_set_fuzzy_key (EphyBookmarksManager *self,
+                                      BookmarkIndexEntry   *entry,
+                                      EphyBookmark         *bookmark,
+                                      char                 *key)
+{
+  if (entry->key) {
+    dzl_fuzzy_mutable_index_remove (self->fuzzy_index, entry->key);
+    g_free (entry->key);
+    self->fuzzy_index_tombstones++;
+  }
+
+  entry->key = key;
+  if (key)
+    dzl_fuzzy_mutable_index_insert (self->fuzzy_index, key, bookmark);
+
+  if (self->fuzzy_index_tombstones > MAX (MIN_FUZZY_INDEX_TOMBSTONES, g_hash_table_size (self->index_entries)))
+    ephy_bookmarks_manager_rebuild_fuzzy_index (self);
+}
+
+static void
+ephy_bookmarks_manager_index_bookmark (EphyBookmarksManager *self,
+                                       EphyBookmark         *bookmark)
+{
+  BookmarkIndexEntry *entry;
+
+  if (g_hash_table_contains (self->index_entries, bookmark))
+    return;
+
+  entry = g_new (BookmarkIndexEntry, 1);
+  entry->id = g_strdup (ephy_bookmark_get_id (bookmark));
+  entry->url = g_strdup (ephy_bookmark_get_url (bookmark));
+  entry->key = build_fuzzy_index_key (bookmark);
+  g_hash_table_insert (self->index_entries, bookmark, entry);
+
+  g_hash_table_replace (self->bookmarks_by_id, entry->id, bookmark);
+  ephy_bookmarks_manager_add_url (self, entry->url, bookmark);
+
+  dzl_fuzzy_mutable_index_insert (self->fuzzy_index, entry->key, bookmark);
+}
+
+static void
+ephy_bookmarks_manager_unindex_bookmark (EphyBookmarksManager *self,
+                                         EphyBookmark         *bookmark)
+{
+  BookmarkIndexEntry *entry;
+
+  entry = g_hash_table_lookup (self->index_entries, bookmark);
+  if (!entry)
+    return;
+
+  g_hash_table_steal (self->index_entries, bookmark);
+
+  if (g_hash_table_lookup (self->bookmarks_by_id, entry->id) == bookmark)
+    g_hash_table_remove (self->bookmarks_by_id, entry->id);
+  ephy_bookmarks_manager_remove_url (self, entry->url, bookmark);
+
+  ephy_bookmarks_manager_set_fuzzy_key (self, entry, bookmark, NULL);
+  bookmark_index_entry_free (entry);
+}
+
+static void
+ephy_bookmarks_manager_journal_bookmark (EphyBookmarksManager *self,
+                                         EphyBookmark         *bookmark)
+{
+  const char *url = ephy_bookmark_get_url (bookmark);
+
+  g_hash_table_remove (self->journal_removed_urls, url);
+  g_hash_table_replace (self->journal_bookmarks, g_strdup (url), g_object_ref (bookmark));
+}
+
+static void
+ephy_bookmarks_manager_journal_removed_url (EphyBookmarksManager *self,
+                                            const char           *url)
+{
+  g_hash_table_remove (self->journal_bookmarks, url);
+  g_hash_table_add (self->journal_removed_urls, g_strdup (url));
+}
+
+static void
+ephy_bookmarks_manager_reindex_bookmark (EphyBookmarksManager *self,
+                                         EphyBookmark         *bookmark)
+{
+  BookmarkIndexEntry *entry;
+  const char *id = ephy_bookmark_get_id (bookmark);
+  const char *url = ephy_bookmark_get_url (bookmark);
+  char *key;
+
+  entry = g_hash_table_lookup (self->index_entries, bookmark);
+  if (!entry)
+    return;
+
+  /* Updated in place, so a bookmark keeps its place among the ones sharing
+   * its URL. */
+  if (g_strcmp0 (entry->url, url) != 0) {
+    ephy_bookmarks_manager_journal_removed_url (self, entry->url);
+    ephy_bookmarks_manager_remove_url (self, entry->url, bookmark);
+    g_free (entry->url);
+    entry->url = g_strdup (url);
+    ephy_bookmarks_manager_add_url (self, entry->url, bookmark);
+  }
+  ephy_bookmarks_manager_journal_bookmark (self, bookmark);
+
+  if (g_strcmp0 (entry->id, id) != 0) {
+    if (g_hash_table_lookup (self->bookmarks_by_id, entry->id) == bookmark)
+      g_hash_table_remove (self->bookmarks_by_id, entry->id);
+    g_free (entry->id);
+    entry->id = g_strdup (id);
+    g_hash_table_replace (self->bookmarks_by_id, entry->id, bookmark);
+  }
+
+  key = build_fuzzy_index_key (bookmark);
+  if (g_strcmp0 (entry->key, key) == 0)
+    g_free (key);
+  else
+    ephy_bookmarks_manager_set_fuzzy_key (self, entry, bookmark, key);
+}
+
 static void
 ephy_bookmarks_manager_copy_tags_from_bookmark (EphyBookmarksManager *self,
                                                 EphyBookmark         *dest,
@@ -120,10 +351,21 @@ ephy_bookmarks_manager_finalize (GObject *object)
 {
   EphyBookmarksManager *self = EPHY_BOOKMARKS_MANAGER (object);
 
+  g_hash_table_unref (self->bookmarks_by_id);
+  g_hash_table_unref (self->bookmarks_by_url);
+  g_hash_table_unref (self->index_entries);
+  dzl_fuzzy_mutable_index_unref (self->fuzzy_index);
+
   g_sequence_free (self->bookmarks);
   g_sequence_free (self->tags);
   g_free (self->gvdb_filename);
 
+  g_free (self->journal_filename);
+  g_hash_table_unref (self->journal_bookmarks);
+  g_hash_table_unref (self->journal_removed_urls);
+  g_hash_table_unref (self->journal_tags);
+  g_ptr_array_unref (self->save_tasks);
+
   G_OBJECT_CLASS (ephy_bookmarks_manager_parent_class)->finalize (object);
 }
 
@@ -235,12 +477,22 @@ ephy_bookmarks_manager_init (EphyBookmarksManager *self)
   self->gvdb_filename = g_build_filename (ephy_profile_dir (),
                                           EPHY_BOOKMARKS_FILE,
                                           NULL);
+  self->journal_filename = g_strconcat (self->gvdb_filename, EPHY_BOOKMARKS_JOURNAL_SUFFIX, NULL);
+  self->journal_bookmarks = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+  self->journal_removed_urls = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->journal_tags = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->save_tasks = g_ptr_array_new ();
 
   self->bookmarks = g_sequence_new (g_object_unref);
   self->tags = g_sequence_new (g_free);
   self->bookmarks_order = g_sequence_new (g_free);
   self->tags_order = g_sequence_new (g_free);
 
+  self->index_entries = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)bookmark_index_entry_free);
+  self->bookmarks_by_id = g_hash_table_new (g_str_hash, g_str_equal);
+  self->bookmarks_by_url = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+  self->fuzzy_index = dzl_fuzzy_mutable_index_new (FALSE);
+
   g_sequence_insert_sorted (self->tags,
                             g_strdup (EPHY_BOOKMARKS_FAVORITES_TAG),
                             (GCompareDataFunc)ephy_bookmark_tags_compare,
@@ -254,11 +506,16 @@ ephy_bookmarks_manager_init (EphyBookmarksManager *self)
     }
   }
 
+  START_PROFILER ("Bookmarks load")
   ephy_bookmarks_import (self, self->gvdb_filename, NULL);
+  STOP_PROFILER ("Bookmarks load")
 
-  ephy_bookmarks_manager_save (self, TRUE, TRUE, self->cancellable,
-                               (GAsyncReadyCallback)ephy_bookmarks_manager_save_warn_on_error_cb,
-                               NULL);
+  /* A journal that can not be appended to, or that has grown too large, is
+   * folded into a new GVDB file right away. */
+  if (self->journal_generation == 0 || self->journal_size >= JOURNAL_COMPACTION_SIZE)
+    ephy_bookmarks_manager_save (self, FALSE, FALSE, self->cancellable,
+                                 (GAsyncReadyCallback)ephy_bookmarks_manager_save_warn_on_error_cb,
+                                 NULL);
 }
 
 static void
@@ -266,6 +523,7 @@ bookmark_title_changed_cb (EphyBookmark         *bookmark,
                            GParamSpec           *pspec,
                            EphyBookmarksManager *self)
 {
+  ephy_bookmarks_manager_reindex_bookmark (self, bookmark);
   g_signal_emit (self, signals[BOOKMARK_TITLE_CHANGED], 0, bookmark);
 }
 
@@ -274,14 +532,24 @@ bookmark_url_changed_cb (EphyBookmark         *bookmark,
                          GParamSpec           *pspec,
                          EphyBookmarksManager *self)
 {
+  ephy_bookmarks_manager_reindex_bookmark (self, bookmark);
   g_signal_emit (self, signals[BOOKMARK_URL_CHANGED], 0, bookmark);
 }
 
+static void
+bookmark_id_changed_cb (EphyBookmark         *bookmark,
+                        GParamSpec           *pspec,
+                        EphyBookmarksManager *self)
+{
+  ephy_bookmarks_manager_reindex_bookmark (self, bookmark);
+}
+
 static void
 bookmark_tag_added_cb (EphyBookmark         *bookmark,
                        const char           *tag,
                        EphyBookmarksManager *self)
 {
+  ephy_bookmarks_manager_reindex_bookmark (self, bookmark);
   g_signal_emit (self, signals[BOOKMARK_TAG_ADDED], 0, bookmark, tag);
 }
 
@@ -290,6 +558,7 @@ bookmark_tag_removed_cb (EphyBookmark         *bookmark,
                          const char           *tag,
                          EphyBookmarksManager *self)
 {
+  ephy_bookmarks_manager_reindex_bookmark (self, bookmark);
   g_signal_emit (self, signals[BOOKMARK_TAG_REMOVED], 0, bookmark, tag);
 }
 
@@ -307,6 +576,8 @@ ephy_bookmarks_manager_watch_bookmark (EphyBookmarksManager *self,
                            G_CALLBACK (bookmark_title_changed_cb), self, 0);
   g_signal_connect_object (bookmark, "notify::bmkUri",
                            G_CALLBACK (bookmark_url_changed_cb), self, 0);
+  g_signal_connect_object (bookmark, "notify::id",
+                           G_CALLBACK (bookmark_id_changed_cb), self, 0);
   g_signal_connect_object (bookmark, "tag-added",
                            G_CALLBACK (bookmark_tag_added_cb), self, 0);
   g_signal_connect_object (bookmark, "tag-removed",
@@ -319,6 +590,7 @@ ephy_bookmarks_manager_unwatch_bookmark (EphyBookmarksManager *self,
 {
   g_signal_handlers_disconnect_by_func (bookmark, bookmark_title_changed_cb, self);
   g_signal_handlers_disconnect_by_func (bookmark, bookmark_url_changed_cb, self);
+  g_signal_handlers_disconnect_by_func (bookmark, bookmark_id_changed_cb, self);
   g_signal_handlers_disconnect_by_func (bookmark, bookmark_tag_added_cb, self);
   g_signal_handlers_disconnect_by_func (bookmark, bookmark_tag_removed_cb, self);
 }
@@ -342,6 +614,8 @@ ephy_bookmarks_manager_add_bookmark_internal (EphyBookmarksManager *self,
     position = g_sequence_iter_get_position (iter);
     g_list_model_items_changed (G_LIST_MODEL (self), position, 0, 1);
 
+    ephy_bookmarks_manager_index_bookmark (self, bookmark);
+    ephy_bookmarks_manager_journal_bookmark (self, bookmark);
     g_signal_emit (self, signals[BOOKMARK_ADDED], 0, bookmark);
     ephy_bookmarks_manager_watch_bookmark (self, bookmark);
   }
@@ -372,6 +646,10 @@ ephy_bookmarks_manager_add_bookmarks (EphyBookmarksManager *self,
   g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
   g_assert (bookmarks);
 
+  /* Sorting the fuzzy index once is much cheaper than keeping it sorted
+   * after each of the bookmarks is inserted. */
+  dzl_fuzzy_mutable_index_begin_bulk_insert (self->fuzzy_index);
+
   for (iter = g_sequence_get_begin_iter (bookmarks);
        !g_sequence_iter_is_end (iter); iter = g_sequence_iter_next (iter)) {
     EphyBookmark *bookmark = g_sequence_get (iter);
@@ -379,6 +657,8 @@ ephy_bookmarks_manager_add_bookmarks (EphyBookmarksManager *self,
     ephy_bookmarks_manager_add_bookmark_internal (self, bookmark, FALSE);
     g_signal_emit (self, signals[SYNCHRONIZABLE_MODIFIED], 0, bookmark, FALSE);
   }
+
+  dzl_fuzzy_mutable_index_end_bulk_insert (self->fuzzy_index);
 }
 
 static void
@@ -405,6 +685,8 @@ ephy_bookmarks_manager_remove_bookmark_internal (EphyBookmarksManager *self,
    * it to be already gone.
    */
   g_object_ref (bookmark);
+  ephy_bookmarks_manager_journal_removed_url (self, ephy_bookmark_get_url (g_sequence_get (iter)));
+  ephy_bookmarks_manager_unindex_bookmark (self, g_sequence_get (iter));
   position = g_sequence_iter_get_position (iter);
   g_sequence_remove (iter);
   g_list_model_items_changed (G_LIST_MODEL (self), position, 1, 0);
@@ -432,42 +714,94 @@ EphyBookmark *
 ephy_bookmarks_manager_get_bookmark_by_url (EphyBookmarksManager *self,
                                             const char           *url)
 {
-  GSequenceIter *iter;
+  GPtrArray *bookmarks;
 
   g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
   g_assert (url);
 
-  for (iter = g_sequence_get_begin_iter (self->bookmarks);
-       !g_sequence_iter_is_end (iter);
-       iter = g_sequence_iter_next (iter)) {
-    EphyBookmark *bookmark = g_sequence_get (iter);
-
-    if (g_strcmp0 (ephy_bookmark_get_url (bookmark), url) == 0)
-      return bookmark;
-  }
+  bookmarks = g_hash_table_lookup (self->bookmarks_by_url, url);
 
-  return NULL;
+  return bookmarks ? g_ptr_array_index (bookmarks, 0) : NULL;
 }
 
 EphyBookmark *
 ephy_bookmarks_manager_get_bookmark_by_id (EphyBookmarksManager *self,
                                            const char           *id)
 {
-  GSequenceIter *iter;
-
   g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
   g_assert (id);
 
-  for (iter = g_sequence_get_begin_iter (self->bookmarks);
-       !g_sequence_iter_is_end (iter);
-       iter = g_sequence_iter_next (iter)) {
-    EphyBookmark *bookmark = g_sequence_get (iter);
+  return g_hash_table_lookup (self->bookmarks_by_id, id);
+}
+
+static gboolean
+index_entry_matches_terms (BookmarkIndexEntry  *entry,
+                           char               **terms)
+{
+  const char *text = entry->key + strlen (entry->id) + 1;
 
-    if (g_strcmp0 (ephy_bookmark_get_id (bookmark), id) == 0)
-      return bookmark;
+  for (guint i = 0; terms[i]; i++) {
+    if (!strstr (text, terms[i]))
+      return FALSE;
   }
 
-  return NULL;
+  return TRUE;
+}
+
+GSequence *
+ephy_bookmarks_manager_find_bookmarks (EphyBookmarksManager *self,
+                                       const char           *query)
+{
+  g_autofree char *query_casefold = NULL;
+  g_auto (GStrv) terms = NULL;
+  g_autoptr (GArray) matches = NULL;
+  g_autoptr (GHashTable) seen = NULL;
+  GSequence *bookmarks;
+  const char *longest_term = "";
+
+  g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
+  g_assert (query);
+
+  bookmarks = g_sequence_new (g_object_unref);
+
+  query_casefold = g_utf8_casefold (query, -1);
+  terms = g_strsplit (query_casefold, " ", -1);
+  for (guint i = 0; terms[i]; i++) {
+    if (strlen (terms[i]) > strlen (longest_term))
+      longest_term = terms[i];
+  }
+
+  if (!*longest_term) {
+    for (GSequenceIter *iter = g_sequence_get_begin_iter (self->bookmarks);
+         !g_sequence_iter_is_end (iter);
+         iter = g_sequence_iter_next (iter))
+      g_sequence_append (bookmarks, g_object_ref (g_sequence_get (iter)));
+
+    return bookmarks;
+  }
+
+  /* Any text containing the longest term also fuzzy matches it, so the fuzzy
+   * index narrows the bookmarks down to a few candidates that are then checked
+   * against every term. Keys of removed or changed bookmarks are still in the
+   * fuzzy index, so only keys equal to the current entry of a bookmark count. */
+  matches = dzl_fuzzy_mutable_index_match (self->fuzzy_index, longest_term, 0);
+  seen = g_hash_table_new (NULL, NULL);
+
+  for (guint i = 0; i < matches->len; i++) {
+    DzlFuzzyMutableIndexMatch *match = &g_array_index (matches, DzlFuzzyMutableIndexMatch, i);
+    BookmarkIndexEntry *entry = g_hash_table_lookup (self->index_entries, match->value);
+
+    if (!entry || strcmp (entry->key, match->key) != 0 || !g_hash_table_add (seen, match->value))
+      continue;
+
+    if (index_entry_matches_terms (entry, terms))
+      g_sequence_insert_sorted (bookmarks,
+                                g_object_ref (match->value),
+                                (GCompareDataFunc)ephy_bookmark_bookmarks_compare_func,
+                                NULL);
+  }
+
+  return bookmarks;
 }
 
 void
@@ -489,6 +823,7 @@ ephy_bookmarks_manager_create_tag (EphyBookmarksManager *self,
   if (g_sequence_iter_is_end (prev_tag_iter)
       || g_strcmp0 (g_sequence_get (prev_tag_iter), tag) != 0) {
     g_sequence_insert_before (tag_iter, g_strdup (tag));
+    g_hash_table_replace (self->journal_tags, g_strdup (tag), GINT_TO_POINTER (TRUE));
     g_signal_emit (self, signals[TAG_CREATED], 0, tag);
   }
 }
@@ -510,6 +845,7 @@ ephy_bookmarks_manager_delete_tag (EphyBookmarksManager *self,
                             (GCompareDataFunc)ephy_bookmark_tags_compare,
                             NULL);
   g_assert (iter);
+  g_hash_table_replace (self->journal_tags, g_strdup (tag), GINT_TO_POINTER (FALSE));
   g_sequence_remove (iter);
 
   /* Also remove the tag from each bookmark if they have it */
@@ -777,16 +1113,103 @@ ephy_bookmarks_manager_save_warn_on_error_cancellable (EphyBookmarksManager *sel
   return self->cancellable;
 }
 
+static void ephy_bookmarks_manager_start_write (EphyBookmarksManager *self);
+
 static void
-bookmarks_export_cb (GObject      *source_object,
-                     GAsyncResult *result,
-                     gpointer      user_data)
+ephy_bookmarks_manager_finish_write (EphyBookmarksManager *self,
+                                     GError               *error)
+{
+  g_autoptr (GPtrArray) tasks = g_steal_pointer (&self->running_save_tasks);
+
+  for (guint i = 0; i < tasks->len; i++) {
+    g_autoptr (GTask) task = g_ptr_array_index (tasks, i);
+
+    if (error)
+      g_task_return_error (task, g_error_copy (error));
+    else
+      g_task_return_boolean (task, TRUE);
+  }
+
+  if (self->save_tasks->len > 0 ||
+      (!error && self->journal_size >= JOURNAL_COMPACTION_SIZE))
+    ephy_bookmarks_manager_start_write (self);
+}
+
+static void
+journal_deleted_cb (GFile        *file,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  g_autoptr (EphyBookmarksManager) self = user_data;
+  g_autoptr (GError) error = NULL;
+
+  /* Records left in an old journal are skipped on import, because their
+   * header does not match the generation of the new GVDB file. */
+  if (!g_file_delete_finish (file, result, &error) &&
+      !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    g_warning ("Failed to delete bookmarks journal: %s", error->message);
+
+  self->journal_size = 0;
+  ephy_bookmarks_manager_finish_write (self, NULL);
+}
+
+static void
+compaction_export_cb (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
 {
   EphyBookmarksManager *self = EPHY_BOOKMARKS_MANAGER (source_object);
-  g_autoptr (GTask) task = user_data;
-  GError *error = NULL;
+  g_autoptr (GFile) file = NULL;
+  g_autoptr (GError) error = NULL;
 
   if (!ephy_bookmarks_export_finish (self, result, &error)) {
+    /* The journal no longer matches any GVDB file, so the next save has to
+     * write a complete one again. */
+    self->journal_generation = 0;
+    ephy_bookmarks_manager_finish_write (self, error);
+    return;
+  }
+
+  file = g_file_new_for_path (self->journal_filename);
+  g_file_delete_async (file, G_PRIORITY_DEFAULT, self->cancellable,
+                       (GAsyncReadyCallback)journal_deleted_cb, g_object_ref (self));
+}
+
+static void
+ephy_bookmarks_manager_compact (EphyBookmarksManager *self)
+{
+  g_hash_table_remove_all (self->journal_bookmarks);
+  g_hash_table_remove_all (self->journal_removed_urls);
+  g_hash_table_remove_all (self->journal_tags);
+  self->compaction_needed = FALSE;
+
+  /* Identifies the new GVDB file in the header of the journal written on top
+   * of it. */
+  self->journal_generation = g_get_real_time ();
+
+  ephy_bookmarks_export (self, self->gvdb_filename, TRUE, TRUE, self->cancellable,
+                         compaction_export_cb, NULL);
+}
+
+static void
+append_to_journal_thread (GTask        *task,
+                          gpointer      source_object,
+                          gpointer      task_data,
+                          GCancellable *cancellable)
+{
+  EphyBookmarksManager *self = EPHY_BOOKMARKS_MANAGER (source_object);
+  GBytes *records = task_data;
+  g_autoptr (GFile) file = NULL;
+  g_autoptr (GFileOutputStream) stream = NULL;
+  GError *error = NULL;
+
+  file = g_file_new_for_path (self->journal_filename);
+  stream = g_file_append_to (file, G_FILE_CREATE_PRIVATE, cancellable, &error);
+  if (!stream ||
+      !g_output_stream_write_all (G_OUTPUT_STREAM (stream),
+                                  g_bytes_get_data (records, NULL), g_bytes_get_size (records),
+                                  NULL, cancellable, &error) ||
+      !g_output_stream_close (G_OUTPUT_STREAM (stream), cancellable, &error)) {
     g_task_return_error (task, error);
     return;
   }
@@ -794,6 +1217,105 @@ bookmarks_export_cb (GObject      *source_object,
   g_task_return_boolean (task, TRUE);
 }
 
+static void
+journal_appended_cb (GObject      *source_object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  EphyBookmarksManager *self = EPHY_BOOKMARKS_MANAGER (source_object);
+  g_autoptr (GError) error = NULL;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+    /* The journal may end with a partial record now, so the next save has
+     * to start over from a complete GVDB file. */
+    self->journal_generation = 0;
+    ephy_bookmarks_manager_finish_write (self, error);
+    return;
+  }
+
+  self->journal_size += g_bytes_get_size (g_task_get_task_data (G_TASK (result)));
+  ephy_bookmarks_manager_finish_write (self, NULL);
+}
+
+static void
+ephy_bookmarks_manager_append_to_journal (EphyBookmarksManager *self)
+{
+  g_autoptr (GByteArray) records = g_byte_array_new ();
+  GHashTableIter iter;
+  gpointer key, value;
+  GTask *task;
+
+  if (self->journal_size == 0)
+    ephy_bookmarks_export_journal_header (records, self->journal_generation);
+
+  g_hash_table_iter_init (&iter, self->journal_tags);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    ephy_bookmarks_export_journal_tag (records, key, GPOINTER_TO_INT (value));
+
+  g_hash_table_iter_init (&iter, self->journal_removed_urls);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    ephy_bookmarks_export_journal_bookmark (records, key, NULL);
+
+  /* A bookmark that was removed or moved to another URL since it was
+   * recorded is no longer stored under this URL. */
+  g_hash_table_iter_init (&iter, self->journal_bookmarks);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    if (g_hash_table_contains (self->index_entries, value) &&
+        g_strcmp0 (ephy_bookmark_get_url (value), key) == 0)
+      ephy_bookmarks_export_journal_bookmark (records, key, value);
+    else
+      ephy_bookmarks_export_journal_bookmark (records, key, NULL);
+  }
+
+  if (g_hash_table_size (self->journal_tags) == 0 &&
+      g_hash_table_size (self->journal_removed_urls) == 0 &&
+      g_hash_table_size (self->journal_bookmarks) == 0) {
+    ephy_bookmarks_manager_finish_write (self, NULL);
+    return;
+  }
+
+  g_hash_table_remove_all (self->journal_tags);
+  g_hash_table_remove_all (self->journal_removed_urls);
+  g_hash_table_remove_all (self->journal_bookmarks);
+
+  task = g_task_new (self, self->cancellable, journal_appended_cb, NULL);
+  g_task_set_task_data (task, g_byte_array_free_to_bytes (g_steal_pointer (&records)), (GDestroyNotify)g_bytes_unref);
+  g_task_run_in_thread (task, append_to_journal_thread);
+  g_object_unref (task);
+}
+
+static void
+ephy_bookmarks_manager_start_write (EphyBookmarksManager *self)
+{
+  g_assert (!self->running_save_tasks);
+
+  self->running_save_tasks = g_steal_pointer (&self->save_tasks);
+  self->save_tasks = g_ptr_array_new ();
+
+  if (!self->cancellable) {
+    g_autoptr (GError) error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                                    "Bookmarks manager is being disposed");
+
+    ephy_bookmarks_manager_finish_write (self, error);
+    return;
+  }
+
+  if (self->compaction_needed ||
+      self->journal_generation == 0 ||
+      self->journal_size >= JOURNAL_COMPACTION_SIZE)
+    ephy_bookmarks_manager_compact (self);
+  else
+    ephy_bookmarks_manager_append_to_journal (self);
+}
+
+/* Saves the changes made since the last save. They are appended to a journal
+ * next to the GVDB file, so saving does not depend on the number of
+ * bookmarks. The GVDB file itself is only rewritten when the bookmarks or
+ * tags order has to be saved, or when the journal has grown too large.
+ *
+ * Writes happen one at a time. A save requested while another is running is
+ * done once that one has finished, together with all saves requested in the
+ * meantime. */
 void
 ephy_bookmarks_manager_save (EphyBookmarksManager *self,
                              gboolean              with_bookmarks_order,
@@ -802,12 +1324,40 @@ ephy_bookmarks_manager_save (EphyBookmarksManager *self,
                              GAsyncReadyCallback   callback,
                              gpointer              user_data)
 {
-  GTask *task;
+  g_ptr_array_add (self->save_tasks, g_task_new (self, cancellable, callback, user_data));
 
-  task = g_task_new (self, cancellable, callback, user_data);
+  /* Orders are only stored in the GVDB file. */
+  if (with_bookmarks_order || with_tags_order)
+    self->compaction_needed = TRUE;
 
-  ephy_bookmarks_export (self, self->gvdb_filename, with_bookmarks_order,
-                         with_tags_order, cancellable, bookmarks_export_cb, task);
+  if (!self->running_save_tasks)
+    ephy_bookmarks_manager_start_write (self);
+}
+
+gint64
+ephy_bookmarks_manager_get_journal_generation (EphyBookmarksManager *self)
+{
+  g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
+
+  return self->journal_generation;
+}
+
+/* Called once the GVDB file with the given generation and its journal have
+ * been loaded. What was loaded is already on disk, so it is not journaled
+ * again. A generation of 0 makes the next save write a complete GVDB file. */
+void
+ephy_bookmarks_manager_journal_loaded (EphyBookmarksManager *self,
+                                       gint64                generation,
+                                       gsize                 journal_size)
+{
+  g_assert (EPHY_IS_BOOKMARKS_MANAGER (self));
+
+  self->journal_generation = generation;
+  self->journal_size = journal_size;
+
+  g_hash_table_remove_all (self->journal_bookmarks);
+  g_hash_table_remove_all (self->journal_removed_urls);
+  g_hash_table_remove_all (self->journal_tags);
 }
 
 gboolean
@@ -964,6 +1514,11 @@ synchronizable_manager_save (EphySynchronizableManager *manager,
                              EphySynchronizable        *synchronizable)
 {
   EphyBookmarksManager *self = EPHY_BOOKMARKS_MANAGER (manager);
+  EphyBookmark *bookmark = EPHY_BOOKMARK (synchronizable);
+
+  /* The server modification time changes without notification. */
+  if (g_hash_table_contains (self->index_entries, bookmark))
+    ephy_bookmarks_manager_journal_bookmark (self, bookmark);
 
   ephy_bookmarks_manager_save (self, FALSE, FALSE, self->cancellable,
                                (GAsyncReadyCallback)ephy_bookmarks_manager_save_warn_on_error_cb,
@@ -1015,6 +1570,7 @@ ephy_bookmarks_manager_handle_initial_merge (EphyBookmarksManager *self,
         ephy_bookmarks_manager_copy_tags_from_bookmark (self, bookmark, l->data);
         timestamp = ephy_synchronizable_get_server_time_modified (l->data);
         ephy_synchronizable_set_server_time_modified (EPHY_SYNCHRONIZABLE (bookmark), timestamp);
+        ephy_bookmarks_manager_journal_bookmark (self, bookmark);
       } else {
         /* Same id, different url. Keep both and upload local one with new id. */
         char *new_id = ephy_sync_utils_get_random_sync_id ();
@@ -1031,6 +1587,7 @@ ephy_bookmarks_manager_handle_initial_merge (EphyBookmarksManager *self,
         ephy_bookmarks_manager_copy_tags_from_bookmark (self, bookmark, l->data);
         timestamp = ephy_synchronizable_get_server_time_modified (l->data);
         ephy_synchronizable_set_server_time_modified (EPHY_SYNCHRONIZABLE (bookmark), timestamp);
+        ephy_bookmarks_manager_journal_bookmark (self, bookmark);
       } else {
         /* Different id, different url. Add remote bookmark. */
         ephy_bookmarks_manager_add_bookmark_internal (self, l->data, FALSE);
@@ -1117,6 +1674,7 @@ ephy_bookmarks_manager_handle_regular_merge (EphyBookmarksManager *self,
         ephy_bookmarks_manager_copy_tags_from_bookmark (self, bookmark, l->data);
         timestamp = ephy_synchronizable_get_server_time_modified (l->data);
         ephy_synchronizable_set_server_time_modified (EPHY_SYNCHRONIZABLE (bookmark), timestamp);
+        ephy_bookmarks_manager_journal_bookmark (self, bookmark);
         g_ptr_array_add (to_upload, g_object_ref (bookmark));
       } else {
         /* Different id, different url. Add remote bookmark. */
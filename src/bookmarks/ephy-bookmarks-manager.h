@@ -47,6 +47,8 @@ EphyBookmark *ephy_bookmarks_manager_get_bookmark_by_url            (EphyBookmar
                                                                      const char           *url);
 EphyBookmark *ephy_bookmarks_manager_get_bookmark_by_id             (EphyBookmarksManager *self,
                                                                      const char           *id);
+GSequence   *ephy_bookmarks_manager_find_bookmarks                 (EphyBookmarksManager *self,
+                                                                     const char           *query);
 
 void         ephy_bookmarks_manager_create_tag                      (EphyBookmarksManager *self,
                                                                      const char           *tag);
@@ -110,4 +112,9 @@ void          ephy_bookmarks_manager_save_warn_on_error_cb          (GObject
                                                                      gpointer               user_data);
 GCancellable *ephy_bookmarks_manager_save_warn_on_error_cancellable (EphyBookmarksManager  *self);
 
+gint64        ephy_bookmarks_manager_get_journal_generation         (EphyBookmarksManager  *self);
+void          ephy_bookmarks_manager_journal_loaded                 (EphyBookmarksManager  *self,
+                                                                     gint64                 generation,
+                                                                     gsize                  journal_size);
+
 G_END_DECLS
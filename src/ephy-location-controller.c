@@ -80,53 +80,36 @@ handle_ephy_tab_uri (EphyLocationController *controller,
                      const char             *content)
 {
   EphyTabView *tab_view = ephy_window_get_tab_view (controller->window);
-  GtkWidget *tab;
+  EphyTabIndex *tab_index = ephy_shell_get_tab_index (ephy_shell_get_default ());
+  EphyTabIndexEntry *tab;
+  GtkWidget *page;
   EphyWebView *webview;
-  int window_id;
-  int tab_id;
-  g_auto (GStrv) split = g_strsplit (content + strlen ("ephy-tab://"), "@", -1);
+  GtkRoot *window;
+  guint64 tab_id;
 
-  if (g_strv_length (split) != 2)
+  if (!g_ascii_string_to_unsigned (content + strlen ("ephy-tab://"), 10, 0, G_MAXUINT64, &tab_id, NULL))
     return FALSE;
 
-  window_id = atoi (split[1]);
-  tab_id = atoi (split[0]);
-  tab = ephy_tab_view_get_selected_page (tab_view);
-  webview = ephy_embed_get_web_view (EPHY_EMBED (tab));
-
-  if (window_id != 0) {
-    GApplication *application;
-    EphyEmbedShell *shell;
-    EphyWindow *window;
-    GList *windows;
-
-    shell = ephy_embed_shell_get_default ();
-    application = G_APPLICATION (shell);
-    windows = gtk_application_get_windows (GTK_APPLICATION (application));
-
-    if ((guint)window_id >= g_list_length (windows))
-      return FALSE;
+  tab = ephy_tab_index_lookup (tab_index, tab_id);
+  if (!tab)
+    return FALSE;
 
-    window = g_list_nth_data (windows, window_id);
-    tab_view = ephy_window_get_tab_view (window);
+  page = ephy_tab_view_get_selected_page (tab_view);
+  webview = ephy_embed_get_web_view (EPHY_EMBED (page));
 
+  window = gtk_widget_get_root (GTK_WIDGET (tab->tab_view));
+  if (window && window != GTK_ROOT (controller->window)) {
     /* FIXME: this doesn't actually work.
      * https://gitlab.gnome.org/GNOME/epiphany/-/issues/1908
      */
     gtk_window_present (GTK_WINDOW (window));
   }
 
-  if (tab_id >= ephy_tab_view_get_n_pages (tab_view))
-    return FALSE;
-
-  ephy_tab_view_select_nth_page (tab_view, tab_id);
+  ephy_tab_view_select_page (tab->tab_view, GTK_WIDGET (tab->embed));
   gtk_widget_grab_focus (GTK_WIDGET (webview));
 
-  if (ephy_web_view_is_overview (webview)) {
-    if (window_id != 0)
-      tab_view = ephy_window_get_tab_view (controller->window);
-    ephy_tab_view_close (tab_view, tab);
-  }
+  if (ephy_web_view_is_overview (webview) && page != GTK_WIDGET (tab->embed))
+    ephy_tab_view_close (tab_view, page);
 
   return TRUE;
 }
@@ -309,6 +292,9 @@ ephy_location_controller_constructed (GObject *object)
   ephy_location_entry_set_model (EPHY_LOCATION_ENTRY (controller->title_widget), G_LIST_MODEL (model));
   g_object_unref (model);
 
+  /* Load the host names for inline completion before the first keystroke. */
+  ephy_embed_shell_get_host_trie (ephy_embed_shell_get_default ());
+
   g_object_bind_property (controller, "editable",
                           widget, "editable",
                           G_BINDING_SYNC_CREATE);
@@ -637,75 +637,51 @@ activate_shortcut_cb (EphyLocationEntry *self,
   return TRUE;
 }
 
+/* Longest common prefix of the suggested URLs, bookmarks included, that
+ * start with @key. Only the URLs themselves are compared: host names and
+ * base domains are completed by the host trie. */
 static char *
-compute_prefix (EphyLocationEntry *self,
-                const char        *key)
+compute_url_prefix (EphyLocationEntry *self,
+                    const char        *key)
 {
   int n_items = g_list_model_get_n_items (G_LIST_MODEL (self->suggestions_model));
   g_autofree char *prefix = NULL;
 
   for (int idx = 0; idx < n_items; idx++) {
     g_autoptr (EphySuggestion) suggestion = NULL;
-    g_autofree char *text = NULL;
     const char *subtitle;
+    char *p;
+    const char *q;
 
     suggestion = g_list_model_get_item (G_LIST_MODEL (self->suggestions_model), idx);
     subtitle = ephy_suggestion_get_subtitle (suggestion);
-    if (!subtitle)
-      continue;
-
-    if (g_str_has_prefix (subtitle, key)) {
-      text = g_strdup (subtitle);
-    } else {
-      g_autoptr (GError) error = NULL;
-      g_autoptr (GUri) uri = g_uri_parse (subtitle, G_URI_FLAGS_PARSE_RELAXED, &error);
-      g_autofree char *base = NULL;
-
-      if (error) {
-        LOG ("Could not parse url: %s", error->message);
-        continue;
-      }
-
-      if (!g_uri_get_host (uri))
-        continue;
-
-      base = ephy_uri_get_base_domain (g_uri_get_host (uri));
-      if (!base) {
-        LOG ("Could not get base domain for host %s", g_uri_get_host (uri));
-        continue;
-      }
-
-      if (g_str_has_prefix (base, key))
-        text = g_strdup (base);
-    }
-
-    if (!text)
+    if (!subtitle || !g_str_has_prefix (subtitle, key))
       continue;
 
     if (!prefix) {
-      prefix = g_strdup (text);
-    } else {
-      char *p = prefix;
-      char *q = text;
+      prefix = g_strdup (subtitle);
+      continue;
+    }
 
-      while (*p && *p == *q) {
-        p++;
-        q++;
-      }
+    p = prefix;
+    q = subtitle;
+    while (*p && *p == *q) {
+      p++;
+      q++;
+    }
 
-      *p = '\0';
+    *p = '\0';
 
-      if (p > prefix) {
-        q = g_utf8_find_prev_char (prefix, p);
+    if (p > prefix) {
+      char *prev = g_utf8_find_prev_char (prefix, p);
 
-        switch  (g_utf8_get_char_validated (q, p - q)) {
-          case (gunichar) - 2:
-          case (gunichar) - 1:
-            *q = 0;
-            break;
-          default:
-            break;
-        }
+      switch (g_utf8_get_char_validated (prev, p - prev)) {
+        case (gunichar) - 2:
+        case (gunichar) - 1:
+          *prev = '\0';
+          break;
+        default:
+          break;
       }
     }
   }
@@ -713,11 +689,28 @@ compute_prefix (EphyLocationEntry *self,
   return g_steal_pointer (&prefix);
 }
 
+static char *
+compute_prefix (EphyLocationEntry *self,
+                const char        *key)
+{
+  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
+  char *prefix;
+
+  prefix = compute_url_prefix (self, key);
+  if (prefix)
+    return prefix;
+
+  if (!shell)
+    return NULL;
+
+  return ephy_host_trie_complete (ephy_embed_shell_get_host_trie (shell), key);
+}
+
 static int
 calc_and_set_prefix (gpointer user_data)
 {
   EphyLocationEntry *self = EPHY_LOCATION_ENTRY (user_data);
-  char *prefix;
+  g_autofree char *prefix = NULL;
 
   prefix = compute_prefix (self, gtk_editable_get_text (GTK_EDITABLE (self->text)));
   if (prefix) {
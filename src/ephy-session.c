@@ -39,10 +39,10 @@
 #include "ephy-tab-view.h"
 #include "ephy-window.h"
 
+#include <errno.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
-#include <libxml/tree.h>
-#include <libxml/xmlwriter.h>
 
 typedef struct {
   EphyTabView *tab_view; /* nullable, weak ref */
@@ -56,11 +56,32 @@ typedef struct {
   WebKitWebViewSessionState *state;
 } ClosedTab;
 
+/* Windows that were not marked dirty since the last save that succeeded keep
+ * the file written for them then. A window only becomes clean once a save
+ * that serialized it is on disk, so a failed save leaves it dirty.
+ */
+typedef struct {
+  guint id;
+  guint changes;
+  guint saved_changes;
+} SessionWindowState;
+
 struct _EphySession {
   GObject parent_instance;
 
   GQueue *closed_tabs;
   guint save_source_id;
+
+  GHashTable *window_states; /* EphyWindow -> SessionWindowState */
+  guint next_window_id;
+
+  /* Protects the on-disk session state. Only held by the save thread and
+   * by session_delete ().
+   */
+  GMutex save_lock;
+  GHashTable *saved_window_files; /* nullable until the first save */
+  GHashTable *saved_windows; /* window id -> file name, nullable until the first save */
+  gboolean legacy_session_removed;
   guint closing : 1;
   guint dont_save : 1;
   guint loaded_page : 1;
@@ -68,6 +89,19 @@ struct _EphySession {
 
 #define SESSION_STATE           "type:session_state"
 
+/* The session is stored as a small manifest listing one file per window.
+ * A save only serializes the windows whose state changed since the previous
+ * one, see SessionWindowState, and names their files after a checksum of
+ * their contents. The legacy session_state.xml file is still read to migrate
+ * older profiles.
+ */
+#define SESSION_STATE_MANIFEST_FILE   "session_state.gvariant"
+#define SESSION_STATE_WINDOWS_DIR     "session_windows"
+#define SESSION_STATE_WINDOW_SUFFIX   ".gvariant"
+#define SESSION_STATE_FORMAT_VERSION  2
+#define SESSION_MANIFEST_VARIANT_TYPE "(uas)"
+#define SESSION_WINDOW_VARIANT_TYPE   "(iibbia(ssbbbbay))"
+
 enum {
   PROP_0,
   PROP_CAN_UNDO_TAB_CLOSED,
@@ -105,14 +139,116 @@ get_session_file (const char *filename)
   return file;
 }
 
+static char *
+get_session_manifest_path (void)
+{
+  return g_build_filename (ephy_profile_dir (), SESSION_STATE_MANIFEST_FILE, NULL);
+}
+
+static char *
+get_session_windows_dir (void)
+{
+  return g_build_filename (ephy_profile_dir (), SESSION_STATE_WINDOWS_DIR, NULL);
+}
+
+static void
+session_mark_all_windows_dirty (EphySession *session)
+{
+  GHashTableIter iter;
+  SessionWindowState *state;
+
+  g_hash_table_iter_init (&iter, session->window_states);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&state))
+    state->changes++;
+}
+
+static void
+session_mark_window_dirty (EphySession *session,
+                           GtkWidget   *widget)
+{
+  SessionWindowState *state = NULL;
+  GtkRoot *root;
+
+  root = gtk_widget_get_root (widget);
+  if (root)
+    state = g_hash_table_lookup (session->window_states, root);
+
+  /* Not in a window right now, e.g. a tab being moved to another one. */
+  if (!state) {
+    session_mark_all_windows_dirty (session);
+    return;
+  }
+
+  state->changes++;
+}
+
+static SessionWindowState *
+session_add_window_state (EphySession *session,
+                          EphyWindow  *window)
+{
+  SessionWindowState *state;
+
+  state = g_new (SessionWindowState, 1);
+  state->id = ++session->next_window_id;
+  state->changes = 1;
+  state->saved_changes = 0;
+  g_hash_table_insert (session->window_states, window, state);
+
+  return state;
+}
+
+static GHashTable *
+list_session_window_files (const char *windows_dir)
+{
+  GHashTable *files;
+  GDir *dir;
+  const char *name;
+
+  files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  dir = g_dir_open (windows_dir, 0, NULL);
+  if (!dir)
+    return files;
+
+  while ((name = g_dir_read_name (dir)))
+    g_hash_table_add (files, g_strdup (name));
+  g_dir_close (dir);
+
+  return files;
+}
+
 static void
 session_delete (EphySession *session)
 {
-  GFile *file;
+  g_autoptr (GFile) file = NULL;
+  g_autoptr (GHashTable) window_files = NULL;
+  g_autofree char *manifest_path = NULL;
+  g_autofree char *windows_dir = NULL;
+  GHashTableIter iter;
+  const char *name;
+
+  g_mutex_lock (&session->save_lock);
 
   file = get_session_file (SESSION_STATE);
   g_file_delete (file, NULL, NULL);
-  g_object_unref (file);
+
+  manifest_path = get_session_manifest_path ();
+  g_unlink (manifest_path);
+
+  windows_dir = get_session_windows_dir ();
+  window_files = list_session_window_files (windows_dir);
+  g_hash_table_iter_init (&iter, window_files);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&name, NULL)) {
+    g_autofree char *path = g_build_filename (windows_dir, name, NULL);
+    g_unlink (path);
+  }
+
+  g_clear_pointer (&session->saved_window_files, g_hash_table_unref);
+  g_clear_pointer (&session->saved_windows, g_hash_table_unref);
+
+  g_mutex_unlock (&session->save_lock);
+
+  session_mark_all_windows_dirty (session);
 }
 
 static void
@@ -120,6 +256,8 @@ load_changed_cb (WebKitWebView   *view,
                  WebKitLoadEvent  load_event,
                  EphySession     *session)
 {
+  session_mark_window_dirty (session, GTK_WIDGET (view));
+
   if (ephy_web_view_load_failed (EPHY_WEB_VIEW (view)))
     return;
 
@@ -324,6 +462,23 @@ ephy_session_get_can_undo_tab_closed (EphySession *session)
   return !g_queue_is_empty (session->closed_tabs);
 }
 
+/* State that is saved, but does not schedule a save by itself. */
+static void
+session_state_changed_cb (GtkWidget   *widget,
+                          GParamSpec  *pspec,
+                          EphySession *session)
+{
+  session_mark_window_dirty (session, widget);
+}
+
+static void
+tab_page_pinned_changed_cb (AdwTabPage  *page,
+                            GParamSpec  *pspec,
+                            EphySession *session)
+{
+  session_mark_window_dirty (session, adw_tab_page_get_child (page));
+}
+
 static void
 tab_view_page_attached_cb (AdwTabView  *tab_view,
                            AdwTabPage  *page,
@@ -331,9 +486,20 @@ tab_view_page_attached_cb (AdwTabView  *tab_view,
                            EphySession *session)
 {
   EphyEmbed *embed = EPHY_EMBED (adw_tab_page_get_child (page));
+  EphyWebView *web_view = ephy_embed_get_web_view (embed);
 
-  g_signal_connect (ephy_embed_get_web_view (embed), "load-changed",
+  session_mark_window_dirty (session, GTK_WIDGET (tab_view));
+
+  g_signal_connect (web_view, "load-changed",
                     G_CALLBACK (load_changed_cb), session);
+  g_signal_connect (web_view, "notify::uri",
+                    G_CALLBACK (session_state_changed_cb), session);
+  g_signal_connect (web_view, "notify::title",
+                    G_CALLBACK (session_state_changed_cb), session);
+  g_signal_connect (embed, "notify::discarded",
+                    G_CALLBACK (session_state_changed_cb), session);
+  g_signal_connect (page, "notify::pinned",
+                    G_CALLBACK (tab_page_pinned_changed_cb), session);
 }
 
 static void
@@ -352,11 +518,19 @@ tab_view_page_detached_cb (AdwTabView  *tab_view,
   ephy_tab_view = EPHY_GET_TAB_VIEW_FROM_ADW_TAB_VIEW (tab_view);
   g_assert (!ephy_tab_view || EPHY_IS_TAB_VIEW (ephy_tab_view));
 
+  session_mark_window_dirty (session, GTK_WIDGET (tab_view));
   ephy_session_save (session);
 
   g_signal_handlers_disconnect_by_func
     (ephy_embed_get_web_view (embed), G_CALLBACK (load_changed_cb),
     session);
+  g_signal_handlers_disconnect_by_func
+    (ephy_embed_get_web_view (embed), G_CALLBACK (session_state_changed_cb),
+    session);
+  g_signal_handlers_disconnect_by_func
+    (embed, G_CALLBACK (session_state_changed_cb), session);
+  g_signal_handlers_disconnect_by_func
+    (page, G_CALLBACK (tab_page_pinned_changed_cb), session);
 
   ephy_session_tab_closed (session, ephy_tab_view, embed, position);
 }
@@ -367,6 +541,7 @@ tab_view_page_reordered_cb (AdwTabView  *tab_view,
                             guint        position,
                             EphySession *session)
 {
+  session_mark_window_dirty (session, GTK_WIDGET (tab_view));
   ephy_session_save (session);
 }
 
@@ -375,6 +550,7 @@ tab_view_notify_selected_page_cb (AdwTabView  *tab_view,
                                   GParamSpec  *pspec,
                                   EphySession *session)
 {
+  session_mark_window_dirty (session, GTK_WIDGET (tab_view));
   ephy_session_save (session);
 }
 
@@ -405,6 +581,17 @@ window_added_cb (GtkApplication *application,
     return;
 
   ephy_window = EPHY_WINDOW (window);
+  if (!g_hash_table_contains (session->window_states, ephy_window))
+    session_add_window_state (session, ephy_window);
+
+  g_signal_connect_object (ephy_window, "notify::default-width",
+                           G_CALLBACK (session_state_changed_cb), session, 0);
+  g_signal_connect_object (ephy_window, "notify::default-height",
+                           G_CALLBACK (session_state_changed_cb), session, 0);
+  g_signal_connect_object (ephy_window, "notify::maximized",
+                           G_CALLBACK (session_state_changed_cb), session, 0);
+  g_signal_connect_object (ephy_window, "notify::fullscreened",
+                           G_CALLBACK (session_state_changed_cb), session, 0);
 
   tab_view = ephy_tab_view_get_tab_view (ephy_window_get_tab_view (ephy_window));
   g_signal_connect_object (tab_view, "page-attached",
@@ -423,6 +610,8 @@ window_removed_cb (GtkApplication *application,
                    GtkWindow      *window,
                    EphySession    *session)
 {
+  g_hash_table_remove (session->window_states, window);
+
   ephy_session_save (session);
 
   /* NOTE: since the window will be destroyed anyway, we don't need to
@@ -430,6 +619,15 @@ window_removed_cb (GtkApplication *application,
    */
 }
 
+static void
+restore_session_policy_changed_cb (GSettings   *settings,
+                                   const char  *key,
+                                   EphySession *session)
+{
+  /* The policy decides which tabs are saved. */
+  session_mark_all_windows_dirty (session);
+}
+
 /* Class implementation */
 
 static void
@@ -440,11 +638,15 @@ ephy_session_init (EphySession *session)
   LOG ("EphySession initialising");
 
   session->closed_tabs = g_queue_new ();
+  session->window_states = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  g_mutex_init (&session->save_lock);
   shell = ephy_shell_get_default ();
   g_signal_connect (shell, "window-added",
                     G_CALLBACK (window_added_cb), session);
   g_signal_connect (shell, "window-removed",
                     G_CALLBACK (window_removed_cb), session);
+  g_signal_connect_object (EPHY_SETTINGS_MAIN, "changed::" EPHY_PREFS_RESTORE_SESSION_POLICY,
+                           G_CALLBACK (restore_session_policy_changed_cb), session, 0);
 }
 
 static void
@@ -460,6 +662,19 @@ ephy_session_dispose (GObject *object)
   G_OBJECT_CLASS (ephy_session_parent_class)->dispose (object);
 }
 
+static void
+ephy_session_finalize (GObject *object)
+{
+  EphySession *session = EPHY_SESSION (object);
+
+  g_clear_pointer (&session->saved_window_files, g_hash_table_unref);
+  g_clear_pointer (&session->saved_windows, g_hash_table_unref);
+  g_clear_pointer (&session->window_states, g_hash_table_unref);
+  g_mutex_clear (&session->save_lock);
+
+  G_OBJECT_CLASS (ephy_session_parent_class)->finalize (object);
+}
+
 static void
 ephy_session_get_property (GObject    *object,
                            guint       property_id,
@@ -484,6 +699,7 @@ ephy_session_class_init (EphySessionClass *class)
   GObjectClass *object_class = G_OBJECT_CLASS (class);
 
   object_class->dispose = ephy_session_dispose;
+  object_class->finalize = ephy_session_finalize;
   object_class->get_property = ephy_session_get_property;
 
   obj_properties[PROP_CAN_UNDO_TAB_CLOSED] =
@@ -514,12 +730,19 @@ ephy_session_close (EphySession *session)
 
   session->closing = TRUE;
 
+  /* Tabs that are still loading are no longer saved as such. */
+  session_mark_all_windows_dirty (session);
   ephy_session_save_now (session);
 
   session->dont_save = TRUE;
 }
 
 typedef struct {
+  guint id;
+  guint changes;
+  /* Unchanged since the last save, nothing else is set. */
+  gboolean clean;
+
   int width;
   int height;
   gboolean is_maximized;
@@ -544,6 +767,7 @@ typedef struct {
   gboolean loading;
   gboolean crashed;
   gboolean pinned;
+  gboolean discarded;
   WebKitWebViewSessionState *state;
 } SessionTab;
 
@@ -580,6 +804,7 @@ session_tab_new (EphyEmbed   *embed,
                           error_page == EPHY_WEB_VIEW_ERROR_PROCESS_CRASH);
   session_tab->state = ephy_embed_get_session_state (EPHY_GET_EMBED_FROM_EPHY_WEB_VIEW (web_view));
   session_tab->pinned = ephy_tab_view_get_is_pinned (tab_view, GTK_WIDGET (embed));
+  session_tab->discarded = ephy_tab_view_get_is_discarded (tab_view, GTK_WIDGET (embed));
 
   return session_tab;
 }
@@ -654,11 +879,25 @@ save_data_new (EphySession *session)
 
   windows = gtk_application_get_windows (GTK_APPLICATION (shell));
   for (w = windows; w; w = w->next) {
+    SessionWindowState *state;
     SessionWindow *session_window;
 
-    session_window = session_window_new (EPHY_WINDOW (w->data), session);
-    if (session_window)
-      data->windows = g_list_prepend (data->windows, session_window);
+    state = g_hash_table_lookup (session->window_states, w->data);
+    if (!state)
+      state = session_add_window_state (session, EPHY_WINDOW (w->data));
+
+    if (state->changes != state->saved_changes) {
+      session_window = session_window_new (EPHY_WINDOW (w->data), session);
+      if (!session_window)
+        continue;
+    } else {
+      session_window = g_new0 (SessionWindow, 1);
+      session_window->clean = TRUE;
+    }
+
+    session_window->id = state->id;
+    session_window->changes = state->changes;
+    data->windows = g_list_prepend (data->windows, session_window);
   }
   data->windows = g_list_reverse (data->windows);
 
@@ -696,82 +935,36 @@ should_save_url (const char *url)
   return TRUE;
 }
 
-static int
-write_tab (xmlTextWriterPtr  writer,
-           SessionTab       *tab)
-{
-  int ret;
-
-  if (!should_save_url (tab->url))
-    return 0;
-
-  ret = xmlTextWriterStartElement (writer, (xmlChar *)"embed");
-  if (ret < 0)
-    return ret;
-
-  ret = xmlTextWriterWriteAttribute (writer, (xmlChar *)"url",
-                                     (const xmlChar *)tab->url);
-  if (ret < 0)
-    return ret;
-
-  ret = xmlTextWriterWriteAttribute (writer, (xmlChar *)"title",
-                                     (const xmlChar *)tab->title);
-  if (ret < 0)
-    return ret;
-
-  if (tab->loading) {
-    ret = xmlTextWriterWriteAttribute (writer,
-                                       (const xmlChar *)"loading",
-                                       (const xmlChar *)"true");
-    if (ret < 0)
-      return ret;
-  }
-
-  if (tab->pinned) {
-    ret = xmlTextWriterWriteAttribute (writer,
-                                       (const xmlChar *)"pinned",
-                                       (const xmlChar *)"true");
-    if (ret < 0)
-      return ret;
-  }
-
-  if (tab->crashed) {
-    ret = xmlTextWriterWriteAttribute (writer,
-                                       (const xmlChar *)"crashed",
-                                       (const xmlChar *)"true");
-    if (ret < 0)
-      return ret;
-  }
+static GVariant *
+session_tab_to_variant (SessionTab *tab)
+{
+  GVariant *history = NULL;
 
   if (tab->state) {
-    GBytes *bytes;
+    g_autoptr (GBytes) bytes = webkit_web_view_session_state_serialize (tab->state);
 
-    bytes = webkit_web_view_session_state_serialize (tab->state);
-    if (bytes) {
-      gchar *base64;
-      gconstpointer data;
-      gsize data_length;
-
-      data = g_bytes_get_data (bytes, &data_length);
-      base64 = g_base64_encode (data, data_length);
-      xmlTextWriterWriteAttribute (writer,
-                                   (const xmlChar *)"history",
-                                   (const xmlChar *)base64);
-      g_free (base64);
-      g_bytes_unref (bytes);
-    }
+    if (bytes)
+      history = g_variant_new_from_bytes (G_VARIANT_TYPE_BYTESTRING, bytes, TRUE);
   }
 
-  ret = xmlTextWriterEndElement (writer);       /* embed */
-  return ret;
+  if (!history)
+    history = g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, NULL, 0, sizeof (guchar));
+
+  return g_variant_new ("(ssbbbb@ay)",
+                        tab->url,
+                        tab->title ? tab->title : "",
+                        tab->loading,
+                        tab->pinned,
+                        tab->crashed,
+                        tab->discarded,
+                        history);
 }
 
-static int
-write_ephy_window (xmlTextWriterPtr  writer,
-                   SessionWindow    *window)
+static GVariant *
+session_window_to_variant (SessionWindow *window)
 {
+  GVariantBuilder tabs;
   GList *l;
-  int ret;
   EphyPrefsRestoreSessionPolicy policy;
   int last_pinned_tab = -1;
   gboolean only_pinned_tabs = FALSE;
@@ -788,36 +981,13 @@ write_ephy_window (xmlTextWriterPtr  writer,
     }
 
     if (last_pinned_tab == -1)
-      return 0;
+      return NULL;
   }
 
-  ret = xmlTextWriterStartElement (writer, (xmlChar *)"window");
-  if (ret < 0)
-    return ret;
-
-  ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *)"width", "%d", window->width);
-  if (ret < 0)
-    return ret;
-
-  ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *)"height", "%d", window->height);
-  if (ret < 0)
-    return ret;
-
-  ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *)"is-maximized", "%d", window->is_maximized);
-  if (ret < 0)
-    return ret;
-
-  ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *)"is-fullscreen", "%d", window->is_fullscreen);
-  if (ret < 0)
-    return ret;
-
   if (last_pinned_tab != -1 && window->active_tab >= last_pinned_tab)
     window->active_tab = last_pinned_tab + 1;
 
-  ret = xmlTextWriterWriteFormatAttribute (writer, (const xmlChar *)"active-tab", "%d",
-                                           window->active_tab);
-  if (ret < 0)
-    return ret;
+  g_variant_builder_init (&tabs, G_VARIANT_TYPE ("a(ssbbbbay)"));
 
   for (l = window->tabs; l; l = l->next) {
     SessionTab *tab = (SessionTab *)l->data;
@@ -825,12 +995,9 @@ write_ephy_window (xmlTextWriterPtr  writer,
     if (only_pinned_tabs && !tab->pinned)
       break;
 
-    ret = write_tab (writer, tab);
-    if (ret < 0)
-      break;
+    if (should_save_url (tab->url))
+      g_variant_builder_add_value (&tabs, session_tab_to_variant (tab));
   }
-  if (ret < 0)
-    return ret;
 
   if (only_pinned_tabs && last_pinned_tab != -1) {
     /* We are in EPHY_PREFS_RESTORE_SESSION_POLICY_NEVER with pinned tabs
@@ -841,12 +1008,17 @@ write_ephy_window (xmlTextWriterPtr  writer,
     new_session_tab->url = g_strdup ("about:overview");
     new_session_tab->title = g_strdup ("");
 
-    write_tab (writer, new_session_tab);
+    g_variant_builder_add_value (&tabs, session_tab_to_variant (new_session_tab));
     session_tab_free (new_session_tab);
   }
 
-  ret = xmlTextWriterEndElement (writer);       /* window */
-  return ret;
+  return g_variant_new ("(iibbi@a(ssbbbbay))",
+                        window->width,
+                        window->height,
+                        window->is_maximized,
+                        window->is_fullscreen,
+                        window->active_tab,
+                        g_variant_builder_end (&tabs));
 }
 
 static void
@@ -854,6 +1026,26 @@ save_session_in_thread_finished_cb (GObject      *source_object,
                                     GAsyncResult *res,
                                     gpointer      user_data)
 {
+  EphySession *session = EPHY_SESSION (source_object);
+  SaveData *data = g_task_get_task_data (G_TASK (res));
+
+  /* Windows not marked dirty again since they were serialized are clean. */
+  if (g_task_propagate_boolean (G_TASK (res), NULL)) {
+    for (GList *w = data->windows; w; w = w->next) {
+      SessionWindow *window = (SessionWindow *)w->data;
+      GHashTableIter iter;
+      SessionWindowState *state;
+
+      g_hash_table_iter_init (&iter, session->window_states);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&state)) {
+        if (state->id == window->id) {
+          state->saved_changes = window->changes;
+          break;
+        }
+      }
+    }
+  }
+
   g_object_unref (EPHY_SESSION (source_object));
   g_application_release (G_APPLICATION (ephy_shell_get_default ()));
 
@@ -861,7 +1053,7 @@ save_session_in_thread_finished_cb (GObject      *source_object,
    * After this GLib issue is fixed, we should instead pass save_data_free() as the
    * GDestroyNotify parameter to g_task_set_task_data().
    */
-  save_data_free (g_task_get_task_data (G_TASK (res)));
+  save_data_free (data);
 }
 
 static gboolean
@@ -913,6 +1105,48 @@ session_seems_reasonable (GList *windows)
   return TRUE;
 }
 
+static gboolean
+write_session_window (EphySession    *session,
+                      const char     *windows_dir,
+                      SessionWindow  *window,
+                      char          **out_name,
+                      GError        **error)
+{
+  g_autoptr (GVariant) variant = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autofree char *checksum = NULL;
+  g_autofree char *name = NULL;
+
+  variant = session_window_to_variant (window);
+  if (!variant) {
+    *out_name = NULL;
+    return TRUE;
+  }
+
+  g_variant_ref_sink (variant);
+  bytes = g_variant_get_data_as_bytes (variant);
+  checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, bytes);
+  name = g_strconcat (checksum, SESSION_STATE_WINDOW_SUFFIX, NULL);
+
+  /* Windows whose state did not change since the last save are already on
+   * disk under the same name.
+   */
+  if (!g_hash_table_contains (session->saved_window_files, name)) {
+    g_autofree char *path = g_build_filename (windows_dir, name, NULL);
+
+    if (!g_file_set_contents (path,
+                              g_bytes_get_data (bytes, NULL),
+                              g_bytes_get_size (bytes),
+                              error))
+      return FALSE;
+
+    g_hash_table_add (session->saved_window_files, g_strdup (name));
+  }
+
+  *out_name = g_steal_pointer (&name);
+  return TRUE;
+}
+
 static void
 save_session_sync (GTask        *task,
                    gpointer      source_object,
@@ -920,67 +1154,96 @@ save_session_sync (GTask        *task,
                    GCancellable *cancellable)
 {
   SaveData *data = (SaveData *)g_task_get_task_data (task);
-  xmlOutputBufferPtr buffer;
-  xmlTextWriterPtr writer = NULL;
+  EphySession *session = data->session;
+  g_autoptr (GHashTable) referenced = NULL;
+  g_autoptr (GHashTable) saved_windows = NULL;
+  g_autoptr (GVariant) manifest = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *windows_dir = NULL;
+  g_autofree char *manifest_path = NULL;
+  GVariantBuilder windows;
+  GHashTableIter iter;
+  const char *name;
+  gboolean success = FALSE;
   GList *w;
-  int ret = -1;
 
-  buffer = xmlAllocOutputBuffer (NULL);
-  if (!buffer)
-    goto out;
+  g_mutex_lock (&session->save_lock);
 
-  writer = xmlNewTextWriter (buffer);
-  if (!writer)
-    goto out;
+  START_PROFILER ("Saving session")
 
-  ret = xmlTextWriterSetIndent (writer, 1);
-  if (ret < 0)
+  windows_dir = get_session_windows_dir ();
+  if (g_mkdir_with_parents (windows_dir, 0700) == -1) {
+    g_warning ("Error saving session: failed to create %s: %s", windows_dir, g_strerror (errno));
     goto out;
+  }
 
-  ret = xmlTextWriterSetIndentString (writer, (const xmlChar *)"	 ");
-  if (ret < 0)
-    goto out;
+  if (!session->saved_window_files)
+    session->saved_window_files = list_session_window_files (windows_dir);
+  if (!session->saved_windows)
+    session->saved_windows = g_hash_table_new_full (NULL, NULL, NULL, g_free);
 
-  START_PROFILER ("Saving session")
+  referenced = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  saved_windows = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  g_variant_builder_init (&windows, G_VARIANT_TYPE_STRING_ARRAY);
 
-  ret = xmlTextWriterStartDocument (writer, "1.0", NULL, NULL);
-  if (ret < 0)
-    goto out;
+  for (w = data->windows; w; w = w->next) {
+    SessionWindow *window = (SessionWindow *)w->data;
+    char *window_name;
 
-  /* create and set the root node for the session */
-  ret = xmlTextWriterStartElement (writer, (const xmlChar *)"session");
-  if (ret < 0)
-    goto out;
+    if (window->clean) {
+      window_name = g_strdup (g_hash_table_lookup (session->saved_windows, GUINT_TO_POINTER (window->id)));
+    } else if (!write_session_window (session, windows_dir, window, &window_name, &error)) {
+      g_warning ("Error saving session: %s", error->message);
+      g_variant_builder_clear (&windows);
+      goto out;
+    }
 
-  /* iterate through all the windows */
-  for (w = data->windows; w && ret >= 0; w = w->next) {
-    ret = write_ephy_window (writer, (SessionWindow *)w->data);
+    if (window_name) {
+      g_variant_builder_add (&windows, "s", window_name);
+      g_hash_table_add (referenced, g_strdup (window_name));
+      g_hash_table_insert (saved_windows, GUINT_TO_POINTER (window->id), window_name);
+    }
   }
-  if (ret < 0)
-    goto out;
 
-  ret = xmlTextWriterEndElement (writer);       /* session */
-  if (ret < 0)
+  manifest = g_variant_ref_sink (g_variant_new ("(u@as)",
+                                                SESSION_STATE_FORMAT_VERSION,
+                                                g_variant_builder_end (&windows)));
+  manifest_path = get_session_manifest_path ();
+  if (!g_file_set_contents (manifest_path,
+                            g_variant_get_data (manifest),
+                            g_variant_get_size (manifest),
+                            &error)) {
+    g_warning ("Error saving session: %s", error->message);
     goto out;
+  }
 
-  ret = xmlTextWriterEndDocument (writer);
+  g_hash_table_unref (session->saved_windows);
+  session->saved_windows = g_steal_pointer (&saved_windows);
+  success = TRUE;
 
-  if (ret >= 0) {
-    g_autoptr (GError) error = NULL;
-    g_autoptr (GFile) session_file = NULL;
+  /* The new manifest is in place, so window files it does not reference
+   * anymore can go away.
+   */
+  g_hash_table_iter_init (&iter, session->saved_window_files);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&name, NULL)) {
+    if (!g_hash_table_contains (referenced, name)) {
+      g_autofree char *path = g_build_filename (windows_dir, name, NULL);
 
-    session_file = get_session_file (SESSION_STATE);
-    if (!g_file_replace_contents (session_file,
-                                  (const char *)xmlBufContent (buffer->buffer),
-                                  xmlBufUse (buffer->buffer),
-                                  NULL, TRUE, 0, NULL, NULL, &error)) {
-      g_warning ("Error saving session: %s", error->message);
+      g_unlink (path);
+      g_hash_table_iter_remove (&iter);
     }
   }
 
+  if (!session->legacy_session_removed) {
+    g_autoptr (GFile) legacy_file = get_session_file (SESSION_STATE);
+
+    g_file_delete (legacy_file, NULL, NULL);
+    session->legacy_session_removed = TRUE;
+  }
+
 out:
-  g_clear_pointer (&writer, xmlFreeTextWriter);
-  g_task_return_boolean (task, TRUE);
+  g_mutex_unlock (&session->save_lock);
+  g_task_return_boolean (task, success);
 
   STOP_PROFILER ("Saving session")
 }
@@ -1123,15 +1386,13 @@ window_destroyed (GtkWidget  *widget,
 }
 
 static void
-session_parse_window (SessionParserContext  *context,
-                      const gchar          **names,
-                      const gchar          **values)
+session_restore_window (SessionParserContext *context,
+                        int                   width,
+                        int                   height,
+                        gboolean              is_maximized,
+                        gboolean              is_fullscreen,
+                        int                   active_tab)
 {
-  int width = 0, height = 0;
-  gboolean is_maximized = FALSE;
-  gboolean is_fullscreen = FALSE;
-  guint i;
-
   if (context->window) {
     /* This should only happen if the session state is malformed. */
     return;
@@ -1139,6 +1400,31 @@ session_parse_window (SessionParserContext  *context,
 
   context->window = ephy_window_new ();
   context->destroy_id = g_signal_connect (context->window, "destroy", G_CALLBACK (window_destroyed), &context->window);
+  context->active_tab = active_tab;
+
+  if (width > 0 && height > 0)
+    ephy_window_set_default_size (context->window, width, height);
+
+  if (is_maximized)
+    gtk_window_maximize (GTK_WINDOW (context->window));
+
+  if (is_fullscreen) {
+    /* Treat fullscreen on session restore same as fullscreen action */
+    ephy_window_show_fullscreen_header_bar (context->window);
+    gtk_window_fullscreen (GTK_WINDOW (context->window));
+  }
+}
+
+static void
+session_parse_window (SessionParserContext  *context,
+                      const gchar          **names,
+                      const gchar          **values)
+{
+  int width = 0, height = 0;
+  int active_tab = 0;
+  gboolean is_maximized = FALSE;
+  gboolean is_fullscreen = FALSE;
+  guint i;
 
   for (i = 0; names[i]; i++) {
     gulong int_value;
@@ -1157,37 +1443,25 @@ session_parse_window (SessionParserContext  *context,
       is_fullscreen = int_value != 0;
     } else if (strcmp (names[i], "active-tab") == 0) {
       ephy_string_to_int (values[i], &int_value);
-      context->active_tab = int_value;
+      active_tab = int_value;
     }
   }
 
-  if (width > 0 && height > 0)
-    ephy_window_set_default_size (context->window, width, height);
-
-  if (is_maximized)
-    gtk_window_maximize (GTK_WINDOW (context->window));
-
-  if (is_fullscreen) {
-    /* Treat fullscreen on session restore same as fullscreen action */
-    ephy_window_show_fullscreen_header_bar (context->window);
-    gtk_window_fullscreen (GTK_WINDOW (context->window));
-  }
+  session_restore_window (context, width, height, is_maximized, is_fullscreen, active_tab);
 }
 
 static void
-session_parse_embed (SessionParserContext  *context,
-                     const gchar          **names,
-                     const gchar          **values)
+session_restore_tab (SessionParserContext *context,
+                     const char           *url,
+                     const char           *title,
+                     GBytes               *history,
+                     gboolean              was_loading,
+                     gboolean              crashed,
+                     gboolean              is_pin,
+                     gboolean              discarded)
 {
   AdwTabView *tab_view;
-  const char *url = NULL;
-  const char *title = NULL;
-  const char *history = NULL;
-  gboolean was_loading = FALSE;
-  gboolean crashed = FALSE;
   gboolean is_blank_page = FALSE;
-  gboolean is_pin = FALSE;
-  guint i;
 
   if (!context->window) {
     /* This can happen if the session is malformed, or if the window is
@@ -1198,22 +1472,9 @@ session_parse_embed (SessionParserContext  *context,
 
   tab_view = ephy_tab_view_get_tab_view (ephy_window_get_tab_view (context->window));
 
-  for (i = 0; names[i]; i++) {
-    if (strcmp (names[i], "url") == 0) {
-      url = values[i];
-      is_blank_page = (strcmp (url, "about:blank") == 0 ||
-                       strcmp (url, "about:overview") == 0);
-    } else if (strcmp (names[i], "title") == 0) {
-      title = values[i];
-    } else if (strcmp (names[i], "loading") == 0) {
-      was_loading = strcmp (values[i], "true") == 0;
-    } else if (strcmp (names[i], "crashed") == 0) {
-      crashed = strcmp (values[i], "true") == 0;
-    } else if (strcmp (names[i], "history") == 0) {
-      history = values[i];
-    } else if (strcmp (names[i], "pinned") == 0) {
-      is_pin = strcmp (values[i], "true") == 0;
-    }
+  if (url) {
+    is_blank_page = (strcmp (url, "about:blank") == 0 ||
+                     strcmp (url, "about:overview") == 0);
   }
 
   /* In the case that crash happens before we receive the URL from the server,
@@ -1239,6 +1500,10 @@ session_parse_embed (SessionParserContext  *context,
                                               EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS);
     }
 
+    /* Tabs that were unloaded to save memory stay unloaded. */
+    if (discarded)
+      delay_loading = TRUE;
+
     flags = EPHY_NEW_TAB_APPEND_LAST;
 
     embed = ephy_shell_new_tab_full (ephy_shell_get_default (),
@@ -1250,16 +1515,8 @@ session_parse_embed (SessionParserContext  *context,
                                   is_pin);
 
     web_view = ephy_embed_get_web_view (embed);
-    if (history) {
-      guchar *data;
-      gsize data_length;
-      GBytes *history_data;
-
-      data = g_base64_decode (history, &data_length);
-      history_data = g_bytes_new_take (data, data_length);
-      state = webkit_web_view_session_state_new (history_data);
-      g_bytes_unref (history_data);
-    }
+    if (history && g_bytes_get_size (history) > 0)
+      state = webkit_web_view_session_state_new (history);
 
     if (delay_loading) {
       WebKitURIRequest *request = webkit_uri_request_new (url);
@@ -1267,6 +1524,9 @@ session_parse_embed (SessionParserContext  *context,
       ephy_embed_set_delayed_load_request (embed, request, state);
       ephy_web_view_set_placeholder (web_view, url, title);
       g_object_unref (request);
+
+      if (discarded)
+        ephy_embed_mark_discarded (embed);
     } else {
       WebKitBackForwardList *bf_list;
       WebKitBackForwardListItem *item;
@@ -1296,6 +1556,43 @@ session_parse_embed (SessionParserContext  *context,
   }
 }
 
+static void
+session_parse_embed (SessionParserContext  *context,
+                     const gchar          **names,
+                     const gchar          **values)
+{
+  g_autoptr (GBytes) history = NULL;
+  const char *url = NULL;
+  const char *title = NULL;
+  gboolean was_loading = FALSE;
+  gboolean crashed = FALSE;
+  gboolean is_pin = FALSE;
+  guint i;
+
+  for (i = 0; names[i]; i++) {
+    if (strcmp (names[i], "url") == 0) {
+      url = values[i];
+    } else if (strcmp (names[i], "title") == 0) {
+      title = values[i];
+    } else if (strcmp (names[i], "loading") == 0) {
+      was_loading = strcmp (values[i], "true") == 0;
+    } else if (strcmp (names[i], "crashed") == 0) {
+      crashed = strcmp (values[i], "true") == 0;
+    } else if (strcmp (names[i], "history") == 0) {
+      guchar *data;
+      gsize data_length;
+
+      g_clear_pointer (&history, g_bytes_unref);
+      data = g_base64_decode (values[i], &data_length);
+      history = g_bytes_new_take (data, data_length);
+    } else if (strcmp (names[i], "pinned") == 0) {
+      is_pin = strcmp (values[i], "true") == 0;
+    }
+  }
+
+  session_restore_tab (context, url, title, history, was_loading, crashed, is_pin, FALSE);
+}
+
 static void
 session_start_element (GMarkupParseContext  *ctx,
                        const gchar          *element_name,
@@ -1315,55 +1612,61 @@ session_start_element (GMarkupParseContext  *ctx,
 }
 
 static void
-session_end_element (GMarkupParseContext  *ctx,
-                     const gchar          *element_name,
-                     gpointer              user_data,
-                     GError              **error)
+session_finish_window (SessionParserContext *context)
 {
-  SessionParserContext *context = (SessionParserContext *)user_data;
+  EphyTabView *tab_view;
+  EphyEmbedShell *shell = ephy_embed_shell_get_default ();
 
-  if (strcmp (element_name, "window") == 0) {
-    EphyTabView *tab_view;
-    EphyEmbedShell *shell = ephy_embed_shell_get_default ();
+  if (!context->window) {
+    /* This can happen if the session is malformed, or if the window is
+     * destroyed before the session finishes loading.
+     */
+    return;
+  }
 
-    if (!context->window) {
-      /* This can happen if the session is malformed, or if the window is
-       * destroyed before the session finishes loading.
-       */
-      return;
-    }
+  if (context->is_first_tab) {
+    EphyEmbed *embed;
+    EphyWebView *web_view;
+
+    /* No tabs were restored from session state. */
 
-    if (context->is_first_tab) {
-      EphyEmbed *embed;
-      EphyWebView *web_view;
+    embed = ephy_shell_new_tab (ephy_shell_get_default (),
+                                context->window, NULL, 0);
+    web_view = ephy_embed_get_web_view (embed);
+    ephy_web_view_load_homepage (web_view);
+  }
 
-      /* No tabs were restored from session state. */
+  tab_view = ephy_window_get_tab_view (context->window);
+  if (context->active_tab < ephy_tab_view_get_n_pages (tab_view))
+    ephy_tab_view_select_nth_page (tab_view, context->active_tab);
 
-      embed = ephy_shell_new_tab (ephy_shell_get_default (),
-                                  context->window, NULL, 0);
-      web_view = ephy_embed_get_web_view (embed);
-      ephy_web_view_load_homepage (web_view);
-    }
+  if (ephy_embed_shell_get_mode (ephy_embed_shell_get_default ()) != EPHY_EMBED_SHELL_MODE_TEST) {
+    EphyEmbed *active_child;
 
-    tab_view = ephy_window_get_tab_view (context->window);
-    if (context->active_tab < ephy_tab_view_get_n_pages (tab_view))
-      ephy_tab_view_select_nth_page (tab_view, context->active_tab);
+    active_child = ephy_embed_container_get_active_child (EPHY_EMBED_CONTAINER (context->window));
+    gtk_widget_grab_focus (GTK_WIDGET (active_child));
+    ephy_window_update_entry_focus (context->window, ephy_embed_get_web_view (active_child));
+    gtk_widget_set_visible (GTK_WIDGET (context->window), TRUE);
+  }
 
-    if (ephy_embed_shell_get_mode (ephy_embed_shell_get_default ()) != EPHY_EMBED_SHELL_MODE_TEST) {
-      EphyEmbed *active_child;
+  ephy_embed_shell_restored_window (shell);
 
-      active_child = ephy_embed_container_get_active_child (EPHY_EMBED_CONTAINER (context->window));
-      gtk_widget_grab_focus (GTK_WIDGET (active_child));
-      ephy_window_update_entry_focus (context->window, ephy_embed_get_web_view (active_child));
-      gtk_widget_set_visible (GTK_WIDGET (context->window), TRUE);
-    }
+  g_clear_signal_handler (&context->destroy_id, context->window);
+  context->window = NULL;
+  context->active_tab = 0;
+  context->is_first_window = FALSE;
+}
 
-    ephy_embed_shell_restored_window (shell);
+static void
+session_end_element (GMarkupParseContext  *ctx,
+                     const gchar          *element_name,
+                     gpointer              user_data,
+                     GError              **error)
+{
+  SessionParserContext *context = (SessionParserContext *)user_data;
 
-    g_clear_signal_handler (&context->destroy_id, context->window);
-    context->window = NULL;
-    context->active_tab = 0;
-    context->is_first_window = FALSE;
+  if (strcmp (element_name, "window") == 0) {
+    session_finish_window (context);
   } else if (strcmp (element_name, "embed") == 0) {
     context->is_first_tab = FALSE;
   }
@@ -1422,8 +1725,9 @@ load_stream_complete (GTask *task)
 }
 
 static void
-load_stream_complete_error (GTask  *task,
-                            GError *error)
+load_stream_complete_error_full (GTask    *task,
+                                 GError   *error,
+                                 gboolean  delete_session)
 {
   EphySession *session;
 
@@ -1434,7 +1738,8 @@ load_stream_complete_error (GTask  *task,
   /* If the session fails to load for whatever reason,
    * delete the file and open an empty window.
    */
-  session_delete (session);
+  if (delete_session)
+    session_delete (session);
 
   session_maybe_open_window (session);
 
@@ -1443,6 +1748,13 @@ load_stream_complete_error (GTask  *task,
   g_application_release (G_APPLICATION (ephy_shell_get_default ()));
 }
 
+static void
+load_stream_complete_error (GTask  *task,
+                            GError *error)
+{
+  load_stream_complete_error_full (task, error, TRUE);
+}
+
 static void
 load_stream_read_cb (GObject      *object,
                      GAsyncResult *result,
@@ -1556,6 +1868,194 @@ ephy_session_load_from_stream_finish (EphySession   *session,
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+typedef struct {
+  SessionParserContext *context;
+  GVariant *windows;
+  char *windows_dir;
+  gsize next_window;
+} LoadBinaryAsyncData;
+
+static void
+load_binary_async_data_free (LoadBinaryAsyncData *data)
+{
+  session_parser_context_free (data->context);
+  g_variant_unref (data->windows);
+  g_free (data->windows_dir);
+
+  g_free (data);
+}
+
+static void
+session_load_window_file (SessionParserContext *context,
+                          const char           *path)
+{
+  g_autoptr (GMappedFile) file = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GVariant) window = NULL;
+  g_autoptr (GVariant) tabs = NULL;
+  g_autoptr (GError) error = NULL;
+  int width, height, active_tab;
+  gboolean is_maximized, is_fullscreen;
+  GVariantIter iter;
+  GVariant *tab;
+
+  file = g_mapped_file_new (path, FALSE, &error);
+  if (!file) {
+    g_warning ("Failed to restore session window: %s", error->message);
+    return;
+  }
+
+  /* The tab histories are handed out as slices of the mapping, so nothing
+   * is copied until WebKit deserializes them.
+   */
+  bytes = g_mapped_file_get_bytes (file);
+  window = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (SESSION_WINDOW_VARIANT_TYPE),
+                                                         bytes, FALSE));
+  g_variant_get (window, "(iibbi@a(ssbbbbay))",
+                 &width, &height, &is_maximized, &is_fullscreen, &active_tab, &tabs);
+
+  session_restore_window (context, width, height, is_maximized, is_fullscreen, active_tab);
+  context->is_first_tab = TRUE;
+
+  g_variant_iter_init (&iter, tabs);
+  while ((tab = g_variant_iter_next_value (&iter))) {
+    g_autoptr (GVariant) history = NULL;
+    g_autoptr (GBytes) history_bytes = NULL;
+    const char *url;
+    const char *title;
+    gboolean was_loading, is_pin, crashed, discarded;
+
+    g_variant_get (tab, "(&s&sbbbb@ay)", &url, &title, &was_loading, &is_pin, &crashed, &discarded, &history);
+    history_bytes = g_variant_get_data_as_bytes (history);
+
+    session_restore_tab (context, url, title, history_bytes, was_loading, crashed, is_pin, discarded);
+    context->is_first_tab = FALSE;
+
+    g_variant_unref (tab);
+  }
+
+  session_finish_window (context);
+}
+
+static gboolean
+load_binary_window_cb (GTask *task)
+{
+  LoadBinaryAsyncData *data = g_task_get_task_data (task);
+  g_autofree char *path = NULL;
+  const char *name;
+  GError *error = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (g_task_get_cancellable (task), &error)) {
+    load_stream_complete_error (task, error);
+    return G_SOURCE_REMOVE;
+  }
+
+  if (data->next_window == g_variant_n_children (data->windows)) {
+    /* Every window file failed to load, or the session was empty. */
+    if (data->context->is_first_window)
+      session_maybe_open_window (EPHY_SESSION (g_task_get_source_object (task)));
+
+    load_stream_complete (task);
+    return G_SOURCE_REMOVE;
+  }
+
+  /* Restore one window per main loop iteration, like the XML parser does
+   * with its read buffer, so the first window is drawn as soon as possible.
+   */
+  g_variant_get_child (data->windows, data->next_window++, "&s", &name);
+  if (strchr (name, G_DIR_SEPARATOR)) {
+    g_warning ("Ignoring invalid session window file name %s", name);
+    return G_SOURCE_CONTINUE;
+  }
+
+  path = g_build_filename (data->windows_dir, name, NULL);
+  session_load_window_file (data->context, path);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void session_read_cb (GObject      *object,
+                             GAsyncResult *result,
+                             gpointer      user_data);
+
+/* The manifest was written by another version of the browser. Neither it nor
+ * its window files are deleted, and the legacy session file is restored
+ * instead if there is one.
+ */
+static void
+session_load_unsupported_version (EphySession *session,
+                                  guint32      version,
+                                  GTask       *task)
+{
+  g_autoptr (GFile) legacy_file = get_session_file (SESSION_STATE);
+
+  g_warning ("Unsupported session state version %u", version);
+
+  /* Saves still replace the manifest, but only remove the window files they
+   * wrote themselves.
+   */
+  g_mutex_lock (&session->save_lock);
+  if (!session->saved_window_files)
+    session->saved_window_files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_mutex_unlock (&session->save_lock);
+
+  if (g_file_query_exists (legacy_file, NULL)) {
+    /* session_read_cb() drops the application hold. */
+    session->dont_save = FALSE;
+    g_file_read_async (legacy_file, g_task_get_priority (task), g_task_get_cancellable (task),
+                       session_read_cb, task);
+    return;
+  }
+
+  load_stream_complete_error_full (task,
+                                   g_error_new (G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                                "Unsupported session state version %u", version),
+                                   FALSE);
+}
+
+static void
+ephy_session_load_binary (EphySession  *session,
+                          const char   *manifest_path,
+                          GTask        *task)
+{
+  g_autoptr (GMappedFile) file = NULL;
+  g_autoptr (GBytes) bytes = NULL;
+  g_autoptr (GVariant) manifest = NULL;
+  LoadBinaryAsyncData *data;
+  GError *error = NULL;
+  guint32 version;
+
+  g_application_hold (G_APPLICATION (ephy_shell_get_default ()));
+
+  session->dont_save = TRUE;
+
+  file = g_mapped_file_new (manifest_path, FALSE, &error);
+  if (!file) {
+    load_stream_complete_error (task, error);
+    return;
+  }
+
+  bytes = g_mapped_file_get_bytes (file);
+  manifest = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (SESSION_MANIFEST_VARIANT_TYPE),
+                                                           bytes, FALSE));
+
+  g_variant_get_child (manifest, 0, "u", &version);
+  if (version != SESSION_STATE_FORMAT_VERSION) {
+    session_load_unsupported_version (session, version, task);
+    return;
+  }
+
+  data = g_new0 (LoadBinaryAsyncData, 1);
+  g_variant_get_child (manifest, 1, "@as", &data->windows);
+  data->context = session_parser_context_new (session);
+  data->windows_dir = get_session_windows_dir ();
+  g_task_set_task_data (task, data, (GDestroyNotify)load_binary_async_data_free);
+
+  g_idle_add_full (g_task_get_priority (task),
+                   (GSourceFunc)load_binary_window_cb,
+                   task, NULL);
+}
+
 static void
 load_from_stream_cb (GObject      *object,
                      GAsyncResult *result,
@@ -1638,6 +2138,19 @@ ephy_session_load (EphySession         *session,
    */
   g_task_set_priority (task, G_PRIORITY_HIGH_IDLE + 30);
 
+  if (strcmp (filename, SESSION_STATE) == 0) {
+    g_autofree char *manifest_path = get_session_manifest_path ();
+
+    /* Fall back to session_state.xml only if a previous version of the
+     * browser wrote the session.
+     */
+    if (g_file_test (manifest_path, G_FILE_TEST_EXISTS)) {
+      ephy_session_load_binary (session, manifest_path, task);
+      g_application_release (G_APPLICATION (ephy_shell_get_default ()));
+      return;
+    }
+  }
+
   save_to_file = get_session_file (filename);
   g_file_read_async (save_to_file, g_task_get_priority (task), cancellable, session_read_cb, task);
   g_object_unref (save_to_file);
@@ -1669,8 +2182,13 @@ session_state_file_exists (EphySession *session)
 {
   GFile *saved_session_file;
   char *saved_session_file_path;
+  g_autofree char *manifest_path = NULL;
   gboolean retval;
 
+  manifest_path = get_session_manifest_path ();
+  if (g_file_test (manifest_path, G_FILE_TEST_EXISTS))
+    return TRUE;
+
   saved_session_file = get_session_file (SESSION_STATE);
   saved_session_file_path = g_file_get_path (saved_session_file);
   g_object_unref (saved_session_file);
@@ -1689,6 +2207,8 @@ session_resumed_cb (GObject      *object,
   GTask *task = G_TASK (user_data);
   GError *error = NULL;
 
+  STOP_PROFILER ("Session restore")
+
   if (!ephy_session_load_finish (session, result, &error)) {
     g_task_return_error (task, error);
   } else {
@@ -1723,6 +2243,7 @@ ephy_session_resume (EphySession         *session,
   if (!has_session_state) {
     session_maybe_open_window (session);
   } else if (ephy_shell_get_n_windows (shell) == 0) {
+    START_PROFILER ("Session restore")
     ephy_session_load (session, SESSION_STATE, cancellable,
                        session_resumed_cb, task);
     return;
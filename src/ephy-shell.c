@@ -39,6 +39,7 @@
 #include "ephy-session.h"
 #include "ephy-settings.h"
 #include "ephy-sync-utils.h"
+#include "ephy-tab-discarder.h"
 #include "ephy-title-box.h"
 #include "ephy-title-widget.h"
 #include "ephy-type-builtins.h"
@@ -64,6 +65,8 @@ struct _EphyShell {
   EphyHistoryManager *history_manager;
   EphyOpenTabsManager *open_tabs_manager;
   EphyWebExtensionManager *web_extension_manager;
+  EphyTabDiscarder *tab_discarder;
+  EphyTabIndex *tab_index;
   GNetworkMonitor *network_monitor;
   GtkWidget *history_dialog;
   GtkWidget *firefox_sync_dialog;
@@ -660,6 +663,9 @@ ephy_shell_startup (GApplication *application)
                                   NULL);
   }
 
+  if (mode != EPHY_EMBED_SHELL_MODE_AUTOMATION)
+    shell->tab_discarder = ephy_tab_discarder_new ();
+
   /* Actions that are available in both app mode and browser mode */
   set_accel_for_action (shell, "app.new-window", "<Primary>n");
   set_accel_for_action (shell, "app.history", "<Primary>h");
@@ -951,6 +957,7 @@ ephy_shell_init (EphyShell *shell)
   g_assert (!ephy_shell);
   ephy_shell = shell;
   ephy_shell->startup_finished = FALSE;
+  ephy_shell->tab_index = ephy_tab_index_new ();
   g_object_add_weak_pointer (G_OBJECT (ephy_shell),
                              (gpointer *)ptr);
 }
@@ -996,6 +1003,7 @@ ephy_shell_dispose (GObject *object)
   g_clear_object (&shell->history_manager);
   g_clear_object (&shell->open_tabs_manager);
   g_clear_object (&shell->web_extension_manager);
+  g_clear_object (&shell->tab_discarder);
   g_clear_pointer (&shell->webapp, ephy_web_application_free);
 
   if (shell->open_notification_id) {
@@ -1024,6 +1032,8 @@ ephy_shell_finalize (GObject *object)
   /* Ensure all windows have been destroyed. */
   g_assert (!shell->windows);
 
+  g_clear_object (&shell->tab_index);
+
   G_OBJECT_CLASS (ephy_shell_parent_class)->finalize (object);
 
   LOG ("Ephy shell finalised");
@@ -1245,6 +1255,20 @@ ephy_shell_get_sync_service (EphyShell *shell)
   return shell->sync_service;
 }
 
+/**
+ * ephy_shell_get_tab_index:
+ * @shell: the #EphyShell
+ *
+ * Returns: (transfer none): the index of the tabs open in every window
+ **/
+EphyTabIndex *
+ephy_shell_get_tab_index (EphyShell *shell)
+{
+  g_assert (EPHY_IS_SHELL (shell));
+
+  return shell->tab_index;
+}
+
 /**
  * ephy_shell_get_bookmarks_manager:
  * @shell: the #EphyShell
@@ -1730,26 +1754,9 @@ EphyWebView *
 ephy_shell_get_web_view (EphyShell *shell,
                          guint64    id)
 {
-  GList *windows;
-  GtkWindow *window;
-  EphyTabView *tab_view;
-
-  windows = gtk_application_get_windows (GTK_APPLICATION (shell));
-
-  for (GList *list = windows; list && list->data; list = list->next) {
-    window = GTK_WINDOW (list->data);
-    tab_view = ephy_window_get_tab_view (EPHY_WINDOW (window));
-
-    for (int i = 0; i < ephy_tab_view_get_n_pages (tab_view); i++) {
-      GtkWidget *page = ephy_tab_view_get_nth_page (tab_view, i);
-      EphyWebView *web_view = ephy_embed_get_web_view (EPHY_EMBED (page));
-
-      if (ephy_web_view_get_uid (web_view) == id)
-        return web_view;
-    }
-  }
+  EphyTabIndexEntry *tab = ephy_tab_index_lookup (shell->tab_index, id);
 
-  return NULL;
+  return tab ? ephy_embed_get_web_view (tab->embed) : NULL;
 }
 
 EphyWebView *
@@ -30,6 +30,7 @@
 #include "ephy-password-manager.h"
 #include "ephy-session.h"
 #include "ephy-sync-service.h"
+#include "ephy-tab-index.h"
 #include "ephy-web-extension-manager.h"
 #include "ephy-web-app-utils.h"
 #include "ephy-window.h"
@@ -100,6 +101,7 @@ EphyBookmarksManager    *ephy_shell_get_bookmarks_manager   (EphyShell        *s
 EphyHistoryManager      *ephy_shell_get_history_manager     (EphyShell        *shell);
 EphyOpenTabsManager     *ephy_shell_get_open_tabs_manager   (EphyShell        *shell);
 EphySyncService         *ephy_shell_get_sync_service        (EphyShell        *shell);
+EphyTabIndex            *ephy_shell_get_tab_index           (EphyShell        *shell);
 
 GtkWidget               *ephy_shell_get_history_dialog      (EphyShell        *shell);
 GtkWidget               *ephy_shell_get_firefox_sync_dialog (EphyShell        *shell);
@@ -24,6 +24,7 @@
 #include "ephy-prefs.h"
 #include "ephy-search-engine-manager.h"
 #include "ephy-settings.h"
+#include "ephy-shell.h"
 #include "ephy-suggestion.h"
 #include "ephy-user-agent.h"
 #include "ephy-window.h"
@@ -33,6 +34,27 @@
 
 #define MAX_SEARCH_ENGINES_SUGGESTIONS 5
 #define MAX_URL_ENTRIES             25
+#define HISTORY_INDEX_SIZE          1000
+
+/* Resident index used to answer location bar queries without a round trip
+ * to the history service. All strings live in the index's string chunk, so
+ * the index is a single contiguous array plus one block of string storage.
+ * Strings of updated or removed entries stay in the chunk until they take
+ * more room than the live ones, then the chunk is rebuilt. */
+typedef struct {
+  const char *url;
+  const char *title;
+  const char *haystack; /* Casefolded text the query terms are matched against. */
+  double frecency;
+} IndexEntry;
+
+typedef struct {
+  GStringChunk *strings;
+  gsize string_bytes;
+  gsize dead_bytes;
+  GArray *entries;
+  GHashTable *positions; /* URL -> position + 1, NULL if not needed */
+} SuggestionIndex;
 
 struct _EphySuggestionModel {
   GObject parent;
@@ -43,6 +65,27 @@ struct _EphySuggestionModel {
   GCancellable *icon_cancellable;
   guint num_custom_entries;
   SoupSession *session;
+
+  SuggestionIndex *history_index;
+  GCancellable *history_index_cancellable;
+  GCancellable *history_updates_cancellable;
+  gboolean history_index_complete;
+  gboolean history_index_loading;
+  gboolean history_index_dirty;
+
+  /* Only the latest query may update the model. */
+  guint query_serial;
+
+  /* Query whose history database job is in flight, if any. */
+  GTask *history_query_task;
+  GCancellable *history_query_cancellable;
+
+  /* History matches of the last database query, in the order they were
+   * returned, so that a query extending it can be answered by filtering
+   * them. Complete when the query returned fewer rows than requested. */
+  SuggestionIndex *history_results;
+  char *history_results_query;
+  gboolean history_results_complete;
 };
 
 #define QUERY_SCOPE_ALL         ' '
@@ -66,11 +109,459 @@ G_DEFINE_FINAL_TYPE_WITH_CODE (EphySuggestionModel, ephy_suggestion_model, G_TYP
 
 static GParamSpec *properties[N_PROPS];
 
+/* Only the history index looks entries up by URL, query results do not. */
+static SuggestionIndex *
+suggestion_index_new (gboolean lookup)
+{
+  SuggestionIndex *index = g_new (SuggestionIndex, 1);
+
+  index->strings = g_string_chunk_new (4096);
+  index->string_bytes = 0;
+  index->dead_bytes = 0;
+  index->entries = g_array_new (FALSE, FALSE, sizeof (IndexEntry));
+  index->positions = lookup ? g_hash_table_new (g_str_hash, g_str_equal) : NULL;
+
+  return index;
+}
+
+static void
+suggestion_index_free (SuggestionIndex *index)
+{
+  g_string_chunk_free (index->strings);
+  g_array_unref (index->entries);
+  g_clear_pointer (&index->positions, g_hash_table_unref);
+  g_free (index);
+}
+
+static gsize
+index_entry_get_size (const IndexEntry *entry)
+{
+  return strlen (entry->url) + strlen (entry->title) + strlen (entry->haystack) + 3;
+}
+
+static void
+index_entry_set_strings (IndexEntry   *entry,
+                         GStringChunk *strings,
+                         const char   *url,
+                         const char   *title,
+                         const char   *haystack)
+{
+  entry->url = g_string_chunk_insert (strings, url);
+  entry->title = g_string_chunk_insert (strings, title);
+  entry->haystack = g_string_chunk_insert (strings, haystack);
+}
+
+static void
+suggestion_index_set_entry (SuggestionIndex *index,
+                            IndexEntry      *entry,
+                            const char      *url,
+                            const char      *title)
+{
+  g_autofree char *text = g_strconcat (title, "\n", url, NULL);
+  g_autofree char *haystack = g_utf8_casefold (text, -1);
+
+  index_entry_set_strings (entry, index->strings, url, title, haystack);
+  index->string_bytes += index_entry_get_size (entry);
+}
+
+/* Sets the positions of the entries from @start to @end, excluded. */
+static void
+suggestion_index_renumber (SuggestionIndex *index,
+                           guint            start,
+                           guint            end)
+{
+  if (!index->positions)
+    return;
+
+  for (guint i = start; i < end && i < index->entries->len; i++)
+    g_hash_table_replace (index->positions,
+                          (gpointer)g_array_index (index->entries, IndexEntry, i).url,
+                          GUINT_TO_POINTER (i + 1));
+}
+
+/* Copies the live strings to a new chunk once the dead ones take more room. */
+static void
+suggestion_index_maybe_compact (SuggestionIndex *index)
+{
+  GStringChunk *strings;
+
+  if (index->dead_bytes <= index->string_bytes - index->dead_bytes)
+    return;
+
+  strings = g_string_chunk_new (4096);
+  for (guint i = 0; i < index->entries->len; i++) {
+    IndexEntry *entry = &g_array_index (index->entries, IndexEntry, i);
+
+    index_entry_set_strings (entry, strings, entry->url, entry->title, entry->haystack);
+  }
+
+  g_string_chunk_free (index->strings);
+  index->strings = strings;
+  index->string_bytes -= index->dead_bytes;
+  index->dead_bytes = 0;
+
+  if (index->positions) {
+    g_hash_table_remove_all (index->positions);
+    suggestion_index_renumber (index, 0, index->entries->len);
+  }
+}
+
+static void
+suggestion_index_append (SuggestionIndex *index,
+                         const char      *url,
+                         const char      *title,
+                         double           frecency)
+{
+  IndexEntry entry;
+
+  suggestion_index_set_entry (index, &entry, url, title);
+  entry.frecency = frecency;
+  g_array_append_val (index->entries, entry);
+  suggestion_index_renumber (index, index->entries->len - 1, index->entries->len);
+}
+
+static gboolean
+suggestion_index_lookup (SuggestionIndex *index,
+                         const char      *url,
+                         guint           *position)
+{
+  gpointer value = g_hash_table_lookup (index->positions, url);
+
+  if (!value)
+    return FALSE;
+
+  *position = GPOINTER_TO_UINT (value) - 1;
+  return TRUE;
+}
+
+/* Removes the entry at @position, without renumbering the ones after it. */
+static void
+suggestion_index_remove (SuggestionIndex *index,
+                         guint            position)
+{
+  IndexEntry *entry = &g_array_index (index->entries, IndexEntry, position);
+
+  if (index->positions)
+    g_hash_table_remove (index->positions, entry->url);
+  index->dead_bytes += index_entry_get_size (entry);
+  g_array_remove_index (index->entries, position);
+}
+
+static gboolean
+index_entry_matches (const IndexEntry  *entry,
+                     char             **terms)
+{
+  for (guint i = 0; terms[i]; i++) {
+    if (!strstr (entry->haystack, terms[i]))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static int
+compare_frecency (const IndexEntry *a,
+                  const IndexEntry *b)
+{
+  if (a->frecency > b->frecency)
+    return -1;
+  if (a->frecency < b->frecency)
+    return 1;
+  return 0;
+}
+
+static double
+compute_frecency (const EphyHistoryURL *url)
+{
+  gint64 age_days = (g_get_real_time () - url->last_visit_time) / G_TIME_SPAN_DAY;
+  double weight;
+
+  if (age_days < 4)
+    weight = 100;
+  else if (age_days < 14)
+    weight = 70;
+  else if (age_days < 31)
+    weight = 50;
+  else if (age_days < 90)
+    weight = 30;
+  else
+    weight = 10;
+
+  return (url->visit_count + url->typed_count) * weight;
+}
+
+static void history_index_refresh (EphySuggestionModel *self);
+
+static void
+history_index_loaded_cb (EphyHistoryService *service,
+                         gboolean            success,
+                         gpointer            result_data,
+                         gpointer            user_data)
+{
+  EphySuggestionModel *self = EPHY_SUGGESTION_MODEL (user_data);
+  GList *urls = result_data;
+
+  self->history_index_loading = FALSE;
+
+  if (success) {
+    SuggestionIndex *index = suggestion_index_new (TRUE);
+
+    for (GList *l = urls; l; l = l->next) {
+      EphyHistoryURL *url = l->data;
+
+      suggestion_index_append (index, url->url, url->title, compute_frecency (url));
+    }
+    /* The database's order only differs by the time elapsed since. */
+    g_array_sort (index->entries, (GCompareFunc)compare_frecency);
+    suggestion_index_renumber (index, 0, index->entries->len);
+
+    g_clear_pointer (&self->history_index, suggestion_index_free);
+    self->history_index = index;
+    self->history_index_complete = g_list_length (urls) < HISTORY_INDEX_SIZE;
+  }
+
+  if (self->history_index_dirty)
+    history_index_refresh (self);
+}
+
+static void
+history_results_clear (EphySuggestionModel *self)
+{
+  g_clear_pointer (&self->history_results, suggestion_index_free);
+  g_clear_pointer (&self->history_results_query, g_free);
+}
+
+static void
+history_index_refresh (EphySuggestionModel *self)
+{
+  /* Deletions change the contents of the results. */
+  history_results_clear (self);
+
+  if (self->history_index_loading) {
+    self->history_index_dirty = TRUE;
+    return;
+  }
+
+  self->history_index_loading = TRUE;
+  self->history_index_dirty = FALSE;
+
+  ephy_history_service_find_urls (self->history_service,
+                                  0, 0,
+                                  HISTORY_INDEX_SIZE, 0,
+                                  NULL,
+                                  EPHY_HISTORY_SORT_FRECENCY,
+                                  self->history_index_cancellable,
+                                  (EphyHistoryJobCallback)history_index_loaded_cb,
+                                  self);
+}
+
+/* Moves the entry of a visited URL to its new place in the index, or adds
+ * it when the visit made it one of the most frecent URLs. */
+static void
+history_index_update (SuggestionIndex *index,
+                      EphyHistoryURL  *url,
+                      gboolean        *complete)
+{
+  double frecency = compute_frecency (url);
+  IndexEntry entry;
+  guint position;
+  guint renumber_start;
+  guint renumber_end;
+  guint low = 0;
+  guint high;
+
+  if (suggestion_index_lookup (index, url->url, &position)) {
+    suggestion_index_remove (index, position);
+    renumber_start = renumber_end = position;
+  } else {
+    renumber_start = renumber_end = index->entries->len;
+  }
+
+  high = index->entries->len;
+  while (low < high) {
+    guint mid = low + (high - low) / 2;
+
+    if (g_array_index (index->entries, IndexEntry, mid).frecency >= frecency)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  /* Below the least frecent URL of an incomplete index, there may be
+   * others that are more frecent. */
+  if (low == index->entries->len && !*complete) {
+    suggestion_index_renumber (index, renumber_start, index->entries->len);
+    suggestion_index_maybe_compact (index);
+    return;
+  }
+
+  suggestion_index_set_entry (index, &entry, url->url, url->title);
+  entry.frecency = frecency;
+  g_array_insert_val (index->entries, low, entry);
+
+  /* Only the entries between the old and the new place moved. */
+  suggestion_index_renumber (index, MIN (renumber_start, low), MAX (renumber_end, low) + 1);
+
+  if (index->entries->len > HISTORY_INDEX_SIZE) {
+    suggestion_index_remove (index, HISTORY_INDEX_SIZE);
+    *complete = FALSE;
+  }
+
+  suggestion_index_maybe_compact (index);
+}
+
+static void
+history_url_loaded_cb (EphyHistoryService *service,
+                       gboolean            success,
+                       gpointer            result_data,
+                       gpointer            user_data)
+{
+  EphySuggestionModel *self = EPHY_SUGGESTION_MODEL (user_data);
+  EphyHistoryURL *url = result_data;
+
+  /* A full load started since the visit replaces the index anyway. */
+  if (!success || !self->history_index || self->history_index_loading)
+    return;
+
+  history_results_clear (self);
+  history_index_update (self->history_index, url, &self->history_index_complete);
+}
+
+static void
+history_urls_visited_cb (EphySuggestionModel  *self,
+                         char                **urls)
+{
+  g_autoptr (GHashTable) visited = NULL;
+
+  /* Visits change the order of the results. */
+  history_results_clear (self);
+
+  if (!self->history_index || self->history_index_loading) {
+    history_index_refresh (self);
+    return;
+  }
+
+  /* Only the visited URLs are read back, to get their new visit counts. */
+  visited = g_hash_table_new (g_str_hash, g_str_equal);
+  for (guint i = 0; urls[i]; i++) {
+    if (!g_hash_table_add (visited, urls[i]))
+      continue;
+
+    ephy_history_service_get_url (self->history_service, urls[i],
+                                  self->history_updates_cancellable,
+                                  (EphyHistoryJobCallback)history_url_loaded_cb,
+                                  self);
+  }
+}
+
+static void
+history_updates_cancel (EphySuggestionModel *self)
+{
+  g_cancellable_cancel (self->history_updates_cancellable);
+  g_object_unref (self->history_updates_cancellable);
+  self->history_updates_cancellable = g_cancellable_new ();
+}
+
+static void
+history_url_deleted_cb (EphySuggestionModel *self,
+                        EphyHistoryURL      *url)
+{
+  history_results_clear (self);
+  history_updates_cancel (self);
+
+  if (self->history_index) {
+    SuggestionIndex *index = self->history_index;
+    guint position;
+
+    if (suggestion_index_lookup (index, url->url, &position)) {
+      suggestion_index_remove (index, position);
+      suggestion_index_renumber (index, position, index->entries->len);
+      suggestion_index_maybe_compact (index);
+    }
+  }
+
+  /* A load in progress may still return the deleted URL. */
+  if (self->history_index_loading)
+    self->history_index_dirty = TRUE;
+}
+
+static void
+history_url_title_changed_cb (EphySuggestionModel *self,
+                              const char          *url,
+                              const char          *title)
+{
+  SuggestionIndex *index = self->history_index;
+  IndexEntry *entry;
+  guint position;
+
+  history_results_clear (self);
+
+  if (!index || !suggestion_index_lookup (index, url, &position))
+    return;
+
+  entry = &g_array_index (index->entries, IndexEntry, position);
+  index->dead_bytes += index_entry_get_size (entry);
+  suggestion_index_set_entry (index, entry, url, title);
+  suggestion_index_renumber (index, position, position + 1);
+  suggestion_index_maybe_compact (index);
+}
+
+static void
+history_host_deleted_cb (EphySuggestionModel *self)
+{
+  history_updates_cancel (self);
+  history_index_refresh (self);
+}
+
+static void
+history_cleared_cb (EphySuggestionModel *self)
+{
+  history_results_clear (self);
+  history_updates_cancel (self);
+  g_clear_pointer (&self->history_index, suggestion_index_free);
+  self->history_index = suggestion_index_new (TRUE);
+  self->history_index_complete = TRUE;
+
+  if (self->history_index_loading)
+    self->history_index_dirty = TRUE;
+}
+
+static void
+ephy_suggestion_model_constructed (GObject *object)
+{
+  EphySuggestionModel *self = EPHY_SUGGESTION_MODEL (object);
+
+  G_OBJECT_CLASS (ephy_suggestion_model_parent_class)->constructed (object);
+
+  g_signal_connect_object (self->history_service, "urls-visited",
+                           G_CALLBACK (history_urls_visited_cb), self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->history_service, "host-deleted",
+                           G_CALLBACK (history_host_deleted_cb), self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->history_service, "url-deleted",
+                           G_CALLBACK (history_url_deleted_cb), self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->history_service, "url-title-changed",
+                           G_CALLBACK (history_url_title_changed_cb), self, G_CONNECT_SWAPPED);
+  g_signal_connect_object (self->history_service, "cleared",
+                           G_CALLBACK (history_cleared_cb), self, G_CONNECT_SWAPPED);
+
+  history_index_refresh (self);
+}
+
 static void
 ephy_suggestion_model_finalize (GObject *object)
 {
   EphySuggestionModel *self = (EphySuggestionModel *)object;
 
+  /* A cancelled history job never runs its callback. */
+  g_cancellable_cancel (self->history_index_cancellable);
+  g_clear_object (&self->history_index_cancellable);
+  g_cancellable_cancel (self->history_updates_cancellable);
+  g_clear_object (&self->history_updates_cancellable);
+  g_clear_pointer (&self->history_index, suggestion_index_free);
+  g_cancellable_cancel (self->history_query_cancellable);
+  g_clear_object (&self->history_query_cancellable);
+  history_results_clear (self);
+
   g_clear_object (&self->bookmarks_manager);
   g_clear_object (&self->history_service);
   g_clear_pointer (&self->urls, g_sequence_free);
@@ -128,6 +619,7 @@ ephy_suggestion_model_class_init (EphySuggestionModelClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->constructed = ephy_suggestion_model_constructed;
   object_class->finalize = ephy_suggestion_model_finalize;
   object_class->get_property = ephy_suggestion_model_get_property;
   object_class->set_property = ephy_suggestion_model_set_property;
@@ -151,6 +643,8 @@ static void
 ephy_suggestion_model_init (EphySuggestionModel *self)
 {
   self->items = g_sequence_new (g_object_unref);
+  self->history_index_cancellable = g_cancellable_new ();
+  self->history_updates_cancellable = g_cancellable_new ();
   self->session = soup_session_new_with_options ("user-agent", ephy_user_agent_get (), NULL);
 }
 
@@ -205,50 +699,6 @@ ephy_suggestion_model_new (EphyHistoryService   *history_service,
                        NULL);
 }
 
-static gboolean
-should_add_bookmark_to_model (EphySuggestionModel *self,
-                              const char          *search_string,
-                              const char          *title,
-                              const char          *location,
-                              GSequence           *tags)
-{
-  g_autofree gchar *search_casefold = g_utf8_casefold (search_string, -1);
-  g_autofree gchar *title_casefold = g_utf8_casefold (title, -1);
-  g_autofree gchar *location_casefold = g_utf8_casefold (location, -1);
-  g_autofree char *tag_string = NULL;
-  g_autofree char *tag_string_casefold = NULL;
-  char **tag_array = NULL;
-  g_auto (GStrv) search_terms = NULL;
-  GSequenceIter *tag_iter;
-  guint i;
-  gboolean ret = TRUE;
-
-  tag_array = g_malloc0 ((g_sequence_get_length (tags) + 1) * sizeof (char *));
-
-  for (i = 0, tag_iter = g_sequence_get_begin_iter (tags);
-       !g_sequence_iter_is_end (tag_iter);
-       i++, tag_iter = g_sequence_iter_next (tag_iter)) {
-    tag_array[i] = g_sequence_get (tag_iter);
-  }
-
-  tag_string = g_strjoinv (" ", tag_array);
-  tag_string_casefold = g_utf8_casefold (tag_string, -1);
-  search_terms = g_strsplit (search_casefold, " ", -1);
-
-  for (i = 0; i < g_strv_length (search_terms); i++) {
-    if (!strstr (title_casefold, search_terms[i]) &&
-        !strstr (location_casefold, search_terms[i]) &&
-        (tag_string_casefold && !strstr (tag_string_casefold, search_terms[i]))) {
-      ret = FALSE;
-      break;
-    }
-  }
-
-  g_free (tag_array);
-
-  return ret;
-}
-
 static void
 icon_loaded_cb (GObject      *source,
                 GAsyncResult *result,
@@ -362,6 +812,7 @@ add_search_engines (EphySuggestionModel *self,
 typedef struct {
   char *query;
   char scope;
+  guint serial;
   gboolean include_search_engines;
   GSequence *tabs;
   GSequence *bookmarks;
@@ -427,6 +878,19 @@ query_collection_done (EphySuggestionModel *self,
   if (--data->active_sources)
     return;
 
+  /* A query superseded by a newer one must not replace its results. */
+  if (data->serial != self->query_serial) {
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                             "Query superseded by a newer one");
+    g_object_unref (task);
+    return;
+  }
+
+  if (g_task_return_error_if_cancelled (task)) {
+    g_object_unref (task);
+    return;
+  }
+
   g_cancellable_cancel (self->icon_cancellable);
   g_clear_object (&self->icon_cancellable);
 
@@ -497,122 +961,237 @@ tabs_query (EphySuggestionModel *self,
             QueryData           *data,
             GTask               *task)
 {
-  GApplication *application;
-  EphyEmbedShell *shell;
-  EphyWindow *window;
-  EphyTabView *tab_view;
-  GList *windows;
-  gint n_pages, selected;
+  EphyShell *shell = ephy_shell_get_default ();
+  GPtrArray *tabs;
+  GtkWindow *active_window;
+  GtkWidget *selected_page = NULL;
+  g_autofree char *query_casefold = NULL;
+
+  /* The search provider has no tabs. */
+  if (!shell) {
+    query_collection_done (self, g_steal_pointer (&task));
+    return;
+  }
 
-  shell = ephy_embed_shell_get_default ();
-  application = G_APPLICATION (shell);
-  windows = gtk_application_get_windows (GTK_APPLICATION (application));
-
-  for (guint win_idx = 0; win_idx < g_list_length (windows); win_idx++) {
-    window = EPHY_WINDOW (g_list_nth_data (windows, win_idx));
-
-    tab_view = ephy_window_get_tab_view (window);
-    n_pages = ephy_tab_view_get_n_pages (tab_view);
-    selected = ephy_tab_view_get_selected_index (tab_view);
-
-    for (int i = 0; i < n_pages; i++) {
-      EphyEmbed *embed;
-      EphyWebView *webview;
-      EphySuggestion *suggestion;
-      g_autofree gchar *escaped_title = NULL;
-      g_autofree gchar *markup = NULL;
-      const gchar *display_address;
-      g_autofree gchar *address = NULL;
-      const gchar *title;
-      g_autofree gchar *title_casefold = NULL;
-      g_autofree gchar *display_address_casefold = NULL;
-      g_autofree gchar *query_casefold = NULL;
-
-      if (win_idx == 0 && i == selected)
-        continue;
-
-      embed = EPHY_EMBED (ephy_tab_view_get_nth_page (tab_view, i));
-      webview = ephy_embed_get_web_view (embed);
-      display_address = ephy_web_view_get_display_address (webview);
-      address = g_strdup_printf ("ephy-tab://%d@%d", i, win_idx);
-      title = webkit_web_view_get_title (WEBKIT_WEB_VIEW (webview));
-
-      display_address_casefold = g_utf8_casefold (display_address, -1);
-      query_casefold = g_utf8_casefold (data->query, -1);
-      if (!title)
-        title = "";
-
-      title_casefold = g_utf8_casefold (title, -1);
-
-      if ((title_casefold && strstr (title_casefold, query_casefold)) || strstr (display_address_casefold, query_casefold)) {
-        char *escaped_address = g_markup_escape_text (display_address, -1);
-
-        if (g_str_has_prefix (escaped_address, EPHY_ABOUT_SCHEME)) {
-          g_autofree char *pretty_address = g_strconcat ("about", escaped_address + EPHY_ABOUT_SCHEME_LEN, NULL);
-          g_free (escaped_address);
-          escaped_address = g_steal_pointer (&pretty_address);
-        }
-
-        escaped_title = g_markup_escape_text (title, -1);
-        markup = dzl_fuzzy_highlight (escaped_title, data->query, FALSE);
-        suggestion = ephy_suggestion_new_with_custom_subtitle (markup, title, escaped_address, address);
-        ephy_suggestion_set_secondary_icon (suggestion, "go-jump-symbolic");
-
-        g_sequence_append (data->tabs, g_object_ref (suggestion));
-      }
+  tabs = ephy_tab_index_get_entries (ephy_shell_get_tab_index (shell));
+  active_window = gtk_application_get_active_window (GTK_APPLICATION (shell));
+  query_casefold = g_utf8_casefold (data->query, -1);
+
+  if (EPHY_IS_WINDOW (active_window))
+    selected_page = ephy_tab_view_get_selected_page (ephy_window_get_tab_view (EPHY_WINDOW (active_window)));
+
+  for (guint i = 0; i < tabs->len; i++) {
+    EphyTabIndexEntry *tab = g_ptr_array_index (tabs, i);
+    EphyWebView *webview;
+    EphySuggestion *suggestion;
+    g_autofree gchar *escaped_title = NULL;
+    g_autofree gchar *markup = NULL;
+    g_autofree gchar *address = NULL;
+    g_autofree char *escaped_address = NULL;
+    const gchar *display_address;
+    const gchar *title;
+
+    if (GTK_WIDGET (tab->embed) == selected_page)
+      continue;
+
+    if (!ephy_tab_index_entry_matches (tab, query_casefold))
+      continue;
+
+    webview = ephy_embed_get_web_view (tab->embed);
+    display_address = ephy_web_view_get_display_address (webview);
+    address = g_strdup_printf ("ephy-tab://%" G_GUINT64_FORMAT, tab->id);
+    title = webkit_web_view_get_title (WEBKIT_WEB_VIEW (webview));
+    if (!title)
+      title = "";
+
+    escaped_address = g_markup_escape_text (display_address ? display_address : "", -1);
+    if (g_str_has_prefix (escaped_address, EPHY_ABOUT_SCHEME)) {
+      g_autofree char *pretty_address = g_strconcat ("about", escaped_address + EPHY_ABOUT_SCHEME_LEN, NULL);
+      g_free (escaped_address);
+      escaped_address = g_steal_pointer (&pretty_address);
     }
+
+    escaped_title = g_markup_escape_text (title, -1);
+    markup = dzl_fuzzy_highlight (escaped_title, data->query, FALSE);
+    suggestion = ephy_suggestion_new_with_custom_subtitle (markup, title, escaped_address, address);
+    ephy_suggestion_set_secondary_icon (suggestion, "go-jump-symbolic");
+
+    g_sequence_append (data->tabs, suggestion);
   }
 
   query_collection_done (self, g_steal_pointer (&task));
 }
 
+static char **
+split_query_terms (const char *query)
+{
+  g_autofree char *query_casefold = g_utf8_casefold (query, -1);
+
+  return g_strsplit (query_casefold, " ", -1);
+}
+
 static void
 bookmarks_query (EphySuggestionModel *self,
                  QueryData           *data,
                  GTask               *task)
 {
-  GSequence *bookmarks;
+  g_autoptr (GSequence) bookmarks = NULL;
 
-  bookmarks = ephy_bookmarks_manager_get_bookmarks (self->bookmarks_manager);
+  bookmarks = ephy_bookmarks_manager_find_bookmarks (self->bookmarks_manager, data->query);
 
   for (GSequenceIter *iter = g_sequence_get_begin_iter (bookmarks);
        !g_sequence_iter_is_end (iter);
        iter = g_sequence_iter_next (iter)) {
-    EphyBookmark *bookmark;
-    GSequence *tags;
+    EphyBookmark *bookmark = g_sequence_get (iter);
+    EphySuggestion *suggestion;
+    g_autofree gchar *escaped_title = NULL;
+    g_autofree gchar *markup = NULL;
+    g_autofree gchar *pretty_url = NULL;
     const char *url, *title;
 
-    bookmark = g_sequence_get (iter);
-
     url = ephy_bookmark_get_url (bookmark);
     title = ephy_bookmark_get_title (bookmark);
     if (strlen (title) == 0)
       title = url;
 
-    tags = ephy_bookmark_get_tags (bookmark);
-    if (should_add_bookmark_to_model (self, data->query, title, url, tags)) {
-      EphySuggestion *suggestion;
-      g_autofree gchar *escaped_title = NULL;
-      g_autofree gchar *markup = NULL;
-      g_autofree gchar *pretty_url = NULL;
-
-      if (g_str_has_prefix (url, EPHY_ABOUT_SCHEME)) {
-        pretty_url = g_strconcat ("about", url + EPHY_ABOUT_SCHEME_LEN, NULL);
-        url = pretty_url;
-      }
+    if (g_str_has_prefix (url, EPHY_ABOUT_SCHEME)) {
+      pretty_url = g_strconcat ("about", url + EPHY_ABOUT_SCHEME_LEN, NULL);
+      url = pretty_url;
+    }
 
-      escaped_title = g_markup_escape_text (title, -1);
-      markup = dzl_fuzzy_highlight (escaped_title, data->query, FALSE);
-      suggestion = ephy_suggestion_new (markup, title, url, FALSE);
-      ephy_suggestion_set_secondary_icon (suggestion, "ephy-starred-symbolic");
+    escaped_title = g_markup_escape_text (title, -1);
+    markup = dzl_fuzzy_highlight (escaped_title, data->query, FALSE);
+    suggestion = ephy_suggestion_new (markup, title, url, FALSE);
+    ephy_suggestion_set_secondary_icon (suggestion, "ephy-starred-symbolic");
 
-      g_sequence_append (data->bookmarks, g_object_ref (suggestion));
-    }
+    g_sequence_append (data->bookmarks, suggestion);
   }
 
   query_collection_done (self, g_steal_pointer (&task));
 }
 
+static void
+append_history_suggestion (QueryData  *data,
+                           const char *url,
+                           const char *title)
+{
+  EphySuggestion *suggestion;
+  g_autofree gchar *escaped_title = NULL;
+  g_autofree gchar *markup = NULL;
+
+  if (strlen (title) == 0)
+    title = url;
+
+  escaped_title = g_markup_escape_text (title, -1);
+
+  markup = dzl_fuzzy_highlight (escaped_title, data->query, FALSE);
+  suggestion = ephy_suggestion_new (markup, title, url, FALSE);
+
+  g_sequence_append (data->history, g_steal_pointer (&suggestion));
+}
+
+/* Answers the history part of a query from the resident index. Returns FALSE
+ * when the index cannot be trusted to hold the best matches, in which case
+ * the history database has to be queried instead. */
+static gboolean
+history_index_query (EphySuggestionModel *self,
+                     QueryData           *data)
+{
+  g_auto (GStrv) terms = NULL;
+  guint matches = 0;
+
+  if (!self->history_index)
+    return FALSE;
+
+  if (strlen (data->query) == 0)
+    return TRUE;
+
+  terms = split_query_terms (data->query);
+
+  for (guint i = 0; i < self->history_index->entries->len && matches < MAX_URL_ENTRIES; i++) {
+    IndexEntry *entry = &g_array_index (self->history_index->entries, IndexEntry, i);
+
+    if (!index_entry_matches (entry, terms))
+      continue;
+
+    append_history_suggestion (data, entry->url, entry->title);
+    matches++;
+  }
+
+  if (matches == MAX_URL_ENTRIES || self->history_index_complete)
+    return TRUE;
+
+  g_sequence_remove_range (g_sequence_get_begin_iter (data->history),
+                           g_sequence_get_end_iter (data->history));
+  return FALSE;
+}
+
+/* Answers the history part of a query by filtering the results of the last
+ * database query, when the new query extends it: every match of the longer
+ * query is then a match of the shorter one. Returns FALSE when the filtered
+ * results may miss better matches, which only happens when the previous
+ * results were cut at the limit and some of them no longer match. */
+static gboolean
+history_results_refine (EphySuggestionModel *self,
+                        QueryData           *data)
+{
+  SuggestionIndex *refined;
+  g_auto (GStrv) terms = NULL;
+
+  if (!self->history_results || !g_str_has_prefix (data->query, self->history_results_query))
+    return FALSE;
+
+  terms = split_query_terms (data->query);
+  refined = suggestion_index_new (FALSE);
+
+  for (guint i = 0; i < self->history_results->entries->len; i++) {
+    IndexEntry *entry = &g_array_index (self->history_results->entries, IndexEntry, i);
+
+    if (index_entry_matches (entry, terms))
+      suggestion_index_append (refined, entry->url, entry->title, entry->frecency);
+  }
+
+  if (!self->history_results_complete && refined->entries->len < self->history_results->entries->len) {
+    suggestion_index_free (refined);
+    return FALSE;
+  }
+
+  LOG ("Refined %u history results of '%s' to %u for '%s'",
+       self->history_results->entries->len, self->history_results_query,
+       refined->entries->len, data->query);
+
+  for (guint i = 0; i < refined->entries->len; i++) {
+    IndexEntry *entry = &g_array_index (refined->entries, IndexEntry, i);
+
+    append_history_suggestion (data, entry->url, entry->title);
+  }
+
+  g_clear_pointer (&self->history_results, suggestion_index_free);
+  self->history_results = refined;
+  g_free (self->history_results_query);
+  self->history_results_query = g_strdup (data->query);
+
+  return TRUE;
+}
+
+static void
+history_results_set (EphySuggestionModel *self,
+                     const char          *query,
+                     GList               *urls)
+{
+  history_results_clear (self);
+
+  self->history_results = suggestion_index_new (FALSE);
+  self->history_results_query = g_strdup (query);
+  self->history_results_complete = g_list_length (urls) < MAX_URL_ENTRIES;
+
+  for (GList *l = urls; l; l = l->next) {
+    EphyHistoryURL *url = l->data;
+
+    suggestion_index_append (self->history_results, url->url, url->title, 0);
+  }
+}
+
 static void
 history_query_completed_cb (EphyHistoryService *service,
                             gboolean            success,
@@ -628,29 +1207,69 @@ history_query_completed_cb (EphyHistoryService *service,
   data = g_task_get_task_data (task);
   urls = (GList *)result_data;
 
+  g_assert (self->history_query_task == task);
+  self->history_query_task = NULL;
+  g_clear_object (&self->history_query_cancellable);
+
+  if (success)
+    history_results_set (self, data->query, urls);
+
   if (strlen (data->query) > 0) {
     for (const GList *p = urls; p; p = p->next) {
       EphyHistoryURL *url = (EphyHistoryURL *)p->data;
-      EphySuggestion *suggestion;
-      g_autofree gchar *escaped_title = NULL;
-      g_autofree gchar *markup = NULL;
-      const gchar *title = url->title;
-
-      if (strlen (url->title) == 0)
-        title = url->url;
 
-      escaped_title = g_markup_escape_text (title, -1);
-
-      markup = dzl_fuzzy_highlight (escaped_title, data->query, FALSE);
-      suggestion = ephy_suggestion_new (markup, title, url->url, FALSE);
-
-      g_sequence_append (data->history, g_steal_pointer (&suggestion));
+      append_history_suggestion (data, url->url, url->title);
     }
   }
 
   query_collection_done (self, g_steal_pointer (&task));
 }
 
+static void
+history_query_start (EphySuggestionModel *self,
+                     QueryData           *data,
+                     GTask               *task)
+{
+  GList *qlist = NULL;
+  g_auto (GStrv) strings = NULL;
+
+  g_assert (!self->history_query_task);
+
+  strings = g_strsplit (data->query, " ", -1);
+
+  for (guint i = 0; strings[i]; i++)
+    qlist = g_list_append (qlist, g_strdup (strings[i]));
+
+  /* The job has a cancellable of its own, the one of the caller cancelling
+   * it would leave the task waiting forever for its history results. */
+  self->history_query_task = task;
+  self->history_query_cancellable = g_cancellable_new ();
+  ephy_history_service_find_urls (self->history_service,
+                                  0, 0,
+                                  MAX_URL_ENTRIES, 0,
+                                  qlist,
+                                  EPHY_HISTORY_SORT_MOST_VISITED,
+                                  self->history_query_cancellable,
+                                  (EphyHistoryJobCallback)history_query_completed_cb,
+                                  task);
+}
+
+static void
+history_query_cancel (EphySuggestionModel *self)
+{
+  GTask *task = g_steal_pointer (&self->history_query_task);
+
+  if (!task)
+    return;
+
+  /* Jobs still queued are dropped before reaching the database. A cancelled
+   * job never runs its callback, so the history part of the superseded
+   * query is completed here, empty. */
+  g_cancellable_cancel (self->history_query_cancellable);
+  g_clear_object (&self->history_query_cancellable);
+  query_collection_done (self, task);
+}
+
 static void
 search_engine_suggestions_loaded_cb (SoupSession  *session,
                                      GAsyncResult *result,
@@ -733,8 +1352,11 @@ ephy_suggestion_model_query_async (EphySuggestionModel *self,
   g_task_set_source_tag (task, ephy_suggestion_model_query_async);
 
   data = query_data_new (query, include_search_engines);
+  data->serial = ++self->query_serial;
   g_task_set_task_data (task, data, (GDestroyNotify)query_data_free);
 
+  history_query_cancel (self);
+
   if (data->scope == QUERY_SCOPE_ALL || data->scope == QUERY_SCOPE_SUGGESTIONS) {
     gboolean is_possible_url = FALSE;
 
@@ -748,22 +1370,10 @@ ephy_suggestion_model_query_async (EphySuggestionModel *self,
   }
 
   if (data->scope == QUERY_SCOPE_ALL || data->scope == QUERY_SCOPE_HISTORY) {
-    GList *qlist = NULL;
-    g_auto (GStrv) strings = NULL;
-
-    strings = g_strsplit (data->query, " ", -1);
-
-    for (guint i = 0; strings[i]; i++)
-      qlist = g_list_append (qlist, g_strdup (strings[i]));
-
-    ephy_history_service_find_urls (self->history_service,
-                                    0, 0,
-                                    MAX_URL_ENTRIES, 0,
-                                    qlist,
-                                    EPHY_HISTORY_SORT_MOST_VISITED,
-                                    cancellable,
-                                    (EphyHistoryJobCallback)history_query_completed_cb,
-                                    task);
+    if (history_index_query (self, data) || history_results_refine (self, data))
+      query_collection_done (self, task);
+    else
+      history_query_start (self, data, task);
   }
 
   if (data->scope == QUERY_SCOPE_ALL || data->scope == QUERY_SCOPE_TABS)
@@ -0,0 +1,295 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-tab-discarder.h"
+
+#include "ephy-debug.h"
+#include "ephy-embed.h"
+#include "ephy-prefs.h"
+#include "ephy-settings.h"
+#include "ephy-shell.h"
+#include "ephy-tab-view.h"
+#include "ephy-window.h"
+
+#include <gio/gio.h>
+
+/* How often background tabs are checked against the tab-discard-timeout
+ * setting.
+ */
+#define IDLE_CHECK_INTERVAL_SECONDS 60
+
+struct _EphyTabDiscarder {
+  GObject parent_instance;
+
+  GMemoryMonitor *memory_monitor;
+  guint idle_check_source_id;
+  GCancellable *cancellable;
+};
+
+G_DEFINE_FINAL_TYPE (EphyTabDiscarder, ephy_tab_discarder, G_TYPE_OBJECT)
+
+static gboolean
+embed_can_be_discarded (EphyTabView *tab_view,
+                        EphyEmbed   *embed)
+{
+  EphyWebView *web_view = ephy_embed_get_web_view (embed);
+
+  if (gtk_widget_get_mapped (GTK_WIDGET (embed)))
+    return FALSE;
+
+  /* Either discarded already, or never loaded since session restore. */
+  if (ephy_embed_has_load_pending (embed))
+    return FALSE;
+
+  /* Pinned tabs are usually web applications that are expected to keep
+   * running in the background.
+   */
+  if (ephy_tab_view_get_is_pinned (tab_view, GTK_WIDGET (embed)))
+    return FALSE;
+
+  /* Tabs playing media or capturing are kept by ephy_embed_discard (). */
+  if (ephy_web_view_is_loading (web_view))
+    return FALSE;
+
+  return TRUE;
+}
+
+static int
+compare_unmapped_time (gconstpointer a,
+                       gconstpointer b)
+{
+  gint64 time_a = ephy_embed_get_unmapped_time (*(EphyEmbed **)a);
+  gint64 time_b = ephy_embed_get_unmapped_time (*(EphyEmbed **)b);
+
+  return (time_a > time_b) - (time_a < time_b);
+}
+
+/* Returns the background tabs of every window that have not been shown since
+ * @hidden_before, the ones hidden for the longest time first.
+ */
+static GPtrArray *
+get_discardable_embeds (gint64 hidden_before)
+{
+  GPtrArray *candidates;
+  GList *windows;
+
+  candidates = g_ptr_array_new ();
+  windows = gtk_application_get_windows (GTK_APPLICATION (ephy_shell_get_default ()));
+
+  for (GList *w = windows; w; w = w->next) {
+    EphyTabView *tab_view;
+    g_autoptr (GList) pages = NULL;
+
+    if (!EPHY_IS_WINDOW (w->data))
+      continue;
+
+    tab_view = ephy_window_get_tab_view (EPHY_WINDOW (w->data));
+    pages = ephy_tab_view_get_pages (tab_view);
+
+    for (GList *p = pages; p; p = p->next) {
+      EphyEmbed *embed = EPHY_EMBED (p->data);
+
+      if (ephy_embed_get_unmapped_time (embed) < hidden_before &&
+          embed_can_be_discarded (tab_view, embed))
+        g_ptr_array_add (candidates, embed);
+    }
+  }
+
+  g_ptr_array_sort (candidates, compare_unmapped_time);
+
+  return candidates;
+}
+
+typedef struct {
+  GPtrArray *embeds;
+  GCancellable *cancellable;
+  guint next;
+  guint max_embeds;
+  guint discarded;
+} DiscardAsyncData;
+
+static void
+discard_async_data_free (DiscardAsyncData *data)
+{
+  g_ptr_array_unref (data->embeds);
+  g_object_unref (data->cancellable);
+  g_free (data);
+}
+
+static void discard_next_embed (DiscardAsyncData *data);
+
+static void
+has_modified_forms_cb (EphyWebView      *view,
+                       GAsyncResult     *result,
+                       DiscardAsyncData *data)
+{
+  EphyEmbed *embed = g_ptr_array_index (data->embeds, data->next++);
+  g_autoptr (GError) error = NULL;
+  gboolean has_modified_forms;
+
+  has_modified_forms = ephy_web_view_has_modified_forms_finish (view, result, &error);
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    discard_async_data_free (data);
+    return;
+  }
+
+  /* Unloading the page would lose what the user typed into it. The tab may
+   * also have been closed while the page was being checked.
+   */
+  if (!error && !has_modified_forms &&
+      gtk_widget_get_parent (GTK_WIDGET (embed)) &&
+      ephy_embed_discard (embed))
+    data->discarded++;
+
+  discard_next_embed (data);
+}
+
+static void
+discard_next_embed (DiscardAsyncData *data)
+{
+  EphyEmbed *embed;
+
+  if (data->next >= data->embeds->len || data->discarded >= data->max_embeds) {
+    LOG ("Discarded %u of %u background tabs", data->discarded, data->embeds->len);
+    discard_async_data_free (data);
+    return;
+  }
+
+  embed = g_ptr_array_index (data->embeds, data->next);
+  ephy_web_view_has_modified_forms (ephy_embed_get_web_view (embed),
+                                    data->cancellable,
+                                    (GAsyncReadyCallback)has_modified_forms_cb,
+                                    data);
+}
+
+/* Discards up to @max_embeds of @embeds, in order, skipping the ones with
+ * modified forms. Checking the forms is asynchronous, so the tabs are
+ * checked and discarded one after the other.
+ */
+static void
+discard_embeds (EphyTabDiscarder *self,
+                GPtrArray        *embeds,
+                guint             max_embeds)
+{
+  DiscardAsyncData *data;
+
+  data = g_new0 (DiscardAsyncData, 1);
+  data->embeds = g_ptr_array_new_with_free_func (g_object_unref);
+  for (guint i = 0; i < embeds->len; i++)
+    g_ptr_array_add (data->embeds, g_object_ref (g_ptr_array_index (embeds, i)));
+  data->cancellable = g_object_ref (self->cancellable);
+  data->max_embeds = max_embeds;
+
+  discard_next_embed (data);
+}
+
+static void
+low_memory_warning_cb (GMemoryMonitor             *monitor,
+                       GMemoryMonitorWarningLevel  level,
+                       EphyTabDiscarder           *self)
+{
+  g_autoptr (GPtrArray) embeds = get_discardable_embeds (G_MAXINT64);
+  guint max_embeds = embeds->len;
+
+  LOG ("Low memory warning, level %d", level);
+
+  /* On the first warning, free the older half of the background tabs. Only
+   * unload every background tab once the system is really short on memory.
+   */
+  if (level < G_MEMORY_MONITOR_WARNING_LEVEL_MEDIUM)
+    max_embeds = MAX (1, embeds->len / 2);
+
+  discard_embeds (self, embeds, max_embeds);
+}
+
+static gboolean
+idle_check_cb (EphyTabDiscarder *self)
+{
+  guint timeout = g_settings_get_uint (EPHY_SETTINGS_MAIN, EPHY_PREFS_TAB_DISCARD_TIMEOUT);
+  g_autoptr (GPtrArray) embeds = NULL;
+
+  embeds = get_discardable_embeds (g_get_monotonic_time () - (gint64)timeout * 60 * G_USEC_PER_SEC);
+  discard_embeds (self, embeds, embeds->len);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+tab_discard_timeout_changed_cb (GSettings        *settings,
+                                const char       *key,
+                                EphyTabDiscarder *self)
+{
+  g_clear_handle_id (&self->idle_check_source_id, g_source_remove);
+
+  if (g_settings_get_uint (settings, key) == 0)
+    return;
+
+  self->idle_check_source_id = g_timeout_add_seconds (IDLE_CHECK_INTERVAL_SECONDS,
+                                                      (GSourceFunc)idle_check_cb,
+                                                      self);
+  g_source_set_name_by_id (self->idle_check_source_id, "[epiphany] tab_discarder_idle_check_cb");
+}
+
+static void
+ephy_tab_discarder_dispose (GObject *object)
+{
+  EphyTabDiscarder *self = EPHY_TAB_DISCARDER (object);
+
+  g_clear_handle_id (&self->idle_check_source_id, g_source_remove);
+
+  if (self->cancellable) {
+    g_cancellable_cancel (self->cancellable);
+    g_clear_object (&self->cancellable);
+  }
+
+  if (self->memory_monitor) {
+    g_signal_handlers_disconnect_by_data (self->memory_monitor, self);
+    g_clear_object (&self->memory_monitor);
+  }
+
+  G_OBJECT_CLASS (ephy_tab_discarder_parent_class)->dispose (object);
+}
+
+static void
+ephy_tab_discarder_class_init (EphyTabDiscarderClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = ephy_tab_discarder_dispose;
+}
+
+static void
+ephy_tab_discarder_init (EphyTabDiscarder *self)
+{
+  self->cancellable = g_cancellable_new ();
+
+  self->memory_monitor = g_memory_monitor_dup_default ();
+  g_signal_connect (self->memory_monitor, "low-memory-warning",
+                    G_CALLBACK (low_memory_warning_cb), self);
+
+  g_signal_connect_object (EPHY_SETTINGS_MAIN, "changed::" EPHY_PREFS_TAB_DISCARD_TIMEOUT,
+                           G_CALLBACK (tab_discard_timeout_changed_cb), self, 0);
+  tab_discard_timeout_changed_cb (EPHY_SETTINGS_MAIN, EPHY_PREFS_TAB_DISCARD_TIMEOUT, self);
+}
+
+EphyTabDiscarder *
+ephy_tab_discarder_new (void)
+{
+  return g_object_new (EPHY_TYPE_TAB_DISCARDER, NULL);
+}
@@ -0,0 +1,213 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-tab-index.h"
+
+#include "ephy-debug.h"
+#include "ephy-web-view.h"
+
+/* Index of the tabs open in every window, so that searching them does not
+ * need to walk the windows and casefold every title and address again.
+ */
+struct _EphyTabIndex {
+  GObject parent_instance;
+
+  GPtrArray *entries;   /* in the order the tabs were attached */
+  GHashTable *ids;      /* id -> EphyTabIndexEntry */
+};
+
+G_DEFINE_FINAL_TYPE (EphyTabIndex, ephy_tab_index, G_TYPE_OBJECT)
+
+static void
+entry_free (EphyTabIndexEntry *entry)
+{
+  g_free (entry->title_casefold);
+  g_free (entry->address_casefold);
+  g_free (entry);
+}
+
+static void
+entry_update_title (EphyTabIndexEntry *entry)
+{
+  const char *title = webkit_web_view_get_title (WEBKIT_WEB_VIEW (ephy_embed_get_web_view (entry->embed)));
+
+  g_free (entry->title_casefold);
+  entry->title_casefold = g_utf8_casefold (title ? title : "", -1);
+}
+
+static void
+entry_update_address (EphyTabIndexEntry *entry)
+{
+  const char *address = ephy_web_view_get_display_address (ephy_embed_get_web_view (entry->embed));
+
+  g_free (entry->address_casefold);
+  entry->address_casefold = g_utf8_casefold (address ? address : "", -1);
+}
+
+static void
+title_changed_cb (EphyWebView  *web_view,
+                  GParamSpec   *pspec,
+                  EphyTabIndex *self)
+{
+  guint64 id = ephy_web_view_get_uid (web_view);
+  EphyTabIndexEntry *entry = g_hash_table_lookup (self->ids, &id);
+
+  if (entry)
+    entry_update_title (entry);
+}
+
+static void
+display_address_changed_cb (EphyWebView  *web_view,
+                            GParamSpec   *pspec,
+                            EphyTabIndex *self)
+{
+  guint64 id = ephy_web_view_get_uid (web_view);
+  EphyTabIndexEntry *entry = g_hash_table_lookup (self->ids, &id);
+
+  if (entry)
+    entry_update_address (entry);
+}
+
+static void
+ephy_tab_index_finalize (GObject *object)
+{
+  EphyTabIndex *self = EPHY_TAB_INDEX (object);
+
+  for (guint i = 0; i < self->entries->len; i++) {
+    EphyTabIndexEntry *entry = g_ptr_array_index (self->entries, i);
+
+    g_signal_handlers_disconnect_by_data (ephy_embed_get_web_view (entry->embed), self);
+  }
+
+  g_hash_table_unref (self->ids);
+  g_ptr_array_unref (self->entries);
+
+  G_OBJECT_CLASS (ephy_tab_index_parent_class)->finalize (object);
+}
+
+static void
+ephy_tab_index_class_init (EphyTabIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = ephy_tab_index_finalize;
+}
+
+static void
+ephy_tab_index_init (EphyTabIndex *self)
+{
+  self->entries = g_ptr_array_new_with_free_func ((GDestroyNotify)entry_free);
+  self->ids = g_hash_table_new (g_int64_hash, g_int64_equal);
+}
+
+EphyTabIndex *
+ephy_tab_index_new (void)
+{
+  return g_object_new (EPHY_TYPE_TAB_INDEX, NULL);
+}
+
+void
+ephy_tab_index_add (EphyTabIndex *self,
+                    EphyTabView  *tab_view,
+                    EphyEmbed    *embed)
+{
+  EphyWebView *web_view = ephy_embed_get_web_view (embed);
+  EphyTabIndexEntry *entry;
+
+  g_assert (EPHY_IS_TAB_INDEX (self));
+
+  /* Tabs moved to another window are detached first, but make sure an embed
+   * is never indexed twice. */
+  ephy_tab_index_remove (self, embed);
+
+  entry = g_new0 (EphyTabIndexEntry, 1);
+  entry->id = ephy_web_view_get_uid (web_view);
+  entry->embed = embed;
+  entry->tab_view = tab_view;
+  entry_update_title (entry);
+  entry_update_address (entry);
+
+  g_ptr_array_add (self->entries, entry);
+  g_hash_table_insert (self->ids, &entry->id, entry);
+
+  g_signal_connect_object (web_view, "notify::title",
+                           G_CALLBACK (title_changed_cb), self, 0);
+  g_signal_connect_object (web_view, "notify::display-address",
+                           G_CALLBACK (display_address_changed_cb), self, 0);
+
+  LOG ("Tab %" G_GUINT64_FORMAT " added to the tab index", entry->id);
+}
+
+void
+ephy_tab_index_remove (EphyTabIndex *self,
+                       EphyEmbed    *embed)
+{
+  EphyWebView *web_view = ephy_embed_get_web_view (embed);
+  guint64 id = ephy_web_view_get_uid (web_view);
+  EphyTabIndexEntry *entry;
+
+  g_assert (EPHY_IS_TAB_INDEX (self));
+
+  entry = g_hash_table_lookup (self->ids, &id);
+  if (!entry || entry->embed != embed)
+    return;
+
+  g_signal_handlers_disconnect_by_data (web_view, self);
+  g_hash_table_remove (self->ids, &id);
+  g_ptr_array_remove (self->entries, entry);
+}
+
+/**
+ * ephy_tab_index_lookup:
+ * @self: an #EphyTabIndex
+ * @id: the id of a tab, as returned by ephy_web_view_get_uid()
+ *
+ * Returns: (transfer none) (nullable): the open tab with @id
+ **/
+EphyTabIndexEntry *
+ephy_tab_index_lookup (EphyTabIndex *self,
+                       guint64       id)
+{
+  g_assert (EPHY_IS_TAB_INDEX (self));
+
+  return g_hash_table_lookup (self->ids, &id);
+}
+
+/**
+ * ephy_tab_index_get_entries:
+ * @self: an #EphyTabIndex
+ *
+ * Returns: (transfer none) (element-type EphyTabIndexEntry): the open tabs,
+ * in the order they were opened
+ **/
+GPtrArray *
+ephy_tab_index_get_entries (EphyTabIndex *self)
+{
+  g_assert (EPHY_IS_TAB_INDEX (self));
+
+  return self->entries;
+}
+
+gboolean
+ephy_tab_index_entry_matches (EphyTabIndexEntry *entry,
+                              const char        *query_casefold)
+{
+  return strstr (entry->title_casefold, query_casefold) ||
+         strstr (entry->address_casefold, query_casefold);
+}
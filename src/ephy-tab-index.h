@@ -0,0 +1,58 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ephy-embed.h"
+#include "ephy-tab-view.h"
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define EPHY_TYPE_TAB_INDEX (ephy_tab_index_get_type ())
+
+G_DECLARE_FINAL_TYPE (EphyTabIndex, ephy_tab_index, EPHY, TAB_INDEX, GObject)
+
+/* An open tab, owned by the index. The id is the one of its web view, it
+ * stays the same when the tab is moved to another window.
+ */
+typedef struct {
+  guint64 id;
+  EphyEmbed *embed;
+  EphyTabView *tab_view;
+  char *title_casefold;
+  char *address_casefold;
+} EphyTabIndexEntry;
+
+EphyTabIndex      *ephy_tab_index_new           (void);
+
+void               ephy_tab_index_add           (EphyTabIndex      *self,
+                                                 EphyTabView       *tab_view,
+                                                 EphyEmbed         *embed);
+void               ephy_tab_index_remove        (EphyTabIndex      *self,
+                                                 EphyEmbed         *embed);
+
+EphyTabIndexEntry *ephy_tab_index_lookup        (EphyTabIndex      *self,
+                                                 guint64            id);
+GPtrArray         *ephy_tab_index_get_entries   (EphyTabIndex      *self);
+
+gboolean           ephy_tab_index_entry_matches (EphyTabIndexEntry *entry,
+                                                 const char        *query_casefold);
+
+G_END_DECLS
@@ -77,6 +77,26 @@ indicator_activated_cb (EphyTabView *self,
   webkit_web_view_set_is_muted (WEBKIT_WEB_VIEW (view), !muted);
 }
 
+static void
+page_attached_cb (EphyTabView *self,
+                  AdwTabPage  *page,
+                  int          position)
+{
+  EphyTabIndex *tab_index = ephy_shell_get_tab_index (ephy_shell_get_default ());
+
+  ephy_tab_index_add (tab_index, self, EPHY_EMBED (adw_tab_page_get_child (page)));
+}
+
+static void
+page_detached_cb (EphyTabView *self,
+                  AdwTabPage  *page,
+                  int          position)
+{
+  EphyTabIndex *tab_index = ephy_shell_get_tab_index (ephy_shell_get_default ());
+
+  ephy_tab_index_remove (tab_index, EPHY_EMBED (adw_tab_page_get_child (page)));
+}
+
 static void
 setup_menu_cb (EphyTabView *self,
                AdwTabPage  *page)
@@ -167,6 +187,18 @@ ephy_tab_view_init (EphyTabView *self)
                            self,
                            G_CONNECT_SWAPPED);
 
+  g_signal_connect_object (self->tab_view,
+                           "page-attached",
+                           G_CALLBACK (page_attached_cb),
+                           self,
+                           G_CONNECT_SWAPPED);
+
+  g_signal_connect_object (self->tab_view,
+                           "page-detached",
+                           G_CALLBACK (page_detached_cb),
+                           self,
+                           G_CONNECT_SWAPPED);
+
   g_signal_connect_object (self->tab_view,
                            "setup-menu",
                            G_CALLBACK (setup_menu_cb),
@@ -360,6 +392,31 @@ ephy_tab_view_get_is_pinned (EphyTabView *self,
   return adw_tab_page_get_pinned (page);
 }
 
+gboolean
+ephy_tab_view_get_is_discarded (EphyTabView *self,
+                                GtkWidget   *widget)
+{
+  g_assert (EPHY_IS_EMBED (widget));
+
+  return ephy_embed_is_discarded (EPHY_EMBED (widget));
+}
+
+static void
+update_discarded_cb (AdwTabPage *page)
+{
+  EphyEmbed *embed = EPHY_EMBED (adw_tab_page_get_child (page));
+
+  if (ephy_embed_is_discarded (embed)) {
+    g_autofree char *tooltip = NULL;
+
+    /* Translators: tooltip of a background tab whose page was unloaded, %s is the page title */
+    tooltip = g_markup_printf_escaped (_("%s\nUnloaded to save memory"), adw_tab_page_get_title (page));
+    adw_tab_page_set_tooltip (page, tooltip);
+  } else {
+    adw_tab_page_set_tooltip (page, NULL);
+  }
+}
+
 static void
 update_title_cb (AdwTabPage *page)
 {
@@ -504,10 +561,18 @@ ephy_tab_view_add_tab (EphyTabView *self,
   g_signal_connect_object (view, "notify::is-muted",
                            G_CALLBACK (update_indicator_cb), page,
                            G_CONNECT_SWAPPED);
+  g_signal_connect_object (embed, "notify::discarded",
+                           G_CALLBACK (update_discarded_cb), page,
+                           G_CONNECT_SWAPPED);
+  /* The tooltip of a discarded tab repeats its title. */
+  g_signal_connect_object (page, "notify::title",
+                           G_CALLBACK (update_discarded_cb), page,
+                           G_CONNECT_SWAPPED);
 
   update_title_cb (page);
   update_uri_cb (page);
   update_indicator_cb (page);
+  update_discarded_cb (page);
 
   return adw_tab_view_get_page_position (self->tab_view, page);
 }
@@ -75,6 +75,9 @@ GList        *ephy_tab_view_get_pages         (EphyTabView *self);
 gboolean      ephy_tab_view_get_is_pinned     (EphyTabView *self,
                                                GtkWidget   *widget);
 
+gboolean      ephy_tab_view_get_is_discarded  (EphyTabView *self,
+                                               GtkWidget   *widget);
+
 gint          ephy_tab_view_add_tab           (EphyTabView *self,
                                                EphyEmbed   *embed,
                                                EphyEmbed   *parent,
@@ -85,6 +85,32 @@ get_website_data_manager (void)
   return webkit_network_session_get_website_data_manager (network_session);
 }
 
+static void
+website_data_cleared_cb (WebKitWebsiteDataManager *manager,
+                         GAsyncResult             *result,
+                         gpointer                  user_data)
+{
+  g_autoptr (GError) error = NULL;
+
+  if (!webkit_website_data_manager_clear_finish (manager, result, &error))
+    g_warning ("Failed to clear website data: %s", error->message);
+
+  ephy_embed_shell_website_data_cleared (ephy_embed_shell_get_default ());
+}
+
+static void
+website_data_removed_cb (WebKitWebsiteDataManager *manager,
+                         GAsyncResult             *result,
+                         gpointer                  user_data)
+{
+  g_autoptr (GError) error = NULL;
+
+  if (!webkit_website_data_manager_remove_finish (manager, result, &error))
+    g_warning ("Failed to remove website data: %s", error->message);
+
+  ephy_embed_shell_website_data_cleared (ephy_embed_shell_get_default ());
+}
+
 G_GNUC_BEGIN_IGNORE_DEPRECATIONS
 static void
 website_data_fetched_cb (WebKitWebsiteDataManager *manager,
@@ -212,13 +238,17 @@ on_clear_button_clicked (ClearDataView *clear_data_view)
   if (types_to_clear) {
     webkit_website_data_manager_clear (get_website_data_manager (),
                                        types_to_clear, 0,
-                                       NULL, NULL, NULL);
+                                       NULL,
+                                       (GAsyncReadyCallback)website_data_cleared_cb,
+                                       NULL);
   }
 
   if (types_to_remove) {
     webkit_website_data_manager_remove (get_website_data_manager (),
                                         types_to_remove, data_to_remove,
-                                        NULL, NULL, NULL);
+                                        NULL,
+                                        (GAsyncReadyCallback)website_data_removed_cb,
+                                        NULL);
   }
 
   if (types_to_clear || types_to_remove) {
@@ -48,7 +48,6 @@ storage_handler_local_set (EphyWebExtensionSender *sender,
   }
 
   /* FIXME: Implement storage.onChanged */
-  /* FIXME: Async IO */
   ephy_web_extension_save_local_storage (sender->extension);
 
   g_task_return_pointer (task, NULL, NULL);
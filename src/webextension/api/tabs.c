@@ -36,7 +36,8 @@ get_web_view_for_tab_id (EphyShell   *shell,
                          gint64       tab_id,
                          EphyWindow **window_out)
 {
-  GList *windows;
+  EphyTabIndexEntry *tab;
+  GtkRoot *window;
 
   if (window_out)
     *window_out = NULL;
@@ -44,25 +45,16 @@ get_web_view_for_tab_id (EphyShell   *shell,
   if (tab_id < 0)
     return NULL;
 
-  windows = gtk_application_get_windows (GTK_APPLICATION (shell));
-
-  for (GList *win_list = windows; win_list; win_list = g_list_next (win_list)) {
-    EphyWindow *window = EPHY_WINDOW (win_list->data);
-    EphyTabView *tab_view = ephy_window_get_tab_view (window);
-
-    for (int i = 0; i < ephy_tab_view_get_n_pages (tab_view); i++) {
-      EphyWebView *web_view = ephy_embed_get_web_view (EPHY_EMBED (ephy_tab_view_get_nth_page (tab_view, i)));
-
-      if (ephy_web_view_get_uid (web_view) == (guint64)tab_id) {
-        if (window_out)
-          *window_out = window;
-        return WEBKIT_WEB_VIEW (web_view);
-      }
-    }
+  tab = ephy_tab_index_lookup (ephy_shell_get_tab_index (shell), tab_id);
+  window = tab ? gtk_widget_get_root (GTK_WIDGET (tab->tab_view)) : NULL;
+  if (!EPHY_IS_WINDOW (window)) {
+    g_debug ("Failed to find tab with id %" G_GUINT64_FORMAT, tab_id);
+    return NULL;
   }
 
-  g_debug ("Failed to find tab with id %" G_GUINT64_FORMAT, tab_id);
-  return NULL;
+  if (window_out)
+    *window_out = EPHY_WINDOW (window);
+  return WEBKIT_WEB_VIEW (ephy_embed_get_web_view (tab->embed));
 }
 
 static void
@@ -192,12 +184,18 @@ tabs_handler_query (EphyWebExtensionSender *sender,
   active_window = EPHY_WINDOW (gtk_application_get_active_window (GTK_APPLICATION (shell)));
   windows = gtk_application_get_windows (GTK_APPLICATION (shell));
 
+  /* Every supported filter selects tabs by window, position or selection,
+   * which the tab view of each window answers directly. The tab index holds
+   * the tabs in the order they were opened, so the results would have to be
+   * sorted back by window and position. It is used to find tabs by id.
+   */
   json_builder_begin_array (builder);
 
   for (GList *win_list = windows; win_list; win_list = g_list_next (win_list)) {
     EphyWindow *window;
     EphyTabView *tab_view;
-    EphyWebView *active_web_view;
+    GtkWidget *active_page;
+    GtkWidget *page;
 
     g_assert (EPHY_IS_WINDOW (win_list->data));
 
@@ -211,20 +209,32 @@ tabs_handler_query (EphyWebExtensionSender *sender,
       continue;
 
     tab_view = ephy_window_get_tab_view (window);
-    active_web_view = ephy_embed_get_web_view (EPHY_EMBED (ephy_tab_view_get_selected_page (tab_view)));
-    for (int i = 0; i < ephy_tab_view_get_n_pages (tab_view); i++) {
-      EphyWebView *web_view;
-
-      if (tab_index != -1 && tab_index != i)
+    active_page = ephy_tab_view_get_selected_page (tab_view);
+
+    /* An index or the active tab designate a single tab of the window. */
+    if (tab_index != -1 || active == API_VALUE_TRUE) {
+      if (tab_index == -1)
+        page = active_page;
+      else if (tab_index >= 0 && tab_index < ephy_tab_view_get_n_pages (tab_view))
+        page = ephy_tab_view_get_nth_page (tab_view, tab_index);
+      else
         continue;
 
-      web_view = ephy_embed_get_web_view (EPHY_EMBED (ephy_tab_view_get_nth_page (tab_view, i)));
-      if (active == API_VALUE_TRUE && web_view != active_web_view)
+      if (!page ||
+          (active == API_VALUE_TRUE && page != active_page) ||
+          (active == API_VALUE_FALSE && page == active_page))
         continue;
-      else if (active == API_VALUE_FALSE && web_view == active_web_view)
+
+      add_web_view_to_json (sender->extension, builder, window, ephy_embed_get_web_view (EPHY_EMBED (page)));
+      continue;
+    }
+
+    for (int i = 0; i < ephy_tab_view_get_n_pages (tab_view); i++) {
+      page = ephy_tab_view_get_nth_page (tab_view, i);
+      if (active == API_VALUE_FALSE && page == active_page)
         continue;
 
-      add_web_view_to_json (sender->extension, builder, window, web_view);
+      add_web_view_to_json (sender->extension, builder, window, ephy_embed_get_web_view (EPHY_EMBED (page)));
     }
   }
 
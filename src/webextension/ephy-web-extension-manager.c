@@ -32,6 +32,7 @@
 #include "ephy-settings.h"
 #include "ephy-shell.h"
 #include "ephy-string.h"
+#include "ephy-tab-index.h"
 #include "ephy-web-extension.h"
 #include "ephy-web-extension-manager.h"
 #include "ephy-web-view.h"
@@ -54,6 +55,21 @@
 #include <archive_entry.h>
 #include <json-glib/json-glib.h>
 
+/* Changes of a tab within about a frame are sent as one tabs.onUpdated. */
+#define TAB_UPDATE_DELAY 16
+
+typedef enum {
+  TAB_CHANGED_STATUS = 1 << 0,
+  TAB_CHANGED_URL    = 1 << 1,
+  TAB_CHANGED_TITLE  = 1 << 2,
+} TabChanges;
+
+typedef struct {
+  EphyWebExtension *web_extension;
+  guint64 tab_id;
+  TabChanges changes;
+} PendingTabUpdate;
+
 static void handle_message_reply (EphyWebExtension *web_extension,
                                   JsonArray        *args);
 
@@ -64,6 +80,7 @@ struct _EphyWebExtensionManager {
 
   GCancellable *cancellable;
   GPtrArray *web_extensions;
+  guint n_scan_loads;  /* Extension loads pending from the directory scan, plus one while enumerating. */
   GHashTable *page_action_map;
 
   GHashTable *browser_action_map;
@@ -75,6 +92,9 @@ struct _EphyWebExtensionManager {
   GHashTable *popup_web_views;
 
   GHashTable *pending_messages;
+
+  GArray *pending_tab_updates;
+  guint tab_updates_source_id;
 };
 
 G_DEFINE_FINAL_TYPE (EphyWebExtensionManager, ephy_web_extension_manager, G_TYPE_OBJECT)
@@ -186,6 +206,15 @@ ephy_web_extension_manager_get_extension_by_guid (EphyWebExtensionManager *self,
   return NULL;
 }
 
+static void
+ephy_web_extension_manager_scan_load_done (EphyWebExtensionManager *self)
+{
+  g_assert (self->n_scan_loads > 0);
+
+  if (--self->n_scan_loads == 0)
+    STOP_PROFILER ("Web extensions scan")
+}
+
 static void
 on_web_extension_loaded (GObject      *source_object,
                          GAsyncResult *result,
@@ -197,6 +226,7 @@ on_web_extension_loaded (GObject      *source_object,
   EphyWebExtensionManager *self = EPHY_WEB_EXTENSION_MANAGER (user_data);
 
   web_extension = ephy_web_extension_load_finished (source_object, result, &error);
+  ephy_web_extension_manager_scan_load_done (self);
   if (!web_extension) {
     g_warning ("Failed to load extension %s: %s", g_file_peek_path (target), error->message);
     return;
@@ -222,6 +252,7 @@ scan_directory_ready_cb (GFile        *file,
   if (error) {
     if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
       g_warning ("Failed to scan extensions directory: %s", error->message);
+    ephy_web_extension_manager_scan_load_done (self);
     return;
   }
 
@@ -236,8 +267,11 @@ scan_directory_ready_cb (GFile        *file,
     if (!info)
       break;
 
+    self->n_scan_loads++;
     ephy_web_extension_load_async (child, info, self->cancellable, on_web_extension_loaded, self);
   }
+
+  ephy_web_extension_manager_scan_load_done (self);
 }
 
 static void
@@ -246,6 +280,9 @@ ephy_web_extension_manager_scan_directory_async (EphyWebExtensionManager *self,
 {
   g_autoptr (GFile) extension_dir = g_file_new_for_path (extension_dir_path);
 
+  if (self->n_scan_loads++ == 0)
+    START_PROFILER ("Web extensions scan")
+
   g_file_enumerate_children_async (extension_dir,
                                    G_FILE_ATTRIBUTE_STANDARD_TYPE,
                                    G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
@@ -339,6 +376,7 @@ ephy_web_extension_manager_constructed (GObject *object)
   self->browser_action_map = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)g_object_unref);
   self->browser_actions = g_list_store_new (EPHY_TYPE_BROWSER_ACTION);
   self->pending_messages = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_hash_table_destroy);
+  self->pending_tab_updates = g_array_new (FALSE, FALSE, sizeof (PendingTabUpdate));
   self->web_extensions = g_ptr_array_new_full (0, g_object_unref);
   self->user_agent_overrides = create_user_agent_overrides ();
 
@@ -352,6 +390,7 @@ ephy_web_extension_manager_dispose (GObject *object)
 
   ephy_web_extension_api_downloads_dispose (self);
 
+  g_clear_handle_id (&self->tab_updates_source_id, g_source_remove);
   g_list_store_remove_all (self->browser_actions);
 
   g_clear_pointer (&self->background_web_views, g_hash_table_destroy);
@@ -360,6 +399,7 @@ ephy_web_extension_manager_dispose (GObject *object)
   g_clear_pointer (&self->browser_action_map, g_hash_table_destroy);
   g_clear_pointer (&self->page_action_map, g_hash_table_destroy);
   g_clear_pointer (&self->pending_messages, g_hash_table_destroy);
+  g_clear_pointer (&self->pending_tab_updates, g_array_unref);
   g_clear_pointer (&self->web_extensions, g_ptr_array_unref);
   g_clear_pointer (&self->user_agent_overrides, g_hash_table_destroy);
 }
@@ -864,6 +904,73 @@ on_web_extension_api_handler_finish (EphyWebExtension *web_extension,
   g_object_unref (task);
 }
 
+/* Extension views report the events they have listeners for, with a count
+ * per event since every frame of the view has its own. Events without one
+ * are neither serialized nor sent to the view. */
+#define EVENT_LISTENERS_KEY "ephy-web-extension-event-listeners"
+
+static void
+extension_view_set_listening (WebKitWebView *web_view,
+                              const char    *name,
+                              gboolean       listening)
+{
+  GHashTable *listeners = g_object_get_data (G_OBJECT (web_view), EVENT_LISTENERS_KEY);
+  guint count;
+
+  if (!listeners) {
+    listeners = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_object_set_data_full (G_OBJECT (web_view), EVENT_LISTENERS_KEY, listeners, (GDestroyNotify)g_hash_table_unref);
+  }
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (listeners, name));
+  if (listening)
+    count++;
+  else if (count > 0)
+    count--;
+
+  if (count > 0)
+    g_hash_table_replace (listeners, g_strdup (name), GUINT_TO_POINTER (count));
+  else
+    g_hash_table_remove (listeners, name);
+}
+
+static gboolean
+extension_view_has_listener (WebKitWebView *web_view,
+                             const char    *name)
+{
+  GHashTable *listeners = g_object_get_data (G_OBJECT (web_view), EVENT_LISTENERS_KEY);
+
+  return listeners && g_hash_table_contains (listeners, name);
+}
+
+/**
+ * ephy_web_extension_manager_has_listener:
+ * @self: an #EphyWebExtensionManager
+ * @web_extension: an #EphyWebExtension
+ * @name: the name of an event, like "tabs.onUpdated"
+ *
+ * Returns: whether one of the views of @web_extension listens to @name, so
+ *   that emitting it is worth building its arguments
+ **/
+gboolean
+ephy_web_extension_manager_has_listener (EphyWebExtensionManager *self,
+                                         EphyWebExtension        *web_extension,
+                                         const char              *name)
+{
+  WebKitWebView *background_view = ephy_web_extension_manager_get_background_web_view (self, web_extension);
+  GPtrArray *popup_views = g_hash_table_lookup (self->popup_web_views, web_extension);
+
+  if (background_view && extension_view_has_listener (background_view, name))
+    return TRUE;
+
+  for (guint i = 0; popup_views && i < popup_views->len; i++) {
+    if (extension_view_has_listener (g_ptr_array_index (popup_views, i), name))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
 static gboolean
 extension_view_handle_user_message (WebKitWebView     *web_view,
                                     WebKitUserMessage *message,
@@ -901,6 +1008,18 @@ extension_view_handle_user_message (WebKitWebView     *web_view,
     return TRUE;
   }
 
+  /* Private API for the listeners of the view, see webextensions-common.js. */
+  if (strcmp (name, "runtime._setListening") == 0) {
+    WebKitUserMessage *reply = webkit_user_message_new ("", g_variant_new_string (""));
+    const char *event_name = ephy_json_array_get_string (json_args, 0);
+    JsonNode *listening = ephy_json_array_get_element (json_args, 1);
+
+    if (event_name && listening && JSON_NODE_HOLDS_VALUE (listening))
+      extension_view_set_listening (web_view, event_name, json_node_get_boolean (listening));
+    webkit_user_message_send_reply (message, reply);
+    return TRUE;
+  }
+
   split = g_strsplit (name, ".", 2);
   if (g_strv_length (split) != 2) {
     respond_with_error (message, "Invalid function name");
@@ -1485,6 +1604,132 @@ typedef struct {
   guint64 window_id;
 } WindowAddedCallbackData;
 
+static char *
+tab_changes_to_json (EphyWebExtension *web_extension,
+                     EphyWebView      *web_view,
+                     TabChanges        changes)
+{
+  g_autoptr (JsonBuilder) builder = json_builder_new ();
+  g_autoptr (JsonNode) root = NULL;
+  gboolean has_tab_permission = ephy_web_extension_has_tab_or_host_permission (web_extension, web_view, TRUE);
+
+  if (!has_tab_permission)
+    changes &= TAB_CHANGED_STATUS;
+
+  if (!changes)
+    return NULL;
+
+  json_builder_begin_object (builder);
+  if (changes & TAB_CHANGED_STATUS) {
+    json_builder_set_member_name (builder, "status");
+    json_builder_add_string_value (builder, ephy_web_view_is_loading (web_view) ? "loading" : "complete");
+  }
+  if (changes & TAB_CHANGED_URL) {
+    json_builder_set_member_name (builder, "url");
+    json_builder_add_string_value (builder, ephy_web_view_get_address (web_view));
+  }
+  if (changes & TAB_CHANGED_TITLE) {
+    json_builder_set_member_name (builder, "title");
+    json_builder_add_string_value (builder, webkit_web_view_get_title (WEBKIT_WEB_VIEW (web_view)));
+  }
+  json_builder_end_object (builder);
+
+  root = json_builder_get_root (builder);
+  return json_to_string (root, FALSE);
+}
+
+static void
+emit_tab_updates_cb (gpointer user_data)
+{
+  EphyWebExtensionManager *self = EPHY_WEB_EXTENSION_MANAGER (user_data);
+  EphyTabIndex *tab_index = ephy_shell_get_tab_index (ephy_shell_get_default ());
+  g_autoptr (GArray) updates = self->pending_tab_updates;
+
+  self->tab_updates_source_id = 0;
+  self->pending_tab_updates = g_array_new (FALSE, FALSE, sizeof (PendingTabUpdate));
+
+  for (guint i = 0; i < updates->len; i++) {
+    PendingTabUpdate *update = &g_array_index (updates, PendingTabUpdate, i);
+    EphyTabIndexEntry *entry = ephy_tab_index_lookup (tab_index, update->tab_id);
+    g_autoptr (JsonNode) tab = NULL;
+    g_autofree char *changes_json = NULL;
+    g_autofree char *tab_json = NULL;
+    g_autofree char *args = NULL;
+    EphyWebView *web_view;
+
+    /* The tab may have been closed or be moving to another window. */
+    if (!entry)
+      continue;
+
+    web_view = ephy_embed_get_web_view (entry->embed);
+    if (!EPHY_IS_WINDOW (gtk_widget_get_root (GTK_WIDGET (web_view))))
+      continue;
+
+    changes_json = tab_changes_to_json (update->web_extension, web_view, update->changes);
+    if (!changes_json)
+      continue;
+
+    tab = ephy_web_extension_api_tabs_create_tab_object (update->web_extension, web_view);
+    tab_json = json_to_string (tab, FALSE);
+    args = g_strdup_printf ("%" G_GUINT64_FORMAT ", %s, %s", update->tab_id, changes_json, tab_json);
+    ephy_web_extension_manager_emit_in_extension_views (self, update->web_extension, "tabs.onUpdated", args);
+  }
+}
+
+static void
+tab_changed_cb (EphyWebView      *web_view,
+                GParamSpec       *pspec,
+                EphyWebExtension *web_extension)
+{
+  EphyWebExtensionManager *manager = ephy_web_extension_manager_get_default ();
+  guint64 tab_id = ephy_web_view_get_uid (web_view);
+  PendingTabUpdate *update = NULL;
+  TabChanges change;
+
+  if (!ephy_web_extension_manager_has_listener (manager, web_extension, "tabs.onUpdated"))
+    return;
+
+  if (strcmp (pspec->name, "is-loading") == 0)
+    change = TAB_CHANGED_STATUS;
+  else if (strcmp (pspec->name, "uri") == 0)
+    change = TAB_CHANGED_URL;
+  else
+    change = TAB_CHANGED_TITLE;
+
+  /* A page load changes all of these, some more than once. */
+  for (guint i = 0; i < manager->pending_tab_updates->len; i++) {
+    PendingTabUpdate *pending = &g_array_index (manager->pending_tab_updates, PendingTabUpdate, i);
+
+    if (pending->web_extension == web_extension && pending->tab_id == tab_id) {
+      update = pending;
+      break;
+    }
+  }
+
+  if (!update) {
+    PendingTabUpdate new_update = { web_extension, tab_id, 0 };
+
+    g_array_append_val (manager->pending_tab_updates, new_update);
+    update = &g_array_index (manager->pending_tab_updates, PendingTabUpdate, manager->pending_tab_updates->len - 1);
+  }
+
+  update->changes |= change;
+
+  if (!manager->tab_updates_source_id) {
+    manager->tab_updates_source_id = g_timeout_add_once (TAB_UPDATE_DELAY, emit_tab_updates_cb, manager);
+    g_source_set_name_by_id (manager->tab_updates_source_id, "[epiphany] emit_tab_updates_cb");
+  }
+}
+
+static void
+connect_tab_changed (EphyWebView      *web_view,
+                     EphyWebExtension *web_extension)
+{
+  g_signal_connect_object (web_view, "notify::is-loading", G_CALLBACK (tab_changed_cb), web_extension, 0);
+  g_signal_connect_object (web_view, "notify::uri", G_CALLBACK (tab_changed_cb), web_extension, 0);
+  g_signal_connect_object (web_view, "notify::title", G_CALLBACK (tab_changed_cb), web_extension, 0);
+}
+
 static void
 on_page_attached (AdwTabView *self,
                   AdwTabPage *page,
@@ -1494,12 +1739,19 @@ on_page_attached (AdwTabView *self,
   EphyWebExtensionManager *manager = ephy_web_extension_manager_get_default ();
   EphyWebExtension *web_extension = user_data;
   g_autoptr (JsonNode) json = NULL;
+  g_autofree char *tab_json = NULL;
   GtkWidget *embed = adw_tab_page_get_child (page);
   EphyWebView *view;
 
   view = ephy_embed_get_web_view (EPHY_EMBED (embed));
+  connect_tab_changed (view, web_extension);
+
+  if (!ephy_web_extension_manager_has_listener (manager, web_extension, "tabs.onCreated"))
+    return;
+
   json = ephy_web_extension_api_tabs_create_tab_object (web_extension, view);
-  ephy_web_extension_manager_emit_in_extension_views (manager, web_extension, "tabs.onCreated", json_to_string (json, FALSE));
+  tab_json = json_to_string (json, FALSE);
+  ephy_web_extension_manager_emit_in_extension_views (manager, web_extension, "tabs.onCreated", tab_json);
 }
 
 static void
@@ -1515,6 +1767,11 @@ on_page_detached (AdwTabView *self,
   EphyWebView *view;
 
   view = ephy_embed_get_web_view (EPHY_EMBED (embed));
+  g_signal_handlers_disconnect_by_func (view, tab_changed_cb, web_extension);
+
+  if (!ephy_web_extension_manager_has_listener (manager, web_extension, "tabs.onRemoved"))
+    return;
+
   tab_json = g_strdup_printf ("%ld", ephy_web_view_get_uid (view));
   ephy_web_extension_manager_emit_in_extension_views (manager, web_extension, "tabs.onRemoved", tab_json);
 }
@@ -1533,14 +1790,23 @@ application_window_added_timeout_cb (gpointer user_data)
   if (!window)
     return G_SOURCE_REMOVE;
 
-  window_json = ephy_web_extension_api_windows_create_window_json (data->web_extension, window);
-  ephy_web_extension_manager_emit_in_extension_views (manager, data->web_extension, "windows.onCreated", window_json);
+  if (ephy_web_extension_manager_has_listener (manager, data->web_extension, "windows.onCreated")) {
+    window_json = ephy_web_extension_api_windows_create_window_json (data->web_extension, window);
+    ephy_web_extension_manager_emit_in_extension_views (manager, data->web_extension, "windows.onCreated", window_json);
+  }
 
   tab_view = ephy_window_get_tab_view (window);
   adw_tab_view = ephy_tab_view_get_tab_view (tab_view);
   g_signal_connect (G_OBJECT (adw_tab_view), "page-attached", G_CALLBACK (on_page_attached), data->web_extension);
   g_signal_connect (G_OBJECT (adw_tab_view), "page-detached", G_CALLBACK (on_page_detached), data->web_extension);
 
+  /* The tabs opened with the window are already there. */
+  for (int i = 0; i < adw_tab_view_get_n_pages (adw_tab_view); i++) {
+    AdwTabPage *page = adw_tab_view_get_nth_page (adw_tab_view, i);
+
+    connect_tab_changed (ephy_embed_get_web_view (EPHY_EMBED (adw_tab_page_get_child (page))), data->web_extension);
+  }
+
   return G_SOURCE_REMOVE;
 }
 
@@ -1576,7 +1842,8 @@ application_window_removed_cb (EphyShell        *shell,
   EphyTabView *tab_view;
   AdwTabView *adw_tab_view;
 
-  ephy_web_extension_manager_emit_in_extension_views (manager, web_extension, "windows.onRemoved", window_json);
+  if (ephy_web_extension_manager_has_listener (manager, web_extension, "windows.onRemoved"))
+    ephy_web_extension_manager_emit_in_extension_views (manager, web_extension, "windows.onRemoved", window_json);
 
   tab_view = ephy_window_get_tab_view (window);
   adw_tab_view = ephy_tab_view_get_tab_view (tab_view);
@@ -1655,8 +1922,21 @@ ephy_web_extension_manager_set_active (EphyWebExtensionManager *self,
 
     ephy_web_extension_api_commands_init (web_extension);
   } else {
+    GPtrArray *tabs = ephy_tab_index_get_entries (ephy_shell_get_tab_index (shell));
+
     g_signal_handlers_disconnect_by_data (shell, web_extension);
 
+    for (guint i = 0; i < tabs->len; i++) {
+      EphyTabIndexEntry *entry = g_ptr_array_index (tabs, i);
+
+      g_signal_handlers_disconnect_by_func (ephy_embed_get_web_view (entry->embed), tab_changed_cb, web_extension);
+    }
+
+    for (guint i = self->pending_tab_updates->len; i > 0; i--) {
+      if (g_array_index (self->pending_tab_updates, PendingTabUpdate, i - 1).web_extension == web_extension)
+        g_array_remove_index (self->pending_tab_updates, i - 1);
+    }
+
     remove_browser_action (self, web_extension);
     g_hash_table_remove (self->background_web_views, web_extension);
     g_object_set_data (G_OBJECT (web_extension), "alarms", NULL); /* Set in alarms.c */
@@ -1906,7 +2186,7 @@ ephy_web_extension_manager_emit_in_background_view (EphyWebExtensionManager *sel
   g_autofree char *script = NULL;
   WebKitWebView *web_view = ephy_web_extension_manager_get_background_web_view (self, web_extension);
 
-  if (!web_view)
+  if (!web_view || !extension_view_has_listener (web_view, name))
     return;
 
   script = g_strdup_printf ("window.browser.%s._emit(%s);", name, json);
@@ -1930,17 +2210,36 @@ ephy_web_extension_manager_emit_in_extension_views_internal (EphyWebExtensionMan
 {
   WebKitWebView *background_view = ephy_web_extension_manager_get_background_web_view (self, web_extension);
   GPtrArray *popup_views = g_hash_table_lookup (self->popup_web_views, web_extension);
+  g_autoptr (GPtrArray) target_views = g_ptr_array_new ();
   g_autofree char *script = NULL;
   PendingMessageReplyTracker *tracker = NULL;
-  guint pending_views = 0;
   GHashTable *pending_messages;
   g_autofree char *message_guid = NULL;
 
+  /* The sender does not get its own message. */
+  if (background_view && (!sender || sender->view != background_view) &&
+      extension_view_has_listener (background_view, name))
+    g_ptr_array_add (target_views, background_view);
+
+  for (guint i = 0; popup_views && i < popup_views->len; i++) {
+    WebKitWebView *popup_view = g_ptr_array_index (popup_views, i);
+
+    if ((!sender || sender->view != popup_view) &&
+        extension_view_has_listener (popup_view, name))
+      g_ptr_array_add (target_views, popup_view);
+  }
+
+  if (target_views->len == 0) {
+    if (reply_task)
+      g_task_return_pointer (reply_task, NULL, NULL);
+    return;
+  }
+
   /* The `runtime.sendMessage()` API emits `runtime.onMessage` and waits for a reply.
    * The way this is implemented is:
    *  - All API handlers can be async: Returning a Promise backed by GTask (@reply_task).
    *  - Instead of completing the GTask we store it for each message waiting on replies.
-   *  - We then call every extension view and track if any of them handled it (see webextensions-common.js).
+   *  - We then call every extension view listening to it and track if any of them handled it (see webextensions-common.js).
    *  - If none handled it we complete with an empty message.
    *  - Otherwise we wait for our private `runtime._sendMessageReply` API call.
    *  - The first `runtime._sendMessageReply` call wins and completes the GTask with its data.
@@ -1953,43 +2252,19 @@ ephy_web_extension_manager_emit_in_extension_views_internal (EphyWebExtensionMan
   } else
     script = g_strdup_printf ("window.browser.%s._emit(%s);", name, message_json);
 
-  if (background_view) {
-    if (!sender || (sender->view != background_view)) {
-      webkit_web_view_evaluate_javascript (background_view,
-                                           script, -1,
-                                           NULL, NULL, NULL,
-                                           reply_task ? on_extension_emit_ready : NULL,
-                                           tracker);
-      pending_views++;
-    }
-  }
-
-  if (popup_views) {
-    for (guint i = 0; i < popup_views->len; i++) {
-      WebKitWebView *popup_view = g_ptr_array_index (popup_views, i);
-      if (!sender || (sender->view == popup_view))
-        continue;
-
-      webkit_web_view_evaluate_javascript (popup_view,
-                                           script, -1,
-                                           NULL, NULL, NULL,
-                                           reply_task ? on_extension_emit_ready : NULL,
-                                           tracker);
-      pending_views++;
-    }
+  for (guint i = 0; i < target_views->len; i++) {
+    webkit_web_view_evaluate_javascript (g_ptr_array_index (target_views, i),
+                                         script, -1,
+                                         NULL, NULL, NULL,
+                                         reply_task ? on_extension_emit_ready : NULL,
+                                         tracker);
   }
 
   if (!reply_task)
     return;
 
-  if (!pending_views) {
-    g_task_return_pointer (reply_task, NULL, NULL);
-    g_free (tracker);
-    return;
-  }
-
   tracker->web_extension = web_extension;
-  tracker->pending_view_responses = pending_views;
+  tracker->pending_view_responses = target_views->len;
   tracker->message_guid = message_guid;
 
   pending_messages = g_hash_table_lookup (self->pending_messages, web_extension);
@@ -83,6 +83,10 @@ void                     ephy_web_extension_manager_handle_notifications_action
 void                     ephy_web_extension_manager_handle_context_menu_action      (EphyWebExtensionManager *self,
                                                                                      GVariant                *params);
 
+gboolean                 ephy_web_extension_manager_has_listener                    (EphyWebExtensionManager *self,
+                                                                                     EphyWebExtension        *web_extension,
+                                                                                     const char              *name);
+
 void                     ephy_web_extension_manager_emit_in_extension_views         (EphyWebExtensionManager *self,
                                                                                      EphyWebExtension        *web_extension,
                                                                                      const char              *name,
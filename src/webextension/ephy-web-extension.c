@@ -105,6 +105,14 @@ struct _EphyWebExtension {
   GCancellable *cancellable;
   char *local_storage_path;
   JsonNode *local_storage;
+  guint local_storage_save_source_id;
+  gboolean local_storage_writing;
+  gboolean local_storage_write_pending;
+  /* Bumped for every write, and the last one that reached the disk, under
+   * local_storage_write_lock.
+   */
+  guint64 local_storage_generation;
+  guint64 local_storage_written;
   GHashTable *web_accessible_resources;
   GHashTable *commands;
 };
@@ -113,6 +121,9 @@ G_DEFINE_QUARK (web - extension - error - quark, web_extension_error)
 
 G_DEFINE_FINAL_TYPE (EphyWebExtension, ephy_web_extension, G_TYPE_OBJECT)
 
+/* Orders the local storage writes made from threads and from dispose. */
+static GMutex local_storage_write_lock;
+
 static gboolean is_supported_scheme (const char *scheme);
 
 gboolean
@@ -947,11 +958,26 @@ web_extension_parse_commands (EphyWebExtension *self,
   }
 }
 
+static void write_local_storage_sync (EphyWebExtension *self);
+
 static void
 ephy_web_extension_dispose (GObject *object)
 {
   EphyWebExtension *self = EPHY_WEB_EXTENSION (object);
 
+  /* Do not lose changes that are still waiting for the debounce timeout, or
+   * for a write in progress to finish. That write is dropped if it did not
+   * reach the disk yet.
+   */
+  if (self->local_storage_save_source_id || self->local_storage_write_pending) {
+    if (self->local_storage_save_source_id) {
+      g_clear_handle_id (&self->local_storage_save_source_id, g_source_remove);
+      g_application_release (g_application_get_default ());
+    }
+    self->local_storage_write_pending = FALSE;
+    write_local_storage_sync (self);
+  }
+
   g_clear_pointer (&self->base_location, g_free);
   g_clear_pointer (&self->manifest, g_free);
   g_clear_pointer (&self->guid, g_free);
@@ -1755,19 +1781,134 @@ ephy_web_extension_get_local_storage (EphyWebExtension *self)
   return self->local_storage;
 }
 
-void
-ephy_web_extension_save_local_storage (EphyWebExtension *self)
+typedef struct {
+  char *path;
+  char *json;
+  guint64 generation;
+} LocalStorageWriteData;
+
+static void
+local_storage_write_data_free (LocalStorageWriteData *data)
+{
+  g_free (data->path);
+  g_free (data->json);
+  g_free (data);
+}
+
+/* Can be called from any thread. A write older than the last one that
+ * reached the disk is dropped.
+ */
+static void
+write_local_storage (EphyWebExtension *self,
+                     const char       *path,
+                     const char       *json,
+                     guint64           generation)
 {
   g_autoptr (GError) error = NULL;
-  g_autofree char *json = NULL;
   g_autofree char *parent_dir = NULL;
 
-  parent_dir = g_path_get_dirname (self->local_storage_path);
-  g_mkdir_with_parents (parent_dir, 0755);
+  g_mutex_lock (&local_storage_write_lock);
+
+  if (generation > self->local_storage_written) {
+    parent_dir = g_path_get_dirname (path);
+    g_mkdir_with_parents (parent_dir, 0755);
+
+    if (!g_file_set_contents (path, json, -1, &error))
+      g_warning ("Failed to write %s: %s", path, error->message);
+    self->local_storage_written = generation;
+  }
+
+  g_mutex_unlock (&local_storage_write_lock);
+}
+
+static void
+write_local_storage_sync (EphyWebExtension *self)
+{
+  g_autofree char *json = NULL;
+
+  json = json_to_string (self->local_storage, FALSE);
+  write_local_storage (self, self->local_storage_path, json, ++self->local_storage_generation);
+}
+
+static void
+write_local_storage_thread (GTask                 *task,
+                            EphyWebExtension      *self,
+                            LocalStorageWriteData *data,
+                            GCancellable          *cancellable)
+{
+  write_local_storage (self, data->path, data->json, data->generation);
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+local_storage_written_cb (EphyWebExtension *self,
+                          GAsyncResult     *result,
+                          gpointer          user_data)
+{
+  self->local_storage_writing = FALSE;
+
+  /* Changes made while writing are saved by a new round, unless dispose
+   * already wrote them.
+   */
+  if (self->local_storage_write_pending) {
+    self->local_storage_write_pending = FALSE;
+    ephy_web_extension_save_local_storage (self);
+  }
+
+  g_application_release (g_application_get_default ());
+}
+
+static void
+save_local_storage_timeout_cb (gpointer user_data)
+{
+  EphyWebExtension *self = EPHY_WEB_EXTENSION (user_data);
+  LocalStorageWriteData *data;
+  GTask *task;
+
+  self->local_storage_save_source_id = 0;
+
+  if (self->local_storage_writing) {
+    self->local_storage_write_pending = TRUE;
+    g_application_release (g_application_get_default ());
+    return;
+  }
+
+  /* Serializing has to happen here, as the tree keeps changing on the main
+   * thread, but the write itself does not block the UI.
+   */
+  data = g_new (LocalStorageWriteData, 1);
+  data->path = g_strdup (self->local_storage_path);
+  data->json = json_to_string (self->local_storage, FALSE);
+  data->generation = ++self->local_storage_generation;
+
+  self->local_storage_writing = TRUE;
+  task = g_task_new (self, NULL, (GAsyncReadyCallback)local_storage_written_cb, NULL);
+  g_task_set_task_data (task, data, (GDestroyNotify)local_storage_write_data_free);
+  g_task_run_in_thread (task, (GTaskThreadFunc)write_local_storage_thread);
+  g_object_unref (task);
+
+  /* The application is now held by the write until it finishes. */
+}
+
+/**
+ * ephy_web_extension_save_local_storage:
+ * @self: an #EphyWebExtension
+ *
+ * Schedules the local storage of @self to be written to disk. Extensions
+ * tend to call storage.local.set() many times in a row, so writes are
+ * delayed by a second and coalesced.
+ */
+void
+ephy_web_extension_save_local_storage (EphyWebExtension *self)
+{
+  if (self->local_storage_save_source_id)
+    return;
+
+  /* Keep the application alive until the write has finished. */
+  g_application_hold (g_application_get_default ());
 
-  json = json_to_string (self->local_storage, TRUE);
-  if (!g_file_set_contents (self->local_storage_path, json, -1, &error))
-    g_warning ("Failed to write %s: %s", self->local_storage_path, error->message);
+  self->local_storage_save_source_id = g_timeout_add_once (1000, save_local_storage_timeout_cb, self);
+  g_source_set_name_by_id (self->local_storage_save_source_id, "[epiphany] save_local_storage_timeout_cb");
 }
 
 void
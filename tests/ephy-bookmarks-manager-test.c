@@ -0,0 +1,180 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-bookmark.h"
+#include "ephy-bookmarks-export.h"
+#include "ephy-bookmarks-manager.h"
+#include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+static void
+save_done_cb (EphyBookmarksManager *manager,
+              GAsyncResult         *result,
+              GMainLoop            *loop)
+{
+  g_autoptr (GError) error = NULL;
+
+  g_assert_true (ephy_bookmarks_manager_save_finish (manager, result, &error));
+  g_assert_no_error (error);
+  g_main_loop_quit (loop);
+}
+
+/* Saves are done one at a time, so this also waits for the saves that were
+ * requested before. */
+static void
+save_and_wait (EphyBookmarksManager *manager)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+
+  ephy_bookmarks_manager_save (manager, FALSE, FALSE, NULL,
+                               (GAsyncReadyCallback)save_done_cb, loop);
+  g_main_loop_run (loop);
+}
+
+static void
+add_bookmark (EphyBookmarksManager *manager,
+              const char           *url,
+              const char           *id)
+{
+  g_autoptr (EphyBookmark) bookmark = ephy_bookmark_new (url, url, g_sequence_new (g_free), id);
+
+  ephy_bookmarks_manager_add_bookmark (manager, bookmark);
+}
+
+static void
+test_ephy_bookmarks_manager_journal_replay (void)
+{
+  g_autofree char *filename = g_build_filename (ephy_profile_dir (), "bookmarks.gvdb", NULL);
+  g_autofree char *journal_filename = g_strconcat (filename, EPHY_BOOKMARKS_JOURNAL_SUFFIX, NULL);
+  g_autofree char *contents = NULL;
+  EphyBookmarksManager *manager;
+  EphyBookmark *bookmark;
+  gint64 generation;
+  gsize length;
+
+  g_unlink (filename);
+  g_unlink (journal_filename);
+
+  manager = ephy_bookmarks_manager_new ();
+  generation = ephy_bookmarks_manager_get_journal_generation (manager);
+  g_assert_cmpint (generation, !=, 0);
+
+  add_bookmark (manager, "https://a.example.com/", "aaaaaaaaaaaa");
+  add_bookmark (manager, "https://b.example.com/", "bbbbbbbbbbbb");
+  save_and_wait (manager);
+
+  /* The changes were appended to the journal, not written to a new file. */
+  g_assert_cmpint (ephy_bookmarks_manager_get_journal_generation (manager), ==, generation);
+  g_assert_true (g_file_test (journal_filename, G_FILE_TEST_EXISTS));
+  g_object_unref (manager);
+
+  /* The journal is replayed on load, and later saves keep appending to it. */
+  manager = ephy_bookmarks_manager_new ();
+  g_assert_cmpint (ephy_bookmarks_manager_get_journal_generation (manager), ==, generation);
+  g_assert_nonnull (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://a.example.com/"));
+  g_assert_nonnull (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://b.example.com/"));
+
+  ephy_bookmarks_manager_create_tag (manager, "journal-tag");
+  bookmark = ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://a.example.com/");
+  ephy_bookmarks_manager_remove_bookmark (manager, bookmark);
+  save_and_wait (manager);
+  g_assert_cmpint (ephy_bookmarks_manager_get_journal_generation (manager), ==, generation);
+  g_object_unref (manager);
+
+  manager = ephy_bookmarks_manager_new ();
+  g_assert_cmpint (ephy_bookmarks_manager_get_journal_generation (manager), ==, generation);
+  g_assert_null (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://a.example.com/"));
+  g_assert_nonnull (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://b.example.com/"));
+  g_assert_true (ephy_bookmarks_manager_tag_exists (manager, "journal-tag"));
+  g_object_unref (manager);
+
+  /* A partial record at the end, the removal of the first bookmark, is
+   * skipped and the journal is folded into a new GVDB file. */
+  g_assert_true (g_file_get_contents (journal_filename, &contents, &length, NULL));
+  g_assert_true (g_file_set_contents (journal_filename, contents, length - 1, NULL));
+
+  manager = ephy_bookmarks_manager_new ();
+  save_and_wait (manager);
+  g_assert_cmpint (ephy_bookmarks_manager_get_journal_generation (manager), !=, generation);
+  g_assert_nonnull (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://a.example.com/"));
+  g_assert_nonnull (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://b.example.com/"));
+  g_assert_true (ephy_bookmarks_manager_tag_exists (manager, "journal-tag"));
+  g_object_unref (manager);
+}
+
+static void
+test_ephy_bookmarks_manager_shared_url (void)
+{
+  g_autofree char *filename = g_build_filename (ephy_profile_dir (), "bookmarks.gvdb", NULL);
+  g_autofree char *journal_filename = g_strconcat (filename, EPHY_BOOKMARKS_JOURNAL_SUFFIX, NULL);
+  EphyBookmarksManager *manager;
+  EphyBookmark *first;
+  EphyBookmark *second;
+
+  g_unlink (filename);
+  g_unlink (journal_filename);
+
+  manager = ephy_bookmarks_manager_new ();
+  add_bookmark (manager, "https://shared.example.com/", "cccccccccccc");
+  add_bookmark (manager, "https://shared.example.com/", "dddddddddddd");
+  first = ephy_bookmarks_manager_get_bookmark_by_id (manager, "cccccccccccc");
+  second = ephy_bookmarks_manager_get_bookmark_by_id (manager, "dddddddddddd");
+
+  /* Editing a bookmark does not change which one is found for its URL. */
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://shared.example.com/") == first);
+  ephy_bookmark_set_title (first, "Shared");
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://shared.example.com/") == first);
+
+  ephy_bookmark_set_url (first, "https://moved.example.com/");
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://shared.example.com/") == second);
+  g_assert_true (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://moved.example.com/") == first);
+
+  ephy_bookmarks_manager_remove_bookmark (manager, second);
+  g_assert_null (ephy_bookmarks_manager_get_bookmark_by_url (manager, "https://shared.example.com/"));
+  g_object_unref (manager);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  int ret;
+
+  gtk_test_init (&argc, &argv);
+  ephy_debug_init ();
+
+  if (!ephy_file_helpers_init (NULL, EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS, NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-manager/journal-replay",
+                   test_ephy_bookmarks_manager_journal_replay);
+  g_test_add_func ("/src/bookmarks/ephy-bookmarks-manager/shared-url",
+                   test_ephy_bookmarks_manager_shared_url);
+
+  ret = g_test_run ();
+
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
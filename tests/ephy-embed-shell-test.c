@@ -55,6 +55,125 @@ test_ephy_embed_shell_web_view_created (void)
   g_object_unref (view);
 }
 
+/* Each item is a URL, optionally followed by a '|' and its title. */
+static GList *
+history_urls_new (const char * const *items)
+{
+  GList *urls = NULL;
+
+  for (guint i = 0; items[i]; i++) {
+    g_auto (GStrv) parts = g_strsplit (items[i], "|", 2);
+
+    urls = g_list_append (urls, ephy_history_url_new (parts[0], parts[1] ? parts[1] : parts[0], 0, 0, 0));
+  }
+
+  return urls;
+}
+
+/* Applies @changes to @old_urls the way the overview of the web process
+ * does, and returns the resulting URLs. */
+static char **
+apply_overview_changes (GList    *old_urls,
+                        GVariant *changes)
+{
+  g_autoptr (GVariantIter) removed = NULL;
+  g_autoptr (GVariantIter) placed = NULL;
+  g_autoptr (GStrvBuilder) builder = g_strv_builder_new ();
+  GList *urls = NULL;
+  const char *url;
+  const char *title;
+  guint position;
+
+  for (GList *l = old_urls; l; l = l->next)
+    urls = g_list_append (urls, ((EphyHistoryURL *)l->data)->url);
+
+  g_variant_get (changes, "(asa(uss))", &removed, &placed);
+
+  while (g_variant_iter_next (removed, "&s", &url))
+    urls = g_list_remove (urls, g_list_find_custom (urls, url, (GCompareFunc)g_strcmp0)->data);
+
+  while (g_variant_iter_next (placed, "(u&s&s)", &position, &url, &title)) {
+    GList *old = g_list_find_custom (urls, url, (GCompareFunc)g_strcmp0);
+
+    if (old)
+      urls = g_list_delete_link (urls, old);
+    urls = g_list_insert (urls, (gpointer)url, position);
+  }
+
+  for (GList *l = urls; l; l = l->next)
+    g_strv_builder_add (builder, l->data);
+  g_list_free (urls);
+
+  return g_strv_builder_end (builder);
+}
+
+typedef struct {
+  const char *old_urls[8];
+  const char *new_urls[8];
+  guint n_removed;
+  guint n_placed;
+  guint n_added;
+} OverviewDiffTest;
+
+static const OverviewDiffTest overview_diff_tests[] = {
+  /* Unchanged. */
+  { { "a", "b", "c", NULL }, { "a", "b", "c", NULL }, 0, 0, 0 },
+  /* Removal. */
+  { { "a", "b", "c", NULL }, { "a", "c", NULL }, 1, 0, 0 },
+  { { "a", "b", "c", NULL }, { NULL }, 3, 0, 0 },
+  /* Reordering, only the URL out of order is placed again. */
+  { { "a", "b", "c", "d", NULL }, { "a", "c", "b", "d", NULL }, 0, 1, 0 },
+  { { "a", "b", "c", "d", NULL }, { "d", "a", "b", "c", NULL }, 0, 1, 0 },
+  /* Insertion. */
+  { { "a", "b", NULL }, { "a", "x", "b", NULL }, 0, 1, 1 },
+  { { NULL }, { "x", "y", NULL }, 0, 2, 2 },
+  /* Retitling. */
+  { { "a", "b", NULL }, { "a", "b|B", NULL }, 0, 1, 0 },
+  /* All of them. */
+  { { "a", "b", "c", "d", NULL }, { "d", "x", "a|A", "c", NULL }, 1, 3, 1 },
+};
+
+static void
+test_ephy_embed_shell_overview_urls_diff (void)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (overview_diff_tests); i++) {
+    const OverviewDiffTest *test = &overview_diff_tests[i];
+    GList *old_urls = history_urls_new (test->old_urls);
+    GList *new_urls = history_urls_new (test->new_urls);
+    g_autoptr (GPtrArray) added_urls = g_ptr_array_new ();
+    g_autoptr (GVariant) changes = NULL;
+    g_autoptr (GVariant) removed = NULL;
+    g_autoptr (GVariant) placed = NULL;
+    g_auto (GStrv) result = NULL;
+
+    changes = _ephy_embed_shell_overview_urls_diff (old_urls, new_urls, added_urls);
+
+    if (test->n_removed == 0 && test->n_placed == 0) {
+      g_assert_null (changes);
+    } else {
+      g_assert_nonnull (changes);
+      g_variant_ref_sink (changes);
+
+      removed = g_variant_get_child_value (changes, 0);
+      placed = g_variant_get_child_value (changes, 1);
+      g_assert_cmpuint (g_variant_n_children (removed), ==, test->n_removed);
+      g_assert_cmpuint (g_variant_n_children (placed), ==, test->n_placed);
+
+      result = apply_overview_changes (old_urls, changes);
+      g_assert_cmpuint (g_strv_length (result), ==, g_list_length (new_urls));
+      for (GList *l = new_urls; l; l = l->next)
+        g_assert_cmpstr (result[g_list_position (new_urls, l)], ==, ((EphyHistoryURL *)l->data)->url);
+    }
+
+    g_assert_cmpuint (added_urls->len, ==, test->n_added);
+    for (guint j = 0; j < added_urls->len; j++)
+      g_assert_nonnull (g_list_find (new_urls, g_ptr_array_index (added_urls, j)));
+
+    ephy_history_url_list_free (old_urls);
+    ephy_history_url_list_free (new_urls);
+  }
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -75,6 +194,8 @@ main (int   argc,
 
   g_test_add_func ("/embed/ephy-embed-shell/web-view-created",
                    test_ephy_embed_shell_web_view_created);
+  g_test_add_func ("/embed/ephy-embed-shell/overview-urls-diff",
+                   test_ephy_embed_shell_overview_urls_diff);
 
   ret = g_test_run ();
 
@@ -448,6 +448,49 @@ test_complex_url_query (void)
   g_main_loop_run (loop);
 }
 
+static void
+perform_frecency_url_query (EphyHistoryService *service,
+                            gboolean            success,
+                            gpointer            result_data,
+                            gpointer            user_data)
+{
+  EphyHistoryQuery *query;
+  EphyHistoryURL *url;
+
+  g_assert_true (success);
+
+  /* A single recent visit weighs more than a few old ones. */
+  query = ephy_history_query_new ();
+  query->limit = 1;
+  query->sort_type = EPHY_HISTORY_SORT_FRECENCY;
+
+  /* The expected result. */
+  url = ephy_history_url_new ("http://www.webkitgtk.org",
+                              "WebKitGTK",
+                              1, 1, 0);
+
+  ephy_history_service_query_urls (service, query, NULL, verify_complex_url_query, url);
+  ephy_history_query_free (query);
+}
+
+static void
+test_frecency_url_query (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  GList *visits = NULL;
+
+  for (int i = 0; i < 5; i++)
+    visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.gnome.org", 10 * i, EPHY_PAGE_VISIT_TYPED));
+  visits = g_list_append (visits, ephy_history_page_visit_new ("http://www.webkitgtk.org", g_get_real_time (), EPHY_PAGE_VISIT_TYPED));
+
+  ephy_history_service_add_visits (service, visits, NULL, perform_frecency_url_query, NULL);
+  ephy_history_page_visit_list_free (visits);
+
+  g_object_set_data (G_OBJECT (service), "main-loop", loop);
+  g_main_loop_run (loop);
+}
+
 static void
 perform_complex_url_query_with_time_range (EphyHistoryService *service,
                                            gboolean            success,
@@ -490,6 +533,46 @@ test_complex_url_query_with_time_range (void)
   g_main_loop_run (loop);
 }
 
+static void
+perform_substring_url_query (EphyHistoryService *service,
+                             gboolean            success,
+                             gpointer            result_data,
+                             gpointer            user_data)
+{
+  EphyHistoryQuery *query;
+  EphyHistoryURL *url;
+
+  g_assert_true (success);
+
+  /* Long enough to be looked up in the full-text index. */
+  query = ephy_history_query_new ();
+  query->substring_list = g_list_prepend (query->substring_list, g_strdup ("desktop"));
+  query->sort_type = EPHY_HISTORY_SORT_MOST_VISITED;
+
+  /* The expected result. */
+  url = ephy_history_url_new ("http://www.freedesktop.org",
+                              "freedesktop.org",
+                              20, 20, 0);
+
+  ephy_history_service_query_urls (service, query, NULL, verify_complex_url_query, url);
+  ephy_history_query_free (query);
+}
+
+static void
+test_substring_url_query (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  GList *visits;
+
+  visits = create_visits_for_complex_tests ();
+  ephy_history_service_add_visits (service, visits, NULL, perform_substring_url_query, NULL);
+  ephy_history_page_visit_list_free (visits);
+
+  g_object_set_data (G_OBJECT (service), "main-loop", loop);
+  g_main_loop_run (loop);
+}
+
 static void
 verify_query_after_clear (EphyHistoryService *service,
                           gboolean            success,
@@ -541,6 +624,156 @@ test_clear (void)
   g_main_loop_run (loop);
 }
 
+static GList *
+create_visits_for_top_sites_test (void)
+{
+  const char *urls[] = {
+    "http://www.gnome.org",
+    "http://www.gnome.org",
+    "http://www.gnome.org",
+    "http://www.webkitgtk.org",
+    "http://www.igalia.com",
+    "http://www.igalia.com",
+    "file:///tmp/local.html",
+    "file:///tmp/local.html",
+    "file:///tmp/local.html",
+    "file:///tmp/local.html",
+  };
+  GList *visits = NULL;
+
+  for (guint i = 0; i < G_N_ELEMENTS (urls); i++)
+    visits = g_list_append (visits, ephy_history_page_visit_new (urls[i], i + 1, EPHY_PAGE_VISIT_TYPED));
+
+  return visits;
+}
+
+static void
+assert_top_sites (EphyHistoryService *service,
+                  const char         *first,
+                  const char         *second)
+{
+  GList *urls;
+
+  g_assert_true (ephy_history_service_get_top_sites (service, 10, &urls));
+  g_assert_cmpint (g_list_length (urls), ==, 2);
+  g_assert_cmpstr (((EphyHistoryURL *)urls->data)->url, ==, first);
+  g_assert_cmpstr (((EphyHistoryURL *)urls->next->data)->url, ==, second);
+  ephy_history_url_list_free (urls);
+}
+
+static void
+top_sites_url_deleted (EphyHistoryService *service,
+                       gboolean            success,
+                       gpointer            result_data,
+                       gpointer            user_data)
+{
+  g_assert_true (success);
+
+  /* The next most visited URL takes the place of the deleted one. */
+  assert_top_sites (service, "http://www.webkitgtk.org", "http://www.igalia.com");
+  g_assert_false (ephy_history_service_is_top_site (service, "http://www.gnome.org"));
+
+  g_object_unref (service);
+  g_main_loop_quit (user_data);
+}
+
+static void
+top_sites_visits_moved (EphyHistoryService *service,
+                        gboolean            success,
+                        gpointer            result_data,
+                        gpointer            user_data)
+{
+  EphyHistoryURL *url;
+  GList *urls;
+
+  g_assert_true (success);
+
+  assert_top_sites (service, "http://www.webkitgtk.org", "http://www.gnome.org");
+  g_assert_false (ephy_history_service_is_top_site (service, "http://www.igalia.com"));
+
+  url = ephy_history_url_new ("http://www.gnome.org", NULL, 0, 0, 0);
+  urls = g_list_prepend (NULL, url);
+  ephy_history_service_delete_urls (service, urls, NULL, top_sites_url_deleted, user_data);
+  ephy_history_url_list_free (urls);
+}
+
+static void
+top_sites_visits_added (EphyHistoryService *service,
+                        gboolean            success,
+                        gpointer            result_data,
+                        gpointer            user_data)
+{
+  EphyHistoryPageVisit *visit;
+
+  g_assert_true (success);
+
+  /* Local files are not top sites, whatever their visit count. */
+  assert_top_sites (service, "http://www.gnome.org", "http://www.igalia.com");
+  g_assert_true (ephy_history_service_is_top_site (service, "http://www.igalia.com"));
+  g_assert_false (ephy_history_service_is_top_site (service, "http://www.webkitgtk.org"));
+  g_assert_false (ephy_history_service_is_top_site (service, "file:///tmp/local.html"));
+
+  /* Two more visits bring a URL in, the third one moves it to the top. */
+  visit = ephy_history_page_visit_new ("http://www.webkitgtk.org", 20, EPHY_PAGE_VISIT_TYPED);
+  ephy_history_service_add_visit (service, visit, NULL, NULL, NULL);
+  ephy_history_service_add_visit (service, visit, NULL, NULL, NULL);
+  ephy_history_service_add_visit (service, visit, NULL, top_sites_visits_moved, user_data);
+  ephy_history_page_visit_free (visit);
+}
+
+static void
+test_top_sites (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  GList *visits = create_visits_for_top_sites_test ();
+
+  ephy_history_service_set_top_sites_size (service, 2);
+  ephy_history_service_add_visits (service, visits, NULL, top_sites_visits_added, loop);
+  ephy_history_page_visit_list_free (visits);
+
+  g_main_loop_run (loop);
+}
+
+static void
+top_sites_tie_visits_added (EphyHistoryService *service,
+                            gboolean            success,
+                            gpointer            result_data,
+                            gpointer            user_data)
+{
+  g_assert_true (success);
+
+  /* Like the query the top sites are loaded with, equally visited URLs are
+   * ordered oldest first, and the scheme is matched whatever its case. */
+  assert_top_sites (service, "http://www.gnome.org", "HTTPS://www.igalia.com");
+
+  g_object_unref (service);
+  g_main_loop_quit (user_data);
+}
+
+static void
+test_top_sites_ties (void)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  EphyHistoryService *service = ensure_empty_history (test_db_filename ());
+  const char *urls[] = {
+    "http://www.gnome.org",
+    "HTTPS://www.igalia.com",
+    "HTTPS://www.igalia.com",
+    "http://www.gnome.org",
+  };
+  GList *visits = NULL;
+
+  for (guint i = 0; i < G_N_ELEMENTS (urls); i++)
+    visits = g_list_append (visits, ephy_history_page_visit_new (urls[i], i + 1, EPHY_PAGE_VISIT_TYPED));
+
+  ephy_history_service_set_top_sites_size (service, 2);
+  ephy_history_service_add_visits (service, visits, NULL, top_sites_tie_visits_added, loop);
+  ephy_history_page_visit_list_free (visits);
+
+  g_main_loop_run (loop);
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -570,7 +803,11 @@ main (int   argc,
   g_test_add_func ("/embed/history/test_get_url_not_existent", test_get_url_not_existent);
   g_test_add_func ("/embed/history/test_complex_url_query", test_complex_url_query);
   g_test_add_func ("/embed/history/test_complex_url_query_with_time_range", test_complex_url_query_with_time_range);
+  g_test_add_func ("/embed/history/test_frecency_url_query", test_frecency_url_query);
+  g_test_add_func ("/embed/history/test_substring_url_query", test_substring_url_query);
   g_test_add_func ("/embed/history/test_clear", test_clear);
+  g_test_add_func ("/embed/history/test_top_sites", test_top_sites);
+  g_test_add_func ("/embed/history/test_top_sites_ties", test_top_sites_ties);
 
   ret = g_test_run ();
 
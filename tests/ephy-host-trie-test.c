@@ -0,0 +1,121 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-host-trie.h"
+
+#include <glib.h>
+
+static void
+assert_completion (EphyHostTrie *trie,
+                   const char   *prefix,
+                   const char   *expected)
+{
+  g_autofree char *completion = ephy_host_trie_complete (trie, prefix);
+
+  g_assert_cmpstr (completion, ==, expected);
+}
+
+static void
+test_ephy_host_trie_weights (void)
+{
+  g_autoptr (EphyHostTrie) trie = ephy_host_trie_new (NULL);
+
+  assert_completion (trie, "www", NULL);
+
+  ephy_host_trie_add_visits (trie, "https://www.example.com/", 5);
+  ephy_host_trie_add_visits (trie, "https://www.exalted.org/a", 2);
+  assert_completion (trie, "www.exa", "www.example.com");
+  assert_completion (trie, "www.exal", "www.exalted.org");
+
+  /* Visits add up, per host and not per URL. */
+  ephy_host_trie_add_visits (trie, "https://www.exalted.org/b", 2);
+  ephy_host_trie_add_visits (trie, "http://www.exalted.org/c", 2);
+  assert_completion (trie, "www.exa", "www.exalted.org");
+
+  /* A complete name has nothing left to complete. */
+  assert_completion (trie, "www.exalted.org", NULL);
+  assert_completion (trie, "www.exz", NULL);
+}
+
+static void
+test_ephy_host_trie_base_domains (void)
+{
+  g_autoptr (EphyHostTrie) trie = ephy_host_trie_new (NULL);
+
+  ephy_host_trie_add_visits (trie, "https://mail.example.com/", 1);
+  ephy_host_trie_add_visits (trie, "https://docs.example.com/", 1);
+  ephy_host_trie_add_visits (trie, "https://www.bbc.co.uk/", 1);
+
+  /* The base domain collects the visits of all of its hosts. */
+  assert_completion (trie, "e", "example.com");
+  assert_completion (trie, "m", "mail.example.com");
+  assert_completion (trie, "bb", "bbc.co.uk");
+  assert_completion (trie, "co", NULL);
+
+  /* Only web pages have hosts to complete. */
+  ephy_host_trie_add_visits (trie, "file:///home/user/index.html", 10);
+  ephy_host_trie_add_visits (trie, "about:blank", 10);
+  ephy_host_trie_add_visits (trie, "ephy-about:overview", 10);
+  assert_completion (trie, "h", NULL);
+  assert_completion (trie, "a", NULL);
+}
+
+static void
+test_ephy_host_trie_schemes (void)
+{
+  g_autoptr (EphyHostTrie) trie = ephy_host_trie_new (NULL);
+
+  ephy_host_trie_add_visits (trie, "https://www.example.com/", 1);
+
+  assert_completion (trie, "https://www.ex", "https://www.example.com");
+  assert_completion (trie, "http://ex", "http://example.com");
+  assert_completion (trie, "https://", NULL);
+  assert_completion (trie, "ftp://www", NULL);
+}
+
+static void
+test_ephy_host_trie_case (void)
+{
+  g_autoptr (EphyHostTrie) trie = ephy_host_trie_new (NULL);
+
+  /* Names are stored in lowercase and matched without regard to case, the
+   * typed prefix is kept as it is. */
+  ephy_host_trie_add_visits (trie, "https://WWW.Example.COM/Path", 1);
+
+  assert_completion (trie, "www.ex", "www.example.com");
+  assert_completion (trie, "WWW.EX", "WWW.EXample.com");
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  gboolean ret;
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/lib/ephy-host-trie/weights", test_ephy_host_trie_weights);
+  g_test_add_func ("/lib/ephy-host-trie/base-domains", test_ephy_host_trie_base_domains);
+  g_test_add_func ("/lib/ephy-host-trie/schemes", test_ephy_host_trie_schemes);
+  g_test_add_func ("/lib/ephy-host-trie/case", test_ephy_host_trie_case);
+
+  ret = g_test_run ();
+
+  return ret;
+}
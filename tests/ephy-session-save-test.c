@@ -0,0 +1,306 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-debug.h"
+#include "ephy-embed-container.h"
+#include "ephy-embed-prefs.h"
+#include "ephy-file-helpers.h"
+#include "ephy-settings.h"
+#include "ephy-shell.h"
+#include "ephy-session.h"
+#include "ephy-test-utils.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+const char *session_data_many_windows =
+  "<?xml version=\"1.0\"?>"
+  "<session>"
+  "<window x=\"100\" y=\"26\" width=\"1067\" height=\"740\" active-tab=\"0\" role=\"epiphany-window-7da420dd\">"
+  "<embed url=\"about:epiphany\" title=\"Pafari\"/>"
+  "</window>"
+  "<window x=\"73\" y=\"26\" width=\"1067\" height=\"740\" active-tab=\"0\" role=\"epiphany-window-1261c786\">"
+  "<embed url=\"about:config\" title=\"Pafari\"/>"
+  "</window>"
+  "</session>";
+
+static gboolean load_stream_retval;
+
+static void
+load_from_stream_cb (GObject      *object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  GMainLoop *loop = (GMainLoop *)user_data;
+
+  load_stream_retval = ephy_session_load_from_stream_finish (EPHY_SESSION (object), result, NULL);
+  g_main_loop_quit (loop);
+}
+
+static gboolean
+load_session_from_string (EphySession *session,
+                          const char  *data)
+{
+  GMainLoop *loop;
+  GInputStream *stream;
+
+  loop = g_main_loop_new (NULL, FALSE);
+  stream = g_memory_input_stream_new_from_data (data, -1, NULL);
+  ephy_session_load_from_stream (session, stream, 0, NULL, load_from_stream_cb, loop);
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+
+  return load_stream_retval;
+}
+
+static void
+enable_delayed_loading (void)
+{
+  g_settings_set_boolean (EPHY_SETTINGS_MAIN,
+                          EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS,
+                          TRUE);
+}
+
+static void
+disable_delayed_loading (void)
+{
+  g_settings_set_boolean (EPHY_SETTINGS_MAIN,
+                          EPHY_PREFS_RESTORE_SESSION_DELAYING_LOADS,
+                          FALSE);
+}
+
+static gboolean load_retval;
+
+static void
+load_cb (GObject      *object,
+         GAsyncResult *result,
+         gpointer      user_data)
+{
+  GMainLoop *loop = (GMainLoop *)user_data;
+
+  load_retval = ephy_session_load_finish (EPHY_SESSION (object), result, NULL);
+  g_main_loop_quit (loop);
+}
+
+static char *
+get_manifest_path (void)
+{
+  return g_build_filename (ephy_profile_dir (), "session_state.gvariant", NULL);
+}
+
+/* Returns the manifest and the window files it references, by path. */
+static GHashTable *
+save_session_and_read_files (EphySession *session)
+{
+  g_autofree char *manifest_path = get_manifest_path ();
+  g_autoptr (GVariant) manifest = NULL;
+  g_autoptr (GVariantIter) windows = NULL;
+  GHashTable *files;
+  GBytes *bytes;
+  char *contents;
+  gsize length;
+  guint32 version;
+  const char *name;
+
+  g_unlink (manifest_path);
+  ephy_session_save (session);
+  while (!g_file_test (manifest_path, G_FILE_TEST_EXISTS))
+    g_main_context_iteration (NULL, TRUE);
+
+  files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_bytes_unref);
+
+  g_assert_true (g_file_get_contents (manifest_path, &contents, &length, NULL));
+  bytes = g_bytes_new_take (contents, length);
+  g_hash_table_insert (files, g_strdup (manifest_path), bytes);
+
+  manifest = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("(uas)"), bytes, FALSE));
+  g_variant_get (manifest, "(uas)", &version, &windows);
+  g_assert_cmpuint (version, ==, 2);
+
+  while (g_variant_iter_next (windows, "&s", &name)) {
+    char *path = g_build_filename (ephy_profile_dir (), "session_windows", name, NULL);
+
+    g_assert_true (g_file_get_contents (path, &contents, &length, NULL));
+    g_hash_table_insert (files, path, g_bytes_new_take (contents, length));
+  }
+
+  return files;
+}
+
+static void
+write_files (GHashTable *files)
+{
+  GHashTableIter iter;
+  const char *path;
+  GBytes *bytes;
+
+  g_hash_table_iter_init (&iter, files);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&path, (gpointer *)&bytes)) {
+    g_autofree char *dir = g_path_get_dirname (path);
+
+    g_assert_cmpint (g_mkdir_with_parents (dir, 0700), ==, 0);
+    g_assert_true (g_file_set_contents (path,
+                                        g_bytes_get_data (bytes, NULL),
+                                        g_bytes_get_size (bytes),
+                                        NULL));
+  }
+}
+
+static void
+test_ephy_session_save_load_round_trip (void)
+{
+  EphySession *session;
+  g_autoptr (GHashTable) files = NULL;
+  g_autofree char *manifest_path = get_manifest_path ();
+  gboolean found_epiphany = FALSE;
+  gboolean found_config = FALSE;
+  GList *l, *p;
+  GMainLoop *loop;
+  GMainLoop *load_loop;
+
+  disable_delayed_loading ();
+
+  session = ephy_shell_get_session (ephy_shell_get_default ());
+  g_assert_nonnull (session);
+
+  loop = ephy_test_utils_setup_ensure_web_views_are_loaded ();
+  g_assert_true (load_session_from_string (session, session_data_many_windows));
+  ephy_test_utils_ensure_web_views_are_loaded (loop);
+
+  files = save_session_and_read_files (session);
+  /* The manifest and one file per window. */
+  g_assert_cmpuint (g_hash_table_size (files), ==, 3);
+
+  /* Closing every window deletes the saved session, put it back. */
+  ephy_session_clear (session);
+  while (g_file_test (manifest_path, G_FILE_TEST_EXISTS))
+    g_main_context_iteration (NULL, TRUE);
+  write_files (files);
+
+  loop = ephy_test_utils_setup_ensure_web_views_are_loaded ();
+  load_loop = g_main_loop_new (NULL, FALSE);
+  ephy_session_load (session, "type:session_state", NULL, load_cb, load_loop);
+  g_main_loop_run (load_loop);
+  g_main_loop_unref (load_loop);
+  g_assert_true (load_retval);
+  ephy_test_utils_ensure_web_views_are_loaded (loop);
+
+  l = gtk_application_get_windows (GTK_APPLICATION (ephy_shell_get_default ()));
+  g_assert_cmpint (g_list_length (l), ==, 2);
+
+  for (p = l; p; p = p->next) {
+    EphyEmbed *embed = ephy_embed_container_get_active_child (EPHY_EMBED_CONTAINER (p->data));
+    const char *address = ephy_web_view_get_address (ephy_embed_get_web_view (embed));
+
+    if (g_strcmp0 (address, "ephy-about:epiphany") == 0)
+      found_epiphany = TRUE;
+    else if (g_strcmp0 (address, "ephy-about:config") == 0)
+      found_config = TRUE;
+  }
+  g_assert_true (found_epiphany);
+  g_assert_true (found_config);
+
+  enable_delayed_loading ();
+  ephy_session_clear (session);
+}
+
+
+static void
+test_ephy_session_save_changed_window (void)
+{
+  EphyShell *shell = ephy_shell_get_default ();
+  EphySession *session;
+  g_autoptr (GHashTable) files = NULL;
+  g_autoptr (GHashTable) new_files = NULL;
+  GHashTableIter iter;
+  const char *path;
+  EphyEmbed *embed;
+  GMainLoop *loop;
+  GList *windows;
+  guint kept = 0;
+
+  disable_delayed_loading ();
+
+  session = ephy_shell_get_session (shell);
+  g_assert_nonnull (session);
+
+  loop = ephy_test_utils_setup_ensure_web_views_are_loaded ();
+  g_assert_true (load_session_from_string (session, session_data_many_windows));
+  ephy_test_utils_ensure_web_views_are_loaded (loop);
+
+  files = save_session_and_read_files (session);
+  g_assert_cmpuint (g_hash_table_size (files), ==, 3);
+
+  windows = gtk_application_get_windows (GTK_APPLICATION (shell));
+  embed = ephy_shell_new_tab (shell, EPHY_WINDOW (windows->data), NULL, EPHY_NEW_TAB_JUMP);
+  loop = ephy_test_utils_setup_wait_until_load_is_committed (ephy_embed_get_web_view (embed));
+  ephy_web_view_load_url (ephy_embed_get_web_view (embed), "ephy-about:overview");
+  ephy_test_utils_wait_until_load_is_committed (loop);
+
+  /* Only the changed window is written again, the manifest still lists the
+   * other one. */
+  new_files = save_session_and_read_files (session);
+  g_assert_cmpuint (g_hash_table_size (new_files), ==, 3);
+
+  g_hash_table_iter_init (&iter, new_files);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&path, NULL)) {
+    if (g_hash_table_contains (files, path))
+      kept++;
+  }
+  /* The manifest and the window that did not change. */
+  g_assert_cmpuint (kept, ==, 2);
+
+  enable_delayed_loading ();
+  ephy_session_clear (session);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  int ret;
+
+  gtk_test_init (&argc, &argv);
+  ephy_debug_init ();
+
+  if (!ephy_file_helpers_init (NULL,
+                               EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS,
+                               NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  _ephy_shell_create_instance (EPHY_EMBED_SHELL_MODE_TEST);
+  g_assert_nonnull (ephy_shell_get_default ());
+
+  g_application_register (G_APPLICATION (ephy_shell_get_default ()), NULL, NULL);
+
+  g_test_add_func ("/src/ephy-session/save-load-round-trip",
+                   test_ephy_session_save_load_round_trip);
+  g_test_add_func ("/src/ephy-session/save-changed-window",
+                   test_ephy_session_save_changed_window);
+
+  ret = g_test_run ();
+
+  g_object_unref (ephy_shell_get_default ());
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
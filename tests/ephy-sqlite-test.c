@@ -24,6 +24,7 @@
 #include "ephy-sqlite-statement.h"
 #include <glib.h>
 #include <gtk/gtk.h>
+#include <string.h>
 
 static void
 test_create_connection (void)
@@ -221,6 +222,67 @@ test_table_exists (void)
   g_free (temporary_file);
 }
 
+static void
+test_cached_statement (void)
+{
+  gchar *temporary_file;
+  EphySQLiteConnection *connection;
+  GError *error = NULL;
+  EphySQLiteStatement *statement = NULL;
+  EphySQLiteStatement *cached_statement = NULL;
+
+  temporary_file = g_build_filename (g_get_tmp_dir (), "epiphany-sqlite-test.db", NULL);
+  connection = ephy_sqlite_connection_new (EPHY_SQLITE_CONNECTION_MODE_READWRITE, temporary_file);
+  g_assert_true (ephy_sqlite_connection_open (connection, &error));
+  g_assert_no_error (error);
+
+  create_table_and_insert_row (connection);
+
+  statement = ephy_sqlite_connection_get_cached_statement (connection, "SELECT id FROM test WHERE id = ?", &error);
+  g_assert_nonnull (statement);
+  g_assert_no_error (error);
+  g_assert_true (ephy_sqlite_statement_bind_int (statement, 0, 3, &error));
+  g_assert_true (ephy_sqlite_statement_step (statement, &error));
+  g_assert_cmpint (ephy_sqlite_statement_get_column_as_int (statement, 0), ==, 3);
+
+  /* The same SQL gives back the same statement, reset for new bindings. */
+  cached_statement = ephy_sqlite_connection_get_cached_statement (connection, "SELECT id FROM test WHERE id = ?", &error);
+  g_assert_true (cached_statement == statement);
+  g_assert_no_error (error);
+  g_assert_true (ephy_sqlite_statement_bind_int (cached_statement, 0, 4, &error));
+  g_assert_false (ephy_sqlite_statement_step (cached_statement, &error));
+  g_assert_no_error (error);
+  g_object_unref (cached_statement);
+  g_object_unref (statement);
+
+  ephy_sqlite_connection_close (connection);
+  ephy_sqlite_connection_delete_database (connection);
+
+  g_object_unref (connection);
+  g_free (temporary_file);
+}
+
+static void
+test_match_pattern_truncation (void)
+{
+  g_autoptr (GString) string = g_string_new ("a");
+  g_autofree char *pattern = NULL;
+  g_autofree char *fts_pattern = NULL;
+
+  /* The byte limit falls in the middle of a two-byte character, which is
+   * dropped whole. */
+  while (string->len < EPHY_SQLITE_LIMIT_LIKE_PATTERN_LENGTH)
+    g_string_append (string, "é");
+
+  pattern = ephy_sqlite_create_match_pattern (string->str);
+  g_assert_true (g_utf8_validate (pattern, -1, NULL));
+  g_assert_cmpuint (strlen (pattern), ==, strlen ("%:%%") + EPHY_SQLITE_LIMIT_LIKE_PATTERN_LENGTH - 3);
+
+  fts_pattern = ephy_sqlite_create_fts_match_pattern (string->str);
+  g_assert_true (g_utf8_validate (fts_pattern, -1, NULL));
+  g_assert_cmpuint (strlen (fts_pattern), ==, strlen ("\"\"") + EPHY_SQLITE_LIMIT_LIKE_PATTERN_LENGTH - 3);
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -232,6 +294,8 @@ main (int   argc,
   g_test_add_func ("/lib/sqlite/ephy-sqlite/create_table_and_insert_row", test_create_table_and_insert_row);
   g_test_add_func ("/lib/sqlite/ephy-sqlite/bind_data", test_bind_data);
   g_test_add_func ("/lib/sqlite/ephy-sqlite/table_exists", test_table_exists);
+  g_test_add_func ("/lib/sqlite/ephy-sqlite/cached_statement", test_cached_statement);
+  g_test_add_func ("/lib/sqlite/ephy-sqlite/match_pattern_truncation", test_match_pattern_truncation);
 
   return g_test_run ();
 }
@@ -0,0 +1,356 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-debug.h"
+#include "ephy-file-helpers.h"
+#include "ephy-history-service.h"
+#include "ephy-shell.h"
+#include "ephy-suggestion.h"
+#include "ephy-suggestion-model.h"
+
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+static void
+visits_added_cb (EphyHistoryService *service,
+                 gboolean            success,
+                 gpointer            result_data,
+                 GMainLoop          *loop)
+{
+  g_assert_true (success);
+  g_main_loop_quit (loop);
+}
+
+/* Creates a history where site<i> has been visited n_urls - i times, so the
+ * resident index of the model only holds the lowest numbered sites.
+ */
+static EphyHistoryService *
+history_service_new_with_urls (guint n_urls)
+{
+  g_autofree char *filename = g_build_filename (g_get_tmp_dir (), "epiphany-suggestion-model-test.db", NULL);
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  EphyHistoryService *service;
+  GList *visits = NULL;
+
+  g_unlink (filename);
+  service = ephy_history_service_new (filename, EPHY_SQLITE_CONNECTION_MODE_READWRITE);
+
+  for (guint i = 0; i < n_urls; i++) {
+    g_autofree char *url = g_strdup_printf ("https://site%u.example.com/", i);
+
+    for (guint j = 0; j < MIN (n_urls - i, 5); j++)
+      visits = g_list_prepend (visits, ephy_history_page_visit_new (url, i * 10 + j, EPHY_PAGE_VISIT_TYPED));
+  }
+
+  ephy_history_service_add_visits (service, visits, NULL,
+                                   (EphyHistoryJobCallback)visits_added_cb, loop);
+  g_main_loop_run (loop);
+  g_list_free_full (visits, (GDestroyNotify)ephy_history_page_visit_free);
+
+  return service;
+}
+
+static void
+query_done_cb (EphySuggestionModel *model,
+               GAsyncResult        *result,
+               GMainLoop           *loop)
+{
+  g_autoptr (GError) error = NULL;
+
+  ephy_suggestion_model_query_finish (model, result, &error);
+  g_assert_no_error (error);
+  g_main_loop_quit (loop);
+}
+
+static void
+query_sync (EphySuggestionModel *model,
+            const char          *query)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+
+  ephy_suggestion_model_query_async (model, query, FALSE, FALSE, NULL,
+                                     (GAsyncReadyCallback)query_done_cb, loop);
+  g_main_loop_run (loop);
+}
+
+static char **
+get_suggestion_uris (EphySuggestionModel *model)
+{
+  g_autoptr (GStrvBuilder) builder = g_strv_builder_new ();
+  guint n_items = g_list_model_get_n_items (G_LIST_MODEL (model));
+
+  for (guint i = 0; i < n_items; i++) {
+    g_autoptr (EphySuggestion) suggestion = g_list_model_get_item (G_LIST_MODEL (model), i);
+
+    g_strv_builder_add (builder, ephy_suggestion_get_uri (suggestion));
+  }
+
+  return g_strv_builder_end (builder);
+}
+
+static EphySuggestionModel *
+suggestion_model_new (EphyHistoryService *service)
+{
+  g_autoptr (EphyBookmarksManager) bookmarks_manager = ephy_bookmarks_manager_new ();
+  EphySuggestionModel *model = ephy_suggestion_model_new (service, bookmarks_manager);
+
+  /* Let the resident history index load. */
+  query_sync (model, "");
+
+  return model;
+}
+
+static void
+test_ephy_suggestion_model_refine (void)
+{
+  g_autoptr (EphyHistoryService) service = history_service_new_with_urls (5000);
+  g_autoptr (EphySuggestionModel) typed_model = suggestion_model_new (service);
+  g_autoptr (EphySuggestionModel) model = NULL;
+  const char *query = "site4321.example";
+  g_auto (GStrv) typed_uris = NULL;
+  g_auto (GStrv) uris = NULL;
+
+  /* Typing one character at a time goes through the refinement of the
+   * previous results, which must give the results of a fresh query.
+   */
+  for (guint i = 1; i <= strlen (query); i++) {
+    g_autofree char *prefix = g_strndup (query, i);
+    query_sync (typed_model, prefix);
+  }
+  typed_uris = get_suggestion_uris (typed_model);
+
+  model = suggestion_model_new (service);
+  query_sync (model, query);
+  uris = get_suggestion_uris (model);
+
+  g_assert_cmpuint (g_strv_length (uris), >, 0);
+  g_assert_true (g_strv_equal ((const char * const *)typed_uris, (const char * const *)uris));
+}
+
+typedef struct {
+  GMainLoop *loop;
+  guint pending;
+  guint superseded;
+} OverlappingQueriesData;
+
+static void
+overlapping_query_done_cb (EphySuggestionModel    *model,
+                           GAsyncResult           *result,
+                           OverlappingQueriesData *data)
+{
+  g_autoptr (GError) error = NULL;
+
+  /* Only the last query completes, the others are superseded by it. */
+  if (--data->pending > 0) {
+    g_assert_false (ephy_suggestion_model_query_finish (model, result, &error));
+    g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+    data->superseded++;
+    return;
+  }
+
+  g_assert_true (ephy_suggestion_model_query_finish (model, result, &error));
+  g_assert_no_error (error);
+  g_main_loop_quit (data->loop);
+}
+
+static void
+test_ephy_suggestion_model_overlapping_queries (void)
+{
+  g_autoptr (EphyHistoryService) service = history_service_new_with_urls (5000);
+  g_autoptr (EphySuggestionModel) model = suggestion_model_new (service);
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  const char * const queries[] = { "site4320.example", "site4322.example", "site4321.example" };
+  OverlappingQueriesData data = { loop, G_N_ELEMENTS (queries), 0 };
+  g_auto (GStrv) uris = NULL;
+
+  /* Most of the history is not in the resident index, so each of these has
+   * a database job in flight when the next one is issued. */
+  for (guint i = 0; i < G_N_ELEMENTS (queries); i++)
+    ephy_suggestion_model_query_async (model, queries[i], FALSE, FALSE, NULL,
+                                       (GAsyncReadyCallback)overlapping_query_done_cb, &data);
+  g_main_loop_run (loop);
+
+  g_assert_cmpuint (data.superseded, ==, G_N_ELEMENTS (queries) - 1);
+
+  uris = get_suggestion_uris (model);
+  g_assert_true (g_strv_contains ((const char * const *)uris, "https://site4321.example.com/"));
+  g_assert_false (g_strv_contains ((const char * const *)uris, "https://site4320.example.com/"));
+  g_assert_false (g_strv_contains ((const char * const *)uris, "https://site4322.example.com/"));
+}
+
+static void
+url_loaded_cb (EphyHistoryService *service,
+               gboolean            success,
+               gpointer            result_data,
+               GMainLoop          *loop)
+{
+  g_main_loop_quit (loop);
+}
+
+static void
+urls_visited_cb (EphyHistoryService  *service,
+                 char               **urls,
+                 GMainLoop           *loop)
+{
+  /* Sent after the lookups of the model, so it returns after them. */
+  ephy_history_service_get_url (service, urls[0], NULL,
+                                (EphyHistoryJobCallback)url_loaded_cb, loop);
+}
+
+static void
+visit_url_and_wait (EphyHistoryService *service,
+                    const char         *url,
+                    guint               n_visits)
+{
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  GList *visits = NULL;
+  gulong id;
+
+  for (guint i = 0; i < n_visits; i++)
+    visits = g_list_prepend (visits, ephy_history_page_visit_new (url, g_get_real_time (), EPHY_PAGE_VISIT_TYPED));
+
+  id = g_signal_connect (service, "urls-visited", G_CALLBACK (urls_visited_cb), loop);
+  ephy_history_service_visit_urls (service, visits);
+  g_main_loop_run (loop);
+  g_signal_handler_disconnect (service, id);
+
+  g_list_free_full (visits, (GDestroyNotify)ephy_history_page_visit_free);
+}
+
+static int
+uri_position (char       **uris,
+              const char  *uri)
+{
+  for (guint i = 0; uris[i]; i++) {
+    if (strcmp (uris[i], uri) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+static void
+test_ephy_suggestion_model_visits (void)
+{
+  g_autoptr (EphyHistoryService) service = history_service_new_with_urls (20);
+  g_autoptr (EphySuggestionModel) model = suggestion_model_new (service);
+  g_auto (GStrv) uris = NULL;
+
+  query_sync (model, "example");
+  uris = get_suggestion_uris (model);
+  g_assert_cmpint (uri_position (uris, "https://new.example.com/"), ==, -1);
+  g_assert_cmpint (uri_position (uris, "https://site0.example.com/"), <,
+                   uri_position (uris, "https://site19.example.com/"));
+  g_clear_pointer (&uris, g_strfreev);
+
+  /* The whole history is in the index, so the visited URLs have to be
+   * added to it or moved up for the queries to see them. */
+  visit_url_and_wait (service, "https://new.example.com/", 1);
+  visit_url_and_wait (service, "https://site19.example.com/", 3);
+
+  query_sync (model, "example");
+  uris = get_suggestion_uris (model);
+  g_assert_cmpint (uri_position (uris, "https://new.example.com/"), >=, 0);
+  g_assert_cmpint (uri_position (uris, "https://site19.example.com/"), <,
+                   uri_position (uris, "https://new.example.com/"));
+  g_assert_cmpint (uri_position (uris, "https://new.example.com/"), <,
+                   uri_position (uris, "https://site0.example.com/"));
+}
+
+/* Benchmark of the latency between a keystroke and the model update it
+ * causes, typing queries one character at a time. Run with -m perf.
+ */
+static void
+test_ephy_suggestion_model_keystroke_perf (gconstpointer user_data)
+{
+  guint n_urls = GPOINTER_TO_UINT (user_data);
+  const char * const queries[] = { "site12345", "example.com/", "site9", "https://site4" };
+  g_autoptr (EphyHistoryService) service = NULL;
+  g_autoptr (EphySuggestionModel) model = NULL;
+  double total = 0;
+  double worst = 0;
+  guint n_keystrokes = 0;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Benchmark, run with -m perf");
+    return;
+  }
+
+  service = history_service_new_with_urls (n_urls);
+  model = suggestion_model_new (service);
+
+  for (guint i = 0; i < G_N_ELEMENTS (queries); i++) {
+    for (guint j = 1; j <= strlen (queries[i]); j++) {
+      g_autofree char *prefix = g_strndup (queries[i], j);
+      double elapsed;
+
+      g_test_timer_start ();
+      query_sync (model, prefix);
+      elapsed = g_test_timer_elapsed ();
+
+      total += elapsed;
+      worst = MAX (worst, elapsed);
+      n_keystrokes++;
+    }
+
+    query_sync (model, "");
+  }
+
+  g_test_minimized_result (worst, "Worst keystroke latency with %u URLs: %.3f ms", n_urls, worst * 1000);
+  g_test_minimized_result (total / n_keystrokes, "Mean keystroke latency with %u URLs: %.3f ms",
+                           n_urls, total / n_keystrokes * 1000);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  int ret;
+
+  gtk_test_init (&argc, &argv);
+  ephy_debug_init ();
+
+  if (!ephy_file_helpers_init (NULL, EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS, NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  _ephy_shell_create_instance (EPHY_EMBED_SHELL_MODE_TEST);
+  g_application_register (G_APPLICATION (ephy_embed_shell_get_default ()), NULL, NULL);
+
+  g_test_add_func ("/src/ephy-suggestion-model/refine",
+                   test_ephy_suggestion_model_refine);
+  g_test_add_func ("/src/ephy-suggestion-model/visits",
+                   test_ephy_suggestion_model_visits);
+  g_test_add_func ("/src/ephy-suggestion-model/overlapping-queries",
+                   test_ephy_suggestion_model_overlapping_queries);
+  g_test_add_data_func ("/src/ephy-suggestion-model/perf/keystroke/10000",
+                        GUINT_TO_POINTER (10000),
+                        test_ephy_suggestion_model_keystroke_perf);
+  g_test_add_data_func ("/src/ephy-suggestion-model/perf/keystroke/50000",
+                        GUINT_TO_POINTER (50000),
+                        test_ephy_suggestion_model_keystroke_perf);
+
+  ret = g_test_run ();
+
+  g_object_unref (ephy_embed_shell_get_default ());
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
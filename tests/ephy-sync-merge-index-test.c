@@ -0,0 +1,223 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-password-manager.h"
+#include "ephy-password-record.h"
+#include "ephy-sync-merge-index.h"
+#include "ephy-synchronizable-manager.h"
+
+#include <glib.h>
+#include <libsecret/secret.h>
+
+static char *
+get_origin_key (EphySynchronizable *synchronizable)
+{
+  return g_strdup (ephy_password_record_get_origin (EPHY_PASSWORD_RECORD (synchronizable)));
+}
+
+static EphyPasswordRecord *
+record_new (const char *id,
+            const char *origin)
+{
+  return ephy_password_record_new (id, origin, origin, "user", "password",
+                                   "username", "password", 0, 0);
+}
+
+static void
+test_ephy_sync_merge_index_lookup (void)
+{
+  g_autoptr (EphySyncMergeIndex) index = ephy_sync_merge_index_new (get_origin_key);
+  g_autoptr (EphyPasswordRecord) first = record_new ("id1", "https://a.example");
+  g_autoptr (EphyPasswordRecord) same_id = record_new ("id1", "https://b.example");
+  g_autoptr (EphyPasswordRecord) same_key = record_new ("id2", "https://a.example");
+
+  ephy_sync_merge_index_add (index, EPHY_SYNCHRONIZABLE (first));
+  ephy_sync_merge_index_add (index, EPHY_SYNCHRONIZABLE (same_id));
+  ephy_sync_merge_index_add (index, EPHY_SYNCHRONIZABLE (same_key));
+
+  /* The first record added wins, like a linear search. */
+  g_assert_true (ephy_sync_merge_index_lookup_id (index, "id1") == EPHY_SYNCHRONIZABLE (first));
+  g_assert_true (ephy_sync_merge_index_lookup_id (index, "id2") == EPHY_SYNCHRONIZABLE (same_key));
+  g_assert_true (ephy_sync_merge_index_lookup_key (index, "https://a.example") == EPHY_SYNCHRONIZABLE (first));
+  g_assert_true (ephy_sync_merge_index_lookup_key (index, "https://b.example") == EPHY_SYNCHRONIZABLE (same_id));
+  g_assert_null (ephy_sync_merge_index_lookup_id (index, "id3"));
+  g_assert_null (ephy_sync_merge_index_lookup_id (index, NULL));
+  g_assert_cmpuint (ephy_sync_merge_index_get_size (index), ==, 2);
+
+  /* Removing it exposes the next record sharing its id or key. */
+  ephy_sync_merge_index_remove (index, EPHY_SYNCHRONIZABLE (first));
+  g_assert_true (ephy_sync_merge_index_lookup_id (index, "id1") == EPHY_SYNCHRONIZABLE (same_id));
+  g_assert_true (ephy_sync_merge_index_lookup_key (index, "https://a.example") == EPHY_SYNCHRONIZABLE (same_key));
+  g_assert_true (ephy_sync_merge_index_lookup_key (index, "https://b.example") == EPHY_SYNCHRONIZABLE (same_id));
+  g_assert_cmpuint (ephy_sync_merge_index_get_size (index), ==, 2);
+
+  ephy_sync_merge_index_remove (index, EPHY_SYNCHRONIZABLE (same_id));
+  g_assert_null (ephy_sync_merge_index_lookup_id (index, "id1"));
+  g_assert_null (ephy_sync_merge_index_lookup_key (index, "https://b.example"));
+  g_assert_true (ephy_sync_merge_index_lookup_key (index, "https://a.example") == EPHY_SYNCHRONIZABLE (same_key));
+  g_assert_cmpuint (ephy_sync_merge_index_get_size (index), ==, 1);
+
+  /* Removing a record that is not indexed is harmless. */
+  ephy_sync_merge_index_remove (index, EPHY_SYNCHRONIZABLE (first));
+  g_assert_true (ephy_sync_merge_index_lookup_id (index, "id2") == EPHY_SYNCHRONIZABLE (same_key));
+  g_assert_cmpuint (ephy_sync_merge_index_get_size (index), ==, 1);
+}
+
+#define BENCHMARK_USERNAME "ephy-merge-benchmark"
+
+static EphyPasswordRecord *
+benchmark_record_new (const char *id,
+                      const char *origin)
+{
+  return ephy_password_record_new (id, origin, origin, BENCHMARK_USERNAME, "password",
+                                   "username", "password", 0, 0);
+}
+
+static void
+benchmark_clear_records (void)
+{
+  g_autoptr (GError) error = NULL;
+
+  secret_password_clear_sync (EPHY_FORM_PASSWORD_SCHEMA, NULL, &error,
+                              USERNAME_KEY, BENCHMARK_USERNAME,
+                              NULL);
+  if (error)
+    g_warning ("Failed to clear benchmark password records: %s", error->message);
+}
+
+static void
+merge_done_cb (GPtrArray *to_upload,
+               gpointer   user_data)
+{
+  GMainLoop *loop = user_data;
+
+  g_ptr_array_unref (to_upload);
+  g_main_loop_quit (loop);
+}
+
+static void
+query_done_cb (GList    *records,
+               gpointer  user_data)
+{
+  GMainLoop *loop = user_data;
+
+  g_main_loop_quit (loop);
+}
+
+/* Benchmark of a regular password merge, from the query of the local records
+ * to the end of the merge pass, with as many remote records as local ones.
+ * Half of the remote records match a local one by id, a quarter by tuple only.
+ * The local records are stored in the session collection of the secret
+ * service, so this needs one. Run with -m perf.
+ */
+static void
+test_ephy_sync_merge_index_perf (gconstpointer user_data)
+{
+  guint n_records = GPOINTER_TO_UINT (user_data);
+  g_autoptr (SecretService) service = NULL;
+  g_autoptr (EphyPasswordManager) manager = NULL;
+  g_autoptr (GMainLoop) loop = NULL;
+  g_autoptr (GError) error = NULL;
+  GList *remote = NULL;
+  double elapsed;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Benchmark, run with -m perf");
+    return;
+  }
+
+  service = secret_service_get_sync (SECRET_SERVICE_NONE, NULL, &error);
+  if (!service) {
+    g_autofree char *message = g_strdup_printf ("No secret service: %s", error->message);
+
+    g_test_skip (message);
+    return;
+  }
+
+  benchmark_clear_records ();
+
+  for (guint i = 0; i < n_records; i++) {
+    g_autofree char *id = g_strdup_printf ("local-%u", i);
+    g_autofree char *origin = g_strdup_printf ("https://site%u.example", i);
+
+    secret_password_store_sync (EPHY_FORM_PASSWORD_SCHEMA, SECRET_COLLECTION_SESSION,
+                                origin, "password", NULL, &error,
+                                ID_KEY, id,
+                                ORIGIN_KEY, origin,
+                                TARGET_ORIGIN_KEY, origin,
+                                USERNAME_KEY, BENCHMARK_USERNAME,
+                                USERNAME_FIELD_KEY, "username",
+                                PASSWORD_FIELD_KEY, "password",
+                                NULL);
+    g_assert_no_error (error);
+  }
+
+  for (guint i = 0; i < n_records; i++) {
+    g_autofree char *id = NULL;
+    g_autofree char *origin = g_strdup_printf ("https://site%u.example", i % 4 == 1 ? i : n_records + i);
+
+    id = i % 2 == 0 ? g_strdup_printf ("local-%u", i) : g_strdup_printf ("remote-%u", i);
+    remote = g_list_prepend (remote, benchmark_record_new (id, origin));
+  }
+
+  loop = g_main_loop_new (NULL, FALSE);
+  manager = ephy_password_manager_new ();
+
+  /* Let the manager load its credentials first, they are not part of a merge. */
+  ephy_password_manager_query (manager, NULL, NULL, NULL, NULL, NULL, NULL,
+                               query_done_cb, loop);
+  g_main_loop_run (loop);
+
+  g_test_timer_start ();
+
+  ephy_synchronizable_manager_merge (EPHY_SYNCHRONIZABLE_MANAGER (manager),
+                                     FALSE, NULL, remote,
+                                     merge_done_cb, loop);
+  g_main_loop_run (loop);
+
+  elapsed = g_test_timer_elapsed ();
+
+  /* The merge leaves its stores in flight, wait for them behind a query. */
+  ephy_password_manager_query (manager, NULL, NULL, NULL, NULL, NULL, NULL,
+                               query_done_cb, loop);
+  g_main_loop_run (loop);
+
+  benchmark_clear_records ();
+  g_list_free_full (remote, g_object_unref);
+
+  g_test_minimized_result (elapsed, "Password merge of %u records: %.3f s", n_records, elapsed);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/lib/sync/ephy-sync-merge-index/lookup",
+                   test_ephy_sync_merge_index_lookup);
+  g_test_add_data_func ("/lib/sync/ephy-sync-merge-index/perf/1000",
+                        GUINT_TO_POINTER (1000),
+                        test_ephy_sync_merge_index_perf);
+  g_test_add_data_func ("/lib/sync/ephy-sync-merge-index/perf/10000",
+                        GUINT_TO_POINTER (10000),
+                        test_ephy_sync_merge_index_perf);
+
+  return g_test_run ();
+}
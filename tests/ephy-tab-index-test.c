@@ -0,0 +1,171 @@
+/* -*- Mode: C; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ *  This file is part of Pafari.
+ *
+ *  Pafari is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Pafari is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "ephy-debug.h"
+#include "ephy-embed.h"
+#include "ephy-file-helpers.h"
+#include "ephy-shell.h"
+#include "ephy-tab-index.h"
+#include "ephy-tab-view.h"
+#include "ephy-web-view.h"
+
+#include <gtk/gtk.h>
+
+static EphyEmbed *
+embed_new (void)
+{
+  return g_object_ref_sink (g_object_new (EPHY_TYPE_EMBED,
+                                          "web-view", ephy_web_view_new (),
+                                          NULL));
+}
+
+static guint64
+embed_get_id (EphyEmbed *embed)
+{
+  return ephy_web_view_get_uid (ephy_embed_get_web_view (embed));
+}
+
+static void
+title_changed_cb (WebKitWebView *web_view,
+                  GParamSpec    *pspec,
+                  GMainLoop     *loop)
+{
+  g_main_loop_quit (loop);
+}
+
+static void
+test_ephy_tab_index_add_remove (void)
+{
+  g_autoptr (EphyTabIndex) index = ephy_tab_index_new ();
+  g_autoptr (EphyTabView) tab_view = g_object_ref_sink (ephy_tab_view_new ());
+  g_autoptr (EphyEmbed) first = embed_new ();
+  g_autoptr (EphyEmbed) second = embed_new ();
+  GPtrArray *entries = ephy_tab_index_get_entries (index);
+  EphyTabIndexEntry *entry;
+
+  ephy_tab_index_add (index, tab_view, first);
+  ephy_tab_index_add (index, tab_view, second);
+  g_assert_cmpuint (entries->len, ==, 2);
+
+  entry = ephy_tab_index_lookup (index, embed_get_id (first));
+  g_assert_nonnull (entry);
+  g_assert_true (entry->embed == first);
+  g_assert_true (entry->tab_view == tab_view);
+  g_assert_true (g_ptr_array_index (entries, 0) == entry);
+
+  ephy_tab_index_remove (index, first);
+  g_assert_cmpuint (entries->len, ==, 1);
+  g_assert_null (ephy_tab_index_lookup (index, embed_get_id (first)));
+  g_assert_nonnull (ephy_tab_index_lookup (index, embed_get_id (second)));
+
+  /* Removing a tab that is not indexed does nothing. */
+  ephy_tab_index_remove (index, first);
+  g_assert_cmpuint (entries->len, ==, 1);
+
+  ephy_tab_index_remove (index, second);
+  g_assert_cmpuint (entries->len, ==, 0);
+  g_assert_null (ephy_tab_index_lookup (index, embed_get_id (second)));
+}
+
+static void
+test_ephy_tab_index_move (void)
+{
+  g_autoptr (EphyTabIndex) index = ephy_tab_index_new ();
+  g_autoptr (EphyTabView) tab_view = g_object_ref_sink (ephy_tab_view_new ());
+  g_autoptr (EphyTabView) other_tab_view = g_object_ref_sink (ephy_tab_view_new ());
+  g_autoptr (EphyEmbed) first = embed_new ();
+  g_autoptr (EphyEmbed) second = embed_new ();
+  GPtrArray *entries = ephy_tab_index_get_entries (index);
+  EphyTabIndexEntry *entry;
+
+  ephy_tab_index_add (index, tab_view, first);
+  ephy_tab_index_add (index, tab_view, second);
+
+  /* A tab moved to another window keeps its id and is indexed once. */
+  ephy_tab_index_add (index, other_tab_view, first);
+  g_assert_cmpuint (entries->len, ==, 2);
+
+  entry = ephy_tab_index_lookup (index, embed_get_id (first));
+  g_assert_nonnull (entry);
+  g_assert_true (entry->embed == first);
+  g_assert_true (entry->tab_view == other_tab_view);
+  g_assert_true (g_ptr_array_index (entries, 1) == entry);
+
+  entry = ephy_tab_index_lookup (index, embed_get_id (second));
+  g_assert_true (entry->tab_view == tab_view);
+}
+
+static void
+test_ephy_tab_index_title (void)
+{
+  g_autoptr (EphyTabIndex) index = ephy_tab_index_new ();
+  g_autoptr (EphyTabView) tab_view = g_object_ref_sink (ephy_tab_view_new ());
+  g_autoptr (EphyEmbed) embed = embed_new ();
+  g_autoptr (GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  WebKitWebView *web_view = WEBKIT_WEB_VIEW (ephy_embed_get_web_view (embed));
+  EphyTabIndexEntry *entry;
+
+  ephy_tab_index_add (index, tab_view, embed);
+  entry = ephy_tab_index_lookup (index, embed_get_id (embed));
+  g_assert_false (ephy_tab_index_entry_matches (entry, "tab index"));
+
+  /* Connected after the index, so the entry is up to date when it runs. */
+  g_signal_connect (web_view, "notify::title", G_CALLBACK (title_changed_cb), loop);
+  webkit_web_view_load_html (web_view, "<html><head><title>Tab Index TITLE</title></head></html>", NULL);
+  g_main_loop_run (loop);
+  g_signal_handlers_disconnect_by_func (web_view, title_changed_cb, loop);
+
+  g_assert_cmpstr (entry->title_casefold, ==, "tab index title");
+  g_assert_true (ephy_tab_index_entry_matches (entry, "index ti"));
+  g_assert_false (ephy_tab_index_entry_matches (entry, "index tx"));
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  int ret;
+
+  /* FIXME: disable AC mode for now for WebView tests because CI doesn't support it. */
+  g_setenv ("WEBKIT_DISABLE_COMPOSITING_MODE", "1", FALSE);
+
+  gtk_test_init (&argc, &argv);
+  ephy_debug_init ();
+
+  if (!ephy_file_helpers_init (NULL, EPHY_FILE_HELPERS_TESTING_MODE | EPHY_FILE_HELPERS_ENSURE_EXISTS, NULL)) {
+    g_debug ("Something wrong happened with ephy_file_helpers_init()");
+    return -1;
+  }
+
+  _ephy_shell_create_instance (EPHY_EMBED_SHELL_MODE_TEST);
+
+  g_test_add_func ("/src/ephy-tab-index/add-remove",
+                   test_ephy_tab_index_add_remove);
+  g_test_add_func ("/src/ephy-tab-index/move",
+                   test_ephy_tab_index_move);
+  g_test_add_func ("/src/ephy-tab-index/title",
+                   test_ephy_tab_index_title);
+
+  ret = g_test_run ();
+
+  g_object_unref (ephy_embed_shell_get_default ());
+  ephy_file_helpers_shutdown ();
+
+  return ret;
+}
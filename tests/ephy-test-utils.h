@@ -18,10 +18,6 @@
  *  along with Pafari.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#if !defined (__EPHY_EPIPHANY_H_INSIDE__) && !defined (EPIPHANY_COMPILATION)
-#error "Only <epiphany/epiphany.h> can be included directly."
-#endif
-
 #ifndef EPHY_TEST_UTILS_H
 #define EPHY_TEST_UTILS_H
 
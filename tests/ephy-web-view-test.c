@@ -186,6 +186,62 @@ test_ephy_web_view_load_url (void)
   }
 }
 
+static void
+overview_load_changed_cb (WebKitWebView   *view,
+                          WebKitLoadEvent  load_event,
+                          GMainLoop       *loop)
+{
+  if (load_event == WEBKIT_LOAD_FINISHED)
+    g_main_loop_quit (loop);
+}
+
+/* Benchmark of how long a new tab takes to show the start page. WebKit has no
+ * first paint signal, so this goes up to the end of the load. The first load
+ * renders every section, the next ones are mostly served from the cache. Run
+ * with -m perf.
+ */
+static void
+test_ephy_web_view_overview_first_paint (void)
+{
+  GtkWidget *window;
+  EphyWebView *view;
+  GMainLoop *loop;
+  double first = 0;
+  double cached = G_MAXDOUBLE;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Benchmark, run with -m perf");
+    return;
+  }
+
+  window = gtk_window_new ();
+  view = EPHY_WEB_VIEW (ephy_web_view_new ());
+  gtk_window_set_child (GTK_WINDOW (window), GTK_WIDGET (view));
+  loop = g_main_loop_new (NULL, FALSE);
+  g_signal_connect (view, "load-changed",
+                    G_CALLBACK (overview_load_changed_cb), loop);
+
+  for (guint i = 0; i < 10; i++) {
+    double elapsed;
+
+    g_test_timer_start ();
+    ephy_web_view_load_url (view, "about:overview");
+    g_main_loop_run (loop);
+    elapsed = g_test_timer_elapsed ();
+
+    if (i == 0)
+      first = elapsed;
+    else
+      cached = MIN (cached, elapsed);
+  }
+
+  g_test_minimized_result (first, "First start page: %.3f s", first);
+  g_test_minimized_result (cached, "Cached start page: %.3f s", cached);
+
+  g_main_loop_unref (loop);
+  g_object_unref (window);
+}
+
 typedef struct {
   const char *url;
   gboolean match;
@@ -515,6 +571,9 @@ main (int   argc,
   g_test_add_func ("/embed/ephy-web-view/error-pages-not-stored-in-history",
                    test_ephy_web_view_error_pages_not_stored_in_history);
 
+  g_test_add_func ("/embed/ephy-web-view/overview-first-paint",
+                   test_ephy_web_view_overview_first_paint);
+
   ret = g_test_run ();
 
   g_object_unref (server);